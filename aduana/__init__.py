@@ -580,6 +580,84 @@ class FreqScheduler(object):
     def margin(self, value):
         self._sch[0].margin = value
 
+class IngestQueue(object):
+    def __init__(self, target, capacity=0, batch_size=None, max_delay=None):
+        """Add pages from a background thread, grouping them in batches.
+
+        Parameters:
+            - target: a PageDB, BFScheduler or FreqScheduler
+            - capacity: maximum number of pages waiting. If 0 the default
+            - batch_size: maximum number of pages inside a transaction
+            - max_delay: maximum milliseconds a page waits for the batch to fill
+        """
+        # save to make sure lib is available at destruction time
+        self._c_aduana = C_ADUANA
+
+        self._closed = False
+        # the target must outlive the queue
+        self._target = target
+        if isinstance(target, PageDB):
+            state = target._page_db[0]
+            add = self._c_aduana.page_db_ingest
+        elif isinstance(target, BFScheduler):
+            state = target._sch[0]
+            add = self._c_aduana.bf_scheduler_ingest
+        elif isinstance(target, FreqScheduler):
+            state = target._sch[0]
+            add = self._c_aduana.freq_scheduler_ingest
+        else:
+            raise AduanaException(
+                "target must be a PageDB, BFScheduler or FreqScheduler instance")
+
+        self._queue = ffi.new('IngestQueue **')
+        ret = self._c_aduana.ingest_queue_new(self._queue, state, add, capacity)
+        if ret != 0:
+            if self._queue[0]:
+                raise AduanaException.from_error(self._queue[0].error)
+            else:
+                raise AduanaException("Error inside ingest_queue_new", ret)
+
+        if batch_size:
+            self._c_aduana.ingest_queue_set_batch_size(self._queue[0], batch_size)
+        if max_delay is not None:
+            self._c_aduana.ingest_queue_set_max_delay(self._queue[0], max_delay)
+
+    @property
+    def closed(self):
+        return self._closed
+
+    @property
+    @only_if_open
+    def n_batches(self):
+        return self._queue[0].n_batches
+
+    @only_if_open
+    def push(self, crawled_page):
+        """The queue takes ownership of the page, which cannot be used afterwards"""
+        if not isinstance(crawled_page, CrawledPage):
+            raise AduanaException("argument to function must be a CrawledPage instance")
+
+        c_page = crawled_page._crawled_page
+        crawled_page._crawled_page = ffi.NULL
+        ret = self._c_aduana.ingest_queue_push(self._queue[0], c_page)
+        if ret != 0:
+            raise AduanaException.from_error(self._queue[0].error)
+
+    @only_if_open
+    def flush(self):
+        ret = self._c_aduana.ingest_queue_flush(self._queue[0])
+        if ret != 0:
+            raise AduanaException.from_error(self._queue[0].error)
+
+    def __del__(self):
+        self.close()
+
+    @close_method
+    def close(self):
+        ret = self._c_aduana.ingest_queue_delete(self._queue[0])
+        if ret != 0:
+            raise AduanaException("Error inside ingest_queue_delete", ret)
+
 def freq_spec(page_db, spec):
     rules = []
     for line in spec:
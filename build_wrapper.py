@@ -24,7 +24,14 @@ aduana_src = [
         'txn_manager.c',
         'domain_temp.c',
         'freq_scheduler.c',
-        'freq_algo.c'
+        'freq_algo.c',
+        'ingest_queue.c',
+        'url_codec.c',
+        'bloom.c',
+        'sharded_page_db.c',
+        'external_sort.c',
+        'link_graph.c',
+        'clock_cache.c'
     ]]
 
 if platform.system() == 'Windows':
@@ -67,6 +74,7 @@ ffi.set_source(
     #include "util.h"
     #include "freq_scheduler.h"
     #include "freq_algo.h"
+    #include "ingest_queue.h"
     ''',
     sources            = aduana_src,
     include_dirs       = aduana_include,
@@ -110,8 +118,9 @@ ffi.cdef(
     page_info_delete(PageInfo *pi);
 
     typedef struct {
-        char *url;   /**< ASCII, null terminated string for the page URL*/
-        float score; /**< An estimated value of the link score */
+        char *url;     /**< ASCII, null terminated string for the page URL*/
+        float score;   /**< An estimated value of the link score */
+        uint64_t hash; /**< Precomputed page_db_hash of the URL, or 0 */
     } LinkInfo;
 
     typedef struct {
@@ -128,17 +137,24 @@ ffi.cdef(
         char *content_hash;          /**< A hash to detect content change since last crawl.
                                           Arbitrary byte sequence */
         size_t content_hash_length;  /**< Number of byes of the content_hash */
+        uint64_t hash;               /**< Precomputed page_db_hash of the URL, or 0 */
     } CrawledPage;
 
     CrawledPage *
     crawled_page_new(const char *url);
 
+    CrawledPage *
+    crawled_page_new_hashed(const char *url, uint64_t hash);
+
     void
     crawled_page_delete(CrawledPage *cp);
 
     int
     crawled_page_add_link(CrawledPage *cp, const char *url, float score);
 
+    int
+    crawled_page_add_link_hashed(CrawledPage *cp, const char *url, float score, uint64_t hash);
+
     size_t
     crawled_page_n_links(const CrawledPage *cp);
 
@@ -153,15 +169,25 @@ ffi.cdef(
          page_db_error_memory,       /**< Error allocating memory */
          page_db_error_invalid_path, /**< File system error */
          page_db_error_internal,     /**< Unexpected error */
-         page_db_error_no_page       /**< A page was requested but could not be found */
+         page_db_error_no_page,      /**< A page was requested but could not be found */
+         page_db_error_format,       /**< Database written with an incompatible format */
+         page_db_error_link_log_reset, /**< The link log was truncated */
+         page_db_error_pruned        /**< The page was removed by page_db_prune */
     } PageDBError;
 
+    typedef enum {
+         txn_manager_sync_none = 0,
+         txn_manager_sync_periodic,
+         txn_manager_sync_commit
+    } TxnManagerSync;
+
     typedef struct {
          char *path;
          void* txn_manager;
          void *domain_temp;
          void *error;
          int persist;
+         ...;
     } PageDB;
 
     uint64_t
@@ -176,12 +202,33 @@ ffi.cdef(
     PageDBError
     page_db_add(PageDB *db, const CrawledPage *page, void **page_info_list);
 
+    PageDBError
+    page_db_add_many(PageDB *db,
+                     const CrawledPage **pages,
+                     size_t n,
+                     void **page_info_list);
+
+    int
+    page_db_ingest(void *state, const CrawledPage **pages, size_t n);
+
     PageDBError
     page_db_delete(PageDB *db);
 
     void
     page_db_set_persist(PageDB *db, int value);
 
+    void
+    page_db_set_link_filter(PageDB *db, size_t bits_per_page);
+
+    PageDBError
+    page_db_set_info_cache(PageDB *db, size_t max_bytes);
+
+    PageDBError
+    page_db_set_map_size(PageDB *db, size_t size, size_t growth);
+
+    PageDBError
+    page_db_set_sync(PageDB *db, TxnManagerSync sync, double interval);
+
     typedef enum {
          stream_state_init,
          stream_state_next,
@@ -193,6 +240,7 @@ ffi.cdef(
          PageDB *db;
          void *cur;
          StreamState state;
+         ...;
     } HashInfoStream;
 
     PageDBError
@@ -218,6 +266,7 @@ ffi.cdef(
     typedef struct {
          void *page_rank;
          PageDB *page_db;
+         void *link_graph;
          void *error;
          int persist;
          int use_content_scores;
@@ -255,6 +304,7 @@ ffi.cdef(
     typedef struct {
          void *hits;
          PageDB *page_db;
+         void *link_graph;
          void *error;
          int persist;
          int use_content_scores;
@@ -324,6 +374,12 @@ ffi.cdef(
     BFSchedulerError
     bf_scheduler_add(BFScheduler *sch, const CrawledPage *page);
 
+    BFSchedulerError
+    bf_scheduler_add_many(BFScheduler *sch, const CrawledPage **pages, size_t n);
+
+    int
+    bf_scheduler_ingest(void *state, const CrawledPage **pages, size_t n);
+
     BFSchedulerError
     bf_scheduler_request(BFScheduler *sch, size_t n_pages, PageRequest **request);
 
@@ -346,6 +402,12 @@ ffi.cdef(
     void
     bf_scheduler_set_max_crawl_depth(BFScheduler *sch, uint64_t value);
 
+    BFSchedulerError
+    bf_scheduler_set_map_size(BFScheduler *sch, size_t size, size_t growth);
+
+    BFSchedulerError
+    bf_scheduler_set_sync(BFScheduler *sch, TxnManagerSync sync, double interval);
+
     typedef int... time_t;
 
     void
@@ -382,6 +444,12 @@ ffi.cdef(
     FreqSchedulerError
     freq_scheduler_load_mmap(FreqScheduler *sch, void *freqs);
 
+    FreqSchedulerError
+    freq_scheduler_set_map_size(FreqScheduler *sch, size_t size, size_t growth);
+
+    FreqSchedulerError
+    freq_scheduler_set_sync(FreqScheduler *sch, TxnManagerSync sync, double interval);
+
     FreqSchedulerError
     freq_scheduler_request(FreqScheduler *sch,
                            size_t max_requests,
@@ -390,6 +458,12 @@ ffi.cdef(
     FreqSchedulerError
     freq_scheduler_add(FreqScheduler *sch, const CrawledPage *page);
 
+    FreqSchedulerError
+    freq_scheduler_add_many(FreqScheduler *sch, const CrawledPage **pages, size_t n);
+
+    int
+    freq_scheduler_ingest(void *state, const CrawledPage **pages, size_t n);
+
     void
     freq_scheduler_delete(FreqScheduler *sch);
 
@@ -410,6 +484,49 @@ ffi.cdef(
     """
 )
 
+ffi.cdef(
+    """
+    typedef int (IngestQueueAddFunc)(void *state, const CrawledPage **pages, size_t n);
+
+    typedef enum {
+         ingest_queue_error_ok = 0,   /**< No error */
+         ingest_queue_error_memory,   /**< Error allocating memory */
+         ingest_queue_error_internal, /**< Unexpected error, for example the add function failed */
+         ingest_queue_error_thread    /**< Error inside the threading library */
+    } IngestQueueError;
+
+    typedef struct {
+         size_t capacity;
+         size_t n_batches;
+         void *error;
+         size_t batch_size;
+         long max_delay;
+         ...;
+    } IngestQueue;
+
+    IngestQueueError
+    ingest_queue_new(IngestQueue **q,
+                     void *state,
+                     IngestQueueAddFunc *add,
+                     size_t capacity);
+
+    IngestQueueError
+    ingest_queue_push(IngestQueue *q, CrawledPage *page);
+
+    IngestQueueError
+    ingest_queue_flush(IngestQueue *q);
+
+    IngestQueueError
+    ingest_queue_delete(IngestQueue *q);
+
+    void
+    ingest_queue_set_batch_size(IngestQueue *q, size_t value);
+
+    void
+    ingest_queue_set_max_delay(IngestQueue *q, long value);
+    """
+)
+
 ffi.cdef(
     """
     int
@@ -75,6 +75,7 @@ bf_scheduler_new(BFScheduler **sch, PageDB *db, const char *path) {
      p->update_thread->n_pages_new = 0.0;
 
      p->page_db = db;
+     page_db_reader_init(&p->page_db_reader, db);
      p->persist = BF_SCHEDULER_DEFAULT_PERSIST;
      p->max_soft_domain_crawl_rate = -1.0;
      p->max_hard_domain_crawl_rate = -1.0;
@@ -106,7 +107,7 @@ bf_scheduler_new(BFScheduler **sch, PageDB *db, const char *path) {
      else if ((rc = mdb_env_set_mapsize(p->txn_manager->env,
                                         BF_SCHEDULER_DEFAULT_SIZE)) != 0)
           error = "setting map size";
-     else if ((rc = mdb_env_set_maxdbs(p->txn_manager->env, 1)) != 0)
+     else if ((rc = mdb_env_set_maxdbs(p->txn_manager->env, BF_SCHEDULER_MAX_DBS)) != 0)
           error = "setting number of databases";
      else if ((rc = mdb_env_open(
                     p->txn_manager->env,
@@ -148,14 +149,24 @@ bf_scheduler_expand(BFScheduler *sch) {
 }
 
 static int
-bf_scheduler_crawlable_page(BFScheduler *sch, PageInfo *pi) {
-     return (pi->n_crawls == 0) &&
+bf_scheduler_crawlable(BFScheduler *sch, uint64_t n_crawls, uint64_t depth) {
+     return (n_crawls == 0) &&
 	  ((sch->max_crawl_depth == 0) ||
-	   (pi->depth <= sch->max_crawl_depth));
+	   (depth <= sch->max_crawl_depth));
+}
+
+static int
+bf_scheduler_crawlable_page(BFScheduler *sch, PageInfo *pi) {
+     return bf_scheduler_crawlable(sch, pi->n_crawls, pi->depth);
 }
 
 BFSchedulerError
 bf_scheduler_add(BFScheduler *sch, const CrawledPage *page) {
+     return bf_scheduler_add_many(sch, &page, 1);
+}
+
+BFSchedulerError
+bf_scheduler_add_many(BFScheduler *sch, const CrawledPage **pages, size_t n) {
      if (bf_scheduler_expand(sch) != 0)
           return sch->error->code;
 
@@ -165,9 +176,9 @@ bf_scheduler_add(BFScheduler *sch, const CrawledPage *page) {
      MDB_txn *txn = 0;
      MDB_cursor *cur = 0;
 
-     PageInfoList *pil;
-     if (page_db_add(sch->page_db, page, &pil) != 0) {
-          error1 = "adding crawled page";
+     PageInfoList *pil = 0;
+     if (page_db_add_many(sch->page_db, pages, n, &pil) != 0) {
+          error1 = "adding crawled pages";
           error2 = sch->page_db->error->message;
           goto on_error;
      }
@@ -176,7 +187,7 @@ bf_scheduler_add(BFScheduler *sch, const CrawledPage *page) {
      if ((rc = pthread_mutex_lock(&sch->update_thread->wait_mutex)) != 0)
           error1 = "locking n_pages mutex";
      else {
-          sch->update_thread->n_pages_new += 1.0;
+          sch->update_thread->n_pages_new += (double)n;
           if ((rc = pthread_cond_broadcast(&sch->update_thread->wait_cond)) != 0)
                error1 = "broadcasting n_pages signal";
           else if ((rc = pthread_mutex_unlock(&sch->update_thread->wait_mutex)) != 0)
@@ -245,6 +256,11 @@ on_error:
      return sch->error->code;
 }
 
+int
+bf_scheduler_ingest(void *state, const CrawledPage **pages, size_t n) {
+     return bf_scheduler_add_many((BFScheduler*)state, pages, n);
+}
+
 BFSchedulerError
 bf_scheduler_reload(BFScheduler *sch) {
      if (bf_scheduler_expand(sch) != 0)
@@ -277,18 +293,26 @@ bf_scheduler_reload(BFScheduler *sch) {
 
      uint64_t n_reloaded_pages = 0;
      uint64_t hash;
-     PageInfo *pi;
-     while (hashinfo_stream_next(st, &hash, &pi) == stream_state_next) {
-          if (bf_scheduler_crawlable_page(sch, pi)) {
+     PageInfoView view;
+     while (hashinfo_stream_next_view(st, &hash, &view) == stream_state_next) {
+          if (bf_scheduler_crawlable(sch, view.n_crawls, view.depth)) {
                ScheduleKey se = {
                     .score = 0.0,
                     .hash = hash
                };
 
-               if (sch->scorer->state)
+               if (sch->scorer->state) {
+                    // scorers receive a full PageInfo
+                    PageInfo *pi = page_info_new_from_view(&view);
+                    if (!pi) {
+                         hashinfo_stream_delete(st);
+                         error1 = "allocating page info";
+                         goto on_error;
+                    }
                     sch->scorer->add(sch->scorer->state, pi, &se.score);
-               else
-                    se.score = pi->score;
+                    page_info_delete(pi);
+               } else
+                    se.score = view.score;
 
                MDB_val key = {
                     .mv_size = sizeof(se),
@@ -312,7 +336,6 @@ bf_scheduler_reload(BFScheduler *sch) {
                     goto on_error;
                }
           }
-	  page_info_delete(pi);
      }
      hashinfo_stream_delete(st);
 
@@ -410,14 +433,11 @@ bf_scheduler_update_batch(BFScheduler *sch) {
      MDB_txn *txn = 0;
      MDB_cursor *cur = 0;
 
-     // if no Hash/Idx stream active create a new one. It will be deleted if:
-     //     1. We reach stream_state_end or
-     //     2. An error is produced
-     if (!sch->update_thread->stream &&
-         (hashidx_stream_new(&sch->update_thread->stream, sch->page_db) != 0)) {
-               error1 = "creating Hash/Index stream";
-               error2 = sch->page_db->error->message;
-               goto on_error;
+     // start a new walk over all pages. It stops when we reach an index not
+     // assigned yet
+     if (!sch->update_thread->walking) {
+          sch->update_thread->walking = 1;
+          sch->update_thread->next_idx = sch->page_db->shard;
      }
 
      // create new read/write transaction and cursor inside the schedule
@@ -436,32 +456,35 @@ bf_scheduler_update_batch(BFScheduler *sch) {
      // we make the update in batches because there can be only one simultaneous
      // write transaction, and we need another write transaction to get requests, which
      // actually has higher priority
-     for (size_t i=0; i<BF_SCHEDULER_UPDATE_BATCH_SIZE && sch->update_thread->stream; ++i) {
+     for (size_t i=0; i<BF_SCHEDULER_UPDATE_BATCH_SIZE && sch->update_thread->walking; ++i) {
 
           uint64_t hash;
-          size_t idx;
+          size_t idx = sch->update_thread->next_idx;
           float score_old;
           float score_new;
-          switch (hashidx_stream_next(sch->update_thread->stream, &hash, &idx)) {
-          case stream_state_next:
+          switch (page_db_get_hash(sch->page_db, idx, &hash)) {
+          case 0:
                sch->scorer->get(sch->scorer->state, idx, &score_old, &score_new);
                // to gain some performance we don't bother to change the schedule unless
                // there is some significant score change
                if (fabs(score_old - score_new) >= 0.1*fabs(score_old) &&
                    (bf_scheduler_change_score(sch, cur, hash, score_old, score_new) != 0)) {
-                    hashidx_stream_delete(sch->update_thread->stream);
+                    sch->update_thread->walking = 0;
                     txn_manager_abort(sch->txn_manager, txn);
                     return sch->error->code;
                }
+               sch->update_thread->next_idx += sch->page_db->n_shards;
                break;
-          case stream_state_end:
-               hashidx_stream_delete(sch->update_thread->stream);
-               sch->update_thread->stream = 0;
+          case page_db_error_pruned:
+               sch->update_thread->next_idx += sch->page_db->n_shards;
                break;
-          case stream_state_init: // not possible really
-          case stream_state_error:
-               error1 = "processing the Hash/Idx stream";
+          case page_db_error_no_page:
+               sch->update_thread->walking = 0;
                break;
+          default:
+               error1 = "retrieving page hash";
+               error2 = sch->page_db->error->message;
+               goto on_error;
           }
      }
      cur = 0;
@@ -475,8 +498,7 @@ bf_scheduler_update_batch(BFScheduler *sch) {
 
      return 0;
 on_error:
-     if (sch->update_thread->stream)
-          hashidx_stream_delete(sch->update_thread->stream);
+     sch->update_thread->walking = 0;
      if (txn)
           txn_manager_abort(sch->txn_manager, txn);
 
@@ -496,7 +518,7 @@ bf_scheduler_update_step(BFScheduler *sch) {
      do {
           if (bf_scheduler_update_batch(sch) != 0)
                return sch->error->code;
-     } while (sch->update_thread->stream);
+     } while (sch->update_thread->walking);
      return 0;
 }
 
@@ -676,6 +698,9 @@ bf_scheduler_update_stop(BFScheduler *sch) {
           }
      return sch->error->code;
 }
+/** Number of schedule entries whose pages are retrieved together */
+#define BF_SCHEDULER_REQUEST_BATCH 256
+
 static BFSchedulerError
 bf_scheduler_add_requests(BFScheduler *sch,
                           MDB_cursor *cur,
@@ -686,65 +711,119 @@ bf_scheduler_add_requests(BFScheduler *sch,
      char *error1 = 0;
      char *error2 = 0;
 
+     char *url = 0;
+     size_t url_size = 0;
+
+     ScheduleKey batch[BF_SCHEDULER_REQUEST_BATCH];
+     uint64_t hashes[BF_SCHEDULER_REQUEST_BATCH];
+     PageInfoView views[BF_SCHEDULER_REQUEST_BATCH];
+     char found[BF_SCHEDULER_REQUEST_BATCH];
+
+     PageDBReader *reader = &sch->page_db_reader;
+     if (page_db_reader_begin(reader) != 0) {
+          error1 = "beginning PageDB read transaction";
+          error2 = sch->page_db->error->message;
+          goto on_error;
+     }
 
      MDB_cursor_op cur_op = MDB_FIRST;
-     while (req->n_urls < max_request) {
+     int end = 0;
+     while (!end && req->n_urls < max_request) {
           int mdb_rc;
           MDB_val key;
           MDB_val val;
-          ScheduleKey *se;
-          PageInfo *pi;
 
-          switch (mdb_rc = mdb_cursor_get(cur, &key, &val, cur_op)) {
+          // read ahead the next entries and retrieve their pages together
+          size_t n_batch = max_request - req->n_urls;
+          if (n_batch > BF_SCHEDULER_REQUEST_BATCH)
+               n_batch = BF_SCHEDULER_REQUEST_BATCH;
+          size_t n = 0;
+          while (n < n_batch &&
+                 (mdb_rc = mdb_cursor_get(cur, &key, &val, cur_op)) == 0) {
+               batch[n] = *(ScheduleKey*)key.mv_data;
+               hashes[n] = batch[n].hash;
+               ++n;
+               cur_op = MDB_NEXT;
+          }
+          switch (n < n_batch? mdb_rc: 0) {
           case 0:
-               se = key.mv_data;
-               if (page_db_get_info(sch->page_db, se->hash, &pi) != 0) {
-                    error1 = "retrieving PageInfo from PageDB";
-                    error2 = sch->page_db->error->message;
-                    goto on_error;
-               }
                break;
-
           case MDB_NOTFOUND: // no more pages left
-               return 0;
+               end = 1;
+               break;
           default:
                error1 = "getting head of schedule";
                error2 = mdb_strerror(mdb_rc);
                goto on_error;
           }
-          int delete = 0;
-          if (pi) {
-               if (pi->n_crawls == 0) {
-                   if ((crawl_limit < 0) ||
-                       page_db_get_domain_crawl_rate(
-                            sch->page_db,
-                            page_db_hash_get_domain(se->hash)) <= crawl_limit) {
-
-                        // if requested --> delete
-                        delete = 1;
-                        if (page_request_add_url(req, pi->url) != 0) {
-                             error1 = "adding url to request";
-                             goto on_error;
-                        }
-                   }
-               } else { // if already crawled --> delete
-                    delete = 1;
-               }
-               page_info_delete(pi);
+          if (n == 0)
+               break;
+          if (page_db_reader_get_view_many(reader, hashes, n, views, found) != 0) {
+               error1 = "retrieving PageInfo from PageDB";
+               error2 = sch->page_db->error->message;
+               goto on_error;
           }
-          if (delete && (mdb_rc = mdb_cursor_del(cur, 0)) != 0) {
-               error1 = "deleting head of schedule";
-               error2 = mdb_strerror(mdb_rc);
+
+          // walk again the same entries, deleting the ones requested
+          key.mv_size = sizeof(batch[0]);
+          key.mv_data = batch;
+          cur_op = MDB_SET;
+          for (size_t i=0; i<n && req->n_urls < max_request; ++i) {
+               if ((mdb_rc = mdb_cursor_get(cur, &key, &val, cur_op)) != 0) {
+                    error1 = "getting head of schedule";
+                    error2 = mdb_strerror(mdb_rc);
                     goto on_error;
+               }
+               // If we delete an item, what's the state of the cursor? It appears you can
+               // use either MDB_NEXT or MDB_GET_CURRENT to get the next element. MDB_NEXT
+               // works both if we delete or not. See:
+               //     http://www.openldap.org/lists/openldap-devel/201502/msg00028.html
+               cur_op = MDB_NEXT;
+
+               // pages removed from the PageDB are dropped too
+               int delete = !found[i];
+               if (found[i]) {
+                    if (views[i].n_crawls == 0) {
+                         if ((crawl_limit < 0) ||
+                             page_db_get_domain_crawl_rate(
+                                  sch->page_db,
+                                  page_db_hash_get_domain(batch[i].hash)) <= crawl_limit) {
+
+                              // if requested --> delete
+                              delete = 1;
+                              size_t size = page_info_view_url_max_size(views + i);
+                              if (size > url_size) {
+                                   char *url_new = realloc(url, size);
+                                   if (!url_new) {
+                                        error1 = "allocating memory";
+                                        goto on_error;
+                                   }
+                                   url = url_new;
+                                   url_size = size;
+                              }
+                              if (page_info_view_url(views + i, url, url_size) < 0 ||
+                                  page_request_add_url(req, url) != 0) {
+                                   error1 = "adding url to request";
+                                   goto on_error;
+                              }
+                         }
+                    } else { // if already crawled --> delete
+                         delete = 1;
+                    }
+               }
+               if (delete && (mdb_rc = mdb_cursor_del(cur, 0)) != 0) {
+                    error1 = "deleting head of schedule";
+                    error2 = mdb_strerror(mdb_rc);
+                    goto on_error;
+               }
           }
-          // If we delete an item, what's the state of the cursor? It appears you can
-          // use either MDB_NEXT or MDB_GET_CURRENT to get the next element. MDB_NEXT
-          // works both if we delete or not. See:
-          //     http://www.openldap.org/lists/openldap-devel/201502/msg00028.html
-          cur_op = MDB_NEXT;
      }
+     free(url);
+     page_db_reader_end(reader);
      return 0;
 on_error:
+     free(url);
+     page_db_reader_end(reader);
      bf_scheduler_set_error(sch, bf_scheduler_error_internal, __func__);
      bf_scheduler_add_error(sch, error1);
      bf_scheduler_add_error(sch, error2);
@@ -862,6 +941,160 @@ bf_scheduler_set_update_interval(BFScheduler *sch, time_t value) {
      sch->update_thread->rest_time = value;
 }
 
+BFSchedulerError
+bf_scheduler_compact(BFScheduler *sch, size_t *bytes_old, size_t *bytes_new) {
+     if (txn_manager_compact(sch->txn_manager,
+                             BF_SCHEDULER_MAX_DBS,
+                             bytes_old,
+                             bytes_new) != 0) {
+          bf_scheduler_set_error(sch, bf_scheduler_error_internal, __func__);
+          bf_scheduler_add_error(sch, sch->txn_manager->error->message);
+     }
+     return sch->error->code;
+}
+
+BFSchedulerError
+bf_scheduler_set_map_size(BFScheduler *sch, size_t size, size_t growth) {
+     txn_manager_set_growth(sch->txn_manager, growth);
+     if (txn_manager_reserve(sch->txn_manager, size) != 0) {
+          bf_scheduler_set_error(sch, bf_scheduler_error_internal, __func__);
+          bf_scheduler_add_error(sch, sch->txn_manager->error->message);
+     }
+     return sch->error->code;
+}
+
+BFSchedulerError
+bf_scheduler_set_sync(BFScheduler *sch, TxnManagerSync sync, double interval) {
+     if (txn_manager_set_sync(sch->txn_manager, sync, interval) != 0) {
+          bf_scheduler_set_error(sch, bf_scheduler_error_internal, __func__);
+          bf_scheduler_add_error(sch, sch->txn_manager->error->message);
+     }
+     return sch->error->code;
+}
+
+/** Remove from the schedule the entries after start whose page is not
+ * inside the @ref PageDB.
+ *
+ * @param start First entry to check. Set to the next entry to check.
+ * @param done Set to 1 if the end of the schedule was reached
+ */
+static BFSchedulerError
+bf_scheduler_prune_batch(BFScheduler *sch, ScheduleKey *start, int *done) {
+     if (bf_scheduler_expand(sch) != 0)
+          return sch->error->code;
+
+     char *error1 = 0;
+     char *error2 = 0;
+
+     MDB_txn *txn = 0;
+     MDB_cursor *cur = 0;
+     MDB_cursor *cur_info = 0;
+
+     if (txn_manager_begin(sch->txn_manager, 0, &txn) != 0) {
+          error1 = "starting transaction";
+          error2 = sch->txn_manager->error->message;
+          goto on_error;
+     }
+     int mdb_rc = bf_scheduler_open_cursor(txn, &cur);
+     if (mdb_rc != 0) {
+          error1 = "opening cursor";
+          error2 = mdb_strerror(mdb_rc);
+          goto on_error;
+     }
+     if (page_db_info_cursor_open(sch->page_db, &cur_info) != 0) {
+          error1 = "opening PageDB cursor";
+          error2 = sch->page_db->error->message;
+          goto on_error;
+     }
+
+     MDB_val key = {
+          .mv_size = sizeof(*start),
+          .mv_data = start
+     };
+     MDB_val val;
+     mdb_rc = mdb_cursor_get(cur, &key, &val, MDB_SET_RANGE);
+     for (size_t i=0; mdb_rc == 0 && i<PAGE_DB_PRUNE_BATCH; ++i) {
+          PageInfoView view;
+          switch (page_db_info_cursor_get(sch->page_db,
+                                          cur_info,
+                                          ((ScheduleKey*)key.mv_data)->hash,
+                                          &view)) {
+          case 0:
+               break;
+          case page_db_error_no_page:
+               if ((mdb_rc = mdb_cursor_del(cur, 0)) != 0) {
+                    error1 = "deleting schedule entry";
+                    error2 = mdb_strerror(mdb_rc);
+                    goto on_error;
+               }
+               break;
+          default:
+               error1 = "retrieving PageInfo from PageDB";
+               error2 = sch->page_db->error->message;
+               goto on_error;
+          }
+          mdb_rc = mdb_cursor_get(cur, &key, &val, MDB_NEXT);
+     }
+     switch (mdb_rc) {
+     case 0:
+          *start = *(ScheduleKey*)key.mv_data;
+          *done = 0;
+          break;
+     case MDB_NOTFOUND:
+          *done = 1;
+          break;
+     default:
+          error1 = "iterating on schedule";
+          error2 = mdb_strerror(mdb_rc);
+          goto on_error;
+     }
+     page_db_info_cursor_close(sch->page_db, cur_info);
+     cur_info = 0;
+
+     if (txn_manager_commit(sch->txn_manager, txn) != 0) {
+          txn = 0;
+          error1 = "commiting schedule transaction";
+          error2 = sch->txn_manager->error->message;
+          goto on_error;
+     }
+     return 0;
+
+on_error:
+     page_db_info_cursor_close(sch->page_db, cur_info);
+     if (txn)
+          txn_manager_abort(sch->txn_manager, txn);
+
+     bf_scheduler_set_error(sch, bf_scheduler_error_internal, __func__);
+     bf_scheduler_add_error(sch, error1);
+     bf_scheduler_add_error(sch, error2);
+     return sch->error->code;
+}
+
+BFSchedulerError
+bf_scheduler_prune(BFScheduler *sch,
+                   float min_score,
+                   uint64_t max_depth,
+                   double max_age,
+                   size_t *n_pruned) {
+     if (page_db_prune(sch->page_db, min_score, max_depth, max_age, n_pruned) != 0) {
+          bf_scheduler_set_error(sch, bf_scheduler_error_internal, __func__);
+          bf_scheduler_add_error(sch, "pruning PageDB");
+          bf_scheduler_add_error(sch, sch->page_db->error->message);
+          return sch->error->code;
+     }
+     // the schedule is ordered by decreasing score, so the walk starts at
+     // the highest possible one
+     ScheduleKey start = {
+          .score = INFINITY,
+          .hash = 0
+     };
+     int done = 0;
+     while (!done)
+          if (bf_scheduler_prune_batch(sch, &start, &done) != 0)
+               return sch->error->code;
+     return 0;
+}
+
 void
 bf_scheduler_delete(BFScheduler *sch) {
      if (sch->update_thread->state != update_thread_none) {
@@ -872,7 +1105,8 @@ bf_scheduler_delete(BFScheduler *sch) {
      (void)pthread_cond_destroy(&sch->update_thread->wait_cond);
      (void)pthread_mutex_destroy(&sch->update_thread->state_mutex);
 
-     mdb_env_close(sch->txn_manager->env);
+     page_db_reader_close(&sch->page_db_reader);
+     txn_manager_close_env(sch->txn_manager);
      (void)txn_manager_delete(sch->txn_manager);
      if (!sch->persist) {
           char *data = build_path(sch->path, "data.mdb");
@@ -16,6 +16,9 @@
 /** Size of the mmap to store the schedule */
 #define BF_SCHEDULER_DEFAULT_SIZE PAGE_DB_DEFAULT_SIZE
 
+/** Number of named databases inside the environment */
+#define BF_SCHEDULER_MAX_DBS 1
+
 /** Size of the batch used in updating the schedule.
  *
  * Updating the schedule involves starting a write transaction. However write
@@ -71,12 +74,14 @@ typedef enum {
 
 /** All variables associated with just the update thread */
 typedef struct {
-     /** An stream of Hash/Index pairs.
+     /** Index of the next page to revisit.
       *
-      * This is necessary because page scores can change. This is stream is used
-      * to make sure all page scores are revisited periodically.
+      * This is necessary because page scores can change. Pages are walked by
+      * index to make sure all page scores are revisited periodically.
       **/
-     HashIdxStream *stream;
+     uint64_t next_idx;
+     /** True while walking the pages */
+     int walking;
 
      /** We only perform an update of scores and schedule when enough new pages
       * have been added, otherwise the update thread sleeps */
@@ -120,6 +125,10 @@ typedef struct {
       * If not set up, the PageInfo.score will be used */
      Scorer *scorer;
 
+     /** Retrieves the pages of the schedule entries examined by requests.
+         Used while the schedule write transaction is held */
+     PageDBReader page_db_reader;
+
      /** The scheduler state is maintained inside am LMDB environment */
      TxnManager *txn_manager;
      /** Path to the @ref env
@@ -168,6 +177,28 @@ bf_scheduler_new(BFScheduler **sch, PageDB *db, const char *path);
 BFSchedulerError
 bf_scheduler_add(BFScheduler *sch, const CrawledPage *page);
 
+/** Add several crawled pages
+ *
+ * Pages are added to the PageDB with @ref page_db_add_many and to the
+ * schedule inside a single transaction.
+ *
+ * @param sch
+ * @param pages Array of crawled pages
+ * @param n Number of elements inside pages
+ *
+ * @return 0 if success, otherwise the error code
+ */
+BFSchedulerError
+bf_scheduler_add_many(BFScheduler *sch, const CrawledPage **pages, size_t n);
+
+/** Same as @ref bf_scheduler_add_many.
+ *
+ * Its signature complies with @ref IngestQueueAddFunc, with state being the
+ * @ref BFScheduler.
+ */
+int
+bf_scheduler_ingest(void *state, const CrawledPage **pages, size_t n);
+
 /** Add to schedule all non-crawled pages
  *
  * This can be used to retry pages that were requested but could not be
@@ -189,6 +220,54 @@ bf_scheduler_reload(BFScheduler *sch);
 BFSchedulerError
 bf_scheduler_request(BFScheduler *sch, size_t n_pages, PageRequest **request);
 
+/** Reclaim the free space left in the schedule file by popped entries.
+ *
+ * See @ref txn_manager_compact. Writes to the schedule wait until the
+ * compaction finishes.
+ *
+ * @param sch
+ * @param bytes_old If not NULL, size of the schedule file before compaction
+ * @param bytes_new If not NULL, size of the schedule file after compaction
+ *
+ * @return 0 if success, otherwise the error code
+ */
+BFSchedulerError
+bf_scheduler_compact(BFScheduler *sch, size_t *bytes_old, size_t *bytes_new);
+
+/** Reserve the memory map of the schedule and set how it grows.
+ *
+ * See @ref page_db_set_map_size
+ */
+BFSchedulerError
+bf_scheduler_set_map_size(BFScheduler *sch, size_t size, size_t growth);
+
+/** Set when the writes to the schedule are made durable.
+ *
+ * See @ref page_db_set_sync
+ */
+BFSchedulerError
+bf_scheduler_set_sync(BFScheduler *sch, TxnManagerSync sync, double interval);
+
+/** Remove stale uncrawled pages from the @ref PageDB and the schedule.
+ *
+ * Pages are removed with @ref page_db_prune, see there for the meaning of
+ * the parameters. The schedule is then walked, in write transactions of
+ * @ref PAGE_DB_PRUNE_BATCH entries, removing the pages no longer inside the
+ * @ref PageDB. Requests skip those entries anyway, so the walk just reclaims
+ * their space earlier.
+ *
+ * @param n_pruned If not NULL, set to the number of pages removed from the
+ *                 @ref PageDB
+ *
+ * @return 0 if success, otherwise the error code
+ */
+BFSchedulerError
+bf_scheduler_prune(BFScheduler *sch,
+                   float min_score,
+                   uint64_t max_depth,
+                   double max_age,
+                   size_t *n_pruned);
+
 /** Delete scheduler.
  *
  * It may or may not delete associated disk files depending on the
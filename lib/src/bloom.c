@@ -0,0 +1,96 @@
+#define _POSIX_C_SOURCE 200809L
+#define _BSD_SOURCE 1
+#define _GNU_SOURCE 1
+
+#include <math.h>
+#include <stdio.h>
+
+#include "bloom.h"
+
+BloomFilter *
+bloom_filter_new(size_t capacity, size_t bits_per_item) {
+     BloomFilter *bf = calloc(1, sizeof(*bf));
+     if (!bf)
+          return 0;
+
+     const size_t block_bits = 64*BLOOM_BLOCK_WORDS;
+     bf->n_blocks = (capacity*bits_per_item + block_bits - 1)/block_bits;
+     if (bf->n_blocks == 0)
+          bf->n_blocks = 1;
+     bf->blocks = calloc(bf->n_blocks*BLOOM_BLOCK_WORDS, sizeof(*bf->blocks));
+     if (!bf->blocks) {
+          free(bf);
+          return 0;
+     }
+     bf->capacity = capacity;
+
+     return bf;
+}
+
+/* Final mix of MurmurHash3. Page hashes are two concatenated 32 bit hashes
+   and the high half is shared by all the pages of a domain, so the bits must
+   be mixed before using them */
+static uint64_t
+bloom_mix(uint64_t h) {
+     h ^= h >> 33;
+     h *= 0xff51afd7ed558ccdULL;
+     h ^= h >> 33;
+     h *= 0xc4ceb9fe1a85ec53ULL;
+     h ^= h >> 33;
+     return h;
+}
+
+/** Block for the hash and, inside probes, BLOOM_N_PROBES bit positions of 9
+ * bits each */
+static uint64_t *
+bloom_filter_block(const BloomFilter *bf, uint64_t hash, uint64_t *probes) {
+     uint64_t h = bloom_mix(hash);
+     *probes = bloom_mix(h ^ 0x9e3779b97f4a7c15ULL);
+     size_t block = (size_t)(((h >> 32)*(uint64_t)bf->n_blocks) >> 32);
+     return bf->blocks + block*BLOOM_BLOCK_WORDS;
+}
+
+void
+bloom_filter_add(BloomFilter *bf, uint64_t hash) {
+     uint64_t probes;
+     uint64_t *block = bloom_filter_block(bf, hash, &probes);
+     for (int i=0; i<BLOOM_N_PROBES; ++i, probes >>= 9)
+          block[(probes >> 6) & (BLOOM_BLOCK_WORDS - 1)] |= 1ULL << (probes & 63);
+     bf->n_items++;
+}
+
+int
+bloom_filter_contains(const BloomFilter *bf, uint64_t hash) {
+     uint64_t probes;
+     const uint64_t *block = bloom_filter_block(bf, hash, &probes);
+     for (int i=0; i<BLOOM_N_PROBES; ++i, probes >>= 9)
+          if (!(block[(probes >> 6) & (BLOOM_BLOCK_WORDS - 1)] & (1ULL << (probes & 63))))
+               return 0;
+     return 1;
+}
+
+size_t
+bloom_filter_memory(const BloomFilter *bf) {
+     return sizeof(*bf) + bf->n_blocks*BLOOM_BLOCK_WORDS*sizeof(*bf->blocks);
+}
+
+double
+bloom_filter_fp_rate(const BloomFilter *bf) {
+     size_t n_words = bf->n_blocks*BLOOM_BLOCK_WORDS;
+     size_t n_set = 0;
+     for (size_t i=0; i<n_words; ++i)
+          n_set += __builtin_popcountll(bf->blocks[i]);
+     return pow((double)n_set/(double)(64*n_words), BLOOM_N_PROBES);
+}
+
+void
+bloom_filter_delete(BloomFilter *bf) {
+     if (bf) {
+          free(bf->blocks);
+          free(bf);
+     }
+}
+
+#if (defined TEST) && TEST
+#include "test_bloom.c"
+#endif
@@ -0,0 +1,73 @@
+#ifndef __BLOOM_H__
+#define __BLOOM_H__
+
+#define _POSIX_C_SOURCE 200809L
+#define _BSD_SOURCE 1
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** Number of 64 bit words inside a block, a block fills a cache line */
+#define BLOOM_BLOCK_WORDS 8
+/** Number of bits set for each item */
+#define BLOOM_N_PROBES 7
+
+/** A blocked Bloom filter over 64 bit hashes.
+ *
+ * All the bits of an item are set inside the same 512 bit block, so each
+ * query touches a single cache line. The price is a slightly higher false
+ * positive rate than a standard Bloom filter of the same size.
+ *
+ * There are no false negatives: if @ref bloom_filter_contains returns 0 the
+ * item was never added.
+ */
+typedef struct {
+     uint64_t *blocks;   /**< n_blocks*BLOOM_BLOCK_WORDS words */
+     size_t n_blocks;    /**< Number of blocks */
+     size_t n_items;     /**< Number of calls to @ref bloom_filter_add */
+     size_t capacity;    /**< Number of items the filter was sized for */
+} BloomFilter;
+
+/// @addtogroup BloomFilter
+/// @{
+
+/** Create a new, empty, filter
+ *
+ * @param capacity Expected number of items
+ * @param bits_per_item Memory per item. 10 bits give about 1% false positives.
+ *
+ * @returns A pointer to the new struct or NULL if failure
+ */
+BloomFilter *
+bloom_filter_new(size_t capacity, size_t bits_per_item);
+
+/** Add an item */
+void
+bloom_filter_add(BloomFilter *bf, uint64_t hash);
+
+/** Returns 0 if the item was never added, 1 if it probably was */
+int
+bloom_filter_contains(const BloomFilter *bf, uint64_t hash);
+
+/** Number of bytes used by the filter */
+size_t
+bloom_filter_memory(const BloomFilter *bf);
+
+/** Expected false positive rate, computed from the fraction of bits set */
+double
+bloom_filter_fp_rate(const BloomFilter *bf);
+
+/** Free memory */
+void
+bloom_filter_delete(BloomFilter *bf);
+
+/// @}
+
+#if (defined TEST) && TEST
+#include "CuTest.h"
+CuSuite *
+test_bloom_suite(void);
+#endif
+
+#endif // __BLOOM_H__
@@ -0,0 +1,299 @@
+#define _POSIX_C_SOURCE 200809L
+#define _BSD_SOURCE 1
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <string.h>
+
+#include "clock_cache.h"
+
+/** Bytes charged to each entry besides its value: the slot and two buckets
+ * of the table, which is kept at most half full */
+#define CLOCK_CACHE_ENTRY_OVERHEAD (sizeof(ClockCacheSlot) + 2*sizeof(uint32_t))
+
+/* Final mix of MurmurHash3. Keys are usually page hashes, whose high half is
+   shared by all the pages of a domain */
+static uint64_t
+clock_cache_mix(uint64_t h) {
+     h ^= h >> 33;
+     h *= 0xff51afd7ed558ccdULL;
+     h ^= h >> 33;
+     h *= 0xc4ceb9fe1a85ec53ULL;
+     h ^= h >> 33;
+     return h;
+}
+
+static ClockCacheShard *
+clock_cache_shard(const ClockCache *cache, uint64_t key) {
+     uint64_t h = clock_cache_mix(key) >> 32;
+     return cache->shards + (size_t)((h*(uint64_t)cache->n_shards) >> 32);
+}
+
+/** Bucket of the table holding key, or of the empty bucket where it should
+ * be inserted */
+static size_t
+clock_cache_bucket(const ClockCacheShard *shard, uint64_t key) {
+     size_t mask = shard->table_size - 1;
+     size_t b = (size_t)clock_cache_mix(key) & mask;
+     while (shard->table[b] != 0 &&
+            shard->slots[shard->table[b] - 1].key != key)
+          b = (b + 1) & mask;
+     return b;
+}
+
+/** Remove the key at bucket b from the table, moving back the keys that
+ * follow so that no search stops early */
+static void
+clock_cache_table_del(ClockCacheShard *shard, size_t b) {
+     size_t mask = shard->table_size - 1;
+     size_t hole = b;
+     for (size_t i = (b + 1) & mask; shard->table[i] != 0; i = (i + 1) & mask) {
+          size_t home =
+               (size_t)clock_cache_mix(shard->slots[shard->table[i] - 1].key) & mask;
+          // move the key back if its home is not between the hole and i
+          if (((i - home) & mask) >= ((i - hole) & mask)) {
+               shard->table[hole] = shard->table[i];
+               hole = i;
+          }
+     }
+     shard->table[hole] = 0;
+}
+
+/** Grow the slots and the table so that one more entry fits.
+ *
+ * @return 0 if success, -1 if memory error
+ */
+static int
+clock_cache_reserve(ClockCacheShard *shard) {
+     if (shard->n_slots < shard->m_slots)
+          return 0;
+     size_t m = shard->m_slots > 0? 2*shard->m_slots: 64;
+     if (m > UINT32_MAX)
+          return -1;
+     ClockCacheSlot *slots = realloc(shard->slots, m*sizeof(*slots));
+     if (!slots)
+          return -1;
+     shard->slots = slots;
+
+     uint32_t *table = calloc(2*m, sizeof(*table));
+     if (!table)
+          return -1;
+     free(shard->table);
+     shard->table = table;
+     shard->table_size = 2*m;
+     for (size_t i=0; i<shard->n_slots; ++i)
+          shard->table[clock_cache_bucket(shard, shard->slots[i].key)] = i + 1;
+     shard->m_slots = m;
+     return 0;
+}
+
+/** Remove the entry at bucket b of the table */
+static void
+clock_cache_remove(ClockCache *cache, ClockCacheShard *shard, size_t b) {
+     size_t i = shard->table[b] - 1;
+     clock_cache_table_del(shard, b);
+
+     ClockCacheSlot *slot = shard->slots + i;
+     cache->free_func(slot->value);
+     shard->n_bytes -= slot->size;
+
+     // fill the hole with the last slot
+     size_t last = --shard->n_slots;
+     if (i != last) {
+          *slot = shard->slots[last];
+          shard->table[clock_cache_bucket(shard, slot->key)] = i + 1;
+     }
+     if (shard->hand >= shard->n_slots)
+          shard->hand = 0;
+}
+
+/** Move the hand until an entry without the reference bit is found, and
+ * evict it */
+static void
+clock_cache_evict(ClockCache *cache, ClockCacheShard *shard) {
+     while (shard->slots[shard->hand].ref) {
+          shard->slots[shard->hand].ref = 0;
+          if (++shard->hand == shard->n_slots)
+               shard->hand = 0;
+     }
+     clock_cache_remove(
+          cache, shard, clock_cache_bucket(shard, shard->slots[shard->hand].key));
+     shard->n_evictions++;
+}
+
+ClockCache *
+clock_cache_new(size_t max_bytes,
+                size_t n_shards,
+                ClockCacheCopyFunc *copy_func,
+                ClockCacheFreeFunc *free_func) {
+     if (n_shards == 0)
+          n_shards = CLOCK_CACHE_DEFAULT_SHARDS;
+
+     ClockCache *cache = calloc(1, sizeof(*cache));
+     if (!cache)
+          return 0;
+     if (!(cache->shards = calloc(n_shards, sizeof(*cache->shards)))) {
+          free(cache);
+          return 0;
+     }
+     cache->copy_func = copy_func;
+     cache->free_func = free_func;
+     for (cache->n_shards=0; cache->n_shards<n_shards; ++cache->n_shards) {
+          ClockCacheShard *shard = cache->shards + cache->n_shards;
+          if (pthread_mutex_init(&shard->lock, 0) != 0) {
+               clock_cache_delete(cache);
+               return 0;
+          }
+          shard->max_bytes = max_bytes/n_shards;
+     }
+     return cache;
+}
+
+int
+clock_cache_get(ClockCache *cache, uint64_t key, void **value, uint64_t *version) {
+     ClockCacheShard *shard = clock_cache_shard(cache, key);
+     *value = 0;
+
+     pthread_mutex_lock(&shard->lock);
+     if (version)
+          *version = shard->version;
+     if (shard->n_slots > 0) {
+          size_t b = clock_cache_bucket(shard, key);
+          if (shard->table[b] != 0) {
+               ClockCacheSlot *slot = shard->slots + shard->table[b] - 1;
+               slot->ref = 1;
+               *value = cache->copy_func(slot->value);
+          }
+     }
+     if (*value)
+          shard->n_hits++;
+     else
+          shard->n_misses++;
+     pthread_mutex_unlock(&shard->lock);
+
+     return *value != 0;
+}
+
+void
+clock_cache_put(ClockCache *cache,
+                uint64_t key,
+                const void *value,
+                size_t size,
+                uint64_t version) {
+     ClockCacheShard *shard = clock_cache_shard(cache, key);
+     size += CLOCK_CACHE_ENTRY_OVERHEAD;
+     if (size > shard->max_bytes)
+          return;
+     // copy outside the lock
+     void *copy = cache->copy_func(value);
+     if (!copy)
+          return;
+
+     pthread_mutex_lock(&shard->lock);
+     if (version != shard->version) {
+          shard->n_rejected++;
+          pthread_mutex_unlock(&shard->lock);
+          cache->free_func(copy);
+          return;
+     }
+     if (shard->n_slots > 0) {
+          size_t b = clock_cache_bucket(shard, key);
+          if (shard->table[b] != 0)
+               clock_cache_remove(cache, shard, b);
+     }
+     while (shard->n_slots > 0 && shard->n_bytes + size > shard->max_bytes)
+          clock_cache_evict(cache, shard);
+     if (clock_cache_reserve(shard) != 0) {
+          pthread_mutex_unlock(&shard->lock);
+          cache->free_func(copy);
+          return;
+     }
+     size_t i = shard->n_slots++;
+     shard->slots[i].key = key;
+     shard->slots[i].value = copy;
+     shard->slots[i].size = size;
+     shard->slots[i].ref = 0;
+     shard->table[clock_cache_bucket(shard, key)] = i + 1;
+     shard->n_bytes += size;
+     shard->n_inserts++;
+     pthread_mutex_unlock(&shard->lock);
+}
+
+void
+clock_cache_invalidate(ClockCache *cache, uint64_t key) {
+     ClockCacheShard *shard = clock_cache_shard(cache, key);
+
+     pthread_mutex_lock(&shard->lock);
+     shard->version++;
+     if (shard->n_slots > 0) {
+          size_t b = clock_cache_bucket(shard, key);
+          if (shard->table[b] != 0) {
+               clock_cache_remove(cache, shard, b);
+               shard->n_invalidations++;
+          }
+     }
+     pthread_mutex_unlock(&shard->lock);
+}
+
+/** Free all the values of a shard. The lock must be held */
+static void
+clock_cache_shard_clear(ClockCache *cache, ClockCacheShard *shard) {
+     for (size_t i=0; i<shard->n_slots; ++i)
+          cache->free_func(shard->slots[i].value);
+     if (shard->table)
+          memset(shard->table, 0, shard->table_size*sizeof(*shard->table));
+     shard->n_slots = 0;
+     shard->n_bytes = 0;
+     shard->hand = 0;
+}
+
+void
+clock_cache_clear(ClockCache *cache) {
+     for (size_t i=0; i<cache->n_shards; ++i) {
+          ClockCacheShard *shard = cache->shards + i;
+          pthread_mutex_lock(&shard->lock);
+          shard->version++;
+          shard->n_invalidations += shard->n_slots;
+          clock_cache_shard_clear(cache, shard);
+          pthread_mutex_unlock(&shard->lock);
+     }
+}
+
+void
+clock_cache_stats(ClockCache *cache, ClockCacheStats *stats) {
+     memset(stats, 0, sizeof(*stats));
+     for (size_t i=0; i<cache->n_shards; ++i) {
+          ClockCacheShard *shard = cache->shards + i;
+          pthread_mutex_lock(&shard->lock);
+          stats->n_hits += shard->n_hits;
+          stats->n_misses += shard->n_misses;
+          stats->n_inserts += shard->n_inserts;
+          stats->n_evictions += shard->n_evictions;
+          stats->n_invalidations += shard->n_invalidations;
+          stats->n_rejected += shard->n_rejected;
+          stats->n_entries += shard->n_slots;
+          stats->n_bytes += shard->n_bytes;
+          stats->max_bytes += shard->max_bytes;
+          pthread_mutex_unlock(&shard->lock);
+     }
+}
+
+void
+clock_cache_delete(ClockCache *cache) {
+     if (!cache)
+          return;
+     // n_shards counts only the shards whose lock was initialized
+     for (size_t i=0; i<cache->n_shards; ++i) {
+          ClockCacheShard *shard = cache->shards + i;
+          clock_cache_shard_clear(cache, shard);
+          free(shard->slots);
+          free(shard->table);
+          pthread_mutex_destroy(&shard->lock);
+     }
+     free(cache->shards);
+     free(cache);
+}
+
+#if (defined TEST) && TEST
+#include "test_clock_cache.c"
+#endif
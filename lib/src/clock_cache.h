@@ -0,0 +1,166 @@
+#ifndef __CLOCK_CACHE_H__
+#define __CLOCK_CACHE_H__
+
+#define _POSIX_C_SOURCE 200809L
+#define _BSD_SOURCE 1
+#define _GNU_SOURCE 1
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/** Default number of shards of a @ref ClockCache */
+#define CLOCK_CACHE_DEFAULT_SHARDS 16
+
+/** Make a copy of a cached value. Returns NULL if memory error */
+typedef void *(ClockCacheCopyFunc)(const void *value);
+/** Free a cached value */
+typedef void (ClockCacheFreeFunc)(void *value);
+
+/** A cached value */
+typedef struct {
+     uint64_t key;
+     void *value;
+     size_t size;  /**< Bytes charged to the budget */
+     uint8_t ref;  /**< Set when read, cleared when the hand passes */
+} ClockCacheSlot;
+
+/** A part of the cache with its own lock and budget */
+typedef struct {
+     pthread_mutex_t lock;
+     /** The entries, in no particular order. The hand of the clock cycles
+         over them */
+     ClockCacheSlot *slots;
+     size_t n_slots;
+     size_t m_slots;
+     /** Open addressing table from key to position inside slots, plus one.
+         0 marks an empty bucket */
+     uint32_t *table;
+     size_t table_size; /**< Always a power of two */
+     size_t hand;
+
+     size_t n_bytes;
+     size_t max_bytes;
+     /** Incremented by every invalidation, see @ref clock_cache_put */
+     uint64_t version;
+
+     size_t n_hits;
+     size_t n_misses;
+     size_t n_inserts;
+     size_t n_evictions;
+     size_t n_invalidations;
+     size_t n_rejected;
+} ClockCacheShard;
+
+/** Usage counters of a @ref ClockCache */
+typedef struct {
+     size_t n_hits;          /**< Lookups that found the key */
+     size_t n_misses;        /**< Lookups that did not find the key */
+     size_t n_inserts;       /**< Values stored */
+     size_t n_evictions;     /**< Values removed to make room for others */
+     size_t n_invalidations; /**< Values removed by @ref clock_cache_invalidate */
+     size_t n_rejected;      /**< Values not stored because they could be stale */
+     size_t n_entries;       /**< Values inside the cache */
+     size_t n_bytes;         /**< Bytes charged to the budget */
+     size_t max_bytes;       /**< The budget */
+} ClockCacheStats;
+
+/** A bounded cache from 64 bit keys to values, evicted with CLOCK.
+ *
+ * Each entry has a reference bit which is set when the entry is read. To make
+ * room for a new entry the hand of the clock moves over the entries, clearing
+ * the bit, and evicts the first one found without it. New entries start
+ * without the bit, so a long run of keys read only once does not push out
+ * the entries that are read repeatedly.
+ *
+ * Keys are split between shards, each one with its own lock, so that
+ * several threads can use the cache at the same time. The byte budget is
+ * split evenly between the shards.
+ *
+ * Values are copied in and out, and therefore they can be freed by the
+ * caller or by the cache at any time.
+ *
+ * To keep the cache consistent with a database, a value read from the
+ * database must be stored only if no invalidation happened since the read
+ * started. @ref clock_cache_get returns a version number for this purpose
+ * which must be taken before the read starts and passed to
+ * @ref clock_cache_put. Writers must call @ref clock_cache_invalidate after
+ * their changes are visible to new reads.
+ */
+typedef struct {
+     ClockCacheShard *shards;
+     size_t n_shards;
+     ClockCacheCopyFunc *copy_func;
+     ClockCacheFreeFunc *free_func;
+} ClockCache;
+
+/// @addtogroup ClockCache
+/// @{
+
+/** Create a new, empty, cache
+ *
+ * @param max_bytes The budget for all the shards. Each entry is charged the
+ *                  size given to @ref clock_cache_put plus some bookkeeping.
+ * @param n_shards If 0, @ref CLOCK_CACHE_DEFAULT_SHARDS
+ * @param copy_func Used to copy values in and out of the cache
+ * @param free_func Used to free the values stored
+ *
+ * @returns A pointer to the new struct or NULL if failure
+ */
+ClockCache *
+clock_cache_new(size_t max_bytes,
+                size_t n_shards,
+                ClockCacheCopyFunc *copy_func,
+                ClockCacheFreeFunc *free_func);
+
+/** Look up a key.
+ *
+ * @param value Set to a copy of the cached value, or NULL if missing
+ * @param version If not NULL, set to the version to pass to
+ *                @ref clock_cache_put after reading the value from elsewhere
+ *
+ * @return 1 if found, 0 if missing or if the copy could not be made
+ */
+int
+clock_cache_get(ClockCache *cache, uint64_t key, void **value, uint64_t *version);
+
+/** Store a copy of a value.
+ *
+ * The value is not stored if any key of the same shard has been invalidated
+ * since version was taken by @ref clock_cache_get, since it could have been
+ * read before the change that caused the invalidation.
+ *
+ * @param size Bytes used by the value
+ */
+void
+clock_cache_put(ClockCache *cache,
+                uint64_t key,
+                const void *value,
+                size_t size,
+                uint64_t version);
+
+/** Remove a key, and prevent storing values of reads already started */
+void
+clock_cache_invalidate(ClockCache *cache, uint64_t key);
+
+/** Invalidate all the keys */
+void
+clock_cache_clear(ClockCache *cache);
+
+/** Get the usage counters, summed over all the shards */
+void
+clock_cache_stats(ClockCache *cache, ClockCacheStats *stats);
+
+/** Free memory */
+void
+clock_cache_delete(ClockCache *cache);
+
+/// @}
+
+#if (defined TEST) && TEST
+#include "CuTest.h"
+CuSuite *
+test_clock_cache_suite(void);
+#endif
+
+#endif // __CLOCK_CACHE_H__
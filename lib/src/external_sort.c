@@ -0,0 +1,393 @@
+#define _POSIX_C_SOURCE 200809L
+#define _BSD_SOURCE 1
+#define _GNU_SOURCE 1
+
+#include <errno.h>
+#include <string.h>
+
+#include "external_sort.h"
+
+/** Records are aligned to this number of bytes inside the memory buffer */
+#define EXTERNAL_SORT_ALIGN sizeof(uint64_t)
+/** Size of the stdio buffer of each temporary file while merging */
+#define EXTERNAL_SORT_FILE_BUFFER (1 << 16)
+
+static void
+external_sort_set_error(ExternalSort *es, int code, const char *message) {
+     error_set(es->error, code, message);
+}
+
+static void
+external_sort_add_error(ExternalSort *es, const char *message) {
+     error_add(es->error, message);
+}
+
+/** Path of the temporary file of a run. Must be freed by the caller */
+static char *
+external_sort_run_path(const ExternalSort *es, size_t run) {
+     size_t size = strlen(es->path) + 32;
+     char *path = malloc(size);
+     if (path)
+          snprintf(path, size, "%s.%zu", es->path, run);
+     return path;
+}
+
+/** Record stored at the given offset of the memory buffer */
+static const char *
+external_sort_rec_data(const ExternalSort *es, size_t offset) {
+     return es->buf + offset + sizeof(size_t);
+}
+
+static size_t
+external_sort_rec_size(const ExternalSort *es, size_t offset) {
+     return *(size_t*)(es->buf + offset);
+}
+
+ExternalSortError
+external_sort_new(ExternalSort **es,
+                  const char *path,
+                  ExternalSortCmpFunc *cmp,
+                  size_t max_memory) {
+     ExternalSort *p = *es = calloc(1, sizeof(*p));
+     if (!p)
+          return external_sort_error_memory;
+     if (!(p->error = error_new()) ||
+         !(p->path = strdup(path))) {
+          error_delete(p->error);
+          free(p);
+          *es = 0;
+          return external_sort_error_memory;
+     }
+     p->cmp = cmp;
+     p->state = stream_state_init;
+     p->max_memory = max_memory? max_memory: EXTERNAL_SORT_DEFAULT_MAX_MEMORY;
+     return 0;
+}
+
+/** Stable merge sort of the offsets of the records in memory.
+ *
+ * qsort is not used since it is not stable and its comparison function has
+ * no access to the buffer.
+ *
+ * @param tmp Scratch space for n/2 offsets
+ */
+static void
+external_sort_sort(ExternalSort *es, size_t *recs, size_t *tmp, size_t n) {
+     if (n < 2)
+          return;
+     size_t h = n/2;
+     external_sort_sort(es, recs, tmp, h);
+     external_sort_sort(es, recs + h, tmp, n - h);
+     if (es->cmp(external_sort_rec_data(es, recs[h - 1]),
+                 external_sort_rec_data(es, recs[h])) <= 0)
+          return;
+
+     memcpy(tmp, recs, h*sizeof(*recs));
+     size_t i = 0;
+     size_t j = h;
+     size_t k = 0;
+     while (i < h && j < n)
+          recs[k++] =
+               es->cmp(external_sort_rec_data(es, tmp[i]),
+                       external_sort_rec_data(es, recs[j])) <= 0?
+               tmp[i++]: recs[j++];
+     while (i < h)
+          recs[k++] = tmp[i++];
+}
+
+static ExternalSortError
+external_sort_sort_memory(ExternalSort *es) {
+     size_t *tmp = malloc((es->n_recs/2 + 1)*sizeof(*tmp));
+     if (!tmp) {
+          external_sort_set_error(es, external_sort_error_memory, __func__);
+          return es->error->code;
+     }
+     external_sort_sort(es, es->recs, tmp, es->n_recs);
+     free(tmp);
+     return 0;
+}
+
+/** Sort the records in memory and write them to a new run */
+static ExternalSortError
+external_sort_flush(ExternalSort *es) {
+     if (external_sort_sort_memory(es) != 0)
+          return es->error->code;
+
+     ExternalSortRun *runs = realloc(es->runs, (es->n_runs + 1)*sizeof(*runs));
+     if (!runs) {
+          external_sort_set_error(es, external_sort_error_memory, __func__);
+          return es->error->code;
+     }
+     es->runs = runs;
+     memset(runs + es->n_runs, 0, sizeof(*runs));
+
+     char *path = external_sort_run_path(es, es->n_runs);
+     if (!path) {
+          external_sort_set_error(es, external_sort_error_memory, __func__);
+          return es->error->code;
+     }
+     FILE *f = fopen(path, "wb");
+     free(path);
+     if (!f) {
+          external_sort_set_error(es, external_sort_error_invalid_path, __func__);
+          external_sort_add_error(es, strerror(errno));
+          return es->error->code;
+     }
+     // from here the file exists and must be removed
+     es->n_runs++;
+
+     int failed = 0;
+     for (size_t i=0; i<es->n_recs && !failed; ++i) {
+          uint64_t size = external_sort_rec_size(es, es->recs[i]);
+          failed =
+               (fwrite(&size, sizeof(size), 1, f) != 1) ||
+               (size > 0 &&
+                fwrite(external_sort_rec_data(es, es->recs[i]), size, 1, f) != 1);
+     }
+     if (fclose(f) != 0)
+          failed = 1;
+     if (failed) {
+          external_sort_set_error(es, external_sort_error_invalid_path, __func__);
+          external_sort_add_error(es, strerror(errno));
+          return es->error->code;
+     }
+     es->buf_used = 0;
+     es->n_recs = 0;
+     return 0;
+}
+
+ExternalSortError
+external_sort_add(ExternalSort *es, const void *data, size_t size) {
+     if (es->state != stream_state_init) {
+          external_sort_set_error(es, external_sort_error_internal, __func__);
+          external_sort_add_error(es, "adding records after sorting");
+          return es->error->code;
+     }
+
+     size_t cost = (sizeof(size_t) + size + EXTERNAL_SORT_ALIGN - 1) &
+          ~(EXTERNAL_SORT_ALIGN - 1);
+     // each record has also its offset and scratch space for sorting
+     if (es->n_recs > 0 &&
+         es->buf_used + cost + 2*(es->n_recs + 1)*sizeof(size_t) > es->max_memory &&
+         external_sort_flush(es) != 0)
+          return es->error->code;
+
+     if (es->buf_used + cost > es->buf_size) {
+          size_t buf_size = es->buf_size? 2*es->buf_size: 1 << 16;
+          while (buf_size < es->buf_used + cost)
+               buf_size *= 2;
+          char *buf = realloc(es->buf, buf_size);
+          if (!buf) {
+               external_sort_set_error(es, external_sort_error_memory, __func__);
+               return es->error->code;
+          }
+          es->buf = buf;
+          es->buf_size = buf_size;
+     }
+     if (es->n_recs == es->m_recs) {
+          size_t m_recs = es->m_recs? 2*es->m_recs: 1024;
+          size_t *recs = realloc(es->recs, m_recs*sizeof(*recs));
+          if (!recs) {
+               external_sort_set_error(es, external_sort_error_memory, __func__);
+               return es->error->code;
+          }
+          es->recs = recs;
+          es->m_recs = m_recs;
+     }
+
+     *(size_t*)(es->buf + es->buf_used) = size;
+     memcpy(es->buf + es->buf_used + sizeof(size_t), data, size);
+     es->recs[es->n_recs++] = es->buf_used;
+     es->buf_used += cost;
+     es->n_records++;
+     return 0;
+}
+
+/** Read the next record of a run.
+ *
+ * @return 1 if read, 0 if the run has ended, -1 if error
+ */
+static int
+external_sort_run_read(ExternalSortRun *run) {
+     uint64_t size;
+     if (fread(&size, sizeof(size), 1, run->file) != 1)
+          return ferror(run->file)? -1: 0;
+     if (size > run->m_data) {
+          char *data = realloc(run->data, size);
+          if (!data)
+               return -1;
+          run->data = data;
+          run->m_data = size;
+     }
+     if (size > 0 && fread(run->data, size, 1, run->file) != 1)
+          return -1;
+     run->size = size;
+     return 1;
+}
+
+/** Order of the runs inside the heap. Ties are broken by run number, which
+ * keeps the sort stable */
+static int
+external_sort_heap_less(const ExternalSort *es, size_t a, size_t b) {
+     int cmp = es->cmp(es->runs[a].data, es->runs[b].data);
+     return cmp < 0 || (cmp == 0 && a < b);
+}
+
+static void
+external_sort_heap_down(ExternalSort *es, size_t i) {
+     size_t *heap = es->heap;
+     while (1) {
+          size_t min = i;
+          size_t l = 2*i + 1;
+          size_t r = l + 1;
+          if (l < es->n_heap && external_sort_heap_less(es, heap[l], heap[min]))
+               min = l;
+          if (r < es->n_heap && external_sort_heap_less(es, heap[r], heap[min]))
+               min = r;
+          if (min == i)
+               break;
+          size_t tmp = heap[i];
+          heap[i] = heap[min];
+          heap[min] = tmp;
+          i = min;
+     }
+}
+
+static void
+external_sort_heap_up(ExternalSort *es, size_t i) {
+     size_t *heap = es->heap;
+     while (i > 0) {
+          size_t parent = (i - 1)/2;
+          if (!external_sort_heap_less(es, heap[i], heap[parent]))
+               break;
+          size_t tmp = heap[i];
+          heap[i] = heap[parent];
+          heap[parent] = tmp;
+          i = parent;
+     }
+}
+
+/** End the input, and prepare the merge of the runs if there is any */
+static ExternalSortError
+external_sort_start(ExternalSort *es) {
+     if (es->n_runs == 0)
+          return external_sort_sort_memory(es);
+
+     if (es->n_recs > 0 && external_sort_flush(es) != 0)
+          return es->error->code;
+     free(es->buf);
+     free(es->recs);
+     es->buf = 0;
+     es->recs = 0;
+     es->buf_size = es->buf_used = 0;
+     es->m_recs = 0;
+
+     if (!(es->heap = malloc(es->n_runs*sizeof(*es->heap)))) {
+          external_sort_set_error(es, external_sort_error_memory, __func__);
+          return es->error->code;
+     }
+     for (size_t i=0; i<es->n_runs; ++i) {
+          ExternalSortRun *run = es->runs + i;
+          char *path = external_sort_run_path(es, i);
+          if (!path) {
+               external_sort_set_error(es, external_sort_error_memory, __func__);
+               return es->error->code;
+          }
+          run->file = fopen(path, "rb");
+          free(path);
+          if (!run->file) {
+               external_sort_set_error(es, external_sort_error_invalid_path, __func__);
+               external_sort_add_error(es, strerror(errno));
+               return es->error->code;
+          }
+          setvbuf(run->file, 0, _IOFBF, EXTERNAL_SORT_FILE_BUFFER);
+
+          switch (external_sort_run_read(run)) {
+          case 1:
+               es->heap[es->n_heap++] = i;
+               external_sort_heap_up(es, es->n_heap - 1);
+               break;
+          case 0:
+               break;
+          default:
+               external_sort_set_error(es, external_sort_error_invalid_path, __func__);
+               external_sort_add_error(es, "reading run");
+               return es->error->code;
+          }
+     }
+     return 0;
+}
+
+StreamState
+external_sort_next(ExternalSort *es, const void **data, size_t *size) {
+     switch (es->state) {
+     case stream_state_init:
+          if (external_sort_start(es) != 0)
+               return es->state = stream_state_error;
+          break;
+     case stream_state_next:
+          // replace the record returned last by the next one of its run
+          if (es->n_runs > 0) {
+               switch (external_sort_run_read(es->runs + es->top)) {
+               case 1:
+                    break;
+               case 0:
+                    es->heap[0] = es->heap[--es->n_heap];
+                    break;
+               default:
+                    external_sort_set_error(es, external_sort_error_invalid_path, __func__);
+                    external_sort_add_error(es, "reading run");
+                    return es->state = stream_state_error;
+               }
+               external_sort_heap_down(es, 0);
+          }
+          break;
+     default:
+          return es->state;
+     }
+
+     if (es->n_runs == 0) {
+          if (es->i_rec >= es->n_recs)
+               return es->state = stream_state_end;
+          size_t offset = es->recs[es->i_rec++];
+          *data = external_sort_rec_data(es, offset);
+          *size = external_sort_rec_size(es, offset);
+     } else {
+          if (es->n_heap == 0)
+               return es->state = stream_state_end;
+          es->top = es->heap[0];
+          *data = es->runs[es->top].data;
+          *size = es->runs[es->top].size;
+     }
+     return es->state = stream_state_next;
+}
+
+ExternalSortError
+external_sort_delete(ExternalSort *es) {
+     if (!es)
+          return 0;
+
+     int failed = 0;
+     for (size_t i=0; i<es->n_runs; ++i) {
+          if (es->runs[i].file)
+               fclose(es->runs[i].file);
+          free(es->runs[i].data);
+          char *path = external_sort_run_path(es, i);
+          if (!path || remove(path) != 0)
+               failed = 1;
+          free(path);
+     }
+     free(es->runs);
+     free(es->heap);
+     free(es->buf);
+     free(es->recs);
+     free(es->path);
+     error_delete(es->error);
+     free(es);
+
+     return failed? external_sort_error_invalid_path: 0;
+}
+
+#if (defined TEST) && TEST
+#include "test_external_sort.c"
+#endif
@@ -0,0 +1,118 @@
+#ifndef __EXTERNAL_SORT_H__
+#define __EXTERNAL_SORT_H__
+
+#define _POSIX_C_SOURCE 200809L
+#define _BSD_SOURCE 1
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "util.h"
+
+/// @addtogroup ExternalSort
+/// @{
+
+/** Default value for @ref ExternalSort::max_memory */
+#define EXTERNAL_SORT_DEFAULT_MAX_MEMORY (256*1024*1024)
+
+/** Compare two records, with the same convention as the comparison
+ * functions of qsort */
+typedef int (ExternalSortCmpFunc)(const void *a, const void *b);
+
+typedef enum {
+     external_sort_error_ok = 0,       /**< No error */
+     external_sort_error_memory,       /**< Error allocating memory */
+     external_sort_error_invalid_path, /**< File system error */
+     external_sort_error_internal      /**< Unexpected error */
+} ExternalSortError;
+
+/** A run of records already sorted, stored inside a temporary file */
+typedef struct {
+     FILE *file;
+     char *data;     /**< Current record */
+     size_t size;    /**< Size of the current record */
+     size_t m_data;  /**< Allocated size of data */
+} ExternalSortRun;
+
+/** Sort more records than fit in memory.
+ *
+ * Records of arbitrary size are accumulated in memory until
+ * @ref ExternalSort::max_memory is reached, then sorted and written to a
+ * temporary file. When all records have been added the files are merged.
+ * If all the records fit in memory no file is written.
+ *
+ * The sort is stable: records that compare equal come out in the same order
+ * they were added.
+ */
+typedef struct {
+     char *path;                  /**< Prefix of the temporary files */
+     ExternalSortCmpFunc *cmp;
+
+     char *buf;                   /**< Records in memory, each one after its size */
+     size_t buf_used;
+     size_t buf_size;
+     size_t *recs;                /**< Offsets of the records inside buf */
+     size_t n_recs;
+     size_t m_recs;
+     size_t i_rec;                /**< Next record returned when not merging files */
+
+     ExternalSortRun *runs;
+     size_t n_runs;
+     size_t *heap;                /**< Runs ordered by their current record */
+     size_t n_heap;
+     size_t top;                  /**< Run whose record was returned last */
+
+     size_t n_records;            /**< Total number of records added */
+     StreamState state;           /**< Init while adding records */
+
+     Error *error;
+// Options
+// -----------------------------------------------------------------------------
+     /** Memory used to hold records, in bytes. Once exceeded the records are
+      * written to a new temporary file. */
+     size_t max_memory;
+} ExternalSort;
+
+/** Create a new sort.
+ *
+ * @param es The new sort. NULL if memory error.
+ * @param path Temporary files are created as path.0, path.1, ...
+ * @param cmp Order of the records
+ * @param max_memory If 0 @ref EXTERNAL_SORT_DEFAULT_MAX_MEMORY is used
+ *
+ * @return 0 if success, otherwise the error code
+ */
+ExternalSortError
+external_sort_new(ExternalSort **es,
+                  const char *path,
+                  ExternalSortCmpFunc *cmp,
+                  size_t max_memory);
+
+/** Add a copy of the record. It is not possible after the first call to
+ * @ref external_sort_next */
+ExternalSortError
+external_sort_add(ExternalSort *es, const void *data, size_t size);
+
+/** Get the next record in order.
+ *
+ * The first call marks the end of the input. The record is valid until the
+ * next call.
+ */
+StreamState
+external_sort_next(ExternalSort *es, const void **data, size_t *size);
+
+/** Free memory and remove the temporary files */
+ExternalSortError
+external_sort_delete(ExternalSort *es);
+
+/// @}
+
+#if (defined TEST) && TEST
+#include "CuTest.h"
+CuSuite *
+test_external_sort_suite(void);
+#endif
+
+#endif // __EXTERNAL_SORT_H__
@@ -3,42 +3,97 @@
 #include "freq_scheduler.h"
 #include "mmap_array.h"
 
+/** Number of hash ranges scanned in parallel by @ref freq_algo_simple */
+#define FREQ_ALGO_SCAN_PARTITIONS 64
+
+/** Frequencies found inside a range of hashes */
+typedef struct {
+     PageFreq *freqs;
+     size_t n_freqs;
+     size_t m_freqs;
+} FreqAlgoPartition;
+
+typedef struct {
+     PageDB *db;
+     FreqAlgoPartition *partitions;
+} FreqAlgoScan;
+
+static int
+freq_algo_simple_scan(void *state, size_t partition, uint64_t first, uint64_t last) {
+     FreqAlgoScan *scan = state;
+     FreqAlgoPartition *p = scan->partitions + partition;
+
+     HashInfoStream *st;
+     if (hashinfo_stream_new_range(&st, scan->db, first, last) != 0)
+          return -1;
+
+     StreamState ss;
+     uint64_t hash;
+     PageInfoView view;
+     while ((ss = hashinfo_stream_next_view(st, &hash, &view)) == stream_state_next) {
+          if (view.n_crawls >= 2) {
+               if (p->n_freqs == p->m_freqs) {
+                    size_t m = p->m_freqs? 2*p->m_freqs: 1024;
+                    PageFreq *freqs = realloc(p->freqs, m*sizeof(*freqs));
+                    if (!freqs) {
+                         ss = stream_state_error;
+                         break;
+                    }
+                    p->freqs = freqs;
+                    p->m_freqs = m;
+               }
+               p->freqs[p->n_freqs].hash = hash;
+               p->freqs[p->n_freqs].freq = page_info_view_rate(&view);
+               p->n_freqs++;
+          }
+     }
+     hashinfo_stream_delete(st);
+     return ss == stream_state_end? 0: -1;
+}
+
 int
 freq_algo_simple(PageDB *db, MMapArray **freqs, const char *path, char **error_msg) {
-#define ERROR(msg) do {*error_msg = strdup(msg); return -1;} while (0)
+#define ERROR(msg) do {*error_msg = strdup(msg); goto on_error;} while (0)
      *error_msg = 0;
 
+     FreqAlgoScan scan = {
+          .db = db,
+          .partitions = calloc(FREQ_ALGO_SCAN_PARTITIONS, sizeof(FreqAlgoPartition))
+     };
+     if (!scan.partitions)
+          ERROR("memory");
+
      if (mmap_array_new(freqs, path, 1, sizeof(PageFreq)) != 0)
-          ERROR(*freqs? strdup((*freqs)->error->message): "memory");
+          ERROR(*freqs? (*freqs)->error->message: "memory");
      MMapArray *pfreqs = *freqs;
 
-     HashInfoStream *st;
-     if (hashinfo_stream_new(&st, db) != 0)
-          ERROR(st? strdup(db->error->message): "memory");
+     // the partitions are scanned in parallel and then concatenated, which
+     // keeps the pages in hash order
+     if (page_db_scan(db,
+                      FREQ_ALGO_SCAN_PARTITIONS,
+                      0,
+                      freq_algo_simple_scan,
+                      &scan) != 0)
+          ERROR("stream error");
 
-     StreamState ss;
-     uint64_t hash;
-     PageInfo *pi;
      size_t n_pages = 0;
-     while ((ss = hashinfo_stream_next(st, &hash, &pi)) == stream_state_next) {
-          if (pi->n_crawls >= 2) {
-               PageFreq pf = {
-                    .hash = hash,
-                    .freq = page_info_rate(pi)
-               };
+     for (size_t i=0; i<FREQ_ALGO_SCAN_PARTITIONS; ++i) {
+          FreqAlgoPartition *p = scan.partitions + i;
+          for (size_t j=0; j<p->n_freqs; ++j) {
                if ((++n_pages >= pfreqs->n_elements) &&
                    (mmap_array_resize(pfreqs, 2*pfreqs->n_elements) != 0))
                     ERROR(pfreqs->error->message);
 
-               if (mmap_array_set(pfreqs, n_pages - 1, &pf) != 0)
+               if (mmap_array_set(pfreqs, n_pages - 1, p->freqs + j) != 0)
                     ERROR(pfreqs->error->message);
           }
-          page_info_delete(pi);
      }
-     if (ss != stream_state_end)
-          ERROR("stream error");
-
-     hashinfo_stream_delete(st);
 
-     return 0;
+on_error:
+     if (scan.partitions)
+          for (size_t i=0; i<FREQ_ALGO_SCAN_PARTITIONS; ++i)
+               free(scan.partitions[i].freqs);
+     free(scan.partitions);
+     return *error_msg? -1: 0;
+#undef ERROR
 }
@@ -45,6 +45,7 @@ freq_scheduler_new(FreqScheduler **sch, PageDB *db, const char *path) {
      }
 
      p->page_db = db;
+     page_db_reader_init(&p->page_db_reader, db);
      p->persist = FREQ_SCHEDULER_DEFAULT_PERSIST;
      p->margin = -1.0; // disabled
      p->max_n_crawls = 0;
@@ -78,7 +79,7 @@ freq_scheduler_new(FreqScheduler **sch, PageDB *db, const char *path) {
      else if ((rc = mdb_env_set_mapsize(p->txn_manager->env,
                                         FREQ_SCHEDULER_DEFAULT_SIZE)) != 0)
           error = "setting map size";
-     else if ((rc = mdb_env_set_maxdbs(p->txn_manager->env, 1)) != 0)
+     else if ((rc = mdb_env_set_maxdbs(p->txn_manager->env, FREQ_SCHEDULER_MAX_DBS)) != 0)
           error = "setting number of databases";
      else if ((rc = mdb_env_open(
                     p->txn_manager->env,
@@ -204,16 +205,16 @@ freq_scheduler_load_simple(FreqScheduler *sch,
 
      StreamState ss;
      uint64_t hash;
-     PageInfo *pi;
+     PageInfoView view;
 
-     while ((ss = hashinfo_stream_next(st, &hash, &pi)) == stream_state_next) {
-          if ((pi->n_crawls > 0) &&
-	      ((sch->max_n_crawls == 0) || (pi->n_crawls < sch->max_n_crawls)) &&
-	      !page_info_is_seed(pi)){
+     while ((ss = hashinfo_stream_next_view(st, &hash, &view)) == stream_state_next) {
+          if ((view.n_crawls > 0) &&
+	      ((sch->max_n_crawls == 0) || (view.n_crawls < sch->max_n_crawls)) &&
+	      !page_info_view_is_seed(&view)){
 
                float freq = freq_default;
                if (freq_scale > 0) {
-                    float rate = page_info_rate(pi);
+                    float rate = page_info_view_rate(&view);
                     if (rate > 0) {
                          freq = freq_scale * rate;
                     }
@@ -221,7 +222,6 @@ freq_scheduler_load_simple(FreqScheduler *sch,
 	       if (freq_scheduler_cursor_write(sch, cursor, hash, freq) != 0)
 		    goto on_error;
           }
-          page_info_delete(pi);
      }
      if (ss != stream_state_end) {
           error1 = "incorrect stream state";
@@ -299,6 +299,36 @@ on_error:
      return sch->error->code;
 }
 
+/** Number of schedule entries whose pages are retrieved together */
+#define FREQ_SCHEDULER_REQUEST_BATCH 256
+
+static int
+freq_scheduler_hash_cmp(const void *a, const void *b) {
+     uint64_t ha = *(const uint64_t*)a;
+     uint64_t hb = *(const uint64_t*)b;
+     return ha < hb? -1: ha > hb;
+}
+
+/** Read ahead the hashes of the first entries of the schedule, sorted.
+ *
+ * @return 0 if success, otherwise an LMDB error code
+ */
+static int
+freq_scheduler_read_ahead(MDB_cursor *cursor, uint64_t *hashes, size_t *n) {
+     MDB_val key;
+     MDB_val val;
+     int mdb_rc;
+     MDB_cursor_op op = MDB_FIRST;
+     *n = 0;
+     while (*n < FREQ_SCHEDULER_REQUEST_BATCH &&
+            (mdb_rc = mdb_cursor_get(cursor, &key, &val, op)) == 0) {
+          hashes[(*n)++] = ((ScheduleKey*)key.mv_data)->hash;
+          op = MDB_NEXT;
+     }
+     qsort(hashes, *n, sizeof(*hashes), freq_scheduler_hash_cmp);
+     return *n < FREQ_SCHEDULER_REQUEST_BATCH && mdb_rc != MDB_NOTFOUND? mdb_rc: 0;
+}
+
 FreqSchedulerError
 freq_scheduler_request(FreqScheduler *sch,
                        size_t max_requests,
@@ -307,10 +337,26 @@ freq_scheduler_request(FreqScheduler *sch,
      char *error2 = 0;
 
      MDB_cursor *cursor = 0;
+     PageDBReader *reader = &sch->page_db_reader;
+     char *url = 0;
+     size_t url_size = 0;
+
+     // pages of the entries at the head of the schedule, retrieved together.
+     // Entries moved back inside the schedule keep their page.
+     uint64_t hashes[FREQ_SCHEDULER_REQUEST_BATCH];
+     PageInfoView views[FREQ_SCHEDULER_REQUEST_BATCH];
+     char found[FREQ_SCHEDULER_REQUEST_BATCH];
+     size_t n_hashes = 0;
 
      if (freq_scheduler_cursor_open(sch, &cursor) != 0)
 	  goto on_error;
 
+     if (page_db_reader_begin(reader) != 0) {
+          error1 = "beginning PageDB read transaction";
+          error2 = sch->page_db->error->message;
+          goto on_error;
+     }
+
      PageRequest *req = *request = page_request_new(max_requests);
      if (!req) {
           error1 = "allocating memory";
@@ -332,22 +378,39 @@ freq_scheduler_request(FreqScheduler *sch,
                sk = *(ScheduleKey*)key.mv_data;
                freq = *(float*)val.mv_data;
 
-
-               PageInfo *pi = 0;
-               if (page_db_get_info(sch->page_db, sk.hash, &pi) != 0) {
-                    error1 = "retrieving PageInfo from PageDB";
-                    error2 = sch->page_db->error->message;
-                    goto on_error;
+               uint64_t *pos = bsearch(&sk.hash, hashes, n_hashes, sizeof(*hashes),
+                                       freq_scheduler_hash_cmp);
+               if (!pos) {
+                    if ((mdb_rc = freq_scheduler_read_ahead(cursor, hashes, &n_hashes)) != 0) {
+                         error1 = "reading schedule";
+                         error2 = mdb_strerror(mdb_rc);
+                         goto on_error;
+                    }
+                    if (page_db_reader_get_view_many(
+                             reader, hashes, n_hashes, views, found) != 0) {
+                         error1 = "retrieving PageInfo from PageDB";
+                         error2 = sch->page_db->error->message;
+                         goto on_error;
+                    }
+                    // back to the head of the schedule
+                    if ((mdb_rc = mdb_cursor_get(cursor, &key, &val, MDB_FIRST)) != 0) {
+                         error1 = "getting head of schedule";
+                         error2 = mdb_strerror(mdb_rc);
+                         goto on_error;
+                    }
+                    pos = bsearch(&sk.hash, hashes, n_hashes, sizeof(*hashes),
+                                  freq_scheduler_hash_cmp);
                }
-
-               if (pi) {
+               // pages missing from the PageDB are dropped
+               const PageInfoView *view = pos && found[pos - hashes]? views + (pos - hashes): 0;
+               if (view) {
                     if (sch->margin >= 0) {
-                         double elapsed = difftime(time(0), 0) - pi->last_crawl;
+                         double elapsed = difftime(time(0), 0) - view->last_crawl;
                          if (elapsed < 1.0/(freq*(1.0 + sch->margin)))
                               interrupt_requests = 1;
                     }
-		    crawl = (sch->max_n_crawls == 0) || (pi->n_crawls < sch->max_n_crawls);
-	       }
+		    crawl = (sch->max_n_crawls == 0) || (view->n_crawls < sch->max_n_crawls);
+               }
 	       if (!interrupt_requests) {
 		    if ((mdb_rc = mdb_cursor_del(cursor, 0)) != 0) {
 			 error1 = "deleting head of schedule";
@@ -355,7 +418,18 @@ freq_scheduler_request(FreqScheduler *sch,
 			 goto on_error;
 		    }
 		    if (crawl) {
-			 if (page_request_add_url(req, pi->url) != 0) {
+                         size_t size = page_info_view_url_max_size(view);
+                         if (size > url_size) {
+                              char *url_new = realloc(url, size);
+                              if (!url_new) {
+                                   error1 = "allocating memory";
+                                   goto on_error;
+                              }
+                              url = url_new;
+                              url_size = size;
+                         }
+			 if (page_info_view_url(view, url, url_size) < 0 ||
+                             page_request_add_url(req, url) != 0) {
 			      error1 = "adding url to request";
 			      goto on_error;
 			 }
@@ -371,7 +445,6 @@ freq_scheduler_request(FreqScheduler *sch,
 			 }
 		    }
 	       }
-	       page_info_delete(pi);
 
                break;
 
@@ -384,11 +457,16 @@ freq_scheduler_request(FreqScheduler *sch,
                goto on_error;
           }
      }
+     free(url);
+     url = 0;
+     page_db_reader_end(reader);
      if (freq_scheduler_cursor_commit(sch, cursor) != 0)
 	  goto on_error;
 
      return sch->error->code;
 on_error:
+     free(url);
+     page_db_reader_end(reader);
      freq_scheduler_cursor_abort(sch, cursor);
 
      freq_scheduler_set_error(sch, freq_scheduler_error_internal, __func__);
@@ -400,17 +478,59 @@ on_error:
 
 FreqSchedulerError
 freq_scheduler_add(FreqScheduler *sch, const CrawledPage *page) {
-     if (page_db_add(sch->page_db, page, 0) != 0) {
+     return freq_scheduler_add_many(sch, &page, 1);
+}
+
+FreqSchedulerError
+freq_scheduler_add_many(FreqScheduler *sch, const CrawledPage **pages, size_t n) {
+     if (page_db_add_many(sch->page_db, pages, n, 0) != 0) {
           freq_scheduler_set_error(sch, freq_scheduler_error_internal, __func__);
-          freq_scheduler_add_error(sch, "adding crawled page");
+          freq_scheduler_add_error(sch, "adding crawled pages");
           freq_scheduler_add_error(sch, sch->page_db->error->message);
      }
      return sch->error->code;
 }
 
+int
+freq_scheduler_ingest(void *state, const CrawledPage **pages, size_t n) {
+     return freq_scheduler_add_many((FreqScheduler*)state, pages, n);
+}
+
+FreqSchedulerError
+freq_scheduler_compact(FreqScheduler *sch, size_t *bytes_old, size_t *bytes_new) {
+     if (txn_manager_compact(sch->txn_manager,
+                             FREQ_SCHEDULER_MAX_DBS,
+                             bytes_old,
+                             bytes_new) != 0) {
+          freq_scheduler_set_error(sch, freq_scheduler_error_internal, __func__);
+          freq_scheduler_add_error(sch, sch->txn_manager->error->message);
+     }
+     return sch->error->code;
+}
+
+FreqSchedulerError
+freq_scheduler_set_map_size(FreqScheduler *sch, size_t size, size_t growth) {
+     txn_manager_set_growth(sch->txn_manager, growth);
+     if (txn_manager_reserve(sch->txn_manager, size) != 0) {
+          freq_scheduler_set_error(sch, freq_scheduler_error_internal, __func__);
+          freq_scheduler_add_error(sch, sch->txn_manager->error->message);
+     }
+     return sch->error->code;
+}
+
+FreqSchedulerError
+freq_scheduler_set_sync(FreqScheduler *sch, TxnManagerSync sync, double interval) {
+     if (txn_manager_set_sync(sch->txn_manager, sync, interval) != 0) {
+          freq_scheduler_set_error(sch, freq_scheduler_error_internal, __func__);
+          freq_scheduler_add_error(sch, sch->txn_manager->error->message);
+     }
+     return sch->error->code;
+}
+
 void
 freq_scheduler_delete(FreqScheduler *sch) {
-     mdb_env_close(sch->txn_manager->env);
+     page_db_reader_close(&sch->page_db_reader);
+     txn_manager_close_env(sch->txn_manager);
      (void)txn_manager_delete(sch->txn_manager);
      if (!sch->persist) {
           char *data = build_path(sch->path, "data.mdb");
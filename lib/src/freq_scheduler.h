@@ -22,6 +22,9 @@ typedef struct {
 /** Size of the mmap to store the schedule */
 #define FREQ_SCHEDULER_DEFAULT_SIZE PAGE_DB_DEFAULT_SIZE
 
+/** Number of named databases inside the environment */
+#define FREQ_SCHEDULER_MAX_DBS 1
+
 /** Don't persist by default */
 #define FREQ_SCHEDULER_DEFAULT_PERSIST 0
 
@@ -35,6 +38,9 @@ typedef enum {
 typedef struct {
      char *path;              /**< Path to the LMDB environment */
      PageDB *page_db;         /**< Associated PageDB */
+     /** Retrieves the pages of the schedule entries examined by requests.
+         Used while the schedule write transaction is held */
+     PageDBReader page_db_reader;
      TxnManager *txn_manager; /**< Transcation manager */
 
      Error *error;
@@ -112,6 +118,51 @@ freq_scheduler_request(FreqScheduler *sch,
 FreqSchedulerError
 freq_scheduler_add(FreqScheduler *sch, const CrawledPage *page);
 
+/** Add several crawled pages inside a single transaction
+ *
+ * See @ref page_db_add_many
+ *
+ * @return 0 if success, otherwise the error code
+ */
+FreqSchedulerError
+freq_scheduler_add_many(FreqScheduler *sch, const CrawledPage **pages, size_t n);
+
+/** Same as @ref freq_scheduler_add_many.
+ *
+ * Its signature complies with @ref IngestQueueAddFunc, with state being the
+ * @ref FreqScheduler.
+ */
+int
+freq_scheduler_ingest(void *state, const CrawledPage **pages, size_t n);
+
+/** Reclaim the free space left in the schedule file by popped entries.
+ *
+ * See @ref txn_manager_compact. Writes to the schedule wait until the
+ * compaction finishes.
+ *
+ * @param sch
+ * @param bytes_old If not NULL, size of the schedule file before compaction
+ * @param bytes_new If not NULL, size of the schedule file after compaction
+ *
+ * @return 0 if success, otherwise the error code
+ */
+FreqSchedulerError
+freq_scheduler_compact(FreqScheduler *sch, size_t *bytes_old, size_t *bytes_new);
+
+/** Reserve the memory map of the schedule and set how it grows.
+ *
+ * See @ref page_db_set_map_size
+ */
+FreqSchedulerError
+freq_scheduler_set_map_size(FreqScheduler *sch, size_t size, size_t growth);
+
+/** Set when the writes to the schedule are made durable.
+ *
+ * See @ref page_db_set_sync
+ */
+FreqSchedulerError
+freq_scheduler_set_sync(FreqScheduler *sch, TxnManagerSync sync, double interval);
+
 /** Delete scheduler.
  *
  * It may or may not delete associated disk files depending on the
@@ -7,6 +7,7 @@
 #include "hits.h"
 #include "hits_scorer.h"
 #include "page_db.h"
+#include "link_graph.h"
 #include "util.h"
 
 static void
@@ -34,6 +35,7 @@ hits_scorer_new(HitsScorer **hs, PageDB *db) {
      p->use_content_scores = HITS_SCORER_USE_CONTENT_SCORES;
 
      p->page_db = db;
+     p->link_graph = 0;
      if (hits_new(&p->hits, db->path, 1000) != 0) {
           hits_scorer_set_error(p, hits_scorer_error_internal, __func__);
           hits_scorer_add_error(p, "initializing HITS");
@@ -41,6 +43,17 @@ hits_scorer_new(HitsScorer **hs, PageDB *db) {
           return p->error->code;
      }
 
+     char *path = build_path(db->path, "hits_links");
+     if (!path || link_graph_new(&p->link_graph, path) != 0) {
+          hits_scorer_set_error(p, hits_scorer_error_internal, __func__);
+          hits_scorer_add_error(p, "initializing link graph");
+          hits_scorer_add_error(p, path && p->link_graph?
+                                p->link_graph->error->message: "NULL");
+          free(path);
+          return p->error->code;
+     }
+     free(path);
+
      return 0;
 }
 
@@ -51,10 +64,18 @@ hits_scorer_update(void *state) {
      char *error1 = 0;
      char *error2 = 0;
 
-     PageDBLinkStream *st = 0;
-     if (page_db_link_stream_new(&st, hs->page_db) != 0) {
+     // decode the links database once instead of once per iteration
+     LinkGraphStream *st = 0;
+     if (link_graph_update(hs->link_graph,
+                           hs->page_db,
+                           PAGE_DB_LINK_STREAM_DEFAULT_ONLY_DIFF_DOMAIN) != 0) {
+          error1 = "updating link graph";
+          error2 = hs->link_graph->error->message;
+          goto on_error;
+     }
+     if (link_graph_stream_new(&st, hs->link_graph) != 0) {
           error1 = "creating link stream";
-          error2 = st? "unknown": "NULL";
+          error2 = "NULL";
           goto on_error;
      }
 
@@ -67,8 +88,8 @@ hits_scorer_update(void *state) {
 
      HitsError herr = hits_compute(hs->hits,
                                    st,
-                                   page_db_link_stream_next,
-                                   page_db_link_stream_reset);
+                                   link_graph_stream_next,
+                                   link_graph_stream_reset);
 
      // Inside a page scorer we allow some lack of precision
      // TODO Give some warning?
@@ -88,10 +109,10 @@ hits_scorer_update(void *state) {
           goto on_error;
      }
 
-     page_db_link_stream_delete(st);
+     link_graph_stream_delete(st);
      return 0;
 on_error:
-     page_db_link_stream_delete(st);
+     link_graph_stream_delete(st);
 
      hits_scorer_set_error(hs,  hits_scorer_error_internal, __func__);
      hits_scorer_add_error(hs, error1);
@@ -121,6 +142,12 @@ hits_scorer_delete(HitsScorer *hs) {
                                 : "unknown error");
           return hs->error->code;
      }
+     if (link_graph_delete(hs->link_graph) != 0) {
+          hits_scorer_set_error(hs,  hits_scorer_error_internal, __func__);
+          hits_scorer_add_error(hs, "deleting link graph");
+          hits_scorer_add_error(hs, hs->link_graph->error->message);
+          return hs->error->code;
+     }
      error_delete(hs->error);
      free(hs);
      return 0;
@@ -138,6 +165,7 @@ void
 hits_scorer_set_persist(HitsScorer *hs, int value) {
      hs->persist = value;
      hits_set_persist(hs->hits, value);
+     link_graph_set_persist(hs->link_graph, value);
 }
 
 void
@@ -3,6 +3,7 @@
 
 #include "hits.h"
 #include "page_db.h"
+#include "link_graph.h"
 #include "scorer.h"
 #include "util.h"
 
@@ -30,6 +31,8 @@ typedef struct {
      Hits *hits;
      /** Database with crawl information */
      PageDB *page_db;
+     /** Snapshot of the links, rebuilt on each update */
+     LinkGraph *link_graph;
 
      /** Error status */
      Error *error;
@@ -0,0 +1,233 @@
+#define _POSIX_C_SOURCE 200809L
+#define _BSD_SOURCE 1
+#define _GNU_SOURCE 1
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ingest_queue.h"
+#include "page_db.h"
+#include "util.h"
+
+static void
+ingest_queue_set_error(IngestQueue *q, int code, const char *message) {
+     error_set(q->error, code, message);
+}
+
+static void
+ingest_queue_add_error(IngestQueue *q, const char *message) {
+     error_add(q->error, message);
+}
+
+/** Absolute time max_delay milliseconds from now, for pthread_cond_timedwait */
+static void
+ingest_queue_deadline(long max_delay, struct timespec *deadline) {
+     clock_gettime(CLOCK_REALTIME, deadline);
+     deadline->tv_sec += max_delay / 1000;
+     deadline->tv_nsec += (max_delay % 1000)*1000000L;
+     if (deadline->tv_nsec >= 1000000000L) {
+          deadline->tv_sec++;
+          deadline->tv_nsec -= 1000000000L;
+     }
+}
+
+static void *
+ingest_queue_writer(void *arg) {
+     IngestQueue *q = arg;
+
+     pthread_mutex_lock(&q->mtx);
+     while (1) {
+          while (q->n_pushed == q->n_taken && !q->stop)
+               pthread_cond_wait(&q->not_empty, &q->mtx);
+          if (q->n_pushed == q->n_taken)
+               break;
+
+          // Wait a little to fill the batch, unless someone is waiting for
+          // the pages to be written
+          struct timespec deadline;
+          ingest_queue_deadline(q->max_delay, &deadline);
+          while (q->n_pushed - q->n_taken < q->batch_size &&
+                 q->n_flush <= q->n_done &&
+                 !q->stop) {
+               if (pthread_cond_timedwait(&q->not_empty, &q->mtx, &deadline) == ETIMEDOUT)
+                    break;
+          }
+
+          size_t n = q->n_pushed - q->n_taken;
+          if (n > q->batch_size)
+               n = q->batch_size;
+          for (size_t i=0; i<n; ++i)
+               q->batch[i] = q->ring[(q->n_taken + i) % q->capacity];
+          q->n_taken += n;
+          int failed = q->error->code != 0;
+          pthread_cond_broadcast(&q->not_full);
+          pthread_mutex_unlock(&q->mtx);
+
+          // After an error pages are discarded, so that nobody blocks forever
+          int rc = 0;
+          if (!failed)
+               rc = q->add(q->state, (const CrawledPage**)q->batch, n);
+          for (size_t i=0; i<n; ++i)
+               crawled_page_delete(q->batch[i]);
+
+          pthread_mutex_lock(&q->mtx);
+          if (rc != 0) {
+               ingest_queue_set_error(q, ingest_queue_error_internal, __func__);
+               ingest_queue_add_error(q, "adding batch of pages");
+          }
+          q->n_done += n;
+          q->n_batches++;
+          pthread_cond_broadcast(&q->done);
+     }
+     pthread_mutex_unlock(&q->mtx);
+     return 0;
+}
+
+IngestQueueError
+ingest_queue_new(IngestQueue **q,
+                 void *state,
+                 IngestQueueAddFunc *add,
+                 size_t capacity) {
+     IngestQueue *p = *q = calloc(1, sizeof(*p));
+     if (!p)
+          return ingest_queue_error_memory;
+
+     if (capacity == 0)
+          capacity = INGEST_QUEUE_DEFAULT_CAPACITY;
+
+     p->capacity = capacity;
+     p->state = state;
+     p->add = add;
+     p->batch_size = INGEST_QUEUE_DEFAULT_BATCH_SIZE < capacity?
+          INGEST_QUEUE_DEFAULT_BATCH_SIZE: capacity;
+     p->max_delay = INGEST_QUEUE_DEFAULT_MAX_DELAY;
+
+     if (!(p->error = error_new()) ||
+         !(p->ring = calloc(capacity, sizeof(*p->ring))) ||
+         !(p->batch = calloc(capacity, sizeof(*p->batch)))) {
+          free(p->ring);
+          free(p->batch);
+          error_delete(p->error);
+          free(p);
+          *q = 0;
+          return ingest_queue_error_memory;
+     }
+
+     int rc = 0;
+     char *error = 0;
+     if ((rc = pthread_mutex_init(&p->mtx, 0)) != 0)
+          error = "initializing mutex";
+     else if ((rc = pthread_cond_init(&p->not_full, 0)) != 0)
+          error = "initializing not_full condition";
+     else if ((rc = pthread_cond_init(&p->not_empty, 0)) != 0)
+          error = "initializing not_empty condition";
+     else if ((rc = pthread_cond_init(&p->done, 0)) != 0)
+          error = "initializing done condition";
+     else if ((rc = pthread_create(&p->thread, 0, ingest_queue_writer, p)) != 0)
+          error = "starting writer thread";
+     else
+          p->running = 1;
+
+     if (error) {
+          ingest_queue_set_error(p, ingest_queue_error_thread, __func__);
+          ingest_queue_add_error(p, error);
+          ingest_queue_add_error(p, strerror(rc));
+     }
+     return p->error->code;
+}
+
+IngestQueueError
+ingest_queue_push(IngestQueue *q, CrawledPage *page) {
+     pthread_mutex_lock(&q->mtx);
+     while (q->n_pushed - q->n_taken == q->capacity && q->error->code == 0)
+          pthread_cond_wait(&q->not_full, &q->mtx);
+
+     int code = q->error->code;
+     if (code == 0) {
+          q->ring[q->n_pushed % q->capacity] = page;
+          q->n_pushed++;
+          pthread_cond_signal(&q->not_empty);
+     }
+     pthread_mutex_unlock(&q->mtx);
+
+     if (code != 0)
+          crawled_page_delete(page);
+     return code;
+}
+
+IngestQueueError
+ingest_queue_flush(IngestQueue *q) {
+     pthread_mutex_lock(&q->mtx);
+     if (q->running) {
+          size_t target = q->n_pushed;
+          if (q->n_flush < target)
+               q->n_flush = target;
+          pthread_cond_signal(&q->not_empty);
+          while (q->n_done < target)
+               pthread_cond_wait(&q->done, &q->mtx);
+     }
+     int code = q->error->code;
+     pthread_mutex_unlock(&q->mtx);
+     return code;
+}
+
+IngestQueueError
+ingest_queue_delete(IngestQueue *q) {
+     if (!q)
+          return 0;
+
+     int code = 0;
+     if (q->running) {
+          pthread_mutex_lock(&q->mtx);
+          q->stop = 1;
+          pthread_cond_signal(&q->not_empty);
+          pthread_mutex_unlock(&q->mtx);
+
+          int rc = 0;
+          if ((rc = pthread_join(q->thread, 0)) != 0) {
+               ingest_queue_set_error(q, ingest_queue_error_thread, __func__);
+               ingest_queue_add_error(q, "joining with writer thread");
+               ingest_queue_add_error(q, strerror(rc));
+          }
+          pthread_mutex_destroy(&q->mtx);
+          pthread_cond_destroy(&q->not_full);
+          pthread_cond_destroy(&q->not_empty);
+          pthread_cond_destroy(&q->done);
+     }
+     code = q->error->code;
+
+     free(q->ring);
+     free(q->batch);
+     error_delete(q->error);
+     free(q);
+
+     return code;
+}
+
+void
+ingest_queue_set_batch_size(IngestQueue *q, size_t value) {
+     if (value == 0)
+          value = 1;
+     if (value > q->capacity)
+          value = q->capacity;
+     pthread_mutex_lock(&q->mtx);
+     q->batch_size = value;
+     pthread_mutex_unlock(&q->mtx);
+}
+
+void
+ingest_queue_set_max_delay(IngestQueue *q, long value) {
+     if (value < 0)
+          value = 0;
+     pthread_mutex_lock(&q->mtx);
+     q->max_delay = value;
+     pthread_mutex_unlock(&q->mtx);
+}
+
+#if (defined TEST) && TEST
+#include "test_ingest_queue.c"
+#endif
@@ -0,0 +1,145 @@
+#ifndef __INGEST_QUEUE_H__
+#define __INGEST_QUEUE_H__
+
+#include <pthread.h>
+
+#include "page_db.h"
+#include "util.h"
+
+/** @addtogroup IngestQueue
+ *
+ * A bounded queue of crawled pages in front of a @ref PageDB (or of a
+ * scheduler).
+ *
+ * Producers hand off pages with @ref ingest_queue_push and return
+ * immediately, without waiting for a write transaction to be commited. A
+ * dedicated writer thread drains the queue and coalesces the pages into a
+ * single transaction every @ref IngestQueue::batch_size pages or every
+ * @ref IngestQueue::max_delay milliseconds, whatever happens first.
+ *
+ * When the queue is full producers block until the writer thread makes
+ * room for new pages.
+ * @{
+ */
+
+/** Add a batch of pages.
+ *
+ * For example @ref page_db_ingest or @ref bf_scheduler_ingest.
+ *
+ * @return 0 if success, otherwise an error code
+ */
+typedef int (IngestQueueAddFunc)(void *state, const CrawledPage **pages, size_t n);
+
+/** Default value for @ref IngestQueue::capacity */
+#define INGEST_QUEUE_DEFAULT_CAPACITY 1024
+/** Default value for @ref IngestQueue::batch_size */
+#define INGEST_QUEUE_DEFAULT_BATCH_SIZE 100
+/** Default value for @ref IngestQueue::max_delay */
+#define INGEST_QUEUE_DEFAULT_MAX_DELAY 100
+
+typedef enum {
+     ingest_queue_error_ok = 0,   /**< No error */
+     ingest_queue_error_memory,   /**< Error allocating memory */
+     ingest_queue_error_internal, /**< Unexpected error, for example the add function failed */
+     ingest_queue_error_thread    /**< Error inside the threading library */
+} IngestQueueError;
+
+typedef struct {
+     /** Ring buffer of pages waiting to be written */
+     CrawledPage **ring;
+     /** Pages being written by the writer thread */
+     CrawledPage **batch;
+     /** Maximum number of pages inside the ring */
+     size_t capacity;
+
+     /** Total number of pages pushed. Position of the next push is
+      * n_pushed % capacity */
+     size_t n_pushed;
+     /** Total number of pages taken by the writer thread. Position of the
+      * next page to write is n_taken % capacity */
+     size_t n_taken;
+     /** Total number of pages already processed by the writer thread */
+     size_t n_done;
+     /** The writer thread will not wait for more pages until n_done reaches
+      * this value */
+     size_t n_flush;
+     /** Number of transactions made by the writer thread */
+     size_t n_batches;
+
+     void *state;              /**< First argument to @ref add */
+     IngestQueueAddFunc *add;  /**< Called by the writer thread with each batch */
+
+     pthread_t thread;
+     pthread_mutex_t mtx;      /**< Protects all the above counters */
+     pthread_cond_t not_full;  /**< Signaled when pages are taken by the writer */
+     pthread_cond_t not_empty; /**< Signaled when pages are pushed */
+     pthread_cond_t done;      /**< Signaled when a batch has been processed */
+     int stop;                 /**< If true the writer thread will exit when the queue is empty */
+     int running;              /**< True if the writer thread was started */
+
+     Error *error;
+// Options
+// -----------------------------------------------------------------------------
+     /** Maximum number of pages inside a single transaction */
+     size_t batch_size;
+     /** Maximum number of milliseconds a page waits for more pages to fill
+      * the batch */
+     long max_delay;
+} IngestQueue;
+
+/** Create a new queue and start the writer thread.
+ *
+ * @param q The new queue. NULL if memory error.
+ * @param state First argument passed to add
+ * @param add Function that will be called by the writer thread with each batch
+ * @param capacity Maximum number of pages inside the queue. If 0 then
+ *                 @ref INGEST_QUEUE_DEFAULT_CAPACITY is used.
+ *
+ * @return 0 if success, otherwise the error code
+ */
+IngestQueueError
+ingest_queue_new(IngestQueue **q,
+                 void *state,
+                 IngestQueueAddFunc *add,
+                 size_t capacity);
+
+/** Add a new page to the queue.
+ *
+ * The queue takes ownership of the page, which will be deleted after it has
+ * been written. If the queue is full this call blocks until there is room for
+ * the page.
+ *
+ * @return 0 if success. If the writer thread failed its error code is
+ *         returned, and the page is deleted without being written.
+ */
+IngestQueueError
+ingest_queue_push(IngestQueue *q, CrawledPage *page);
+
+/** Block until all pages pushed before this call have been written */
+IngestQueueError
+ingest_queue_flush(IngestQueue *q);
+
+/** Flush the queue, stop the writer thread and free memory.
+ *
+ * @return The error code of the writer thread, if any. Memory is freed anyway.
+ */
+IngestQueueError
+ingest_queue_delete(IngestQueue *q);
+
+/** Set @ref IngestQueue::batch_size. It will be capped by the capacity */
+void
+ingest_queue_set_batch_size(IngestQueue *q, size_t value);
+
+/** Set @ref IngestQueue::max_delay in milliseconds */
+void
+ingest_queue_set_max_delay(IngestQueue *q, long value);
+
+/// @}
+
+#if (defined TEST) && TEST
+#include "CuTest.h"
+CuSuite *
+test_ingest_queue_suite(size_t n_pages);
+#endif
+
+#endif // __INGEST_QUEUE_H__
@@ -0,0 +1,535 @@
+#define _POSIX_C_SOURCE 200809L
+#define _BSD_SOURCE 1
+#define _GNU_SOURCE 1
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "link_graph.h"
+#include "mmap_array.h"
+#include "page_db.h"
+#include "util.h"
+
+static void
+link_graph_set_error(LinkGraph *lg, int code, const char *message) {
+     error_set(lg->error, code, message);
+}
+
+static void
+link_graph_add_error(LinkGraph *lg, const char *message) {
+     error_add(lg->error, message);
+}
+
+LinkGraphError
+link_graph_new(LinkGraph **lg, const char *path) {
+     LinkGraph *p = *lg = calloc(1, sizeof(*p));
+     if (!p)
+          return link_graph_error_memory;
+     if (!(p->error = error_new())) {
+          free(p);
+          *lg = 0;
+          return link_graph_error_memory;
+     }
+     p->persist = LINK_GRAPH_DEFAULT_PERSIST;
+     p->merge_ratio = LINK_GRAPH_DEFAULT_MERGE_RATIO;
+     p->target_size = sizeof(uint32_t);
+
+     if (path &&
+         (!(p->path_offsets = concat(path, "offsets.bin", '_')) ||
+          !(p->path_targets = concat(path, "targets.bin", '_')))) {
+          link_graph_set_error(p, link_graph_error_memory, __func__);
+          link_graph_add_error(p, "building file paths");
+     }
+     return p->error->code;
+}
+
+LinkGraphError
+link_graph_delete(LinkGraph *lg) {
+     if (!lg)
+          return 0;
+
+     if (mmap_array_delete(lg->offsets) != 0) {
+          link_graph_set_error(lg, link_graph_error_internal, __func__);
+          link_graph_add_error(lg, "deleting offsets");
+          link_graph_add_error(lg, lg->offsets->error->message);
+          return lg->error->code;
+     }
+     lg->offsets = 0;
+     if (mmap_array_delete(lg->targets) != 0) {
+          link_graph_set_error(lg, link_graph_error_internal, __func__);
+          link_graph_add_error(lg, "deleting targets");
+          link_graph_add_error(lg, lg->targets->error->message);
+          return lg->error->code;
+     }
+     free(lg->delta);
+     free(lg->delta_targets);
+     free(lg->path_offsets);
+     free(lg->path_targets);
+     error_delete(lg->error);
+     free(lg);
+     return 0;
+}
+
+/** Make room for at least n elements, doubling the size of the array */
+static MMapArrayError
+link_graph_reserve(MMapArray *marr, size_t n) {
+     if (n <= marr->n_elements)
+          return 0;
+     size_t m = marr->n_elements;
+     while (m < n)
+          m *= 2;
+     return mmap_array_resize(marr, m);
+}
+
+LinkGraphError
+link_graph_build(LinkGraph *lg, PageDB *db, int only_diff_domain) {
+     char *error1 = 0;
+     char *error2 = 0;
+
+     // drop the previous snapshot before its files are reused
+     if (mmap_array_delete(lg->offsets) != 0) {
+          error1 = "deleting offsets";
+          error2 = lg->offsets->error->message;
+          goto on_error;
+     }
+     lg->offsets = 0;
+     if (mmap_array_delete(lg->targets) != 0) {
+          error1 = "deleting targets";
+          error2 = lg->targets->error->message;
+          goto on_error;
+     }
+     lg->targets = 0;
+     lg->n_pages = lg->n_links = 0;
+     lg->n_delta = lg->n_delta_targets = 0;
+     lg->only_diff_domain = only_diff_domain;
+
+     // before the read transaction, see page_db_link_log_tell
+     page_db_link_log_tell(db, &lg->log_pos);
+
+     PageDBLinkStream *st = 0;
+     if (page_db_link_stream_new(&st, db) != 0) {
+          error1 = "creating link stream";
+          error2 = db->error->message;
+          goto on_error;
+     }
+     st->only_diff_domain = only_diff_domain;
+
+     // the stream has already opened its read transaction, so pages added
+     // from now on can only make this bound larger than necessary
+     pthread_mutex_lock(&db->idx2hash_lock);
+     uint64_t n_idx = (uint64_t)db->n_idx2hash*db->n_shards;
+     pthread_mutex_unlock(&db->idx2hash_lock);
+     lg->target_size = n_idx <= UINT32_MAX? sizeof(uint32_t): sizeof(uint64_t);
+
+     if (mmap_array_new(&lg->offsets, lg->path_offsets, 1024, sizeof(uint64_t)) != 0) {
+          error1 = "creating offsets";
+          error2 = lg->offsets? lg->offsets->error->message: "NULL";
+          lg->offsets = 0;
+          goto on_stream_error;
+     }
+     lg->offsets->persist = lg->persist;
+     if (mmap_array_new(&lg->targets, lg->path_targets, 1024, lg->target_size) != 0) {
+          error1 = "creating targets";
+          error2 = lg->targets? lg->targets->error->message: "NULL";
+          lg->targets = 0;
+          goto on_stream_error;
+     }
+     lg->targets->persist = lg->persist;
+
+     // invariant: offsets[n_pages] == n_links
+     ((uint64_t*)lg->offsets->mem)[0] = 0;
+     size_t n_pages = 0;
+     size_t n_links = 0;
+
+     Link link;
+     StreamState ss;
+     while ((ss = page_db_link_stream_next(st, &link)) == stream_state_next) {
+          const size_t from = link.from;
+          if (from + 1 < n_pages) {
+               error1 = "links database not sorted";
+               goto on_stream_error;
+          }
+          if (lg->target_size == sizeof(uint32_t) && (uint64_t)link.to > UINT32_MAX) {
+               error1 = "link target does not fit inside 32 bits";
+               goto on_stream_error;
+          }
+          if (link_graph_reserve(lg->offsets, from + 2) != 0) {
+               error1 = "resizing offsets";
+               error2 = lg->offsets->error->message;
+               goto on_stream_error;
+          }
+          if (link_graph_reserve(lg->targets, n_links + 1) != 0) {
+               error1 = "resizing targets";
+               error2 = lg->targets->error->message;
+               goto on_stream_error;
+          }
+          uint64_t *offsets = (uint64_t*)lg->offsets->mem;
+          // pages without links between the last source and this one
+          while (n_pages <= from)
+               offsets[++n_pages] = n_links;
+
+          if (lg->target_size == sizeof(uint32_t))
+               ((uint32_t*)lg->targets->mem)[n_links] = link.to;
+          else
+               ((uint64_t*)lg->targets->mem)[n_links] = link.to;
+          offsets[n_pages] = ++n_links;
+     }
+     if (ss != stream_state_end) {
+          error1 = "reading links";
+          error2 = db->error->message;
+          goto on_stream_error;
+     }
+     page_db_link_stream_delete(st);
+
+     // trim the files to the actual size
+     if (mmap_array_resize(lg->offsets, n_pages + 1) != 0) {
+          error1 = "trimming offsets";
+          error2 = lg->offsets->error->message;
+          goto on_error;
+     }
+     if (n_links > 0 && mmap_array_resize(lg->targets, n_links) != 0) {
+          error1 = "trimming targets";
+          error2 = lg->targets->error->message;
+          goto on_error;
+     }
+     lg->n_pages = n_pages;
+     lg->n_links = n_links;
+     return 0;
+
+on_stream_error:
+     page_db_link_stream_delete(st);
+on_error:
+     link_graph_set_error(lg, link_graph_error_internal, __func__);
+     link_graph_add_error(lg, error1);
+     if (error2)
+          link_graph_add_error(lg, error2);
+     return lg->error->code;
+}
+
+static int
+link_graph_row_cmp(const void *a, const void *b) {
+     const LinkGraphRow *r1 = a;
+     const LinkGraphRow *r2 = b;
+     if (r1->from != r2->from)
+          return r1->from < r2->from? -1: 1;
+     return r1->start < r2->start? -1: r1->start > r2->start;
+}
+
+/** Add the link log records to the delta.
+ *
+ * Each record replaces all the links of a page, so only the last row of
+ * each page is kept.
+ */
+static LinkGraphError
+link_graph_delta_add(LinkGraph *lg, const uint64_t *records, size_t n_records) {
+     for (size_t i=0; i<n_records; ) {
+          if (i + 3 > n_records ||
+              records[i + 1] + records[i + 2] > n_records - i - 3) {
+               link_graph_set_error(lg, link_graph_error_internal, __func__);
+               link_graph_add_error(lg, "truncated link log record");
+               return lg->error->code;
+          }
+          const uint64_t from = records[i];
+          const size_t n = records[i + 1] +
+               (lg->only_diff_domain? 0: records[i + 2]);
+          const uint64_t *to = records + i + 3;
+          i += 3 + records[i + 1] + records[i + 2];
+
+          if (lg->n_delta == lg->m_delta) {
+               size_t m = lg->m_delta? 2*lg->m_delta: 1024;
+               LinkGraphRow *delta = realloc(lg->delta, m*sizeof(*delta));
+               if (!delta)
+                    goto on_memory_error;
+               lg->delta = delta;
+               lg->m_delta = m;
+          }
+          if (lg->n_delta_targets + n > lg->m_delta_targets) {
+               size_t m = lg->m_delta_targets? lg->m_delta_targets: 1024;
+               while (m < lg->n_delta_targets + n)
+                    m *= 2;
+               uint64_t *targets = realloc(lg->delta_targets, m*sizeof(*targets));
+               if (!targets)
+                    goto on_memory_error;
+               lg->delta_targets = targets;
+               lg->m_delta_targets = m;
+          }
+          LinkGraphRow *row = lg->delta + lg->n_delta++;
+          row->from = from;
+          row->start = lg->n_delta_targets;
+          row->n = n;
+          if (n > 0)
+               memcpy(lg->delta_targets + row->start, to, n*sizeof(*to));
+          lg->n_delta_targets += n;
+     }
+
+     // newer rows have larger start
+     qsort(lg->delta, lg->n_delta, sizeof(*lg->delta), link_graph_row_cmp);
+     size_t n_delta = 0;
+     for (size_t i=0; i<lg->n_delta; ++i) {
+          if (i + 1 < lg->n_delta && lg->delta[i + 1].from == lg->delta[i].from)
+               continue;
+          lg->delta[n_delta++] = lg->delta[i];
+     }
+     lg->n_delta = n_delta;
+     return 0;
+
+on_memory_error:
+     link_graph_set_error(lg, link_graph_error_memory, __func__);
+     link_graph_add_error(lg, "growing delta");
+     return lg->error->code;
+}
+
+/** Create an array for the next snapshot, next to the current file */
+static MMapArrayError
+link_graph_array_new(MMapArray **marr, const char *path, size_t n, size_t size) {
+     char *path_new = 0;
+     if (path && !(path_new = concat(path, "new", '.'))) {
+          *marr = 0;
+          return mmap_array_error_memory;
+     }
+     MMapArrayError ret = mmap_array_new(marr, path_new, n, size);
+     free(path_new);
+     return ret;
+}
+
+/** Replace an array of the snapshot with the one created by
+ * @ref link_graph_array_new */
+static int
+link_graph_array_replace(MMapArray **marr, MMapArray *marr_new, const char *path) {
+     if (mmap_array_delete(*marr) != 0)
+          return -1;
+     *marr = marr_new;
+     if (path) {
+          char *p = strdup(path);
+          if (!p || rename(marr_new->path, p) != 0) {
+               free(p);
+               return -1;
+          }
+          free(marr_new->path);
+          marr_new->path = p;
+     }
+     return 0;
+}
+
+/** Copy targets [first, first + n) of the snapshot into the array of the next one */
+static void
+link_graph_copy_targets(const LinkGraph *lg,
+                        size_t first,
+                        size_t n,
+                        MMapArray *targets,
+                        size_t target_size,
+                        size_t pos) {
+     if (target_size == lg->target_size)
+          memcpy(targets->mem + pos*target_size,
+                 lg->targets->mem + first*target_size,
+                 n*target_size);
+     else // from 32 to 64 bits
+          for (size_t i=0; i<n; ++i)
+               ((uint64_t*)targets->mem)[pos + i] = link_graph_target(lg, first + i);
+}
+
+/** Build a new snapshot with the delta rows, see @ref link_graph_update */
+static LinkGraphError
+link_graph_merge(LinkGraph *lg) {
+     char *error1 = 0;
+     char *error2 = 0;
+     MMapArray *offsets = 0;
+     MMapArray *targets = 0;
+
+     const uint64_t *old_offsets = (const uint64_t*)lg->offsets->mem;
+     size_t n_pages = lg->n_pages;
+     size_t n_links = lg->n_links;
+     size_t target_size = lg->target_size;
+     for (size_t j=0; j<lg->n_delta; ++j) {
+          const LinkGraphRow *row = lg->delta + j;
+          if (row->from < lg->n_pages)
+               n_links -= old_offsets[row->from + 1] - old_offsets[row->from];
+          else
+               n_pages = row->from + 1;
+          n_links += row->n;
+          for (size_t k=0; k<row->n; ++k)
+               if (lg->delta_targets[row->start + k] > UINT32_MAX)
+                    target_size = sizeof(uint64_t);
+     }
+
+     if (link_graph_array_new(&offsets, lg->path_offsets, n_pages + 1, sizeof(uint64_t)) != 0) {
+          error1 = "creating offsets";
+          error2 = offsets? offsets->error->message: "NULL";
+          offsets = 0;
+          goto on_error;
+     }
+     offsets->persist = lg->persist;
+     if (link_graph_array_new(&targets, lg->path_targets, n_links > 0? n_links: 1, target_size) != 0) {
+          error1 = "creating targets";
+          error2 = targets? targets->error->message: "NULL";
+          targets = 0;
+          goto on_error;
+     }
+     targets->persist = lg->persist;
+
+     uint64_t *new_offsets = (uint64_t*)offsets->mem;
+     new_offsets[0] = 0;
+     size_t from = 0;
+     size_t t = 0;
+     for (size_t j=0; j<=lg->n_delta; ++j) {
+          const LinkGraphRow *row = j < lg->n_delta? lg->delta + j: 0;
+          const size_t end = row? row->from: n_pages;
+          // untouched rows of the snapshot, their links are contiguous
+          const size_t end_old = end < lg->n_pages? end: lg->n_pages;
+          if (from < end_old) {
+               const uint64_t first = old_offsets[from];
+               link_graph_copy_targets(lg,
+                                       first,
+                                       old_offsets[end_old] - first,
+                                       targets,
+                                       target_size,
+                                       t);
+               for (; from < end_old; ++from)
+                    new_offsets[from + 1] = old_offsets[from + 1] - first + t;
+               t = new_offsets[from];
+          }
+          // pages past the snapshot without links
+          for (; from < end; ++from)
+               new_offsets[from + 1] = t;
+          if (row) {
+               for (size_t k=0; k<row->n; ++k, ++t)
+                    if (target_size == sizeof(uint32_t))
+                         ((uint32_t*)targets->mem)[t] = lg->delta_targets[row->start + k];
+                    else
+                         ((uint64_t*)targets->mem)[t] = lg->delta_targets[row->start + k];
+               new_offsets[++from] = t;
+          }
+     }
+
+     if (link_graph_array_replace(&lg->offsets, offsets, lg->path_offsets) != 0) {
+          error1 = "replacing offsets";
+          mmap_array_delete(lg->targets);
+          lg->offsets = lg->targets = 0;
+          lg->n_pages = lg->n_links = lg->n_delta = lg->n_delta_targets = 0;
+          goto on_error;
+     }
+     offsets = 0;
+     if (link_graph_array_replace(&lg->targets, targets, lg->path_targets) != 0) {
+          error1 = "replacing targets";
+          // the next update will build the graph again
+          mmap_array_delete(lg->offsets);
+          lg->offsets = lg->targets = 0;
+          lg->n_pages = lg->n_links = lg->n_delta = lg->n_delta_targets = 0;
+          goto on_error;
+     }
+     lg->n_pages = n_pages;
+     lg->n_links = n_links;
+     lg->target_size = target_size;
+     lg->n_delta = lg->n_delta_targets = 0;
+     return 0;
+
+on_error:
+     mmap_array_delete(offsets);
+     mmap_array_delete(targets);
+     link_graph_set_error(lg, link_graph_error_internal, __func__);
+     link_graph_add_error(lg, error1);
+     if (error2)
+          link_graph_add_error(lg, error2);
+     return lg->error->code;
+}
+
+LinkGraphError
+link_graph_update(LinkGraph *lg, PageDB *db, int only_diff_domain) {
+     if (!lg->offsets || only_diff_domain != lg->only_diff_domain)
+          return link_graph_build(lg, db, only_diff_domain);
+
+     uint64_t *records = 0;
+     size_t n_records = 0;
+     switch (page_db_link_log_read(db, &lg->log_pos, &records, &n_records)) {
+     case page_db_error_ok:
+          break;
+     case page_db_error_link_log_reset:
+          return link_graph_build(lg, db, only_diff_domain);
+     default:
+          link_graph_set_error(lg, link_graph_error_internal, __func__);
+          link_graph_add_error(lg, "reading link log");
+          link_graph_add_error(lg, db->error->message);
+          return lg->error->code;
+     }
+     LinkGraphError ret = link_graph_delta_add(lg, records, n_records);
+     free(records);
+     if (ret != 0)
+          return ret;
+
+     if (lg->n_delta > 0 && lg->n_delta_targets >= lg->merge_ratio*lg->n_links)
+          return link_graph_merge(lg);
+     return 0;
+}
+
+void
+link_graph_set_persist(LinkGraph *lg, int value) {
+     lg->persist = value;
+     if (lg->offsets)
+          lg->offsets->persist = value;
+     if (lg->targets)
+          lg->targets->persist = value;
+}
+
+LinkGraphError
+link_graph_stream_new(LinkGraphStream **st, const LinkGraph *lg) {
+     LinkGraphStream *p = *st = calloc(1, sizeof(*p));
+     if (!p)
+          return link_graph_error_memory;
+     p->lg = lg;
+     link_graph_stream_reset(p);
+     return 0;
+}
+
+StreamState
+link_graph_stream_reset(void *st) {
+     LinkGraphStream *s = st;
+     const LinkGraph *lg = s->lg;
+     s->n_pages = lg->n_pages;
+     if (lg->n_delta > 0 && lg->delta[lg->n_delta - 1].from >= s->n_pages)
+          s->n_pages = lg->delta[lg->n_delta - 1].from + 1;
+     s->from = s->next = s->delta = 0;
+     s->i = s->end = 0;
+     s->in_delta = 0;
+     return stream_state_init;
+}
+
+StreamState
+link_graph_stream_next(void *st, Link *link) {
+     LinkGraphStream *s = st;
+     const LinkGraph *lg = s->lg;
+     // skip pages without links
+     while (s->i >= s->end) {
+          if (s->next >= s->n_pages)
+               return stream_state_end;
+          s->from = s->next++;
+          if (s->delta < lg->n_delta && lg->delta[s->delta].from == s->from) {
+               const LinkGraphRow *row = lg->delta + s->delta;
+               s->in_delta = 1;
+               s->i = row->start;
+               s->end = row->start + row->n;
+               ++s->delta;
+          } else if (s->from < lg->n_pages) {
+               const uint64_t *offsets = (const uint64_t*)lg->offsets->mem;
+               s->in_delta = 0;
+               s->i = offsets[s->from];
+               s->end = offsets[s->from + 1];
+          }
+     }
+
+     link->from = s->from;
+     link->to = s->in_delta?
+          lg->delta_targets[s->i++]:
+          link_graph_target(lg, s->i++);
+     return stream_state_next;
+}
+
+void
+link_graph_stream_delete(LinkGraphStream *st) {
+     free(st);
+}
+
+#if (defined TEST) && TEST
+#include "test_link_graph.c"
+#endif // TEST
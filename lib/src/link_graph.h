@@ -0,0 +1,183 @@
+#ifndef __LINK_GRAPH_H__
+#define __LINK_GRAPH_H__
+
+#include <stdint.h>
+
+#include "link_stream.h"
+#include "mmap_array.h"
+#include "page_db.h"
+#include "util.h"
+
+/** @addtogroup LinkGraph
+ *
+ * A snapshot of the links database in compressed sparse row format, so that
+ * algorithms that iterate many times over all the links, like @ref PageRank
+ * or @ref Hits, read plain arrays instead of decoding the database again on
+ * every iteration.
+ *
+ * @{
+ */
+
+typedef enum {
+     link_graph_error_ok = 0,   /**< No error */
+     link_graph_error_memory,   /**< Error allocating memory */
+     link_graph_error_internal  /**< Unexpected error */
+} LinkGraphError;
+
+#define LINK_GRAPH_DEFAULT_PERSIST 0 /**< Default @ref LinkGraph::persist */
+#define LINK_GRAPH_DEFAULT_MERGE_RATIO 0.1 /**< Default @ref LinkGraph::merge_ratio */
+
+/** The links of a page changed after the snapshot was taken */
+typedef struct {
+     uint64_t from;  /**< Source page */
+     size_t start;   /**< Position of the first link inside @ref LinkGraph::delta_targets */
+     size_t n;       /**< Number of links */
+} LinkGraphRow;
+
+/** Links of page i are at positions [offsets[i], offsets[i + 1]) of targets,
+ * unless the page has a row inside delta.
+ */
+typedef struct {
+     /** Position of the first link of each page, n_pages + 1 uint64_t */
+     MMapArray *offsets;
+     /** Destination of each link, uint32_t or uint64_t depending on
+         @ref LinkGraph::target_size */
+     MMapArray *targets;
+
+     /** Number of pages with an entry in offsets: the largest source
+         index plus one */
+     size_t n_pages;
+     /** Number of links inside offsets and targets */
+     size_t n_links;
+     /** 4 if all page indices fit inside an uint32_t, otherwise 8 */
+     size_t target_size;
+
+     /** Rows that replace those of the snapshot, sorted by source page */
+     LinkGraphRow *delta;
+     size_t n_delta;
+     size_t m_delta;
+     /** Destinations of the delta links, including those of rows that have
+         already been replaced again */
+     uint64_t *delta_targets;
+     size_t n_delta_targets;
+     size_t m_delta_targets;
+
+     /** Position inside @ref PageDB::link_log of the first change not
+         applied yet */
+     PageDBLinkLogPos log_pos;
+     /** Value used for the last @ref link_graph_build */
+     int only_diff_domain;
+
+     /** Path to the offsets file, NULL if in memory */
+     char *path_offsets;
+     /** Path to the targets file, NULL if in memory */
+     char *path_targets;
+
+     /** Error status */
+     Error *error;
+
+// Options
+// -----------------------------------------------------------------------------
+     /** If true, do not delete files after deleting */
+     int persist;
+     /** The delta is merged into a new snapshot when it holds more than this
+         fraction of the snapshot links. See @ref link_graph_update */
+     float merge_ratio;
+} LinkGraph;
+
+/** Create a new, empty, graph.
+ *
+ * @param lg The new graph is returned here. NULL if memory error.
+ * @param path Files are stored at path_offsets.bin and path_targets.bin.
+ *             If NULL the graph is kept in anonymous memory.
+ *
+ * @return 0 if success, otherwise an error code.
+ */
+LinkGraphError
+link_graph_new(LinkGraph **lg, const char *path);
+
+/** Free memory and close associated resources.
+ *
+ * Files will be deleted or not depending on the value of LinkGraph::persist.
+ **/
+LinkGraphError
+link_graph_delete(LinkGraph *lg);
+
+/** Replace the graph with the current contents of the links database.
+ *
+ * The database is read in a single pass inside one read transaction.
+ *
+ * @param lg
+ * @param db
+ * @param only_diff_domain Same as @ref PageDBLinkStream::only_diff_domain
+ *
+ * @return 0 if success, otherwise an error code.
+ */
+LinkGraphError
+link_graph_build(LinkGraph *lg, PageDB *db, int only_diff_domain);
+
+/** Bring the graph up to date with the links database.
+ *
+ * The changes recorded inside @ref PageDB::link_log since the last update
+ * are kept as a delta, so the cost tracks the pages added instead of the
+ * size of the graph. Once the delta holds more than
+ * @ref LinkGraph::merge_ratio links per snapshot link the touched rows are
+ * merged into a new snapshot, copying the untouched ones in whole ranges.
+ *
+ * Falls back to @ref link_graph_build if there is no snapshot yet, if
+ * only_diff_domain changed or if the log was truncated.
+ *
+ * @return 0 if success, otherwise an error code.
+ */
+LinkGraphError
+link_graph_update(LinkGraph *lg, PageDB *db, int only_diff_domain);
+
+/** Destination of the n-th link */
+static inline uint64_t
+link_graph_target(const LinkGraph *lg, size_t n) {
+     return lg->target_size == sizeof(uint32_t)?
+          ((const uint32_t*)lg->targets->mem)[n]:
+          ((const uint64_t*)lg->targets->mem)[n];
+}
+
+/** Set value of @ref LinkGraph::persist */
+void
+link_graph_set_persist(LinkGraph *lg, int value);
+
+/** Stream over the links of a @ref LinkGraph, in the same order as
+ * @ref PageDBLinkStream */
+typedef struct {
+     const LinkGraph *lg;
+     size_t n_pages;  /**< Number of pages, counting those inside the delta */
+     size_t from;     /**< Current page */
+     size_t next;     /**< Next page */
+     size_t delta;    /**< Next row of @ref LinkGraph::delta */
+     size_t i;        /**< Next link of the current page */
+     size_t end;      /**< End of the links of the current page */
+     int in_delta;    /**< If true i and end point inside @ref LinkGraph::delta_targets */
+} LinkGraphStream;
+
+/** Create a new stream, positioned at the first link */
+LinkGraphError
+link_graph_stream_new(LinkGraphStream **st, const LinkGraph *lg);
+
+/** Rewind stream to the beginning. Complies with @ref LinkStreamResetFunc */
+StreamState
+link_graph_stream_reset(void *st);
+
+/** Get next link. Complies with @ref LinkStreamNextFunc */
+StreamState
+link_graph_stream_next(void *st, Link *link);
+
+void
+link_graph_stream_delete(LinkGraphStream *st);
+
+/// @}
+
+#if (defined TEST) && TEST
+#include "CuTest.h"
+CuSuite *
+test_link_graph_suite(void);
+#endif
+
+#endif // __LINK_GRAPH_H__
@@ -14,17 +14,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "lmdb.h"
 #include "smaz.h"
 #include "xxhash.h"
 
 #include "page_db.h"
+#include "external_sort.h"
 #include "hits.h"
 #include "page_rank.h"
 #include "txn_manager.h"
+#include "url_codec.h"
 #include "util.h"
 
 /** Allocate a new structure, with an initial default number of @ref LinkInfo slots*/
@@ -62,7 +66,7 @@ page_links_delete(PageLinks *pl) {
  * @return 0 if success, -1 if failure
  * */
 static int
-page_links_add_link(PageLinks *pl, const char *url, float score) {
+page_links_add_link(PageLinks *pl, const char *url, float score, uint64_t hash) {
      // Each time we hit the limit we double reserved space
      if (pl->n_links == pl->m_links) {
           void *p = realloc(pl->link_info, 2*pl->m_links*sizeof(LinkInfo));
@@ -72,6 +76,7 @@ page_links_add_link(PageLinks *pl, const char *url, float score) {
           pl->m_links *= 2;
      }
      pl->link_info[pl->n_links].score = score;
+     pl->link_info[pl->n_links].hash = hash;
      if (!(pl->link_info[pl->n_links].url = strdup(url)))
           return -1;
 
@@ -105,6 +110,14 @@ crawled_page_new(const char *url) {
      return cp;
 }
 
+CrawledPage *
+crawled_page_new_hashed(const char *url, uint64_t hash) {
+     CrawledPage *cp = crawled_page_new(url);
+     if (cp)
+          cp->hash = hash;
+     return cp;
+}
+
 void
 crawled_page_delete(CrawledPage *cp) {
      if (cp) {
@@ -143,7 +156,12 @@ crawled_page_set_hash32(CrawledPage *cp, uint32_t hash) {
 
 int
 crawled_page_add_link(CrawledPage *cp, const char *url, float score) {
-     return page_links_add_link(cp->links, url, score);
+     return page_links_add_link(cp->links, url, score, 0);
+}
+
+int
+crawled_page_add_link_hashed(CrawledPage *cp, const char *url, float score, uint64_t hash) {
+     return page_links_add_link(cp->links, url, score, hash);
 }
 
 size_t
@@ -276,129 +294,592 @@ page_info_update(PageInfo *pi, const CrawledPage *cp) {
      return 0;
 }
 
-/** Serialize the PageInfo into a contiguos block of memory.
+/** Flag inside the record tag: @ref PageInfo::linked_from is stored */
+#define PAGE_INFO_FLAG_LINKED_FROM 0x1
+/** Flag inside the record tag: the page has been crawled at least once */
+#define PAGE_INFO_FLAG_CRAWLED     0x2
+/** Flag inside the record tag: the URL starts with the host prefix of its
+ * domain, which is not stored. See @ref PageDBHosts */
+#define PAGE_INFO_FLAG_HOST        0x4
+
+/** Start resolving prefixes inside the transaction, with the domains
+ * database already opened.
  *
- * Note that enough new memory will be allocated inside val.mv_data to contain
- * the results of the dump. This memory should be freed when no longer is
- * necessary (for example after an mdb_cursor_put).
+ * @param flags MDB_RDONLY if the transaction is read only
+ */
+static void
+page_db_hosts_init_dbi(PageDBHosts *hosts,
+                       MDB_txn *txn,
+                       MDB_dbi dbi,
+                       unsigned int flags) {
+     hosts->txn = txn;
+     hosts->dbi = dbi;
+     hosts->copy = !(flags & MDB_RDONLY);
+     hosts->domain = 0;
+     hosts->host.mv_size = 0;
+     hosts->host.mv_data = 0;
+}
+
+/** Open the domains database inside the transaction
  *
- * @param pi The PageInfo to be serialized
- * @param val The destination of the serialization. Should have no memory
- *            allocated inside mv_data since new memory will be allocated.
+ * @param flags MDB_RDONLY if the transaction is read only
+ */
+static int
+page_db_hosts_init(PageDBHosts *hosts, MDB_txn *txn, unsigned int flags) {
+     MDB_dbi dbi;
+     int mdb_rc = mdb_dbi_open(txn, "domains", MDB_INTEGERKEY, &dbi);
+     if (mdb_rc == 0)
+          page_db_hosts_init_dbi(hosts, txn, dbi, flags);
+     return mdb_rc;
+}
+
+/** Cache the prefix of the domain.
  *
- * @return 0 if success, -1 if failure.
+ * Inside write transactions the prefix is copied, since LMDB can move or
+ * reuse the page holding it after the next write. Prefixes longer than
+ * @ref PageDBHosts::buf are not cached there.
+ */
+static void
+page_db_hosts_cache(PageDBHosts *hosts, uint32_t domain, const MDB_val *host) {
+     if (!hosts->copy)
+          hosts->host = *host;
+     else if (host->mv_size <= sizeof(hosts->buf)) {
+          memcpy(hosts->buf, host->mv_data, host->mv_size);
+          hosts->host.mv_size = host->mv_size;
+          hosts->host.mv_data = hosts->buf;
+     } else {
+          hosts->host.mv_data = 0;
+          return;
+     }
+     hosts->domain = domain;
+}
+
+/** Get the host prefix registered for the domain.
+ *
+ * Inside read transactions the prefix points to memory owned by LMDB, valid
+ * until the transaction ends. Inside write transactions it is only valid
+ * until the next call or write.
+ *
+ * @return 0 if success, MDB_NOTFOUND if none registered, otherwise the
+ *         LMDB error code.
  */
 static int
-page_info_dump(const PageInfo *pi, MDB_val *val) {
-     /* To save space we apply the following 'compression' method:
-        1. If n_crawls > 1 all data is saved
-        2. If n_crawls = 1 we have the following constraints:
-               last_crawl = first_crawl
-               n_changes  = 0
-           And so we don't bother to store last_crawl and n_changes
-        3. If n_crawls = 0, which is the very common case of an uncrawled page:
-               first_crawl         = 0
-               last_crawl          = 0
-               n_changes           = 0
-               content_hash_length = 0
-               content_hash        = NULL
-     */
+page_db_hosts_get(PageDBHosts *hosts, uint32_t domain, MDB_val *host) {
+     if (hosts->host.mv_data && hosts->domain == domain) {
+          *host = hosts->host;
+          return 0;
+     }
+     MDB_val key = {
+          .mv_size = sizeof(domain),
+          .mv_data = &domain
+     };
+     int mdb_rc = mdb_get(hosts->txn, hosts->dbi, &key, host);
+     if (mdb_rc != 0)
+          return mdb_rc;
+     page_db_hosts_cache(hosts, domain, host);
+     return 0;
+}
+
+/** Find how many chars of the URL are covered by its domain host prefix,
+ * registering the prefix if the domain has none yet.
+ *
+ * Must be called inside a write transaction.
+ *
+ * @param hosts
+ * @param key The key (hash) of the page
+ * @param url
+ * @param skip Output parameter, the length of the prefix or 0 if the URL
+ *             does not start with it.
+ *
+ * @return 0 if success, otherwise the LMDB error code
+ */
+static int
+page_db_hosts_register(PageDBHosts *hosts,
+                       const MDB_val *key,
+                       const char *url,
+                       size_t *skip) {
+     *skip = 0;
+     uint32_t domain = page_db_hash_get_domain(*(uint64_t*)key->mv_data);
+     size_t host_size = url_codec_host_size(url);
+     if (domain == 0 || host_size == 0)
+          return 0;
+
+     MDB_val host;
+     int mdb_rc = page_db_hosts_get(hosts, domain, &host);
+     switch (mdb_rc) {
+     case 0:
+          if (host.mv_size <= strlen(url) &&
+              memcmp(url, host.mv_data, host.mv_size) == 0)
+               *skip = host.mv_size;
+          return 0;
+     case MDB_NOTFOUND:
+          break;
+     default:
+          return mdb_rc;
+     }
 
-     // TODO: store the following fields using varint compression:
-     //    - n_crawls
-     //    - n_changes
-     //    - content_hash_length
-     //    - depth
+     MDB_val domain_key = {
+          .mv_size = sizeof(domain),
+          .mv_data = &domain
+     };
+     host.mv_size = host_size;
+     host.mv_data = 0;
+     if ((mdb_rc = mdb_put(hosts->txn, hosts->dbi, &domain_key, &host, MDB_RESERVE)) != 0)
+          return mdb_rc;
+     memcpy(host.mv_data, url, host_size);
+     page_db_hosts_cache(hosts, domain, &host);
+     *skip = host_size;
+     return 0;
+}
 
-     // necessary size except for the URL, which we don't know yet how much is going
-     // to cost storing
-     val->mv_size = sizeof(pi->linked_from) +
-          sizeof(pi->score) + sizeof(pi->n_crawls) + sizeof(pi->depth);
+/** Compress the URL of a PageInfo using @ref UrlCodec.
+ *
+ * @param url The URL to compress
+ * @param url_size Number of chars to compress
+ * @param buf Scratch memory for the compressed URL
+ * @param buf_size Size of buf. If it is not enough new memory is allocated.
+ * @param curl Output parameter, it will point to buf or to new memory, which
+ *             should be freed by the caller.
+ * @param curl_size Output parameter, size of the compressed URL
+ *
+ * @return 0 if success, ENOMEM if memory could not be allocated.
+ */
+static int
+page_info_compress_url(const char *url, size_t url_size,
+                       char *buf, size_t buf_size,
+                       char **curl, size_t *curl_size) {
+     *curl = buf;
+     if (URL_CODEC_MAX_ENCODED_SIZE(url_size) > buf_size &&
+         !(*curl = malloc(URL_CODEC_MAX_ENCODED_SIZE(url_size))))
+          return ENOMEM;
+     *curl_size = url_codec_encode(url, url_size, *curl);
+     return 0;
+}
+
+/** Number of bytes written by @ref page_info_encode */
+static size_t
+page_info_encode_size(const PageInfo *pi, size_t curl_size) {
+     size_t size = 1 + varint_size_uint64(curl_size) + curl_size +
+          sizeof(pi->score) + varint_size_uint64(pi->depth);
+     if (pi->linked_from != 0)
+          size += sizeof(pi->linked_from);
      if (pi->n_crawls > 0) {
-          val->mv_size += sizeof(pi->first_crawl) +
-               pi->content_hash_length + sizeof(pi->content_hash_length);
+          size += varint_size_uint64(pi->n_crawls) + sizeof(uint32_t);
           if (pi->n_crawls > 1)
-               val->mv_size += sizeof(pi->last_crawl) + sizeof(pi->n_changes);
+               size +=
+                    varint_size_int64((int64_t)pi->last_crawl -
+                                      (int64_t)(uint32_t)pi->first_crawl) +
+                    varint_size_uint64(pi->n_changes);
+          size += varint_size_uint64(pi->content_hash_length) +
+               pi->content_hash_length;
      }
+     return size;
+}
 
-     size_t url_size = strlen(pi->url);
-     char *data = val->mv_data = malloc(val->mv_size + 4*url_size);
-     if (!data)
-          return -1;
-
-     size_t curl_size = (size_t)smaz_compress(
-          pi->url, url_size, data + sizeof(unsigned short), 4*url_size);
-     if (curl_size > 4*url_size) // TODO
-          return -1;
-     ((unsigned short*)data)[0] = curl_size;
-     val->mv_size += sizeof(unsigned short) + curl_size;
+/** Serialize the PageInfo into data.
+ *
+ * @param pi The PageInfo to be serialized
+ * @param flags Additional PAGE_INFO_FLAG_* for the tag
+ * @param curl The compressed URL, see @ref page_info_compress_url
+ * @param curl_size
+ * @param data Destination, with at least @ref page_info_encode_size bytes
+ *
+ * @return Pointer just past the last byte written
+ */
+static uint8_t *
+page_info_encode(const PageInfo *pi,
+                 uint8_t flags,
+                 const char *curl, size_t curl_size,
+                 uint8_t *data) {
+     /* Record layout, format version @ref PAGE_DB_FORMAT:
+
+          tag                 1 byte, format version in the high nibble
+                              and PAGE_INFO_FLAG_* in the low nibble
+          curl_size           varint, size of the compressed URL
+          url                 compressed URL. Without the host prefix
+                              if PAGE_INFO_FLAG_HOST
+          score               float
+          linked_from         uint64_t, only if PAGE_INFO_FLAG_LINKED_FROM
+          depth               varint
+
+        And only if PAGE_INFO_FLAG_CRAWLED:
+
+          n_crawls            varint
+          first_crawl         uint32_t, seconds since epoch
+          last_crawl          zigzag varint, seconds since first_crawl. Only if n_crawls > 1
+          n_changes           varint, only if n_crawls > 1
+          content_hash_length varint
+          content_hash        content_hash_length bytes
+
+        An uncrawled page costs 7 bytes plus the URL, unless we need to
+        store linked_from. Format 1 is the same, except that the URL is
+        smaz compressed and always complete.
+     */
+     uint8_t tag = (PAGE_DB_FORMAT << 4) | flags;
+     if (pi->linked_from != 0)
+          tag |= PAGE_INFO_FLAG_LINKED_FROM;
+     if (pi->n_crawls > 0)
+          tag |= PAGE_INFO_FLAG_CRAWLED;
+     data[0] = tag;
 
+     uint8_t *end = varint_encode_uint64(curl_size, data + 1);
+     memcpy(end, curl, curl_size);
 
-     size_t i = sizeof(unsigned short) + curl_size;
+     size_t i = (end - data) + curl_size;
      size_t j;
      char * s;
 #define PAGE_INFO_WRITE(x) for (j=0, s=(char*)&(x); j<sizeof(x); data[i++] = s[j++])
+#define PAGE_INFO_WRITE_VARINT(x) i = varint_encode_uint64(x, data + i) - data
      PAGE_INFO_WRITE(pi->score);
-     PAGE_INFO_WRITE(pi->linked_from);
-     PAGE_INFO_WRITE(pi->depth);
-     PAGE_INFO_WRITE(pi->n_crawls);
-     if (pi->n_crawls > 0) {
-          PAGE_INFO_WRITE(pi->first_crawl);
+     if (tag & PAGE_INFO_FLAG_LINKED_FROM)
+          PAGE_INFO_WRITE(pi->linked_from);
+     PAGE_INFO_WRITE_VARINT(pi->depth);
+     if (tag & PAGE_INFO_FLAG_CRAWLED) {
+          PAGE_INFO_WRITE_VARINT(pi->n_crawls);
+          uint32_t first_crawl = (uint32_t)pi->first_crawl;
+          PAGE_INFO_WRITE(first_crawl);
           if (pi->n_crawls > 1) {
-               PAGE_INFO_WRITE(pi->last_crawl);
-               PAGE_INFO_WRITE(pi->n_changes);
+               i = varint_encode_int64(
+                    (int64_t)pi->last_crawl - (int64_t)first_crawl, data + i) - data;
+               PAGE_INFO_WRITE_VARINT(pi->n_changes);
           }
-          PAGE_INFO_WRITE(pi->content_hash_length);
+          PAGE_INFO_WRITE_VARINT(pi->content_hash_length);
           for (j=0; j<pi->content_hash_length; data[i++] = pi->content_hash[j++]);
      }
+     return data + i;
+}
 
-     return 0;
+/** Stack space used to compress URLs before serialization */
+#define PAGE_INFO_CURL_BUF_SIZE 1024
+
+#if (defined TEST) && TEST
+/** Serialize the PageInfo, with its complete URL, into a contiguos block of
+ * memory.
+ *
+ * Note that enough new memory will be allocated inside val.mv_data to contain
+ * the results of the dump. This memory should be freed when no longer is
+ * necessary. Records are written into the database with @ref page_info_put.
+ *
+ * @param pi The PageInfo to be serialized
+ * @param val The destination of the serialization. Should have no memory
+ *            allocated inside mv_data since new memory will be allocated.
+ *
+ * @return 0 if success, -1 if failure.
+ */
+static int
+page_info_dump(const PageInfo *pi, MDB_val *val) {
+     char buf[PAGE_INFO_CURL_BUF_SIZE];
+     char *curl;
+     size_t curl_size;
+     val->mv_data = 0;
+     if (page_info_compress_url(
+              pi->url, strlen(pi->url), buf, sizeof(buf), &curl, &curl_size) != 0)
+          return -1;
+
+     size_t size = page_info_encode_size(pi, curl_size);
+     uint8_t *data = val->mv_data = malloc(size);
+     if (data)
+          val->mv_size = page_info_encode(pi, 0, curl, curl_size, data) - data;
+     if (curl != buf)
+          free(curl);
+
+     return data? 0: -1;
 }
+#endif
 
-// fast retrieval of just the score associated with the page
-static float
-page_info_dump_get_score(MDB_val *val) {
-     char *data = val->mv_data;
-     unsigned short curl_size = ((unsigned short*)data)[0];
-     data += sizeof(unsigned short) + curl_size;
-     return *((float*)data);
+/** Serialize the PageInfo directly inside the database.
+ *
+ * Space for the record is reserved with MDB_RESERVE and the PageInfo is
+ * encoded in place, so the only copy made is the one LMDB would make anyway.
+ *
+ * @param hosts Host prefixes of the write transaction
+ * @param cur An open cursor to the hash2info database
+ * @param key
+ * @param pi
+ * @param flags Flags for mdb_cursor_put. MDB_RESERVE is added.
+ * @param size If not NULL, the size of the record written
+ *
+ * @return 0 if success, otherwise the LMDB error code (ENOMEM if the URL
+ *         could not be compressed)
+ */
+static int
+page_info_put(PageDBHosts *hosts,
+              MDB_cursor *cur,
+              MDB_val *key,
+              const PageInfo *pi,
+              unsigned int flags,
+              size_t *size) {
+     size_t skip;
+     int mdb_rc = page_db_hosts_register(hosts, key, pi->url, &skip);
+     if (mdb_rc != 0)
+          return mdb_rc;
+
+     char buf[PAGE_INFO_CURL_BUF_SIZE];
+     char *curl;
+     size_t curl_size;
+     mdb_rc = page_info_compress_url(
+          pi->url + skip, strlen(pi->url + skip), buf, sizeof(buf), &curl, &curl_size);
+     if (mdb_rc != 0)
+          return mdb_rc;
+
+     MDB_val val;
+     val.mv_size = page_info_encode_size(pi, curl_size);
+     val.mv_data = 0;
+     mdb_rc = mdb_cursor_put(cur, key, &val, flags | MDB_RESERVE);
+     if (mdb_rc == 0)
+          page_info_encode(
+               pi, skip > 0? PAGE_INFO_FLAG_HOST: 0, curl, curl_size, val.mv_data);
+     if (size)
+          *size = val.mv_size;
+     if (curl != buf)
+          free(curl);
+
+     return mdb_rc;
 }
 
-/** Create a new PageInfo loading the information from a previously
- * dumped PageInfo inside val.
+/** Parse a record written by @ref page_info_put, without copying.
  *
- * @return pointer to the new PageInfo or NULL if failure
+ * @param view
+ * @param hosts Host prefixes of the transaction. Can be NULL if the record
+ *              has the complete URL.
+ * @param key The key (hash) of the record. Can be NULL if hosts is NULL.
+ * @param val
+ *
+ * @return 0 if success, -1 if the record was written with an unsupported
+ *         format version or its host prefix could not be found
  */
-static PageInfo *
-page_info_load(const MDB_val *val) {
-     PageInfo *pi = calloc(1, sizeof(*pi));
-     if (!pi)
-       return 0;
+static int
+page_info_view_load(PageInfoView *view,
+                    PageDBHosts *hosts,
+                    const MDB_val *key,
+                    const MDB_val *val) {
+     uint8_t *data = val->mv_data;
+     if (val->mv_size == 0)
+          return -1;
+     view->version = data[0] >> 4;
+     if (view->version < PAGE_DB_FORMAT_COMPAT || view->version > PAGE_DB_FORMAT)
+          return -1;
 
-     char *data = val->mv_data;
-     size_t i = 0;
+     uint8_t tag = data[0];
+     if (tag & PAGE_INFO_FLAG_HOST) {
+          MDB_val host;
+          if (!hosts ||
+              page_db_hosts_get(
+                   hosts,
+                   page_db_hash_get_domain(*(uint64_t*)key->mv_data),
+                   &host) != 0)
+               return -1;
+          view->host = host.mv_data;
+          view->host_size = host.mv_size;
+     } else {
+          view->host = 0;
+          view->host_size = 0;
+     }
+
+     uint8_t read;
+     size_t i = 1;
      size_t j;
      char * d;
 #define PAGE_INFO_READ(x) for (j=0, d=(char*)&(x); j<sizeof(x); d[j++] = data[i++])
-     unsigned short curl_size;
-     PAGE_INFO_READ(curl_size);
+#define PAGE_INFO_READ_VARINT(x) do {                   \
+          x = varint_decode_uint64(data + i, &read);    \
+          i += read;                                    \
+     } while (0)
+
+     PAGE_INFO_READ_VARINT(view->curl_size);
+     view->curl = (char*)data + i;
+     i += view->curl_size;
+
+     PAGE_INFO_READ(view->score);
+     if (tag & PAGE_INFO_FLAG_LINKED_FROM)
+          PAGE_INFO_READ(view->linked_from);
+     else
+          view->linked_from = 0;
+     PAGE_INFO_READ_VARINT(view->depth);
+     if (tag & PAGE_INFO_FLAG_CRAWLED) {
+          PAGE_INFO_READ_VARINT(view->n_crawls);
+          uint32_t first_crawl;
+          PAGE_INFO_READ(first_crawl);
+          view->first_crawl = first_crawl;
+          if (view->n_crawls > 1) {
+               view->last_crawl =
+                    (double)((int64_t)first_crawl + varint_decode_int64(data + i, &read));
+               i += read;
+               PAGE_INFO_READ_VARINT(view->n_changes);
+          } else {
+               view->last_crawl = view->first_crawl;
+               view->n_changes = 0;
+          }
+          PAGE_INFO_READ_VARINT(view->content_hash_length);
+          view->content_hash = (char*)data + i;
+     } else {
+          view->n_crawls = 0;
+          view->first_crawl = view->last_crawl = 0;
+          view->n_changes = 0;
+          view->content_hash_length = 0;
+          view->content_hash = 0;
+     }
+     return 0;
+}
+
+size_t
+page_info_view_url_max_size(const PageInfoView *view) {
+     if (view->version == 1)
+          // a single smaz compressed byte expands at most to 7 chars
+          return 7*view->curl_size + 1;
+     return view->host_size + URL_CODEC_MAX_DECODED_SIZE(view->curl_size) + 1;
+}
+
+int
+page_info_view_url(const PageInfoView *view, char *url, size_t size) {
+     if (size <= view->host_size)
+          return -1;
+     memcpy(url, view->host, view->host_size);
+     size -= view->host_size + 1;
+
+     int dec;
+     if (view->version == 1) {
+          dec = smaz_decompress((char*)view->curl, view->curl_size, url, size);
+          if ((size_t)dec > size)
+               return -1;
+     } else {
+          dec = url_codec_decode(
+               view->curl, view->curl_size, url + view->host_size, size);
+          if (dec < 0)
+               return -1;
+          dec += view->host_size;
+     }
+     url[dec] = '\0';
+     return dec;
+}
+
+float
+page_info_view_rate(const PageInfoView *view) {
+     float rate = -1.0;
+     float delta = view->last_crawl - view->first_crawl;
+     if (delta > 0)
+          rate = ((float)view->n_changes + 1.0)/delta;
+     return rate;
+}
+
+int
+page_info_view_is_seed(const PageInfoView *view) {
+     char buf[1024];
+     size_t size = page_info_view_url_max_size(view);
+     char *url = size <= sizeof(buf)? buf: malloc(size);
+     if (!url)
+          return 0;
+
+     int is_seed = (page_info_view_url(view, url, size) >= 6) &&
+          (strncmp(url, "_seed_", 6) == 0);
+     if (url != buf)
+          free(url);
+     return is_seed;
+}
+
+PageInfo *
+page_info_new_from_view(const PageInfoView *view) {
+     PageInfo *pi = calloc(1, sizeof(*pi));
+     if (!pi)
+          return 0;
+
+     size_t url_size = page_info_view_url_max_size(view);
+     if (!(pi->url = malloc(url_size)))
+          goto on_error;
+     int len = page_info_view_url(view, pi->url, url_size);
+     if (len < 0)
+          goto on_error;
+     char *url = realloc(pi->url, len + 1);
+     if (url)
+          pi->url = url;
+
+     pi->linked_from = view->linked_from;
+     pi->depth = view->depth;
+     pi->first_crawl = view->first_crawl;
+     pi->last_crawl = view->last_crawl;
+     pi->n_changes = view->n_changes;
+     pi->n_crawls = view->n_crawls;
+     pi->score = view->score;
+     pi->content_hash_length = view->content_hash_length;
+     if (view->content_hash) {
+          if (!(pi->content_hash = malloc(view->content_hash_length)))
+               goto on_error;
+          memcpy(pi->content_hash, view->content_hash, view->content_hash_length);
+     }
+     return pi;
+
+on_error:
+     page_info_delete(pi);
+     return 0;
+}
+
+/** Create a new PageInfo loading the information from a previously
+ * dumped PageInfo inside val. See @ref page_info_view_load for the parameters.
+ *
+ * @return pointer to the new PageInfo or NULL if failure, including records
+ *         written with a different format version.
+ */
+static PageInfo *
+page_info_load(PageDBHosts *hosts, const MDB_val *key, const MDB_val *val) {
+     PageInfoView view;
+     if (page_info_view_load(&view, hosts, key, val) != 0)
+          return 0;
+     return page_info_new_from_view(&view);
+}
 
-     unsigned short url_size = 4*curl_size + 1;
+/** Decompress a smaz compressed URL into a newly allocated, null terminated,
+ * string.
+ *
+ * @return NULL if memory error
+ */
+static char *
+page_info_load_url(char *curl, size_t curl_size) {
+     char *url = 0;
+     size_t url_size = 4*curl_size + 1;
      int enough_memory = 0;
      do {
-          if (!(pi->url = realloc(pi->url, url_size))) {
-               free(pi);
+          char *url_new = realloc(url, url_size);
+          if (!url_new) {
+               free(url);
                return 0;
           }
-          int dec = smaz_decompress(data + i, curl_size, pi->url, url_size);
-          if ((unsigned int)dec < url_size) {
+          url = url_new;
+          int dec = smaz_decompress(curl, curl_size, url, url_size);
+          if ((size_t)dec < url_size) {
                enough_memory = 1;
                url_size = dec;
           } else {
                url_size *= 2;
           }
      } while (!enough_memory);
-     pi->url[url_size] = '\0';
+     url[url_size] = '\0';
+     return url;
+}
+
+/** Load a PageInfo written by versions of the library previous to the
+ * introduction of @ref PAGE_DB_FORMAT (format 0).
+ *
+ * Format 0 records have no tag byte and store all fields at full width. Only
+ * used to migrate old databases, see @ref page_db_migrate.
+ *
+ * @return pointer to the new PageInfo or NULL if failure
+ */
+static PageInfo *
+page_info_load_v0(const MDB_val *val) {
+     PageInfo *pi = calloc(1, sizeof(*pi));
+     if (!pi)
+       return 0;
+
+     char *data = val->mv_data;
+     size_t i = 0;
+     size_t j;
+     char * d;
+     unsigned short curl_size;
+     PAGE_INFO_READ(curl_size);
+     if (!(pi->url = page_info_load_url(data + i, curl_size))) {
+          free(pi);
+          return 0;
+     }
      i += curl_size;
 
      PAGE_INFO_READ(pi->score);
@@ -425,24 +906,88 @@ page_info_load(const MDB_val *val) {
      return pi;
 }
 
-float
-page_info_rate(const PageInfo *pi) {
-     float rate = -1.0;
-     float delta = pi->last_crawl - pi->first_crawl;
-     if (delta > 0)
-          rate = ((float)pi->n_changes + 1.0)/delta;
-     return rate;
-}
+#if (defined TEST) && TEST
+/** Serialize using format 0, to test migration of old databases */
+static int
+page_info_dump_v0(const PageInfo *pi, MDB_val *val) {
+     val->mv_size = sizeof(pi->linked_from) +
+          sizeof(pi->score) + sizeof(pi->n_crawls) + sizeof(pi->depth);
+     if (pi->n_crawls > 0) {
+          val->mv_size += sizeof(pi->first_crawl) +
+               pi->content_hash_length + sizeof(pi->content_hash_length);
+          if (pi->n_crawls > 1)
+               val->mv_size += sizeof(pi->last_crawl) + sizeof(pi->n_changes);
+     }
 
-int
-page_info_is_seed(const PageInfo *pi) {
-     return (pi->url[0] == '_' &&
-	     pi->url[1] == 's' &&
-	     pi->url[2] == 'e' &&
-	     pi->url[3] == 'e' &&
-	     pi->url[4] == 'd' &&
-	     pi->url[5] == '_');
-}
+     size_t url_size = strlen(pi->url);
+     char *data = val->mv_data = malloc(val->mv_size + 4*url_size);
+     if (!data)
+          return -1;
+
+     size_t curl_size = (size_t)smaz_compress(
+          pi->url, url_size, data + sizeof(unsigned short), 4*url_size);
+     if (curl_size > 4*url_size)
+          return -1;
+     ((unsigned short*)data)[0] = curl_size;
+     val->mv_size += sizeof(unsigned short) + curl_size;
+
+     size_t i = sizeof(unsigned short) + curl_size;
+     size_t j;
+     char * s;
+     PAGE_INFO_WRITE(pi->score);
+     PAGE_INFO_WRITE(pi->linked_from);
+     PAGE_INFO_WRITE(pi->depth);
+     PAGE_INFO_WRITE(pi->n_crawls);
+     if (pi->n_crawls > 0) {
+          PAGE_INFO_WRITE(pi->first_crawl);
+          if (pi->n_crawls > 1) {
+               PAGE_INFO_WRITE(pi->last_crawl);
+               PAGE_INFO_WRITE(pi->n_changes);
+          }
+          PAGE_INFO_WRITE(pi->content_hash_length);
+          for (j=0; j<pi->content_hash_length; data[i++] = pi->content_hash[j++]);
+     }
+     return 0;
+}
+
+/** Serialize using format 1, with a smaz compressed URL */
+static int
+page_info_dump_v1(const PageInfo *pi, MDB_val *val) {
+     size_t url_size = strlen(pi->url);
+     char *curl = malloc(4*url_size + 1);
+     if (!curl)
+          return -1;
+     size_t curl_size = (size_t)smaz_compress(
+          pi->url, url_size, curl, 4*url_size + 1);
+
+     uint8_t *data = val->mv_data = malloc(page_info_encode_size(pi, curl_size));
+     if (data) {
+          val->mv_size = page_info_encode(pi, 0, curl, curl_size, data) - data;
+          data[0] = (1 << 4) | (data[0] & 0xF);
+     }
+     free(curl);
+     return data? 0: -1;
+}
+#endif
+
+float
+page_info_rate(const PageInfo *pi) {
+     float rate = -1.0;
+     float delta = pi->last_crawl - pi->first_crawl;
+     if (delta > 0)
+          rate = ((float)pi->n_changes + 1.0)/delta;
+     return rate;
+}
+
+int
+page_info_is_seed(const PageInfo *pi) {
+     return (pi->url[0] == '_' &&
+	     pi->url[1] == 's' &&
+	     pi->url[2] == 'e' &&
+	     pi->url[3] == 'e' &&
+	     pi->url[4] == 'd' &&
+	     pi->url[5] == '_');
+}
 
 void
 page_info_delete(PageInfo *pi) {
@@ -453,6 +998,42 @@ page_info_delete(PageInfo *pi) {
      }
 }
 
+/** Make a deep copy, see @ref ClockCacheCopyFunc */
+static void *
+page_info_copy(const void *value) {
+     const PageInfo *pi = value;
+     PageInfo *copy = malloc(sizeof(*copy));
+     if (!copy)
+          return 0;
+     *copy = *pi;
+     copy->url = 0;
+     copy->content_hash = 0;
+     if (!(copy->url = strdup(pi->url)))
+          goto on_error;
+     if (pi->content_hash) {
+          if (!(copy->content_hash = malloc(pi->content_hash_length)))
+               goto on_error;
+          memcpy(copy->content_hash, pi->content_hash, pi->content_hash_length);
+     }
+     return copy;
+
+on_error:
+     page_info_delete(copy);
+     return 0;
+}
+
+/** See @ref ClockCacheFreeFunc */
+static void
+page_info_free(void *value) {
+     page_info_delete(value);
+}
+
+/** Bytes used by a @ref PageInfo and its fields */
+static size_t
+page_info_memory(const PageInfo *pi) {
+     return sizeof(*pi) + strlen(pi->url) + 1 + pi->content_hash_length;
+}
+
 PageInfoList *
 page_info_list_new(PageInfo *pi, uint64_t hash) {
      PageInfoList *pil = malloc(sizeof(*pil));
@@ -479,13 +1060,12 @@ page_info_list_cons(PageInfoList *pil, PageInfo *pi, uint64_t hash) {
 
 void
 page_info_list_delete(PageInfoList *pil) {
-     PageInfoList *next;
-     do {
-          next = pil->next;
+     while (pil != 0) {
+          PageInfoList *next = pil->next;
           page_info_delete(pil->page_info);
           free(pil);
           pil = next;
-     } while (next != 0);
+     }
 }
 /// @}
 
@@ -498,19 +1078,104 @@ page_info_list_delete(PageInfoList *pil) {
  */
 static char info_n_pages[] = "n_pages";
 
+/** This key points to the @ref PAGE_DB_FORMAT used to write the
+ * @ref PageInfo records. It is missing in databases of format 0.
+ */
+static char info_format[] = "format";
 
-uint64_t
-page_db_hash(const char *url) {
-     int start, end;
+/** This key points to the shard number and number of shards, as two
+ * uint64_t. It is missing if the database is not a shard.
+ */
+static char info_shard[] = "shard";
+
+/** This key points to the checksum of the first n_pages entries of
+ * @ref PageDB::idx2hash, see @ref page_db_idx2hash_mix. It is missing in
+ * databases written by older versions.
+ */
+static char info_idx2hash_sum[] = "idx2hash_sum";
+
+/** Read the shard settings stored inside the info database.
+ *
+ * @return 0 if success, otherwise the LMDB error code
+ */
+static int
+page_db_get_shard(MDB_txn *txn, MDB_dbi dbi_info, size_t *shard, size_t *n_shards) {
+     MDB_val key = {
+          .mv_size = sizeof(info_shard),
+          .mv_data = info_shard
+     };
+     MDB_val val;
+     int mdb_rc = mdb_get(txn, dbi_info, &key, &val);
+     switch (mdb_rc) {
+     case 0:
+          *shard = ((uint64_t*)val.mv_data)[0];
+          *n_shards = ((uint64_t*)val.mv_data)[1];
+          return 0;
+     case MDB_NOTFOUND:
+          *shard = 0;
+          *n_shards = 1;
+          return 0;
+     default:
+          return mdb_rc;
+     }
+}
+
+
+/** Build a hash from the domain and URL parts, see @ref page_db_hash */
+static uint64_t
+page_db_hash_join(uint32_t domain, uint32_t url) {
      uint64_t hash_full;
      uint32_t *hash_part = (uint32_t*)&hash_full;
-     if (url_domain(url, &start, &end) != 0)
-          hash_part[1] = 0;
+     hash_part[1] = domain;
+     hash_part[0] = url;
+     return hash_full;
+}
+
+/** Same as @ref page_db_hash but also returns the limits of the domain,
+ * as computed by @ref url_domain. If the URL has no domain they are set to -1.
+ */
+static uint64_t
+page_db_hash_domain(const char *url, int *start, int *end) {
+     uint32_t domain = 0;
+     if (url_domain(url, start, end) != 0)
+          *start = *end = -1;
      else
-          hash_part[1] = XXH32(url + start, end - start + 1, 0);
+          domain = XXH32(url + *start, *end - *start + 1, 0);
+     return page_db_hash_join(domain, XXH32(url, strlen(url), 0));
+}
 
-     hash_part[0] = XXH32(url, strlen(url), 0);
-     return hash_full;
+uint64_t
+page_db_hash(const char *url) {
+     int start, end;
+     return page_db_hash_domain(url, &start, &end);
+}
+
+void
+page_db_hash_many(const char **urls, size_t n, uint64_t *out) {
+     // consecutive links usually share the domain, whose hash is then reused
+     const char *last = 0;
+     int last_len = -1;
+     uint32_t last_domain = 0;
+     for (size_t i=0; i<n; ++i) {
+          // links are usually scattered around the heap
+          if (i + 1 < n)
+               __builtin_prefetch(urls[i + 1]);
+          const char *url = urls[i];
+          uint32_t domain = 0;
+          int start, end;
+          if (url_domain(url, &start, &end) == 0) {
+               int len = end - start + 1;
+               if (len == last_len && memcmp(url + start, last, len) == 0)
+                    domain = last_domain;
+               else {
+                    domain = XXH32(url + start, len, 0);
+                    last = url + start;
+                    last_len = len;
+                    last_domain = domain;
+               }
+          }
+          out[i] = page_db_hash_join(domain, XXH32(url, strlen(url), 0));
+     }
 }
 
 uint32_t
@@ -564,6 +1229,220 @@ page_db_open_info(MDB_txn *txn, MDB_cursor **cursor) {
      return page_db_open_cursor(txn, "info", 0, cursor, 0);
 }
 
+static int
+page_db_open_pruned(MDB_txn *txn, MDB_cursor **cursor) {
+     return page_db_open_cursor(
+          txn, "pruned", MDB_INTEGERKEY, cursor, 0);
+}
+
+static int
+page_db_open_free(MDB_txn *txn, MDB_cursor **cursor) {
+     return page_db_open_cursor(
+          txn, "free", MDB_INTEGERKEY, cursor, 0);
+}
+
+static int
+page_db_open_domain_stats(MDB_txn *txn, MDB_cursor **cursor) {
+     return page_db_open_cursor(
+          txn, "domain_stats", MDB_INTEGERKEY, cursor, 0);
+}
+
+/** Add (sign > 0) or remove (sign < 0) a page from the statistics of its
+ * domain. Counters are unsigned and wrap around, so that changes can be
+ * accumulated with @ref page_db_domain_stats_merge in any order.
+ */
+static void
+page_db_domain_stats_page(PageDBDomainStats *st,
+                          int sign,
+                          uint64_t n_crawls,
+                          uint64_t n_changes,
+                          double first_crawl,
+                          double last_crawl,
+                          float score) {
+     uint64_t one = sign > 0? 1: (uint64_t)-1;
+     st->n_pages += one;
+     if (n_crawls > 0)
+          st->n_crawled += one;
+     st->n_crawls += one*n_crawls;
+     st->n_changes += one*n_changes;
+     st->score += sign*(double)score;
+     // the same as page_info_rate
+     float delta = last_crawl - first_crawl;
+     if (delta > 0) {
+          st->n_rated += one;
+          st->rate += sign*(((float)n_changes + 1.0)/delta);
+     }
+}
+
+static void
+page_db_domain_stats_info(PageDBDomainStats *st, int sign, const PageInfo *pi) {
+     page_db_domain_stats_page(st, sign,
+                               pi->n_crawls, pi->n_changes,
+                               pi->first_crawl, pi->last_crawl,
+                               pi->score);
+}
+
+static void
+page_db_domain_stats_view(PageDBDomainStats *st, int sign, const PageInfoView *view) {
+     page_db_domain_stats_page(st, sign,
+                               view->n_crawls, view->n_changes,
+                               view->first_crawl, view->last_crawl,
+                               view->score);
+}
+
+static void
+page_db_domain_stats_merge(PageDBDomainStats *st, const PageDBDomainStats *delta) {
+     st->n_pages += delta->n_pages;
+     st->n_crawled += delta->n_crawled;
+     st->n_crawls += delta->n_crawls;
+     st->n_changes += delta->n_changes;
+     st->n_rated += delta->n_rated;
+     st->rate += delta->rate;
+     st->score += delta->score;
+}
+
+/** Order @ref PageDBDomainStatsEntry by domain */
+static int
+page_db_domain_stats_cmp(const void *a, const void *b) {
+     uint32_t da = ((const PageDBDomainStatsEntry*)a)->domain;
+     uint32_t db = ((const PageDBDomainStatsEntry*)b)->domain;
+     return da < db? -1: da > db;
+}
+
+/** Number of domains whose statistics are accumulated in memory before
+ * merging them into the domain_stats database */
+#define PAGE_DB_DOMAIN_STATS_BUFFER 65536
+
+/** Merge changes into the domain_stats database.
+ *
+ * Domains are visited in key order, and the statistics of a domain left
+ * without pages are deleted.
+ *
+ * @param cur An open cursor to the domain_stats database
+ * @param entries The changes, reordered by domain
+ * @param n Number of elements of entries
+ *
+ * @return 0 if success, otherwise an LMDB error code
+ */
+static int
+page_db_domain_stats_flush(MDB_cursor *cur, PageDBDomainStatsEntry *entries, size_t n) {
+     qsort(entries, n, sizeof(*entries), page_db_domain_stats_cmp);
+
+     int mdb_rc = 0;
+     for (size_t i=0; i<n && mdb_rc == 0;) {
+          uint32_t domain = entries[i].domain;
+          MDB_val key = {
+               .mv_size = sizeof(domain),
+               .mv_data = &domain
+          };
+          MDB_val val;
+          PageDBDomainStats st;
+          int found = 0;
+          switch (mdb_rc = mdb_cursor_get(cur, &key, &val, MDB_SET)) {
+          case 0:
+               memcpy(&st, val.mv_data, sizeof(st));
+               found = 1;
+               break;
+          case MDB_NOTFOUND:
+               memset(&st, 0, sizeof(st));
+               mdb_rc = 0;
+               break;
+          default:
+               return mdb_rc;
+          }
+          for (; i<n && entries[i].domain == domain; ++i)
+               page_db_domain_stats_merge(&st, &entries[i].stats);
+
+          if (st.n_pages == 0) {
+               if (found)
+                    mdb_rc = mdb_cursor_del(cur, 0);
+          } else {
+               val.mv_size = sizeof(st);
+               val.mv_data = &st;
+               mdb_rc = mdb_cursor_put(cur, &key, &val, 0);
+          }
+     }
+     return mdb_rc;
+}
+
+/** Compute the domain_stats database from all the pages inside hash2info.
+ *
+ * Databases written before domain_stats existed get it this way when they
+ * are opened or migrated.
+ *
+ * @return 0 if success, otherwise an LMDB error code
+ */
+static int
+page_db_domain_stats_build(MDB_txn *txn) {
+     MDB_cursor *cur_hash2info = 0;
+     MDB_cursor *cur_stats = 0;
+     PageDBHosts hosts;
+     MDB_val key;
+     MDB_val val;
+     int mdb_rc;
+
+     PageDBDomainStatsEntry *entries =
+          malloc(PAGE_DB_DOMAIN_STATS_BUFFER*sizeof(*entries));
+     if (!entries)
+          return ENOMEM;
+     size_t n = 0;
+
+     if ((mdb_rc = page_db_open_hash2info(txn, &cur_hash2info)) != 0 ||
+         (mdb_rc = page_db_open_domain_stats(txn, &cur_stats)) != 0 ||
+         (mdb_rc = mdb_drop(txn, mdb_cursor_dbi(cur_stats), 0)) != 0 ||
+         (mdb_rc = page_db_hosts_init(&hosts, txn, 0)) != 0)
+          goto exit;
+
+     // pages of the same domain are usually consecutive
+     for (mdb_rc = mdb_cursor_get(cur_hash2info, &key, &val, MDB_FIRST);
+          mdb_rc == 0;
+          mdb_rc = mdb_cursor_get(cur_hash2info, &key, &val, MDB_NEXT)) {
+          PageInfoView view;
+          if (page_info_view_load(&view, &hosts, &key, &val) != 0) {
+               mdb_rc = MDB_CORRUPTED;
+               goto exit;
+          }
+          uint32_t domain = page_db_hash_get_domain(*(uint64_t*)key.mv_data);
+          if (n == 0 || entries[n - 1].domain != domain) {
+               if (n == PAGE_DB_DOMAIN_STATS_BUFFER) {
+                    if ((mdb_rc = page_db_domain_stats_flush(cur_stats, entries, n)) != 0)
+                         goto exit;
+                    n = 0;
+               }
+               memset(entries + n, 0, sizeof(*entries));
+               entries[n++].domain = domain;
+          }
+          page_db_domain_stats_view(&entries[n - 1].stats, 1, &view);
+     }
+     if (mdb_rc == MDB_NOTFOUND)
+          mdb_rc = page_db_domain_stats_flush(cur_stats, entries, n);
+
+exit:
+     if (cur_hash2info)
+          mdb_cursor_close(cur_hash2info);
+     if (cur_stats)
+          mdb_cursor_close(cur_stats);
+     free(entries);
+     return mdb_rc;
+}
+
+/** Build the domain_stats database if it is empty but there are pages.
+ *
+ * @return 0 if success, otherwise an LMDB error code
+ */
+static int
+page_db_domain_stats_init(MDB_txn *txn, MDB_dbi dbi_hash2info, MDB_dbi dbi_domain_stats) {
+     MDB_stat stat_pages;
+     MDB_stat stat_domains;
+     int mdb_rc;
+     if ((mdb_rc = mdb_stat(txn, dbi_hash2info, &stat_pages)) != 0 ||
+         (mdb_rc = mdb_stat(txn, dbi_domain_stats, &stat_domains)) != 0)
+          return mdb_rc;
+     if (stat_pages.ms_entries == 0 || stat_domains.ms_entries > 0)
+          return 0;
+     return page_db_domain_stats_build(txn);
+}
+
 
 static void
 page_db_set_error(PageDB *db, int code, const char *message) {
@@ -579,61 +1458,466 @@ page_db_add_error(PageDB *db, const char *message) {
  *
  * This function is automatically called when an operation cannot proceed because
  * of insufficient allocated mmap memory.
+ *
+ * @param n_pages Number of pages the next write adds, see
+ *                @ref txn_manager_expand_many
  */
 static PageDBError
-page_db_expand(PageDB *db) {
-     if (txn_manager_expand(db->txn_manager, 0) != 0) {
+page_db_expand(PageDB *db, size_t n_pages) {
+     if (txn_manager_expand_many(db->txn_manager, n_pages) != 0) {
           page_db_set_error(db, page_db_error_internal, __func__);
           page_db_add_error(db, db->txn_manager->error->message);
      }
      return db->error->code;
 }
 
-PageDBError
-page_db_new(PageDB **db, const char *path) {
-     PageDB *p = *db = malloc(sizeof(*p));
-     if (p == 0)
-          return page_db_error_memory;
+/** Initialize n_pages and format inside the info database.
+ *
+ * A database without format key is marked with the current format only
+ * if it does not contain pages yet. Databases with a format that can still
+ * be read, see @ref PAGE_DB_FORMAT_COMPAT, are marked with the current format.
+ *
+ * @param format Format of the database
+ * @return 0 if success, otherwise the LMDB error code
+ */
+static int
+page_db_init_info(MDB_txn *txn,
+                  MDB_dbi dbi_info,
+                  MDB_dbi dbi_hash2info,
+                  uint32_t *format) {
+     size_t n_pages = 0;
+     MDB_val key = {
+          .mv_size = sizeof(info_n_pages),
+          .mv_data = info_n_pages
+     };
+     MDB_val val = {
+          .mv_size = sizeof(size_t),
+          .mv_data = &n_pages
+     };
+     int mdb_rc = mdb_put(txn, dbi_info, &key, &val, MDB_NOOVERWRITE);
+     if (mdb_rc != 0 && mdb_rc != MDB_KEYEXIST)
+          return mdb_rc;
 
-     p->error = error_new();
-     if (p->error == 0) {
-          free(p);
-          return page_db_error_memory;
+     key.mv_size = sizeof(info_format);
+     key.mv_data = info_format;
+     switch (mdb_rc = mdb_get(txn, dbi_info, &key, &val)) {
+     case 0:
+          *format = *(uint32_t*)val.mv_data;
+          if (*format < PAGE_DB_FORMAT_COMPAT || *format >= PAGE_DB_FORMAT)
+               return 0;
+          // old records remain readable, but new ones will be written
+          // with the current format
+          goto set_format;
+     case MDB_NOTFOUND:
+          break;
+     default:
+          return mdb_rc;
      }
-     p->persist = PAGE_DB_DEFAULT_PERSIST;
-     p->domain_temp = 0;
 
-     // create directory if not present yet
-     const char *error = make_dir(path);
-     if ((p->path = strdup(path)) == 0) {
-          error = "could not duplicate path string";
-     }
-     if (error != 0) {
-          page_db_set_error(p, page_db_error_invalid_path, __func__);
-          page_db_add_error(p, error);
-          return p->error->code;
+     MDB_stat stat;
+     if ((mdb_rc = mdb_stat(txn, dbi_hash2info, &stat)) != 0)
+          return mdb_rc;
+     if (stat.ms_entries > 0) {
+          *format = 0;
+          return 0;
      }
+set_format:
+     *format = PAGE_DB_FORMAT;
+     val.mv_size = sizeof(*format);
+     val.mv_data = format;
+     return mdb_put(txn, dbi_info, &key, &val, 0);
+}
 
-     if (txn_manager_new(&p->txn_manager, 0) != 0) {
-          page_db_set_error(p, page_db_error_internal, __func__);
-          page_db_add_error(p, p->txn_manager?
-                            p->txn_manager->error->message:
-                            "NULL");
-          return p->error->code;
-     }
+/** Position inside @ref PageDB::idx2hash of the page with the given index */
+static size_t
+page_db_idx2hash_pos(const PageDB *db, uint64_t idx) {
+     return idx/db->n_shards;
+}
+
+/** Term of an entry of @ref PageDB::idx2hash inside its checksum, which is
+ * the sum of the terms of all the entries.
+ *
+ * A sum can be updated as entries change. Pruned entries add nothing, so
+ * that indices can be left without a page without changing the checksum.
+ */
+static uint64_t
+page_db_idx2hash_mix(size_t pos, uint64_t hash) {
+     if (hash == 0)
+          return 0;
+     // final mix of MurmurHash3
+     uint64_t h = hash ^ ((uint64_t)pos*0x9e3779b97f4a7c15ULL);
+     h ^= h >> 33;
+     h *= 0xff51afd7ed558ccdULL;
+     h ^= h >> 33;
+     h *= 0xc4ceb9fe1a85ec53ULL;
+     h ^= h >> 33;
+     return h;
+}
+
+/** Open @ref PageDB::idx2hash, rebuilding it from hash2idx if it does not
+ * match the database.
+ *
+ * Entries are written before the transaction that adds the page commits.
+ * Unless a sync policy is set, see @ref page_db_set_sync, the OS writes them
+ * back in any order, so after a crash any entry can be stale. The file is
+ * also missing if the database was written by an older version. The entries
+ * are checked against info.idx2hash_sum, which is updated by the same
+ * transactions, and the checksum is stored again after a rebuild.
+ */
+static PageDBError
+page_db_idx2hash_load(PageDB *db) {
+     MDB_txn *txn = 0;
+     MDB_cursor *cur_hash2idx = 0;
+     MDB_cursor *cur_info = 0;
+     MDB_val key;
+     MDB_val val;
 
-     // initialize LMDB on the directory
-     MDB_txn *txn;
-     MDB_dbi dbi;
      int mdb_rc = 0;
-     if ((mdb_rc = mdb_env_create(&p->txn_manager->env) != 0))
-          error = "creating environment";
-     else if ((mdb_rc = mdb_env_set_mapsize(
-                    p->txn_manager->env, PAGE_DB_DEFAULT_SIZE)) != 0)
-          error = "setting map size";
-     else if ((mdb_rc = mdb_env_set_maxdbs(p->txn_manager->env, 5)) != 0)
-          error = "setting number of databases";
-     else if ((mdb_rc = mdb_env_open(
+     char *error1 = 0;
+     char *error2 = 0;
+
+     char *path = build_path(db->path, "idx2hash.bin");
+     if (!path) {
+          error1 = "building idx2hash path";
+          goto on_error;
+     }
+     if ((txn_manager_begin(db->txn_manager, MDB_RDONLY, &txn)) != 0) {
+          error1 = db->txn_manager->error->message;
+          goto on_error;
+     }
+     if ((mdb_rc = page_db_open_hash2idx(txn, &cur_hash2idx)) != 0)
+          error1 = "opening hash2idx cursor";
+     else if ((mdb_rc = page_db_open_info(txn, &cur_info)) != 0)
+          error1 = "opening info cursor";
+     if (error1)
+          goto on_error;
+
+     key.mv_size = sizeof(info_n_pages);
+     key.mv_data = info_n_pages;
+     if ((mdb_rc = mdb_cursor_get(cur_info, &key, &val, MDB_SET)) != 0) {
+          error1 = "retrieving info.n_pages";
+          goto on_error;
+     }
+     size_t n_pages = *(size_t*)val.mv_data;
+
+     int has_sum = 0;
+     uint64_t stored_sum = 0;
+     key.mv_size = sizeof(info_idx2hash_sum);
+     key.mv_data = info_idx2hash_sum;
+     switch (mdb_rc = mdb_cursor_get(cur_info, &key, &val, MDB_SET)) {
+     case 0:
+          has_sum = 1;
+          stored_sum = *(uint64_t*)val.mv_data;
+          break;
+     case MDB_NOTFOUND:
+          break;
+     default:
+          error1 = "retrieving info.idx2hash_sum";
+          goto on_error;
+     }
+     mdb_rc = 0;
+
+     // keeps page_db_idx2hash_sync away from the array being replaced
+     pthread_mutex_lock(&db->idx2hash_lock);
+     db->n_idx2hash = 0;
+     pthread_mutex_unlock(&db->idx2hash_lock);
+     mmap_array_delete(db->idx2hash);
+     // entries past n_pages belong to uncommitted pages and can be dropped
+     if (mmap_array_new(&db->idx2hash, path, n_pages, sizeof(uint64_t)) != 0) {
+          error1 = "opening idx2hash array";
+          error2 = db->idx2hash? db->idx2hash->error->message: "memory error";
+          goto on_error;
+     }
+     db->idx2hash->persist = 1;
+     uint64_t *hashes = (uint64_t*)db->idx2hash->mem;
+
+     // a sequential pass over the file, much cheaper than the rebuild
+     uint64_t sum = 0;
+     for (size_t pos=0; pos<n_pages; ++pos)
+          sum += page_db_idx2hash_mix(pos, hashes[pos]);
+     if (has_sum && sum == stored_sum) {
+          pthread_mutex_lock(&db->idx2hash_lock);
+          db->n_idx2hash = n_pages;
+          pthread_mutex_unlock(&db->idx2hash_lock);
+          goto exit;
+     }
+
+     mmap_array_zero(db->idx2hash);
+     sum = 0;
+     for (mdb_rc = mdb_cursor_get(cur_hash2idx, &key, &val, MDB_FIRST);
+          mdb_rc == 0;
+          mdb_rc = mdb_cursor_get(cur_hash2idx, &key, &val, MDB_NEXT)) {
+          size_t pos = page_db_idx2hash_pos(db, *(uint64_t*)val.mv_data);
+          if (pos < n_pages) {
+               hashes[pos] = *(uint64_t*)key.mv_data;
+               sum += page_db_idx2hash_mix(pos, hashes[pos]);
+          }
+     }
+     if (mdb_rc != MDB_NOTFOUND) {
+          error1 = "iterating on hash2idx";
+          goto on_error;
+     }
+     mdb_rc = 0;
+     txn_manager_abort(db->txn_manager, txn);
+     txn = 0;
+     pthread_mutex_lock(&db->idx2hash_lock);
+     db->n_idx2hash = n_pages;
+     pthread_mutex_unlock(&db->idx2hash_lock);
+
+     if (!has_sum || sum != stored_sum) {
+          if ((txn_manager_begin(db->txn_manager, 0, &txn)) != 0) {
+               txn = 0;
+               error1 = db->txn_manager->error->message;
+               goto on_error;
+          }
+          if ((mdb_rc = page_db_open_info(txn, &cur_info)) != 0) {
+               error1 = "opening info cursor";
+               goto on_error;
+          }
+          key.mv_size = sizeof(info_idx2hash_sum);
+          key.mv_data = info_idx2hash_sum;
+          val.mv_size = sizeof(sum);
+          val.mv_data = &sum;
+          if ((mdb_rc = mdb_cursor_put(cur_info, &key, &val, 0)) != 0) {
+               error1 = "storing info.idx2hash_sum";
+               goto on_error;
+          }
+          if (txn_manager_commit(db->txn_manager, txn) != 0) {
+               txn = 0;
+               error1 = db->txn_manager->error->message;
+               goto on_error;
+          }
+          txn = 0;
+     }
+     goto exit;
+
+on_error:
+     page_db_set_error(db, page_db_error_internal, __func__);
+     page_db_add_error(db, error1);
+     if (error2)
+          page_db_add_error(db, error2);
+     if (mdb_rc != 0)
+          page_db_add_error(db, mdb_strerror(mdb_rc));
+exit:
+     if (txn)
+          txn_manager_abort(db->txn_manager, txn);
+     free(path);
+     return db->error->code;
+}
+
+/** Store the hash of a page inside @ref PageDB::idx2hash.
+ *
+ * New pages usually go past the committed entries, which readers never
+ * touch, so only growing the array needs the lock. Indices recycled by
+ * @ref page_db_prune are the exception.
+ *
+ * @param hash 0 marks the index as pruned
+ *
+ * @return 0 if success, otherwise an errno code
+ */
+static int
+page_db_idx2hash_set(PageDB *db, uint64_t idx, uint64_t hash) {
+     MMapArray *hashes = db->idx2hash;
+     size_t pos = page_db_idx2hash_pos(db, idx);
+     if (pos >= hashes->n_elements) {
+          size_t n = hashes->n_elements;
+          while (n <= pos)
+               n *= 2;
+          pthread_mutex_lock(&db->idx2hash_lock);
+          int rc = mmap_array_resize(hashes, n);
+          pthread_mutex_unlock(&db->idx2hash_lock);
+          if (rc != 0)
+               return ENOMEM;
+     }
+     if (pos < db->n_idx2hash) {
+          pthread_mutex_lock(&db->idx2hash_lock);
+          ((uint64_t*)hashes->mem)[pos] = hash;
+          pthread_mutex_unlock(&db->idx2hash_lock);
+     } else
+          ((uint64_t*)hashes->mem)[pos] = hash;
+     return 0;
+}
+
+/** Write back @ref PageDB::idx2hash before each sync of the environment,
+ * see @ref TxnManager::before_sync.
+ *
+ * Otherwise a crash could lose entries of pages already committed, and the
+ * next open would rebuild the whole array.
+ *
+ * @return 0 if success, otherwise an errno code
+ */
+static int
+page_db_idx2hash_sync(void *state) {
+     PageDB *db = state;
+     int rc = 0;
+     pthread_mutex_lock(&db->idx2hash_lock);
+     if (db->n_idx2hash > 0 && mmap_array_sync(db->idx2hash, MS_SYNC) != 0) {
+          rc = EIO;
+          // the next sync retries it
+          error_clean(db->idx2hash->error);
+     }
+     pthread_mutex_unlock(&db->idx2hash_lock);
+     return rc;
+}
+
+/** Initial size of @ref PageDB::link_log, and size after truncation */
+#define PAGE_DB_LINK_LOG_MIN_SIZE 1024
+
+/** Create an empty @ref PageDB::link_log.
+ *
+ * The log is only meaningful while the database is open, so its file is
+ * truncated now and deleted with the database.
+ */
+static PageDBError
+page_db_link_log_open(PageDB *db) {
+     char *path = build_path(db->path, "links_log.bin");
+     if (!path) {
+          page_db_set_error(db, page_db_error_memory, __func__);
+          page_db_add_error(db, "building link log path");
+          return db->error->code;
+     }
+     if (mmap_array_new(&db->link_log, path, PAGE_DB_LINK_LOG_MIN_SIZE, sizeof(uint64_t)) != 0) {
+          page_db_set_error(db, page_db_error_internal, __func__);
+          page_db_add_error(db, "opening link log array");
+          page_db_add_error(db, db->link_log? db->link_log->error->message: "memory error");
+     } else
+          db->link_log->persist = 0;
+     free(path);
+     return db->error->code;
+}
+
+/** Drop all the records of @ref PageDB::link_log. The lock must be held */
+static void
+page_db_link_log_truncate(PageDB *db) {
+     db->n_link_log = 0;
+     ++db->link_log_generation;
+     // if shrinking fails the array just keeps its size
+     if (db->link_log->n_elements > PAGE_DB_LINK_LOG_MIN_SIZE)
+          (void)mmap_array_resize(db->link_log, PAGE_DB_LINK_LOG_MIN_SIZE);
+}
+
+/** Truncate @ref PageDB::link_log after the links database has been written
+ * without logging, so that readers start again from the database */
+static void
+page_db_link_log_reset(PageDB *db) {
+     pthread_mutex_lock(&db->link_log_lock);
+     page_db_link_log_truncate(db);
+     pthread_mutex_unlock(&db->link_log_lock);
+}
+
+/** Append a record with the links of a page to @ref PageDB::link_log.
+ *
+ * As with @ref PageDB::idx2hash entries go past the committed ones, and
+ * they are published by @ref page_db_writer_commit.
+ *
+ * @return 0 if success, otherwise an errno code
+ */
+static int
+page_db_link_log_append(PageDBWriter *w,
+                        uint64_t idx,
+                        const uint64_t *diff_id, size_t n_diff,
+                        const uint64_t *same_id, size_t n_same) {
+     PageDB *db = w->db;
+     if (db->link_log_max_size == 0)
+          return 0;
+
+     MMapArray *log = db->link_log;
+     size_t end = w->n_link_log + 3 + n_diff + n_same;
+     if (end > log->n_elements) {
+          size_t n = log->n_elements;
+          while (n < end)
+               n *= 2;
+          pthread_mutex_lock(&db->link_log_lock);
+          int rc = mmap_array_resize(log, n);
+          pthread_mutex_unlock(&db->link_log_lock);
+          if (rc != 0)
+               return ENOMEM;
+     }
+     uint64_t *record = (uint64_t*)log->mem + w->n_link_log;
+     record[0] = idx;
+     record[1] = n_diff;
+     record[2] = n_same;
+     if (n_diff > 0)
+          memcpy(record + 3, diff_id, n_diff*sizeof(uint64_t));
+     if (n_same > 0)
+          memcpy(record + 3 + n_diff, same_id, n_same*sizeof(uint64_t));
+     w->n_link_log = end;
+     return 0;
+}
+
+PageDBError
+page_db_new(PageDB **db, const char *path) {
+     PageDB *p = *db = malloc(sizeof(*p));
+     if (p == 0)
+          return page_db_error_memory;
+
+     p->error = error_new();
+     if (p->error == 0) {
+          free(p);
+          return page_db_error_memory;
+     }
+     p->persist = PAGE_DB_DEFAULT_PERSIST;
+     p->domain_temp = 0;
+     p->link_filter = 0;
+     p->link_filter_bits = PAGE_DB_DEFAULT_LINK_FILTER_BITS;
+     memset(&p->link_filter_stats, 0, sizeof(p->link_filter_stats));
+     p->info_cache = 0;
+     p->shard = 0;
+     p->n_shards = 1;
+     p->idx2hash = 0;
+     p->n_idx2hash = 0;
+     p->link_log = 0;
+     p->n_link_log = 0;
+     p->link_log_generation = 1;
+     p->link_log_max_size = PAGE_DB_DEFAULT_LINK_LOG_MAX_SIZE;
+     if (pthread_mutex_init(&p->idx2hash_lock, 0) != 0) {
+          error_delete(p->error);
+          free(p);
+          *db = 0;
+          return page_db_error_memory;
+     }
+     if (pthread_mutex_init(&p->link_log_lock, 0) != 0) {
+          pthread_mutex_destroy(&p->idx2hash_lock);
+          error_delete(p->error);
+          free(p);
+          *db = 0;
+          return page_db_error_memory;
+     }
+
+     // create directory if not present yet
+     const char *error = make_dir(path);
+     if ((p->path = strdup(path)) == 0) {
+          error = "could not duplicate path string";
+     }
+     if (error != 0) {
+          page_db_set_error(p, page_db_error_invalid_path, __func__);
+          page_db_add_error(p, error);
+          return p->error->code;
+     }
+
+     if (txn_manager_new(&p->txn_manager, 0) != 0) {
+          page_db_set_error(p, page_db_error_internal, __func__);
+          page_db_add_error(p, p->txn_manager?
+                            p->txn_manager->error->message:
+                            "NULL");
+          return p->error->code;
+     }
+
+     // initialize LMDB on the directory
+     MDB_txn *txn;
+     MDB_dbi dbi;
+     MDB_dbi dbi_hash2info;
+     MDB_dbi dbi_domain_stats;
+     uint32_t format = 0;
+     int mdb_rc = 0;
+     if ((mdb_rc = mdb_env_create(&p->txn_manager->env) != 0))
+          error = "creating environment";
+     else if ((mdb_rc = mdb_env_set_mapsize(
+                    p->txn_manager->env, PAGE_DB_DEFAULT_SIZE)) != 0)
+          error = "setting map size";
+     else if ((mdb_rc = mdb_env_set_maxdbs(p->txn_manager->env, PAGE_DB_MAX_DBS)) != 0)
+          error = "setting number of databases";
+     else if ((mdb_rc = mdb_env_open(
                     p->txn_manager->env,
                     path,
                     MDB_NOTLS | MDB_NOSYNC, 0664) != 0))
@@ -644,7 +1928,7 @@ page_db_new(PageDB **db, const char *path) {
      else if ((mdb_rc = mdb_dbi_open(txn,
                                      "hash2info",
                                      MDB_CREATE | MDB_INTEGERKEY,
-                                     &dbi)) != 0)
+                                     &dbi_hash2info)) != 0)
           error = "creating hash2info database";
      else if ((mdb_rc = mdb_dbi_open(txn,
                                      "hash2idx",
@@ -656,55 +1940,83 @@ page_db_new(PageDB **db, const char *path) {
                                      MDB_CREATE | MDB_INTEGERKEY,
                                      &dbi)) != 0)
           error = "creating links database";
+     else if ((mdb_rc = mdb_dbi_open(txn,
+                                     "domains",
+                                     MDB_CREATE | MDB_INTEGERKEY,
+                                     &p->dbi_domains)) != 0)
+          error = "creating domains database";
+     else if ((mdb_rc = mdb_dbi_open(txn,
+                                     "pruned",
+                                     MDB_CREATE | MDB_INTEGERKEY,
+                                     &dbi)) != 0)
+          error = "creating pruned database";
+     else if ((mdb_rc = mdb_dbi_open(txn,
+                                     "free",
+                                     MDB_CREATE | MDB_INTEGERKEY,
+                                     &dbi)) != 0)
+          error = "creating free database";
+     else if ((mdb_rc = mdb_dbi_open(txn,
+                                     "domain_stats",
+                                     MDB_CREATE | MDB_INTEGERKEY,
+                                     &dbi_domain_stats)) != 0)
+          error = "creating domain_stats database";
      else if ((mdb_rc = mdb_dbi_open(txn, "info", MDB_CREATE, &dbi)) != 0)
           error = "creating info database";
-     else {
-          // initialize n_pages inside info database
-          size_t n_pages = 0;
-          MDB_val key = {
-               .mv_size = sizeof(info_n_pages),
-               .mv_data = info_n_pages
-          };
-          MDB_val val = {
-               .mv_size = sizeof(size_t),
-               .mv_data = &n_pages
-          };
-          switch (mdb_rc = mdb_put(txn, dbi, &key, &val, MDB_NOOVERWRITE)) {
-          case MDB_KEYEXIST:
-          case 0:
-               if (txn_manager_commit(p->txn_manager, txn) != 0)
-                    error = p->txn_manager->error->message;
-               break; // we good
-          default:
-               error = "could not initialize info.n_pages";
-          }
+     else if ((mdb_rc = page_db_init_info(txn, dbi, dbi_hash2info, &format)) != 0)
+          error = "initializing info database";
+     else if ((mdb_rc = page_db_get_shard(txn, dbi, &p->shard, &p->n_shards)) != 0)
+          error = "reading shard settings";
+     else if (format != PAGE_DB_FORMAT) {
+          txn_manager_abort(p->txn_manager, txn);
+          txn_manager_close_env(p->txn_manager);
+
+          char msg[100];
+          sprintf(msg, "database has format %u but format %u is required",
+                  format, PAGE_DB_FORMAT);
+          page_db_set_error(p, page_db_error_format, __func__);
+          page_db_add_error(p, msg);
+          page_db_add_error(p, "convert it using page_db_migrate");
+          return p->error->code;
      }
+     else if ((mdb_rc = page_db_domain_stats_init(txn, dbi_hash2info, dbi_domain_stats)) != 0)
+          error = "building domain_stats database";
+     else if (txn_manager_commit(p->txn_manager, txn) != 0)
+          error = p->txn_manager->error->message;
 
      if (error != 0) {
           page_db_set_error(p, page_db_error_internal, __func__);
           page_db_add_error(p, error);
           page_db_add_error(p, mdb_strerror(mdb_rc));
 
-          mdb_env_close(p->txn_manager->env);
+          txn_manager_close_env(p->txn_manager);
+          return p->error->code;
      }
 
-     return p->error->code;
+     if (page_db_idx2hash_load(p) != 0)
+          return p->error->code;
+     p->txn_manager->before_sync = page_db_idx2hash_sync;
+     p->txn_manager->before_sync_state = p;
+     return page_db_link_log_open(p);
 }
 
 
 /** Store a new or updated @ref PageInfo for a crawled page.
  *
+ * @param hosts Host prefixes of the write transaction
  * @param cur An open cursor to the hash2info database
  * @param key The key (hash) to the page
  * @param page
+ * @param stats If not NULL, the change is added to these domain statistics
  * @param mdb_error In case of failure, if the error occurs inside LMDB this output parameter
  *                  will be set with the error (otherwise is set to zero).
  * @return 0 if success, -1 if failure.
  */
 static int
-page_db_add_crawled_page_info(MDB_cursor *cur,
+page_db_add_crawled_page_info(PageDBHosts *hosts,
+                              MDB_cursor *cur,
                               MDB_val *key,
                               const CrawledPage *page,
+                              PageDBDomainStats *stats,
                               PageInfo **page_info,
                               int *mdb_error) {
      MDB_val val;
@@ -714,8 +2026,10 @@ page_db_add_crawled_page_info(MDB_cursor *cur,
      int put_flags = 0;
      switch (mdb_rc) {
      case 0:
-          if (!(*page_info = page_info_load(&val)))
+          if (!(*page_info = page_info_load(hosts, key, &val)))
                goto on_error;
+          if (stats)
+               page_db_domain_stats_info(stats, -1, *page_info);
           if ((page_info_update(*page_info, page) != 0))
                goto on_error;
           put_flags = MDB_CURRENT;
@@ -728,21 +2042,15 @@ page_db_add_crawled_page_info(MDB_cursor *cur,
           goto on_error;
      }
 
-     if ((page_info_dump(*page_info, &val)   != 0))
-          goto on_error;
-
-     if ((mdb_rc = mdb_cursor_put(cur, key, &val, put_flags)) != 0)
+     if ((mdb_rc = page_info_put(hosts, cur, key, *page_info, put_flags, 0)) != 0)
           goto on_error;
-
-     free(val.mv_data);
-     val.mv_data = 0;
+     if (stats)
+          page_db_domain_stats_info(stats, 1, *page_info);
 
      *mdb_error = 0;
      return 0;
 
 on_error:
-     if (val.mv_data)
-          free(val.mv_data);
      *mdb_error = mdb_rc;
      page_info_delete(*page_info);
      return -1;
@@ -750,44 +2058,53 @@ on_error:
 
 /** Store a new or updated @ref PageInfo for an uncrawled link.
  *
+ * @param hosts Host prefixes of the write transaction
  * @param cur An open cursor to the hash2info database
  * @param key The key (hash) to the page
  * @param url
+ * @param stats If not NULL, the new page is added to these domain statistics
+ * @param page_info If not NULL a new @ref PageInfo will be allocated and
+ *                  returned here. Otherwise the link is serialized without
+ *                  allocating memory.
  * @param mdb_error In case of failure, if the error occurs inside LMDB this output parameter
  *                  will be set with the error (otherwise is set to zero).
  * @return 0 if success, -1 if failure.
  */
 static int
-page_db_add_link_page_info(MDB_cursor *cur,
+page_db_add_link_page_info(PageDBHosts *hosts,
+                           MDB_cursor *cur,
                            MDB_val *key,
                            uint64_t linked_from,
                            uint64_t depth,
                            const LinkInfo *link,
+                           PageDBDomainStats *stats,
                            PageInfo **page_info,
                            int *mdb_error) {
-     MDB_val val;
      int mdb_rc = 0;
 
-     PageInfo *pi = *page_info =
-          page_info_new_link(link->url, linked_from, depth, link->score);
-     if (!pi)
-          goto on_error;
-
-     if ((page_info_dump(pi, &val)   != 0))
-          goto on_error;
+     PageInfo tmp;
+     PageInfo *pi = 0;
+     if (page_info) {
+          pi = *page_info =
+               page_info_new_link(link->url, linked_from, depth, link->score);
+          if (!pi)
+               goto on_error;
+     } else {
+          memset(&tmp, 0, sizeof(tmp));
+          tmp.url = (char*)link->url;
+          tmp.linked_from = linked_from;
+          tmp.depth = depth;
+          tmp.score = link->score;
+     }
 
-     if ((mdb_rc = mdb_cursor_put(cur, key, &val, MDB_NOOVERWRITE)) != 0)
+     if ((mdb_rc = page_info_put(hosts, cur, key, pi? pi: &tmp, MDB_NOOVERWRITE, 0)) != 0)
           goto on_error;
-
-     free(val.mv_data);
-     val.mv_data = 0;
+     if (stats)
+          page_db_domain_stats_info(stats, 1, pi? pi: &tmp);
 
      *mdb_error = 0;
      return 0;
 on_error:
-     if (val.mv_data)
-          free(val.mv_data);
-
      *mdb_error = mdb_rc;
      page_info_delete(pi);
      return -1;
@@ -804,460 +2121,3210 @@ on_error:
             |                                 |
             +--------> page_info_new_link <---+
 */
-PageDBError
-page_db_add(PageDB *db, const CrawledPage *page, PageInfoList **page_info_list) {
-     // check if page should be expanded
-     if (page_db_expand(db) != 0)
-          return db->error->code;
 
-     MDB_txn *txn;
-
-     MDB_cursor *cur_hash2info;
-     MDB_cursor *cur_hash2idx;
-     MDB_cursor *cur_links;
-     MDB_cursor *cur_info;
+/** Pages with at most this number of links keep their link ids on the stack */
+#define PAGE_DB_STACK_LINKS 256
+/** Minimum number of pages the filter of known URLs is sized for */
+#define PAGE_DB_LINK_FILTER_MIN_CAPACITY (1 << 16)
 
-     MDB_val key;
-     MDB_val val;
+/** A link of a crawled page, sorted by hash before touching the database */
+typedef struct {
+     uint64_t hash; /**< @ref page_db_hash of the link URL */
+     size_t i;      /**< Position inside the crawled page */
+} PageDBLink;
 
-     int mdb_rc;
-     char *error = 0;
+/** Link id of duplicated links */
+#define PAGE_DB_DUP_ID UINT64_MAX
 
-     uint64_t *diff_id = 0;
-     uint64_t *same_id = 0;
+/** Flag of a link inside the same domain as the crawled page */
+#define PAGE_DB_LINK_SAME 0x1
+/** Flag of a link not yet inside hash2idx */
+#define PAGE_DB_LINK_NEW  0x2
 
-     // start a new write transaction
-     txn = 0;
-     if ((txn_manager_begin(db->txn_manager, 0, &txn)) != 0)
-          error = db->txn_manager->error->message;
-     else if ((mdb_rc = page_db_open_hash2info(txn, &cur_hash2info)) != 0)
-          error = "opening hash2info cursor";
-     else if ((mdb_rc = page_db_open_hash2idx(txn, &cur_hash2idx)) != 0)
-          error = "opening hash2idx cursor";
-     else if ((mdb_rc = page_db_open_links(txn, &cur_links)) != 0)
-          error = "opening links cursor";
-     else if ((mdb_rc = page_db_open_info(txn, &cur_info)) != 0)
-          error = "opening info cursor";
+/** Order links by hash and, among duplicates, by position */
+static int
+page_db_link_cmp(const void *a, const void *b) {
+     const PageDBLink *la = a;
+     const PageDBLink *lb = b;
+     if (la->hash != lb->hash)
+          return la->hash < lb->hash? -1: 1;
+     return la->i < lb->i? -1: la->i > lb->i;
+}
 
-     if (error != 0)
-          goto on_error;
+/** Check if a link is inside the same domain as the crawled page.
+ *
+ * The limits of both domains are the ones found by @ref page_db_hash_domain.
+ */
+static int
+page_db_link_same_domain(const char *url, int start, int end,
+                         const char *cp_url, int cp_start, int cp_end) {
+     if (cp_start >= 0)
+          return
+               start >= 0 &&
+               end - start == cp_end - cp_start &&
+               memcmp(url + start, cp_url + cp_start, end - start + 1) == 0;
+     else
+          return start < 0 && strcmp(url, cp_url) == 0;
+}
 
-     // get n_pages
-     key.mv_size = sizeof(info_n_pages);
-     key.mv_data = info_n_pages;
-     if ((mdb_rc = mdb_cursor_get(cur_info, &key, &val, MDB_SET)) != 0) {
-          error = "retrieving info.n_pages";
-          goto on_error;
-     }
-     size_t n_pages = *(size_t*)val.mv_data;
+/** Same as @ref page_db_link_same_domain but for already hashed URLs.
+ *
+ * URLs without domain have a domain hash of 0, and then they are only
+ * inside the same domain as themselves.
+ */
+static int
+page_db_hash_same_domain(uint64_t hash, uint64_t cp_hash) {
+     uint32_t domain = page_db_hash_get_domain(hash);
+     if (domain != 0)
+          return domain == page_db_hash_get_domain(cp_hash);
+     else
+          return hash == cp_hash;
+}
 
-     uint64_t cp_hash = page_db_hash(page->url);
-     key.mv_size = sizeof(uint64_t);
-     key.mv_data = &cp_hash;
+void
+crawled_page_domain_init(CrawledPageDomain *d, const CrawledPage *cp) {
+     d->page = cp;
+     if (cp->hash != 0) {
+          d->hash = cp->hash;
+          d->start = d->end = -2;
+     } else
+          d->hash = page_db_hash_domain(cp->url, &d->start, &d->end);
+}
 
-     if (db->domain_temp) {
-          domain_temp_update(db->domain_temp, (float)page->time);
-          domain_temp_heat(db->domain_temp, page_db_hash_get_domain(cp_hash));
+uint64_t
+crawled_page_domain_link(CrawledPageDomain *d, size_t i, int *same) {
+     const LinkInfo *link = crawled_page_get_link(d->page, i);
+     if (link->hash != 0) {
+          *same = page_db_hash_same_domain(link->hash, d->hash);
+          return link->hash;
      }
+     int start, end;
+     if (url_domain(link->url, &start, &end) != 0)
+          start = end = -1;
+     if (d->start == -2 && url_domain(d->page->url, &d->start, &d->end) != 0)
+          d->start = d->end = -1;
+     *same = page_db_link_same_domain(
+          link->url, start, end, d->page->url, d->start, d->end);
+     // links to the same domain share the domain hash of the crawled page
+     uint32_t domain = 0;
+     if (start >= 0)
+          domain = *same?
+               page_db_hash_get_domain(d->hash):
+               XXH32(link->url + start, end - start + 1, 0);
+     return page_db_hash_join(domain, XXH32(link->url, strlen(link->url), 0));
+}
 
-     PageInfo *pi;
-     if (page_db_add_crawled_page_info(cur_hash2info, &key, page, &pi, &mdb_rc) != 0) {
-          error = "adding/updating page info";
-          goto on_error;
+/** Find the index of a page, using the filter of known URLs if enabled.
+ *
+ * @return 0 if found, MDB_NOTFOUND if not, otherwise an LMDB error code
+ */
+static int
+page_db_find_idx(PageDB *db, MDB_cursor *cur_hash2idx, MDB_val *key, uint64_t *id) {
+     if (db->link_filter) {
+          db->link_filter_stats.n_queries++;
+          if (!bloom_filter_contains(db->link_filter, *(uint64_t*)key->mv_data))
+               return MDB_NOTFOUND;
+          db->link_filter_stats.n_positives++;
      }
-     uint64_t link_depth = pi->depth + 1;
-
+     MDB_val val;
+     int mdb_rc = mdb_cursor_get(cur_hash2idx, key, &val, MDB_SET);
+     if (mdb_rc == 0)
+          *id = *(uint64_t*)val.mv_data;
+     else if (mdb_rc == MDB_NOTFOUND && db->link_filter)
+          db->link_filter_stats.n_false_positives++;
+     return mdb_rc;
+}
+
+/** Replace the first occurrence of old_id by new_id */
+static void
+page_db_replace_id(uint64_t *ids, size_t n, uint64_t old_id, uint64_t new_id) {
+     for (size_t i=0; i<n; ++i)
+          if (ids[i] == old_id) {
+               ids[i] = new_id;
+               return;
+          }
+}
+
+/** Store the links of a crawled page.
+ *
+ * The format for the links is the following:
+ *
+ *     KEY = ID of crawled page
+ *     VAL = Number of links to different domain,
+ *           diff link id 1, diff link id 2, ...
+ *           same link id 1, same link id 2, ...
+ *
+ * The ids are stored as deltas starting from the crawled page, encoded using
+ * varint.
+ *
+ * @param flags Flags for mdb_cursor_put. MDB_RESERVE is added.
+ *
+ * @return 0 if success, otherwise an LMDB error code
+ */
+static int
+page_db_put_links(MDB_cursor *cur_links,
+                  uint64_t idx,
+                  const uint64_t *diff_id, size_t n_diff,
+                  const uint64_t *same_id, size_t n_same,
+                  unsigned int flags) {
+     MDB_val key = {
+          .mv_size = sizeof(idx),
+          .mv_data = &idx
+     };
+     MDB_val val;
+     // We compute first the exact size so that the links can be encoded
+     // directly inside the space reserved by LMDB.
+     uint64_t prev = idx;
+     val.mv_size = varint_size_uint64(n_diff);
+     for (size_t i=0; i<n_diff; prev = diff_id[i++])
+          val.mv_size += varint_size_int64((int64_t)diff_id[i] - (int64_t)prev);
+     for (size_t i=0; i<n_same; prev = same_id[i++])
+          val.mv_size += varint_size_int64((int64_t)same_id[i] - (int64_t)prev);
+     val.mv_data = 0;
+
+     int mdb_rc = mdb_cursor_put(cur_links, &key, &val, flags | MDB_RESERVE);
+     if (mdb_rc != 0)
+          return mdb_rc;
+
+     uint8_t *buf = val.mv_data;
+     prev = idx;
+     buf = varint_encode_uint64(n_diff, buf);
+     for (size_t i=0; i<n_diff; prev = diff_id[i++])
+          buf = varint_encode_int64((int64_t)diff_id[i] - (int64_t)prev, buf);
+     for (size_t i=0; i<n_same; prev = same_id[i++])
+          buf = varint_encode_int64((int64_t)same_id[i] - (int64_t)prev, buf);
+     return 0;
+}
+
+/** Index of the n-th page stored inside the database */
+static uint64_t
+page_db_shard_idx(const PageDB *db, size_t n) {
+     return (uint64_t)n*db->n_shards + db->shard;
+}
+
+/** Assign an index past all the pages stored */
+static uint64_t
+page_db_writer_next_idx(PageDBWriter *w) {
+     return page_db_shard_idx(w->db, w->n_pages++);
+}
+
+/** Assign an index to a new page, recycling first the indices freed by
+ * @ref page_db_prune.
+ *
+ * @return 0 if success, otherwise an LMDB error code
+ */
+static int
+page_db_writer_new_idx(PageDBWriter *w, uint64_t *idx) {
+     if (w->n_free == 0) {
+          *idx = page_db_writer_next_idx(w);
+          return 0;
+     }
+     // remembered so that idx2hash can be restored if the writer aborts
+     if (w->n_reused == w->m_reused) {
+          size_t m = w->m_reused > 0? 2*w->m_reused: PAGE_DB_STACK_LINKS;
+          uint64_t *reused = realloc(w->reused, m*sizeof(*reused));
+          if (!reused)
+               return ENOMEM;
+          w->reused = reused;
+          w->m_reused = m;
+     }
+     MDB_val key;
+     MDB_val val;
+     int mdb_rc = mdb_cursor_get(w->cur_free, &key, &val, MDB_FIRST);
+     if (mdb_rc == 0) {
+          *idx = *(uint64_t*)key.mv_data;
+          mdb_rc = mdb_cursor_del(w->cur_free, 0);
+     }
+     if (mdb_rc == 0) {
+          w->reused[w->n_reused++] = *idx;
+          --w->n_free;
+     }
+     return mdb_rc;
+}
+
+/** Give back an index assigned by @ref page_db_writer_new_idx that was
+ * not used, so that the next new page takes it */
+static int
+page_db_writer_free_idx(PageDBWriter *w, uint64_t idx) {
+     MDB_val key = {
+          .mv_size = sizeof(idx),
+          .mv_data = &idx
+     };
+     MDB_val empty = {
+          .mv_size = 0,
+          .mv_data = 0
+     };
+     int mdb_rc = mdb_cursor_put(w->cur_free, &key, &empty, 0);
+     if (mdb_rc == 0)
+          ++w->n_free;
+     return mdb_rc;
+}
+
+/** Give a page to an index of @ref PageDB::idx2hash without one,
+ * updating the checksum stored at commit.
+ *
+ * @return 0 if success, otherwise an errno code
+ */
+static int
+page_db_writer_idx2hash_set(PageDBWriter *w, uint64_t idx, uint64_t hash) {
+     w->idx2hash_sum += page_db_idx2hash_mix(page_db_idx2hash_pos(w->db, idx), hash);
+     return page_db_idx2hash_set(w->db, idx, hash);
+}
+
+/** Store the checksum of @ref PageDB::idx2hash, see
+ * @ref page_db_idx2hash_mix
+ *
+ * @return 0 if success, otherwise an LMDB error code
+ */
+static int
+page_db_writer_put_idx2hash_sum(PageDBWriter *w) {
+     MDB_val key = {
+          .mv_size = sizeof(info_idx2hash_sum),
+          .mv_data = info_idx2hash_sum
+     };
+     MDB_val val = {
+          .mv_size = sizeof(w->idx2hash_sum),
+          .mv_data = &w->idx2hash_sum
+     };
+     return mdb_cursor_put(w->cur_info, &key, &val, 0);
+}
+
+/** Insert a new page inside hash2idx and idx2hash.
+ *
+ * The filter of known URLs only sees the writes of this handle, and it can
+ * miss pages added by other handles or processes. If the page is already
+ * inside hash2idx the index assigned is given back and id is set to the
+ * stored one.
+ *
+ * @param id The index assigned to the page. Set to the stored index if the
+ *           page was already known.
+ *
+ * @return 0 if inserted, MDB_KEYEXIST if already known, otherwise an LMDB
+ *         error code
+ */
+static int
+page_db_put_idx(PageDBWriter *w, MDB_val *key, uint64_t *id) {
+     PageDB *db = w->db;
+     MDB_val val = {
+          .mv_size = sizeof(*id),
+          .mv_data = id
+     };
+     int mdb_rc = mdb_cursor_put(w->cur_hash2idx, key, &val, MDB_NOOVERWRITE);
+     if (mdb_rc == MDB_KEYEXIST) {
+          uint64_t unused = *id;
+          if ((mdb_rc = mdb_cursor_get(w->cur_hash2idx, key, &val, MDB_SET)) != 0 ||
+              (mdb_rc = page_db_writer_free_idx(w, unused)) != 0)
+               return mdb_rc;
+          *id = *(uint64_t*)val.mv_data;
+          if (db->link_filter) {
+               db->link_filter_stats.n_false_negatives++;
+               bloom_filter_add(db->link_filter, *(uint64_t*)key->mv_data);
+          }
+          return MDB_KEYEXIST;
+     }
+     if (mdb_rc == 0 && db->link_filter)
+          bloom_filter_add(db->link_filter, *(uint64_t*)key->mv_data);
+     if (mdb_rc == 0)
+          mdb_rc = page_db_writer_idx2hash_set(w, *id, *(uint64_t*)key->mv_data);
+     return mdb_rc;
+}
+
+/** Merge the accumulated changes into the domain_stats database.
+ *
+ * @return 0 if success, otherwise an LMDB error code
+ */
+static int
+page_db_writer_flush_domain_stats(PageDBWriter *w) {
+     int mdb_rc = page_db_domain_stats_flush(w->cur_domain_stats,
+                                             w->domain_stats,
+                                             w->n_domain_stats);
+     w->n_domain_stats = 0;
+     return mdb_rc;
+}
+
+/** Get the accumulated changes to the statistics of a domain.
+ *
+ * The pointer is valid until the next call.
+ *
+ * @return 0 if success, otherwise an LMDB error code
+ */
+static int
+page_db_writer_domain_stats(PageDBWriter *w, uint32_t domain, PageDBDomainStats **st) {
+     // the pages of a domain usually arrive together
+     size_t n = w->n_domain_stats;
+     if (n > 0 && w->domain_stats[n - 1].domain == domain) {
+          *st = &w->domain_stats[n - 1].stats;
+          return 0;
+     }
+     if (n == PAGE_DB_DOMAIN_STATS_BUFFER) {
+          int mdb_rc = page_db_writer_flush_domain_stats(w);
+          if (mdb_rc != 0)
+               return mdb_rc;
+          n = 0;
+     }
+     if (n == w->m_domain_stats) {
+          size_t m = n > 0? 2*n: PAGE_DB_STACK_LINKS;
+          PageDBDomainStatsEntry *entries =
+               realloc(w->domain_stats, m*sizeof(*entries));
+          if (!entries)
+               return ENOMEM;
+          w->domain_stats = entries;
+          w->m_domain_stats = m;
+     }
+     PageDBDomainStatsEntry *entry = w->domain_stats + w->n_domain_stats++;
+     memset(entry, 0, sizeof(*entry));
+     entry->domain = domain;
+     *st = &entry->stats;
+     return 0;
+}
+
+/** Remember that the page has been modified inside hash2info.
+ *
+ * The page is removed from @ref PageDB::info_cache once the changes are
+ * committed: removing it before would let a reader with an older snapshot
+ * store it again.
+ *
+ * @return 0 if success, otherwise an LMDB error code
+ */
+static int
+page_db_writer_changed(PageDBWriter *w, uint64_t hash) {
+     if (!w->db->info_cache)
+          return 0;
+     if (w->n_changed == w->m_changed) {
+          size_t m = w->m_changed > 0? 2*w->m_changed: PAGE_DB_STACK_LINKS;
+          uint64_t *changed = realloc(w->changed, m*sizeof(*changed));
+          if (!changed)
+               return ENOMEM;
+          w->changed = changed;
+          w->m_changed = m;
+     }
+     w->changed[w->n_changed++] = hash;
+     return 0;
+}
+
+/** Add a single crawled page inside an already open write transaction.
+ *
+ * @param w The write transaction
+ * @param page
+ * @param page_info_list If not NULL the @ref PageInfo of the updated pages
+ *                       will be added at the head of this list.
+ *
+ * @return 0 if success, otherwise the error code
+ */
+static PageDBError
+page_db_add_page(PageDBWriter *w,
+                 const CrawledPage *page,
+                 PageInfoList **page_info_list) {
+     PageDB *db = w->db;
+     MDB_val key;
+
+     int mdb_rc = 0;
+     char *error = 0;
+
+     uint64_t *diff_id = 0;
+     uint64_t *same_id = 0;
+     uint64_t stack_id[2*(PAGE_DB_STACK_LINKS + 1)];
+     PageDBLink *links = 0;
+     PageDBLink stack_links[PAGE_DB_STACK_LINKS];
+     // id of each link, by position inside the crawled page
+     uint64_t *link_id = 0;
+     uint64_t stack_link_id[PAGE_DB_STACK_LINKS];
+     // PAGE_DB_LINK_* flags of each link
+     uint8_t *link_flags = 0;
+     uint8_t stack_link_flags[PAGE_DB_STACK_LINKS];
+
+     // the domain of the crawled page is parsed just once for all the links
+     CrawledPageDomain cp_domain;
+     crawled_page_domain_init(&cp_domain, page);
+     uint64_t cp_hash = cp_domain.hash;
+     key.mv_size = sizeof(uint64_t);
+     key.mv_data = &cp_hash;
+
+     if (db->domain_temp) {
+          domain_temp_update(db->domain_temp, (float)page->time);
+          domain_temp_heat(db->domain_temp, page_db_hash_get_domain(cp_hash));
+     }
+
+     PageInfo *pi;
+     PageDBDomainStats *stats;
+     if ((mdb_rc = page_db_writer_domain_stats(
+               w, page_db_hash_get_domain(cp_hash), &stats)) != 0) {
+          error = "updating domain statistics";
+          goto on_error;
+     }
+     if (page_db_add_crawled_page_info(&w->hosts, w->cur_hash2info, &key, page, stats, &pi, &mdb_rc) != 0) {
+          error = "adding/updating page info";
+          goto on_error;
+     }
+     if ((mdb_rc = page_db_writer_changed(w, cp_hash)) != 0) {
+          page_info_delete(pi);
+          error = "invalidating cached page info";
+          goto on_error;
+     }
+     uint64_t link_depth = pi->depth + 1;
+
      if (page_info_list) {
-          *page_info_list = page_info_list_new(pi, cp_hash);
-          if (!*page_info_list) {
+          PageInfoList *pil = page_info_list_cons(*page_info_list, pi, cp_hash);
+          if (!pil) {
+               page_info_delete(pi);
                error = "allocating new PageInfo list";
                goto on_error;
           }
+          *page_info_list = pil;
      } else {
           page_info_delete(pi);
           pi = 0;
      }
 
      size_t n_links = crawled_page_n_links(page);
-     // store here links inside the same domain as the crawled page
-     same_id = malloc((n_links + 1)*sizeof(*same_id));
-     // store here links outside the domain of the crawled page
-     diff_id = malloc((n_links + 1)*sizeof(*diff_id));
-     // next link id is going to be written here
-     uint64_t *id = diff_id;
+     if (n_links <= PAGE_DB_STACK_LINKS) {
+          same_id = stack_id;
+          diff_id = stack_id + PAGE_DB_STACK_LINKS + 1;
+          links = stack_links;
+          link_id = stack_link_id;
+          link_flags = stack_link_flags;
+     } else {
+          // store here links inside the same domain as the crawled page
+          same_id = malloc((n_links + 1)*sizeof(*same_id));
+          // store here links outside the domain of the crawled page
+          diff_id = malloc((n_links + 1)*sizeof(*diff_id));
+          links = malloc(n_links*sizeof(*links));
+          link_id = malloc(n_links*sizeof(*link_id));
+          link_flags = malloc(n_links*sizeof(*link_flags));
+     }
      // number of id's in same_id and diff_id. The first element of diff_id
      // array is reserved for the id of the crawled page, so we start at 1.
      // The first element of same_id will be a copy of the last element of
      // diff_id, so we start at 1 too.
      uint64_t same_i = 1;
      uint64_t diff_i = 1;
-     if (!same_id || !diff_id) {
+     if (!same_id || !diff_id || !links || !link_id || !link_flags) {
           error = "could not malloc";
           goto on_error;
      }
-     // hash of the current URL
-     uint64_t hash = cp_hash;
-     for (size_t i=0; i <= n_links; ++i) {
-          const LinkInfo *link = i > 0? crawled_page_get_link(page, i - 1): 0;
-          if (link) {
-               hash = page_db_hash(link->url);
-               key.mv_size = sizeof(uint64_t);
-               key.mv_data = &hash;
 
-               id = same_domain(page->url, link->url)?
-                    same_id + same_i++:
-                    diff_id + diff_i++;
+     key.mv_size = sizeof(uint64_t);
+     key.mv_data = &cp_hash;
+     switch (mdb_rc = page_db_find_idx(db, w->cur_hash2idx, &key, diff_id)) {
+     case 0:
+          break;
+     case MDB_NOTFOUND:
+          if ((mdb_rc = page_db_writer_new_idx(w, diff_id)) != 0 ||
+              ((mdb_rc = page_db_put_idx(w, &key, diff_id)) != 0 &&
+               mdb_rc != MDB_KEYEXIST)) {
+               error = "adding page to hash2idx";
+               goto on_error;
           }
-          val.mv_size = sizeof(uint64_t);
-          val.mv_data = &n_pages;
+          break;
+     default:
+          error = "retrieving page from hash2idx";
+          goto on_error;
+     }
 
-          switch (mdb_rc = mdb_cursor_put(cur_hash2idx, &key, &val, MDB_NOOVERWRITE)) {
-          case MDB_KEYEXIST: // not really an error
-               *id = *(uint64_t*)val.mv_data;
-               break;
+     // Hash all links, sort them and remove duplicates. The databases are
+     // then visited in key order, which keeps the cursors inside the same
+     // B-tree pages between consecutive links.
+     for (size_t i=0; i<n_links; ++i) {
+          int same;
+          links[i].hash = crawled_page_domain_link(&cp_domain, i, &same);
+          links[i].i = i;
+          link_flags[i] = same? PAGE_DB_LINK_SAME: 0;
+     }
+     qsort(links, n_links, sizeof(*links), page_db_link_cmp);
+     size_t n_unique = 0;
+     for (size_t i=0; i<n_links; ++i) {
+          link_id[i] = PAGE_DB_DUP_ID;
+          if (n_unique == 0 || links[i].hash != links[n_unique - 1].hash)
+               links[n_unique++] = links[i];
+     }
+
+     size_t n_new = 0;
+     for (size_t i=0; i<n_unique; ++i) {
+          key.mv_size = sizeof(uint64_t);
+          key.mv_data = &links[i].hash;
+          switch (mdb_rc = page_db_find_idx(db, w->cur_hash2idx, &key, link_id + links[i].i)) {
           case 0:
-               *id = n_pages++;
-               if (link) {
-                    if (page_db_add_link_page_info(
-                             cur_hash2info,
-                             &key,
-                             cp_hash,
-                             link_depth,
-                             link,
-                             &pi,
-                             &mdb_rc) != 0) {
-                         error = "adding/updating link info";
-                         goto on_error;
-                    }
-                    if (page_info_list) {
-                         if (!(*page_info_list = page_info_list_cons(*page_info_list, pi, hash))) {
-                              error = "adding new PageInfo to list";
-                              goto on_error;
-                         }
-                    }
-                    else {
-                         page_info_delete(pi);
-                    }
+               break;
+          case MDB_NOTFOUND:
+               link_flags[links[i].i] |= PAGE_DB_LINK_NEW;
+               ++n_new;
+               break;
+          default:
+               error = "retrieving link from hash2idx";
+               goto on_error;
+          }
+     }
 
+     // new pages are numbered in the order the crawler sent them, and links
+     // are stored in that order too
+     for (size_t i=0; i<n_links; ++i) {
+          if (link_flags[i] & PAGE_DB_LINK_NEW) {
+               if ((mdb_rc = page_db_writer_new_idx(w, link_id + i)) != 0) {
+                    error = "assigning index to link";
+                    goto on_error;
                }
+          } else if (link_id[i] == PAGE_DB_DUP_ID)
+               continue;
+          if (link_flags[i] & PAGE_DB_LINK_SAME)
+               same_id[same_i++] = link_id[i];
+          else
+               diff_id[diff_i++] = link_id[i];
+     }
+
+     // and inserted in key order
+     for (size_t i=0; i<n_unique && n_new > 0; ++i) {
+          if (!(link_flags[links[i].i] & PAGE_DB_LINK_NEW))
+               continue;
+          --n_new;
+          key.mv_size = sizeof(uint64_t);
+          key.mv_data = &links[i].hash;
+          uint64_t id = link_id[links[i].i];
+          switch (mdb_rc = page_db_put_idx(w, &key, &id)) {
+          case 0:
                break;
+          case MDB_KEYEXIST:
+               // added meanwhile by another handle: point to the stored page
+               page_db_replace_id(
+                    link_flags[links[i].i] & PAGE_DB_LINK_SAME? same_id + 1: diff_id + 1,
+                    link_flags[links[i].i] & PAGE_DB_LINK_SAME? same_i - 1: diff_i - 1,
+                    link_id[links[i].i],
+                    id);
+               link_id[links[i].i] = id;
+               continue;
           default:
+               error = "adding link to hash2idx";
+               goto on_error;
+          }
+          if ((mdb_rc = page_db_writer_domain_stats(
+                    w, page_db_hash_get_domain(links[i].hash), &stats)) != 0) {
+               error = "updating domain statistics";
+               goto on_error;
+          }
+          if (page_db_add_link_page_info(
+                   &w->hosts,
+                   w->cur_hash2info,
+                   &key,
+                   cp_hash,
+                   link_depth,
+                   crawled_page_get_link(page, links[i].i),
+                   stats,
+                   page_info_list? &pi: 0,
+                   &mdb_rc) != 0) {
+               error = "adding/updating link info";
+               goto on_error;
+          }
+          if (page_info_list) {
+               PageInfoList *pil =
+                    page_info_list_cons(*page_info_list, pi, links[i].hash);
+               if (!pil) {
+                    page_info_delete(pi);
+                    error = "adding new PageInfo to list";
+                    goto on_error;
+               }
+               *page_info_list = pil;
+          }
+     }
+
+     if ((mdb_rc = page_db_put_links(w->cur_links,
+                                     diff_id[0],
+                                     diff_id + 1, diff_i - 1,
+                                     same_id + 1, same_i - 1,
+                                     0)) != 0 ||
+         (mdb_rc = page_db_link_log_append(w,
+                                           diff_id[0],
+                                           diff_id + 1, diff_i - 1,
+                                           same_id + 1, same_i - 1)) != 0) {
+          error = "storing links";
+          goto on_error;
+     }
+
+     if (same_id != stack_id) {
+          free(same_id);
+          free(diff_id);
+          free(links);
+          free(link_id);
+          free(link_flags);
+     }
+
+     return 0;
+
+on_error:
+     if (same_id != stack_id) {
+          free(same_id);
+          free(diff_id);
+          free(links);
+          free(link_id);
+          free(link_flags);
+     }
+
+     page_db_set_error(db, page_db_error_internal, __func__);
+     page_db_add_error(db, error);
+     if (mdb_rc != 0)
+          page_db_add_error(db, mdb_strerror(mdb_rc));
+
+     return db->error->code;
+}
+
+/** Build the filter of known URLs from the hashes inside hash2idx.
+ *
+ * It is sized with room to grow and built again when it gets full, so that
+ * the false positive rate stays close to the one requested.
+ *
+ * @param cur_hash2idx An open cursor to the hash2idx database, the
+ *                     filter will match the content seen by its transaction.
+ * @param n_new Number of pages about to be added
+ *
+ * @return 0 if success, otherwise an LMDB error code
+ */
+static int
+page_db_link_filter_build(PageDB *db, MDB_cursor *cur_hash2idx, size_t n_new) {
+     if (db->link_filter_bits == 0) {
+          bloom_filter_delete(db->link_filter);
+          db->link_filter = 0;
+          return 0;
+     }
+     if (db->link_filter &&
+         db->link_filter->n_items + n_new <= db->link_filter->capacity)
+          return 0;
+
+     MDB_stat stat;
+     int mdb_rc = mdb_stat(mdb_cursor_txn(cur_hash2idx),
+                           mdb_cursor_dbi(cur_hash2idx),
+                           &stat);
+     if (mdb_rc != 0)
+          return mdb_rc;
+
+     size_t capacity = 2*(stat.ms_entries + n_new);
+     if (capacity < PAGE_DB_LINK_FILTER_MIN_CAPACITY)
+          capacity = PAGE_DB_LINK_FILTER_MIN_CAPACITY;
+
+     BloomFilter *bf = bloom_filter_new(capacity, db->link_filter_bits);
+     if (!bf)
+          return ENOMEM;
+
+     MDB_val key;
+     MDB_val val;
+     for (mdb_rc = mdb_cursor_get(cur_hash2idx, &key, &val, MDB_FIRST);
+          mdb_rc == 0;
+          mdb_rc = mdb_cursor_get(cur_hash2idx, &key, &val, MDB_NEXT))
+          bloom_filter_add(bf, *(uint64_t*)key.mv_data);
+     if (mdb_rc != MDB_NOTFOUND) {
+          bloom_filter_delete(bf);
+          return mdb_rc;
+     }
+
+     bloom_filter_delete(db->link_filter);
+     db->link_filter = bf;
+     return 0;
+}
+
+/** Start a write transaction that adds n_pages crawled pages */
+static PageDBError
+page_db_writer_begin_many(PageDBWriter *w, PageDB *db, size_t n_pages) {
+     memset(w, 0, sizeof(*w));
+     w->db = db;
+
+     // check if page should be expanded
+     if (page_db_expand(db, n_pages) != 0)
+          return db->error->code;
+
+     MDB_val key;
+     MDB_val val;
+
+     int mdb_rc = 0;
+     char *error = 0;
+
+     // start a new write transaction
+     if ((txn_manager_begin(db->txn_manager, 0, &w->txn)) != 0) {
+          w->txn = 0;
+          error = db->txn_manager->error->message;
+     }
+     else if ((mdb_rc = page_db_open_hash2info(w->txn, &w->cur_hash2info)) != 0)
+          error = "opening hash2info cursor";
+     else if ((mdb_rc = page_db_open_hash2idx(w->txn, &w->cur_hash2idx)) != 0)
+          error = "opening hash2idx cursor";
+     else if ((mdb_rc = page_db_open_links(w->txn, &w->cur_links)) != 0)
+          error = "opening links cursor";
+     else if ((mdb_rc = page_db_open_info(w->txn, &w->cur_info)) != 0)
+          error = "opening info cursor";
+     else if ((mdb_rc = page_db_hosts_init(&w->hosts, w->txn, 0)) != 0)
+          error = "opening domains database";
+     else if ((mdb_rc = page_db_open_free(w->txn, &w->cur_free)) != 0)
+          error = "opening free cursor";
+     else if ((mdb_rc = page_db_open_domain_stats(w->txn, &w->cur_domain_stats)) != 0)
+          error = "opening domain_stats cursor";
+
+     if (error != 0)
+          goto on_error;
+
+     MDB_stat stat;
+     if ((mdb_rc = mdb_stat(w->txn, mdb_cursor_dbi(w->cur_free), &stat)) != 0) {
+          error = "counting free indices";
+          goto on_error;
+     }
+     w->n_free = stat.ms_entries;
+
+     // get n_pages
+     key.mv_size = sizeof(info_n_pages);
+     key.mv_data = info_n_pages;
+     if ((mdb_rc = mdb_cursor_get(w->cur_info, &key, &val, MDB_SET)) != 0) {
+          error = "retrieving info.n_pages";
+          goto on_error;
+     }
+     w->n_pages = *(size_t*)val.mv_data;
+
+     // rebuilt when the database is opened if missing
+     key.mv_size = sizeof(info_idx2hash_sum);
+     key.mv_data = info_idx2hash_sum;
+     switch (mdb_rc = mdb_cursor_get(w->cur_info, &key, &val, MDB_SET)) {
+     case 0:
+          w->idx2hash_sum = *(uint64_t*)val.mv_data;
+          break;
+     case MDB_NOTFOUND:
+          w->idx2hash_sum = 0;
+          break;
+     default:
+          error = "retrieving info.idx2hash_sum";
+          goto on_error;
+     }
+     mdb_rc = 0;
+
+     // we are the only writer, so readers have had the chance to follow
+     // the log since the last truncation
+     pthread_mutex_lock(&db->link_log_lock);
+     if (db->n_link_log > db->link_log_max_size)
+          page_db_link_log_truncate(db);
+     w->n_link_log = db->n_link_log;
+     pthread_mutex_unlock(&db->link_log_lock);
+
+     return 0;
+
+on_error:
+     page_db_writer_abort(w);
+
+     page_db_set_error(db, page_db_error_internal, __func__);
+     page_db_add_error(db, error);
+     if (mdb_rc != 0)
+          page_db_add_error(db, mdb_strerror(mdb_rc));
+     return db->error->code;
+}
+
+PageDBError
+page_db_writer_begin(PageDBWriter *w, PageDB *db) {
+     return page_db_writer_begin_many(w, db, 1);
+}
+
+PageDBError
+page_db_add(PageDB *db, const CrawledPage *page, PageInfoList **page_info_list) {
+     return page_db_add_many(db, &page, 1, page_info_list);
+}
+
+PageDBError
+page_db_add_many(PageDB *db,
+                 const CrawledPage **pages,
+                 size_t n,
+                 PageInfoList **page_info_list) {
+     if (page_info_list)
+          *page_info_list = 0;
+
+     // the space check is amortized per page, as if they were added one
+     // at a time
+     PageDBWriter w;
+     if (page_db_writer_begin_many(&w, db, n) != 0)
+          return db->error->code;
+
+     // every link can be a new page
+     size_t n_new = 0;
+     for (size_t i=0; i<n; ++i)
+          n_new += 1 + crawled_page_n_links(pages[i]);
+     int mdb_rc = page_db_link_filter_build(db, w.cur_hash2idx, n_new);
+     if (mdb_rc != 0) {
+          page_db_set_error(db, page_db_error_internal, __func__);
+          page_db_add_error(db, "building filter of known URLs");
+          page_db_add_error(db, mdb_strerror(mdb_rc));
+          goto on_error;
+     }
+
+     // all pages share the same transaction, so the cost of opening cursors
+     // and commiting is paid just once for the whole batch
+     for (size_t i=0; i<n; ++i)
+          if (page_db_add_page(&w, pages[i], page_info_list) != 0)
+               goto on_error;
+
+     if (page_db_writer_commit(&w) != 0)
+          goto on_commit_error;
+     return db->error->code;
+
+on_error:
+     page_db_writer_abort(&w);
+on_commit_error:
+     if (page_info_list && *page_info_list) {
+          page_info_list_delete(*page_info_list);
+          *page_info_list = 0;
+     }
+     return db->error->code;
+}
+
+PageDBError
+page_db_writer_commit(PageDBWriter *w) {
+     PageDB *db = w->db;
+     int mdb_rc = 0;
+     char *error = 0;
+
+     // store n_pages
+     MDB_val key = {
+          .mv_size = sizeof(info_n_pages),
+          .mv_data = info_n_pages
+     };
+     MDB_val val = {
+          .mv_size = sizeof(size_t),
+          .mv_data = &w->n_pages
+     };
+     if ((mdb_rc = page_db_writer_flush_domain_stats(w)) != 0) {
+          page_db_writer_abort(w);
+          error = "storing domain statistics";
+     }
+     else if ((mdb_rc = mdb_cursor_put(w->cur_info, &key, &val, 0)) != 0) {
+          page_db_writer_abort(w);
+          error = "storing n_pages";
+     }
+     else if ((mdb_rc = page_db_writer_put_idx2hash_sum(w)) != 0) {
+          page_db_writer_abort(w);
+          error = "storing idx2hash_sum";
+     }
+     else if (txn_manager_commit(db->txn_manager, w->txn) != 0) {
+          w->txn = 0; // already aborted by the transaction manager
+          page_db_writer_abort(w);
+          error = db->txn_manager->error->message;
+     } else {
+          free(w->reused);
+          w->reused = 0;
+          w->n_reused = w->m_reused = 0;
+          free(w->domain_stats);
+          w->domain_stats = 0;
+          w->n_domain_stats = w->m_domain_stats = 0;
+
+          for (size_t i=0; i<w->n_changed; ++i)
+               clock_cache_invalidate(db->info_cache, w->changed[i]);
+          free(w->changed);
+          w->changed = 0;
+          w->n_changed = w->m_changed = 0;
+
+          pthread_mutex_lock(&db->idx2hash_lock);
+          db->n_idx2hash = w->n_pages;
+          pthread_mutex_unlock(&db->idx2hash_lock);
+
+          pthread_mutex_lock(&db->link_log_lock);
+          db->n_link_log = w->n_link_log;
+          pthread_mutex_unlock(&db->link_log_lock);
+     }
+     w->txn = 0;
+
+     if (error != 0) {
+          page_db_set_error(db, page_db_error_internal, __func__);
+          page_db_add_error(db, error);
+          if (mdb_rc != 0)
+               page_db_add_error(db, mdb_strerror(mdb_rc));
+     }
+     return db->error->code;
+}
+
+void
+page_db_writer_abort(PageDBWriter *w) {
+     if (w->txn)
+          txn_manager_abort(w->db->txn_manager, w->txn);
+     w->txn = 0;
+     // recycled indices go back to pruned
+     for (size_t i=0; i<w->n_reused; ++i)
+          (void)page_db_idx2hash_set(w->db, w->reused[i], 0);
+     free(w->reused);
+     w->reused = 0;
+     w->n_reused = w->m_reused = 0;
+     free(w->domain_stats);
+     w->domain_stats = 0;
+     w->n_domain_stats = w->m_domain_stats = 0;
+     free(w->changed);
+     w->changed = 0;
+     w->n_changed = w->m_changed = 0;
+}
+
+PageDBError
+page_db_reserve_idx(PageDB *db,
+                    size_t n_pages,
+                    const uint64_t *reused,
+                    size_t n_reused) {
+     MDB_txn *txn = 0;
+     MDB_cursor *cur_info = 0;
+     MDB_cursor *cur_free = 0;
+     MDB_val key = {
+          .mv_size = sizeof(info_n_pages),
+          .mv_data = info_n_pages
+     };
+     MDB_val val;
+
+     int mdb_rc = 0;
+     char *error = 0;
+
+     // the failure that left the indices to reserve was already reported
+     error_clean(db->txn_manager->error);
+     if (txn_manager_expand(db->txn_manager, 0) != 0 ||
+         txn_manager_begin(db->txn_manager, 0, &txn) != 0) {
+          txn = 0;
+          error = db->txn_manager->error->message;
+          goto on_error;
+     }
+     if ((mdb_rc = page_db_open_info(txn, &cur_info)) != 0) {
+          error = "opening info cursor";
+          goto on_error;
+     }
+     if ((mdb_rc = page_db_open_free(txn, &cur_free)) != 0) {
+          error = "opening free cursor";
+          goto on_error;
+     }
+     if ((mdb_rc = mdb_cursor_get(cur_info, &key, &val, MDB_SET)) != 0) {
+          error = "retrieving info.n_pages";
+          goto on_error;
+     }
+     const size_t n_stored = *(size_t*)val.mv_data;
+     if (n_stored < n_pages) {
+          val.mv_size = sizeof(n_pages);
+          val.mv_data = &n_pages;
+          if ((mdb_rc = mdb_cursor_put(cur_info, &key, &val, 0)) != 0) {
+               error = "storing n_pages";
+               goto on_error;
+          }
+     }
+     for (size_t i=0; i<n_reused; ++i) {
+          uint64_t idx = reused[i];
+          MDB_val free_key = {
+               .mv_size = sizeof(idx),
+               .mv_data = &idx
+          };
+          switch (mdb_rc = mdb_cursor_get(cur_free, &free_key, &val, MDB_SET)) {
+          case 0:
+               if ((mdb_rc = mdb_cursor_del(cur_free, 0)) != 0) {
+                    error = "deleting free index";
+                    goto on_error;
+               }
+               break;
+          case MDB_NOTFOUND:
+               break;
+          default:
+               error = "retrieving free index";
+               goto on_error;
+          }
+     }
+     mdb_rc = 0;
+     if (txn_manager_commit(db->txn_manager, txn) != 0) {
+          txn = 0;
+          error = db->txn_manager->error->message;
+          goto on_error;
+     }
+     // the new pages were not stored, leave their indices without a page
+     for (size_t n=n_stored; n<n_pages; ++n)
+          (void)page_db_idx2hash_set(db, page_db_shard_idx(db, n), 0);
+     pthread_mutex_lock(&db->idx2hash_lock);
+     if (db->n_idx2hash < n_pages)
+          db->n_idx2hash = n_pages;
+     pthread_mutex_unlock(&db->idx2hash_lock);
+     return 0;
+
+on_error:
+     if (txn)
+          txn_manager_abort(db->txn_manager, txn);
+     page_db_set_error(db, page_db_error_internal, __func__);
+     page_db_add_error(db, error);
+     if (mdb_rc != 0)
+          page_db_add_error(db, mdb_strerror(mdb_rc));
+     return db->error->code;
+}
+
+/** Find the index of a page, inserting it if new.
+ *
+ * @param is_new Set to 1 if the page was inserted
+ * @return 0 if success, otherwise an LMDB error code
+ */
+static int
+page_db_writer_idx(PageDBWriter *w, MDB_val *key, uint64_t *idx, int *is_new) {
+     *is_new = 0;
+     int mdb_rc = page_db_find_idx(w->db, w->cur_hash2idx, key, idx);
+     if (mdb_rc == MDB_NOTFOUND &&
+         (mdb_rc = page_db_writer_new_idx(w, idx)) == 0) {
+          if ((mdb_rc = page_db_put_idx(w, key, idx)) == 0)
+               *is_new = 1;
+          else if (mdb_rc == MDB_KEYEXIST)
+               mdb_rc = 0;
+     }
+     return mdb_rc;
+}
+
+PageDBError
+page_db_writer_add_crawled(PageDBWriter *w,
+                           const CrawledPage *page,
+                           uint64_t hash,
+                           uint64_t *depth,
+                           uint64_t *idx) {
+     PageDB *db = w->db;
+     MDB_val key = {
+          .mv_size = sizeof(hash),
+          .mv_data = &hash
+     };
+     int mdb_rc = 0;
+     char *error = 0;
+     int is_new;
+
+     if (db->domain_temp) {
+          domain_temp_update(db->domain_temp, (float)page->time);
+          domain_temp_heat(db->domain_temp, page_db_hash_get_domain(hash));
+     }
+
+     PageInfo *pi;
+     PageDBDomainStats *stats;
+     if ((mdb_rc = page_db_writer_domain_stats(
+               w, page_db_hash_get_domain(hash), &stats)) != 0)
+          error = "updating domain statistics";
+     else if (page_db_add_crawled_page_info(&w->hosts, w->cur_hash2info, &key, page, stats, &pi, &mdb_rc) != 0)
+          error = "adding/updating page info";
+     else if ((mdb_rc = page_db_writer_changed(w, hash)) != 0) {
+          page_info_delete(pi);
+          error = "invalidating cached page info";
+     }
+     else {
+          *depth = pi->depth;
+          page_info_delete(pi);
+          if ((mdb_rc = page_db_writer_idx(w, &key, idx, &is_new)) != 0)
+               error = "adding page to hash2idx";
+     }
+     if (error != 0) {
+          page_db_set_error(db, page_db_error_internal, __func__);
+          page_db_add_error(db, error);
+          if (mdb_rc != 0)
+               page_db_add_error(db, mdb_strerror(mdb_rc));
+     }
+     return db->error->code;
+}
+
+PageDBError
+page_db_writer_add_link(PageDBWriter *w,
+                        uint64_t hash,
+                        const LinkInfo *link,
+                        uint64_t linked_from,
+                        uint64_t depth,
+                        uint64_t *idx) {
+     PageDB *db = w->db;
+     MDB_val key = {
+          .mv_size = sizeof(hash),
+          .mv_data = &hash
+     };
+     int mdb_rc = 0;
+     char *error = 0;
+     int is_new;
+     PageDBDomainStats *stats;
+
+     if ((mdb_rc = page_db_writer_idx(w, &key, idx, &is_new)) != 0)
+          error = "adding link to hash2idx";
+     else if (is_new &&
+              (mdb_rc = page_db_writer_domain_stats(
+                   w, page_db_hash_get_domain(hash), &stats)) != 0)
+          error = "updating domain statistics";
+     else if (is_new &&
+              page_db_add_link_page_info(&w->hosts,
+                                         w->cur_hash2info,
+                                         &key,
+                                         linked_from,
+                                         depth,
+                                         link,
+                                         stats,
+                                         0,
+                                         &mdb_rc) != 0)
+          error = "adding link info";
+
+     if (error != 0) {
+          page_db_set_error(db, page_db_error_internal, __func__);
+          page_db_add_error(db, error);
+          if (mdb_rc != 0)
+               page_db_add_error(db, mdb_strerror(mdb_rc));
+     }
+     return db->error->code;
+}
+
+PageDBError
+page_db_writer_put_links(PageDBWriter *w,
+                         uint64_t idx,
+                         const uint64_t *diff_id, size_t n_diff,
+                         const uint64_t *same_id, size_t n_same) {
+     int mdb_rc = page_db_put_links(w->cur_links, idx, diff_id, n_diff, same_id, n_same, 0);
+     if (mdb_rc == 0)
+          mdb_rc = page_db_link_log_append(w, idx, diff_id, n_diff, same_id, n_same);
+     if (mdb_rc != 0) {
+          page_db_set_error(w->db, page_db_error_internal, __func__);
+          page_db_add_error(w->db, "storing links");
+          page_db_add_error(w->db, mdb_strerror(mdb_rc));
+     }
+     return w->db->error->code;
+}
+
+int
+page_db_ingest(void *state, const CrawledPage **pages, size_t n) {
+     return page_db_add_many((PageDB*)state, pages, n, 0);
+}
+
+/** Number of writes made by @ref page_db_bulk_load inside each transaction */
+#define PAGE_DB_BULK_LOAD_BATCH 100000
+
+/** A crawled page or one of its links, as sorted by @ref page_db_bulk_load.
+ *
+ * It is followed by the URL and the content hash.
+ */
+typedef struct {
+     uint64_t hash;                 /**< Hash of the page */
+     uint64_t seq;                  /**< Position of the crawled page inside the input */
+     uint64_t pos;                  /**< 0 for the crawled page, i + 1 for its i-th link */
+     uint64_t from;                 /**< Hash of the crawled page */
+     double time;                   /**< See @ref CrawledPage::time. Crawled page only */
+     float score;                   /**< Score of the crawled page or of the link */
+     uint32_t same;                 /**< 1 if the link is inside the domain of the crawled page */
+     uint32_t url_size;
+     uint32_t content_hash_length;  /**< Crawled page only */
+} PageDBBulkPage;
+
+/** A link, with the index of its page already assigned */
+typedef struct {
+     uint64_t from;  /**< Hash of the crawled page */
+     uint64_t seq;   /**< See @ref PageDBBulkPage::seq */
+     uint64_t pos;   /**< See @ref PageDBBulkPage::pos */
+     uint64_t idx;   /**< Index of the crawled page if pos is 0, otherwise of the link */
+     uint64_t same;  /**< See @ref PageDBBulkPage::same */
+} PageDBBulkLink;
+
+/** Both @ref PageDBBulkPage and @ref PageDBBulkLink are sorted by their
+ * first three fields */
+static int
+page_db_bulk_cmp(const void *a, const void *b) {
+     const uint64_t *ka = a;
+     const uint64_t *kb = b;
+     for (int i=0; i<3; ++i)
+          if (ka[i] != kb[i])
+               return ka[i] < kb[i]? -1: 1;
+     return 0;
+}
+
+/** Add a crawled page or a link to the sort */
+static int
+page_db_bulk_add(ExternalSort *pages,
+                 char **buf, size_t *buf_size,
+                 const PageDBBulkPage *page,
+                 const char *url,
+                 const char *content_hash) {
+     size_t size = sizeof(*page) + page->url_size + page->content_hash_length;
+     if (size > *buf_size) {
+          char *new_buf = realloc(*buf, size);
+          if (!new_buf)
+               return -1;
+          *buf = new_buf;
+          *buf_size = size;
+     }
+     memcpy(*buf, page, sizeof(*page));
+     memcpy(*buf + sizeof(*page), url, page->url_size);
+     if (page->content_hash_length > 0)
+          memcpy(*buf + sizeof(*page) + page->url_size,
+                 content_hash,
+                 page->content_hash_length);
+     return external_sort_add(pages, *buf, size);
+}
+
+/** Write the links of a crawled page. The links are ordered by position */
+static int
+page_db_bulk_put_links(PageDBWriter *w,
+                       uint64_t idx,
+                       const PageDBBulkLink *links, size_t n_links,
+                       uint64_t **ids, size_t *m_ids) {
+     if (2*n_links > *m_ids) {
+          uint64_t *new_ids = realloc(*ids, 2*n_links*sizeof(*new_ids));
+          if (!new_ids)
+               return ENOMEM;
+          *ids = new_ids;
+          *m_ids = 2*n_links;
+     }
+     uint64_t *diff_id = *ids;
+     uint64_t *same_id = *ids + n_links;
+     size_t n_diff = 0;
+     size_t n_same = 0;
+     for (size_t i=0; i<n_links; ++i)
+          if (links[i].same)
+               same_id[n_same++] = links[i].idx;
+          else
+               diff_id[n_diff++] = links[i].idx;
+     return page_db_put_links(w->cur_links,
+                              idx,
+                              diff_id, n_diff,
+                              same_id, n_same,
+                              MDB_APPEND);
+}
+
+/** Commit the current batch of the bulk load and start a new one, which
+ * gives a chance to expand the database */
+static PageDBError
+page_db_bulk_next_batch(PageDBWriter *w, size_t *n_puts) {
+     PageDB *db = w->db;
+     if (++(*n_puts) < PAGE_DB_BULK_LOAD_BATCH)
+          return 0;
+     *n_puts = 0;
+     if (page_db_writer_commit(w) != 0)
+          return db->error->code;
+     return page_db_writer_begin(w, db);
+}
+
+PageDBError
+page_db_bulk_load(PageDB *db,
+                  PageDBBulkLoadNextFunc *next,
+                  void *state,
+                  size_t max_memory) {
+     ExternalSort *pages = 0;
+     ExternalSort *links = 0;
+     PageDBWriter w;
+
+     int mdb_rc = 0;
+     char *error1 = 0;
+     char *error2 = 0;
+
+     char *buf = 0;
+     size_t buf_size = 0;
+     PageDBLink *page_links = 0;
+     size_t m_page_links = 0;
+     uint8_t *link_same = 0;
+     PageInfo *pi = 0;
+     char *link_url = 0;
+     size_t link_url_size = 0;
+     PageDBBulkLink *page_link_ids = 0;
+     size_t m_page_link_ids = 0;
+     uint64_t *ids = 0;
+     size_t m_ids = 0;
+
+     if (page_db_writer_begin(&w, db) != 0)
+          return db->error->code;
+     if (w.n_pages != 0) {
+          error1 = "bulk load needs an empty database";
+          goto on_error;
+     }
+
+     // the links are sorted while the pages are still being read, so each
+     // sort gets half the memory
+     if (max_memory == 0)
+          max_memory = EXTERNAL_SORT_DEFAULT_MAX_MEMORY;
+     char *ppages = build_path(db->path, "bulk_pages");
+     char *plinks = build_path(db->path, "bulk_links");
+     if (ppages && plinks &&
+         (external_sort_new(&pages, ppages, page_db_bulk_cmp, max_memory/2) != 0 ||
+          external_sort_new(&links, plinks, page_db_bulk_cmp, max_memory/2) != 0))
+          error1 = "creating sorts";
+     else if (!ppages || !plinks)
+          error1 = "memory error";
+     free(ppages);
+     free(plinks);
+     if (error1)
+          goto on_error;
+
+     // 1. Hash the crawled pages and their links, and sort them by hash
+     const CrawledPage *cp;
+     StreamState ss;
+     uint64_t seq = 0;
+     while ((ss = next(state, &cp)) == stream_state_next) {
+          CrawledPageDomain cp_domain;
+          crawled_page_domain_init(&cp_domain, cp);
+          PageDBBulkPage page = {
+               .hash = cp_domain.hash,
+               .seq = seq++,
+               .pos = 0,
+               .time = cp->time,
+               .score = cp->score,
+               .same = 1,
+               .url_size = strlen(cp->url),
+               .content_hash_length = cp->content_hash_length
+          };
+          page.from = page.hash;
+          if (page_db_bulk_add(pages, &buf, &buf_size, &page, cp->url, cp->content_hash) != 0) {
+               error1 = "sorting crawled page";
+               goto on_error;
+          }
+
+          // duplicated links are stored just once, like page_db_add does
+          size_t n_links = crawled_page_n_links(cp);
+          if (n_links > m_page_links) {
+               PageDBLink *new_links = realloc(page_links, n_links*sizeof(*new_links));
+               uint8_t *new_same = realloc(link_same, n_links*sizeof(*new_same));
+               if (new_links)
+                    page_links = new_links;
+               if (new_same)
+                    link_same = new_same;
+               if (!new_links || !new_same) {
+                    error1 = "memory error";
+                    goto on_error;
+               }
+               m_page_links = n_links;
+          }
+          for (size_t i=0; i<n_links; ++i) {
+               int same;
+               page_links[i].hash = crawled_page_domain_link(&cp_domain, i, &same);
+               page_links[i].i = i;
+               link_same[i] = same;
+          }
+          qsort(page_links, n_links, sizeof(*page_links), page_db_link_cmp);
+          for (size_t i=0; i<n_links; ++i) {
+               if (i > 0 && page_links[i].hash == page_links[i - 1].hash)
+                    continue;
+               const LinkInfo *link = crawled_page_get_link(cp, page_links[i].i);
+               PageDBBulkPage link_page = {
+                    .hash = page_links[i].hash,
+                    .seq = page.seq,
+                    .pos = page_links[i].i + 1,
+                    .from = page.hash,
+                    .time = 0,
+                    .score = link->score,
+                    .same = link_same[page_links[i].i],
+                    .url_size = strlen(link->url),
+                    .content_hash_length = 0
+               };
+               if (page_db_bulk_add(pages, &buf, &buf_size, &link_page, link->url, 0) != 0) {
+                    error1 = "sorting link";
+                    goto on_error;
+               }
+          }
+     }
+     if (ss != stream_state_end) {
+          error1 = "reading input";
+          goto on_error;
+     }
+
+     // 2. Assign indices in hash order, and write hash2idx and hash2info
+     //    appending at the end. The links are sorted again, by crawled page,
+     //    now that the index of each link is known.
+     size_t n_puts = 0;
+     const void *data;
+     size_t size;
+     uint64_t hash = 0;
+     uint64_t idx = 0;
+     int has_group = 0;
+     int has_link = 0;
+     PageInfo link_info;
+     while (1) {
+          ss = external_sort_next(pages, &data, &size);
+          if (ss != stream_state_next && ss != stream_state_end) {
+               error1 = "sorting pages";
+               error2 = pages->error->message;
+               goto on_error;
+          }
+          const PageDBBulkPage *page = data;
+
+          if (has_group && (ss == stream_state_end || page->hash != hash)) {
+               MDB_val key = {
+                    .mv_size = sizeof(hash),
+                    .mv_data = &hash
+               };
+               MDB_val val = {
+                    .mv_size = sizeof(idx),
+                    .mv_data = &idx
+               };
+               if ((mdb_rc = mdb_cursor_put(w.cur_hash2idx, &key, &val, MDB_APPEND)) != 0 ||
+                   (mdb_rc = page_db_writer_idx2hash_set(&w, idx, hash)) != 0) {
+                    error1 = "adding page to hash2idx";
+                    goto on_error;
+               }
+               if ((mdb_rc = page_info_put(&w.hosts,
+                                           w.cur_hash2info,
+                                           &key,
+                                           pi? pi: &link_info,
+                                           MDB_APPEND,
+                                           0)) != 0) {
+                    error1 = "adding page info";
+                    goto on_error;
+               }
+               PageDBDomainStats *stats;
+               if ((mdb_rc = page_db_writer_domain_stats(
+                         &w, page_db_hash_get_domain(hash), &stats)) != 0) {
+                    error1 = "updating domain statistics";
+                    goto on_error;
+               }
+               page_db_domain_stats_info(stats, 1, pi? pi: &link_info);
+               page_info_delete(pi);
+               pi = 0;
+               has_group = has_link = 0;
+               if (page_db_bulk_next_batch(&w, &n_puts) != 0)
+                    goto on_writer_error;
+          }
+          if (ss == stream_state_end)
+               break;
+
+          if (!has_group) {
+               hash = page->hash;
+               idx = page_db_writer_next_idx(&w);
+               has_group = 1;
+          }
+          PageDBBulkLink link = {
+               .from = page->from,
+               .seq = page->seq,
+               .pos = page->pos,
+               .idx = idx,
+               .same = page->same
+          };
+          if (external_sort_add(links, &link, sizeof(link)) != 0) {
+               error1 = "sorting links";
+               error2 = links->error->message;
+               goto on_error;
+          }
+
+          // records of the same page are merged in input order, the same
+          // way page_db_add would: the first link creates the page and
+          // each crawl updates it
+          if (page->pos != 0 && (pi || has_link))
+               continue;
+          char **purl = page->pos == 0? &buf: &link_url;
+          size_t *purl_size = page->pos == 0? &buf_size: &link_url_size;
+          if (page->url_size + 1 > *purl_size) {
+               char *new_url = realloc(*purl, page->url_size + 1);
+               if (!new_url) {
+                    error1 = "memory error";
+                    goto on_error;
+               }
+               *purl = new_url;
+               *purl_size = page->url_size + 1;
+          }
+          memcpy(*purl, (const char*)data + sizeof(*page), page->url_size);
+          (*purl)[page->url_size] = '\0';
+
+          if (page->pos != 0) {
+               memset(&link_info, 0, sizeof(link_info));
+               link_info.url = link_url;
+               link_info.linked_from = page->from;
+               link_info.depth = 1;
+               link_info.score = page->score;
+               has_link = 1;
+               continue;
+          }
+          CrawledPage crawled = {
+               .url = buf,
+               .links = 0,
+               .time = page->time,
+               .score = page->score,
+               .content_hash = (char*)data + sizeof(*page) + page->url_size,
+               .content_hash_length = page->content_hash_length
+          };
+          if (!pi) {
+               pi = has_link?
+                    page_info_new_link(link_url,
+                                       link_info.linked_from,
+                                       link_info.depth,
+                                       link_info.score):
+                    page_info_new_crawled(&crawled);
+               if (!pi || (has_link && page_info_update(pi, &crawled) != 0)) {
+                    error1 = "creating page info";
+                    goto on_error;
+               }
+          } else if (page_info_update(pi, &crawled) != 0) {
+               error1 = "updating page info";
+               goto on_error;
+          }
+     }
+
+     // 3. Write the links of each crawled page, in index order. If a page
+     //    was crawled several times only the links of the last crawl are kept.
+     uint64_t from = 0;
+     size_t n_page_link_ids = 0;
+     has_group = 0;
+     while (1) {
+          ss = external_sort_next(links, &data, &size);
+          if (ss != stream_state_next && ss != stream_state_end) {
+               error1 = "sorting links";
+               error2 = links->error->message;
+               goto on_error;
+          }
+          const PageDBBulkLink *link = data;
+
+          if (has_group && (ss == stream_state_end || link->from != from)) {
+               if ((mdb_rc = page_db_bulk_put_links(&w,
+                                                    idx,
+                                                    page_link_ids,
+                                                    n_page_link_ids,
+                                                    &ids,
+                                                    &m_ids)) != 0) {
+                    error1 = "storing links";
+                    goto on_error;
+               }
+               has_group = 0;
+               if (page_db_bulk_next_batch(&w, &n_puts) != 0)
+                    goto on_writer_error;
+          }
+          if (ss == stream_state_end)
+               break;
+
+          if (link->pos == 0) {
+               from = link->from;
+               idx = link->idx;
+               n_page_link_ids = 0;
+               has_group = 1;
+               continue;
+          }
+          if (n_page_link_ids == m_page_link_ids) {
+               size_t m = m_page_link_ids? 2*m_page_link_ids: 256;
+               PageDBBulkLink *new_ids = realloc(page_link_ids, m*sizeof(*new_ids));
+               if (!new_ids) {
+                    error1 = "memory error";
+                    goto on_error;
+               }
+               page_link_ids = new_ids;
+               m_page_link_ids = m;
+          }
+          page_link_ids[n_page_link_ids++] = *link;
+     }
+
+     if (page_db_writer_commit(&w) != 0)
+          goto on_writer_error;
+
+     // the filter of known URLs will be built again on the next write
+     bloom_filter_delete(db->link_filter);
+     db->link_filter = 0;
+     goto exit;
+
+on_error:
+     page_db_set_error(db, page_db_error_internal, __func__);
+     page_db_add_error(db, error1);
+     if (error2)
+          page_db_add_error(db, error2);
+     else if (mdb_rc != 0)
+          page_db_add_error(db, mdb_strerror(mdb_rc));
+on_writer_error:
+     page_db_writer_abort(&w);
+
+exit:
+     // links are appended without logging, even if loading failed halfway
+     page_db_link_log_reset(db);
+     if (db->info_cache)
+          clock_cache_clear(db->info_cache);
+     external_sort_delete(pages);
+     external_sort_delete(links);
+     page_info_delete(pi);
+     free(buf);
+     free(page_links);
+     free(link_same);
+     free(link_url);
+     free(page_link_ids);
+     free(ids);
+     return db->error->code;
+}
+
+PageDBError
+page_db_get_info(PageDB *db, uint64_t hash, PageInfo **pi) {
+     MDB_txn *txn = 0;
+     MDB_cursor *cur = 0;
+     PageDBHosts hosts;
+     uint64_t version = 0;
+
+     if (db->info_cache &&
+         clock_cache_get(db->info_cache, hash, (void**)pi, &version))
+          return 0;
+
+     int mdb_rc = 0;
+     char *error = 0;
+     if (txn_manager_begin(db->txn_manager, MDB_RDONLY, &txn) != 0) {
+          txn = 0;
+          error = db->txn_manager->error->message;
+          goto on_error;
+     }
+     // open hash2info database
+     else if ((mdb_rc = page_db_open_hash2info(txn, &cur)) != 0) {
+          error = "opening hash2info database";
+          goto on_error;
+     }
+     else if ((mdb_rc = page_db_hosts_init(&hosts, txn, MDB_RDONLY)) != 0) {
+          error = "opening domains database";
+          goto on_error;
+     }
+     else {
+          MDB_val key = {
+               .mv_size = sizeof(hash),
+               .mv_data = &hash
+          };
+          MDB_val val;
+          switch (mdb_rc = mdb_cursor_get(cur, &key, &val, MDB_SET)) {
+          case 0:
+               *pi = page_info_load(&hosts, &key, &val);
+               if (!*pi) {
+                    error = "deserializing data from database";
+                    goto on_error;
+               }
+               if (db->info_cache)
+                    clock_cache_put(db->info_cache,
+                                    hash,
+                                    *pi,
+                                    page_info_memory(*pi),
+                                    version);
+               break;
+          case MDB_NOTFOUND:
+               *pi = 0;
+               break;
+          default:
+               error = "retrieving val from hash2info";
+               goto on_error;
+               break;
+          }
+     }
+     mdb_cursor_close(cur);
+     txn_manager_abort(db->txn_manager, txn);
+     return 0;
+
+on_error:
+     if (cur)
+          mdb_cursor_close(cur);
+     if (txn)
+          txn_manager_abort(db->txn_manager, txn);
+     page_db_set_error(db, page_db_error_internal, __func__);
+     page_db_add_error(db, error);
+     if (mdb_rc != 0)
+          page_db_add_error(db, mdb_strerror(mdb_rc));
+
+     return db->error->code;
+}
+
+PageDBError
+page_db_info_cursor_open(PageDB *db, MDB_cursor **cur) {
+     MDB_txn *txn;
+     int mdb_rc = 0;
+     *cur = 0;
+     if (txn_manager_begin(db->txn_manager, MDB_RDONLY, &txn) != 0) {
+          page_db_set_error(db, page_db_error_internal, __func__);
+          page_db_add_error(db, db->txn_manager->error->message);
+     } else if ((mdb_rc = page_db_open_hash2info(txn, cur)) != 0) {
+          txn_manager_abort(db->txn_manager, txn);
+          page_db_set_error(db, page_db_error_internal, __func__);
+          page_db_add_error(db, "opening hash2info cursor");
+          page_db_add_error(db, mdb_strerror(mdb_rc));
+     }
+     return db->error->code;
+}
+
+PageDBError
+page_db_info_cursor_get(PageDB *db,
+                        MDB_cursor *cur,
+                        uint64_t hash,
+                        PageInfoView *view) {
+     MDB_val key = {
+          .mv_size = sizeof(hash),
+          .mv_data = &hash
+     };
+     MDB_val val;
+     PageDBHosts hosts;
+     int mdb_rc;
+     switch (mdb_rc = mdb_cursor_get(cur, &key, &val, MDB_SET)) {
+     case 0:
+          page_db_hosts_init_dbi(
+               &hosts, mdb_cursor_txn(cur), db->dbi_domains, MDB_RDONLY);
+          if (page_info_view_load(view, &hosts, &key, &val) != 0) {
+               page_db_set_error(db, page_db_error_internal, __func__);
+               page_db_add_error(db, "parsing page info");
+               return db->error->code;
+          }
+          return 0;
+     case MDB_NOTFOUND:
+          return page_db_error_no_page;
+     default:
+          page_db_set_error(db, page_db_error_internal, __func__);
+          page_db_add_error(db, "retrieving val from hash2info");
+          page_db_add_error(db, mdb_strerror(mdb_rc));
+          return db->error->code;
+     }
+}
+
+void
+page_db_info_cursor_close(PageDB *db, MDB_cursor *cur) {
+     if (cur) {
+          MDB_txn *txn = mdb_cursor_txn(cur);
+          mdb_cursor_close(cur);
+          txn_manager_abort(db->txn_manager, txn);
+     }
+}
+
+static PageDBError
+page_db_get_idx_cur(PageDB *db, MDB_cursor *cur, uint64_t hash, uint64_t *idx) {
+     int mdb_rc = 0;
+
+     MDB_val key = {
+          .mv_size = sizeof(uint64_t),
+          .mv_data = &hash
+     };
+     MDB_val val;
+     switch (mdb_rc = mdb_cursor_get(cur, &key, &val, MDB_SET)) {
+     case 0:
+          *idx = *(uint64_t*)val.mv_data;
+          return 0;
+
+     case MDB_NOTFOUND:
+          *idx = 0;
+          return page_db_error_no_page;
+
+     default:
+          page_db_set_error(db, page_db_error_internal, __func__);
+          page_db_add_error(db, "retrieving val from hash2info");
+          page_db_add_error(db, mdb_strerror(mdb_rc));
+          return db->error->code;
+     }
+}
+
+PageDBError
+page_db_get_idx(PageDB *db, uint64_t hash, uint64_t *idx) {
+     MDB_txn *txn = 0;
+     MDB_cursor *cur = 0;
+
+     int mdb_rc;
+     int ret = 0;
+     char *error = 0;
+     if (txn_manager_begin(db->txn_manager, MDB_RDONLY, &txn) != 0)
+          error = db->txn_manager->error->message;
+     // open hash2info database
+     else if ((mdb_rc = page_db_open_hash2idx(txn, &cur)) != 0)
+          error = "opening hash2idx database";
+
+     if (error) {
+          page_db_set_error(db, page_db_error_internal, __func__);
+          page_db_add_error(db, error);
+          if (mdb_rc != 0)
+               page_db_add_error(db, mdb_strerror(mdb_rc));
+
+          ret = page_db_error_internal;
+     }
+     else {
+          ret = page_db_get_idx_cur(db, cur, hash, idx);
+     }
+     if (cur)
+          mdb_cursor_close(cur);
+     if (txn)
+          txn_manager_abort(db->txn_manager, txn);
+     return ret;
+}
+
+void
+page_db_reader_init(PageDBReader *r, PageDB *db) {
+     memset(r, 0, sizeof(*r));
+     r->db = db;
+}
+
+PageDBError
+page_db_reader_begin(PageDBReader *r) {
+     PageDB *db = r->db;
+     int mdb_rc = 0;
+     char *error = 0;
+
+     if (r->txn)
+          return 0;
+     if (txn_manager_begin(db->txn_manager, MDB_RDONLY, &r->txn) != 0) {
+          r->txn = 0;
+          page_db_set_error(db, page_db_error_internal, __func__);
+          page_db_add_error(db, db->txn_manager->error->message);
+          return db->error->code;
+     }
+     // cursors of an environment reopened by page_db_compact are not valid
+     if (r->cur_hash2info && r->generation != db->txn_manager->generation) {
+          mdb_cursor_close(r->cur_hash2info);
+          mdb_cursor_close(r->cur_hash2idx);
+          r->cur_hash2info = r->cur_hash2idx = 0;
+     }
+     if (r->cur_hash2info) {
+          if ((mdb_rc = mdb_cursor_renew(r->txn, r->cur_hash2info)) != 0 ||
+              (mdb_rc = mdb_cursor_renew(r->txn, r->cur_hash2idx)) != 0)
+               error = "renewing cursors";
+     }
+     else if ((mdb_rc = page_db_open_hash2info(r->txn, &r->cur_hash2info)) != 0)
+          error = "opening hash2info cursor";
+     else if ((mdb_rc = page_db_open_hash2idx(r->txn, &r->cur_hash2idx)) != 0)
+          error = "opening hash2idx cursor";
+     else
+          r->generation = db->txn_manager->generation;
+
+     if (!error && (mdb_rc = page_db_hosts_init(&r->hosts, r->txn, MDB_RDONLY)) != 0)
+          error = "opening domains database";
+
+     if (error) {
+          page_db_reader_close(r);
+          page_db_set_error(db, page_db_error_internal, __func__);
+          page_db_add_error(db, error);
+          page_db_add_error(db, mdb_strerror(mdb_rc));
+          return db->error->code;
+     }
+     return 0;
+}
+
+void
+page_db_reader_end(PageDBReader *r) {
+     if (r->txn)
+          txn_manager_abort(r->db->txn_manager, r->txn);
+     r->txn = 0;
+}
+
+void
+page_db_reader_close(PageDBReader *r) {
+     page_db_reader_end(r);
+     // cursors of read transactions can be closed after the transaction ends
+     if (r->cur_hash2info)
+          mdb_cursor_close(r->cur_hash2info);
+     if (r->cur_hash2idx)
+          mdb_cursor_close(r->cur_hash2idx);
+     r->cur_hash2info = r->cur_hash2idx = 0;
+}
+
+/** Find and parse the record of a page.
+ *
+ * @return 0 if success, otherwise an LMDB error code
+ */
+static int
+page_db_reader_load_view(PageDBReader *r, uint64_t hash, PageInfoView *view) {
+     MDB_val key = {
+          .mv_size = sizeof(hash),
+          .mv_data = &hash
+     };
+     MDB_val val;
+     int mdb_rc = mdb_cursor_get(r->cur_hash2info, &key, &val, MDB_SET);
+     if (mdb_rc == 0 && page_info_view_load(view, &r->hosts, &key, &val) != 0)
+          mdb_rc = MDB_CORRUPTED;
+     return mdb_rc;
+}
+
+PageDBError
+page_db_reader_get_view(PageDBReader *r, uint64_t hash, PageInfoView *view) {
+     int mdb_rc;
+     switch (mdb_rc = page_db_reader_load_view(r, hash, view)) {
+     case 0:
+          return 0;
+     case MDB_NOTFOUND:
+          return page_db_error_no_page;
+     default:
+          page_db_set_error(r->db, page_db_error_internal, __func__);
+          page_db_add_error(r->db, "retrieving val from hash2info");
+          page_db_add_error(r->db, mdb_strerror(mdb_rc));
+          return r->db->error->code;
+     }
+}
+
+/** Sort the hashes, remembering their position.
+ *
+ * @param stack Used if n is at most @ref PAGE_DB_STACK_LINKS
+ *
+ * @return The sorted hashes, or NULL if failure. If not stack, it must
+ *         be freed by the caller.
+ */
+static PageDBLink *
+page_db_sort_hashes(const uint64_t *hashes, size_t n, PageDBLink *stack) {
+     PageDBLink *sorted =
+          n <= PAGE_DB_STACK_LINKS? stack: malloc(n*sizeof(*sorted));
+     if (!sorted)
+          return 0;
+     for (size_t i=0; i<n; ++i) {
+          sorted[i].hash = hashes[i];
+          sorted[i].i = i;
+     }
+     qsort(sorted, n, sizeof(*sorted), page_db_link_cmp);
+     return sorted;
+}
+
+PageDBError
+page_db_reader_get_view_many(PageDBReader *r,
+                             const uint64_t *hashes,
+                             size_t n,
+                             PageInfoView *views,
+                             char *found) {
+     PageDBLink stack[PAGE_DB_STACK_LINKS];
+     PageDBLink *sorted = page_db_sort_hashes(hashes, n, stack);
+     if (!sorted) {
+          page_db_set_error(r->db, page_db_error_memory, __func__);
+          return r->db->error->code;
+     }
+     int mdb_rc = 0;
+     for (size_t i=0; i<n && mdb_rc == 0; ++i) {
+          size_t j = sorted[i].i;
+          found[j] = 0;
+          switch (mdb_rc = page_db_reader_load_view(r, sorted[i].hash, views + j)) {
+          case 0:
+               found[j] = 1;
+               break;
+          case MDB_NOTFOUND:
+               mdb_rc = 0;
+               break;
+          }
+     }
+     if (sorted != stack)
+          free(sorted);
+     if (mdb_rc != 0) {
+          page_db_set_error(r->db, page_db_error_internal, __func__);
+          page_db_add_error(r->db, "retrieving val from hash2info");
+          page_db_add_error(r->db, mdb_strerror(mdb_rc));
+          return r->db->error->code;
+     }
+     return 0;
+}
+
+PageDBError
+page_db_reader_get_idx(PageDBReader *r, uint64_t hash, uint64_t *idx) {
+     return page_db_get_idx_cur(r->db, r->cur_hash2idx, hash, idx);
+}
+
+PageDBError
+page_db_get_info_many(PageDB *db,
+                      const uint64_t *hashes,
+                      size_t n,
+                      PageInfo **pis) {
+     PageDBReader r;
+     PageDBLink stack[PAGE_DB_STACK_LINKS];
+     PageDBLink *sorted = 0;
+     uint64_t stack_versions[PAGE_DB_STACK_LINKS];
+     uint64_t *versions = 0;
+     int mdb_rc = 0;
+     char *error = 0;
+
+     for (size_t i=0; i<n; ++i)
+          pis[i] = 0;
+     page_db_reader_init(&r, db);
+     if (db->info_cache) {
+          versions = n <= PAGE_DB_STACK_LINKS?
+               stack_versions: malloc(n*sizeof(*versions));
+          if (!versions) {
+               page_db_set_error(db, page_db_error_memory, __func__);
+               return db->error->code;
+          }
+          // versions must be taken before the transaction starts
+          size_t n_hits = 0;
+          for (size_t i=0; i<n; ++i)
+               n_hits += clock_cache_get(
+                    db->info_cache, hashes[i], (void**)(pis + i), versions + i);
+          if (n_hits == n)
+               goto exit;
+     }
+     if (page_db_reader_begin(&r) != 0) {
+          if (versions != stack_versions)
+               free(versions);
+          for (size_t i=0; i<n; ++i) {
+               page_info_delete(pis[i]);
+               pis[i] = 0;
+          }
+          return db->error->code;
+     }
+     if (!(sorted = page_db_sort_hashes(hashes, n, stack))) {
+          error = "memory error";
+          goto on_error;
+     }
+     for (size_t i=0; i<n; ++i) {
+          if (pis[sorted[i].i])
+               continue;
+          MDB_val key = {
+               .mv_size = sizeof(sorted[i].hash),
+               .mv_data = &sorted[i].hash
+          };
+          MDB_val val;
+          switch (mdb_rc = mdb_cursor_get(r.cur_hash2info, &key, &val, MDB_SET)) {
+          case 0:
+               if (!(pis[sorted[i].i] = page_info_load(&r.hosts, &key, &val))) {
+                    mdb_rc = 0;
+                    error = "deserializing data from database";
+                    goto on_error;
+               }
+               if (db->info_cache)
+                    clock_cache_put(db->info_cache,
+                                    sorted[i].hash,
+                                    pis[sorted[i].i],
+                                    page_info_memory(pis[sorted[i].i]),
+                                    versions[sorted[i].i]);
+               break;
+          case MDB_NOTFOUND:
+               break;
+          default:
+               error = "retrieving val from hash2info";
+               goto on_error;
+          }
+     }
+exit:
+     if (sorted != stack)
+          free(sorted);
+     if (versions != stack_versions)
+          free(versions);
+     page_db_reader_close(&r);
+     return 0;
+
+on_error:
+     if (sorted != stack)
+          free(sorted);
+     if (versions != stack_versions)
+          free(versions);
+     page_db_reader_close(&r);
+     for (size_t i=0; i<n; ++i) {
+          page_info_delete(pis[i]);
+          pis[i] = 0;
+     }
+     page_db_set_error(db, page_db_error_internal, __func__);
+     page_db_add_error(db, error);
+     if (mdb_rc != 0)
+          page_db_add_error(db, mdb_strerror(mdb_rc));
+     return db->error->code;
+}
+
+/** Read just the score of a @ref PageInfo record, without touching the
+ * URL or the host prefixes.
+ *
+ * @return 0 if success, -1 if the record is not valid
+ */
+static int
+page_info_score_load(const MDB_val *val, float *score) {
+     const uint8_t *data = val->mv_data;
+     if (val->mv_size == 0)
+          return -1;
+     uint8_t version = data[0] >> 4;
+     if (version < PAGE_DB_FORMAT_COMPAT || version > PAGE_DB_FORMAT)
+          return -1;
+
+     // the varint with the URL size must end inside the record
+     size_t i = 1;
+     while (i < val->mv_size && (data[i] & 0x80))
+          ++i;
+     if (i >= val->mv_size)
+          return -1;
+
+     uint8_t read;
+     uint64_t curl_size = varint_decode_uint64(data + 1, &read);
+     i = 1 + read;
+     if (curl_size > val->mv_size - i ||
+         sizeof(*score) > val->mv_size - i - curl_size)
+          return -1;
+     memcpy(score, data + i + curl_size, sizeof(*score));
+     return 0;
+}
+
+PageDBError
+page_db_get_scores(PageDB *db, MMapArray **scores) {
+     MDB_txn *txn;
+
+     MDB_cursor *cur_hash2info = 0;
+     MDB_cursor *cur_hash2idx = 0;
+     MDB_cursor *cur_info = 0;
+
+     MDB_val key;
+     MDB_val val;
+
+     int mdb_rc = 0;
+     char *error1 = 0;
+     char *error2 = 0;
+
+     char *pscores = 0;
+
+     if ((txn_manager_begin(db->txn_manager, MDB_RDONLY, &txn)) != 0) {
+          txn = 0;
+          error1 = db->txn_manager->error->message;
+     }
+     else if ((mdb_rc = page_db_open_hash2info(txn, &cur_hash2info)) != 0)
+          error1 = "opening hash2info cursor";
+     else if ((mdb_rc = page_db_open_hash2idx(txn, &cur_hash2idx)) != 0)
+          error1 = "opening hash2idx cursor";
+     else if ((mdb_rc = page_db_open_info(txn, &cur_info)) != 0)
+          error1 = "opening info cursor";
+
+     if (error1)
+          goto on_error;
+
+     // get n_pages
+     key.mv_size = sizeof(info_n_pages);
+     key.mv_data = info_n_pages;
+     if ((mdb_rc = mdb_cursor_get(cur_info, &key, &val, MDB_SET)) != 0) {
+          error1 = "retrieving info.n_pages";
+          error2 = mdb_strerror(mdb_rc);
+          goto on_error;
+     }
+     // indices of a shard go up to n_pages*n_shards
+     size_t n_pages = page_db_shard_idx(db, *(size_t*)val.mv_data);
+
+     pscores = build_path(db->path, "scores.bin");
+     if (mmap_array_new(scores, pscores, n_pages, sizeof(float)) != 0) {
+          error1 = "creating scores array";
+          error2 = *scores? (*scores)->error->message: "memory error";
+          goto on_error;
+     }
+     mmap_array_zero(*scores);
+     float *pscore = (float*)(*scores)->mem;
+
+     // hash2info and hash2idx have the same keys in the same order, so they
+     // are joined walking both cursors at the same time
+     MDB_val key_idx;
+     MDB_val val_idx;
+     int mdb_rc_idx = mdb_cursor_get(cur_hash2idx, &key_idx, &val_idx, MDB_FIRST);
+     for (mdb_rc = mdb_cursor_get(cur_hash2info, &key, &val, MDB_FIRST);
+          mdb_rc == 0 && mdb_rc_idx == 0;
+          mdb_rc = mdb_cursor_get(cur_hash2info, &key, &val, MDB_NEXT)) {
+
+          uint64_t hash = *(uint64_t*)key.mv_data;
+          while (mdb_rc_idx == 0 && *(uint64_t*)key_idx.mv_data < hash)
+               mdb_rc_idx = mdb_cursor_get(cur_hash2idx, &key_idx, &val_idx, MDB_NEXT);
+          if (mdb_rc_idx != 0 || *(uint64_t*)key_idx.mv_data != hash)
+               continue;
+
+          uint64_t idx = *(uint64_t*)val_idx.mv_data;
+          if (idx >= n_pages) {
+               error1 = "index out of bounds";
+               goto on_error;
+          }
+          if (page_info_score_load(&val, pscore + idx) != 0) {
+               error1 = "parsing page info";
+               goto on_error;
+          }
+     }
+     if (mdb_rc_idx == MDB_NOTFOUND)
+          mdb_rc = mdb_rc == 0? MDB_NOTFOUND: mdb_rc;
+     else if (mdb_rc_idx != 0) {
+          error1 = "iterating on hash2idx";
+          error2 = mdb_strerror(mdb_rc_idx);
+          goto on_error;
+     }
+     if (mdb_rc != MDB_NOTFOUND) {
+          error1 = "iterating on hash2info";
+          error2 = mdb_strerror(mdb_rc);
+          goto on_error;
+     }
+     goto exit;
+
+on_error:
+     page_db_set_error(db, page_db_error_internal, __func__);
+     page_db_add_error(db, error1);
+     if (error2)
+          page_db_add_error(db, error2);
+
+exit:
+     mdb_cursor_close(cur_hash2info);
+     mdb_cursor_close(cur_hash2idx);
+     mdb_cursor_close(cur_info);
+     if (txn)
+          txn_manager_abort(db->txn_manager, txn);
+     free(pscores);
+
+     return db->error->code;
+}
+
+PageDBError
+page_db_get_hash(PageDB *db, uint64_t idx, uint64_t *hash) {
+     if (idx % db->n_shards != db->shard)
+          return page_db_error_no_page;
+     size_t pos = page_db_idx2hash_pos(db, idx);
+
+     PageDBError ret = page_db_error_no_page;
+     pthread_mutex_lock(&db->idx2hash_lock);
+     if (pos < db->n_idx2hash) {
+          *hash = ((uint64_t*)db->idx2hash->mem)[pos];
+          ret = *hash != 0? 0: page_db_error_pruned;
+     }
+     pthread_mutex_unlock(&db->idx2hash_lock);
+     return ret;
+}
+
+void
+page_db_link_log_tell(PageDB *db, PageDBLinkLogPos *pos) {
+     pthread_mutex_lock(&db->link_log_lock);
+     pos->generation = db->link_log_generation;
+     pos->pos = db->n_link_log;
+     pthread_mutex_unlock(&db->link_log_lock);
+}
+
+PageDBError
+page_db_link_log_read(PageDB *db,
+                      PageDBLinkLogPos *pos,
+                      uint64_t **records,
+                      size_t *n_records) {
+     *records = 0;
+     *n_records = 0;
+
+     PageDBError ret = 0;
+     // copy under the lock since a writer can move the array when it grows
+     pthread_mutex_lock(&db->link_log_lock);
+     if (db->link_log_max_size == 0 ||
+         pos->generation != db->link_log_generation ||
+         pos->pos > db->n_link_log)
+          ret = page_db_error_link_log_reset;
+     else if (pos->pos < db->n_link_log) {
+          size_t n = db->n_link_log - pos->pos;
+          if (!(*records = malloc(n*sizeof(uint64_t))))
+               ret = page_db_error_memory;
+          else {
+               memcpy(*records, (uint64_t*)db->link_log->mem + pos->pos, n*sizeof(uint64_t));
+               *n_records = n;
+               pos->pos = db->n_link_log;
+          }
+     }
+     pthread_mutex_unlock(&db->link_log_lock);
+
+     if (ret == page_db_error_memory) {
+          page_db_set_error(db, page_db_error_memory, __func__);
+          page_db_add_error(db, "copying link log records");
+     }
+     return ret;
+}
+
+void
+page_db_partition(size_t partition,
+                  size_t n_partitions,
+                  uint64_t *first,
+                  uint64_t *last) {
+     // split the 32 bits of the domain hash, the top half of the key
+     *first = ((((uint64_t)partition) << 32)/n_partitions) << 32;
+     if (partition + 1 >= n_partitions)
+          *last = UINT64_MAX;
+     else
+          *last = (((((uint64_t)partition + 1) << 32)/n_partitions) << 32) - 1;
+}
+
+/** Partitions shared by the threads of @ref page_db_scan */
+typedef struct {
+     PageDBScanFunc *f;
+     void *state;
+     size_t n_partitions;
+
+     pthread_mutex_t mtx;
+     size_t next;   /**< Next partition to scan */
+     int failed;    /**< Set when a call fails, no more partitions are handed out */
+} PageDBScan;
+
+static void *
+page_db_scan_worker(void *arg) {
+     PageDBScan *scan = arg;
+     while (1) {
+          pthread_mutex_lock(&scan->mtx);
+          size_t partition = scan->failed? scan->n_partitions: scan->next++;
+          pthread_mutex_unlock(&scan->mtx);
+          if (partition >= scan->n_partitions)
+               break;
+
+          uint64_t first, last;
+          page_db_partition(partition, scan->n_partitions, &first, &last);
+          if (scan->f(scan->state, partition, first, last) != 0) {
+               pthread_mutex_lock(&scan->mtx);
+               scan->failed = 1;
+               pthread_mutex_unlock(&scan->mtx);
+          }
+     }
+     return 0;
+}
+
+PageDBError
+page_db_scan(PageDB *db,
+             size_t n_partitions,
+             size_t n_threads,
+             PageDBScanFunc *f,
+             void *state) {
+     if (n_threads == 0) {
+          long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+          n_threads = n_cpus > 0? (size_t)n_cpus: 1;
+     }
+     if (n_threads > n_partitions)
+          n_threads = n_partitions;
+
+     PageDBScan scan = {
+          .f = f,
+          .state = state,
+          .n_partitions = n_partitions,
+          .next = 0,
+          .failed = 0
+     };
+     if (pthread_mutex_init(&scan.mtx, 0) != 0) {
+          page_db_set_error(db, page_db_error_internal, __func__);
+          page_db_add_error(db, "initializing mutex");
+          return db->error->code;
+     }
+
+     // the calling thread is one of the workers, so the scan goes on even
+     // if no thread can be created
+     pthread_t *threads = n_threads > 1? calloc(n_threads - 1, sizeof(*threads)): 0;
+     size_t n_created = 0;
+     if (threads)
+          while (n_created < n_threads - 1 &&
+                 pthread_create(threads + n_created, 0, page_db_scan_worker, &scan) == 0)
+               ++n_created;
+     page_db_scan_worker(&scan);
+     for (size_t i=0; i<n_created; ++i)
+          pthread_join(threads[i], 0);
+     free(threads);
+     pthread_mutex_destroy(&scan.mtx);
+
+     if (scan.failed) {
+          page_db_set_error(db, page_db_error_internal, __func__);
+          page_db_add_error(db, "scanning partition");
+     }
+     return db->error->code;
+}
+
+float
+page_db_get_domain_crawl_rate(PageDB *db, uint32_t domain_hash) {
+     if (db->domain_temp)
+          return domain_temp_get(db->domain_temp, domain_hash);
+     else
+          return 0.0;
+}
+
+PageDBError
+page_db_get_domain_stats(PageDB *db,
+                         uint32_t domain_hash,
+                         PageDBDomainStats *stats) {
+     MDB_txn *txn = 0;
+     MDB_cursor *cur = 0;
+     MDB_val key = {
+          .mv_size = sizeof(domain_hash),
+          .mv_data = &domain_hash
+     };
+     MDB_val val;
+
+     int mdb_rc = 0;
+     char *error = 0;
+     memset(stats, 0, sizeof(*stats));
+     if (txn_manager_begin(db->txn_manager, MDB_RDONLY, &txn) != 0) {
+          txn = 0;
+          error = db->txn_manager->error->message;
+     }
+     else if ((mdb_rc = page_db_open_domain_stats(txn, &cur)) != 0)
+          error = "opening domain_stats cursor";
+     else switch (mdb_rc = mdb_cursor_get(cur, &key, &val, MDB_SET)) {
+     case 0:
+          memcpy(stats, val.mv_data, sizeof(*stats));
+          break;
+     case MDB_NOTFOUND:
+          mdb_rc = 0;
+          break;
+     default:
+          error = "retrieving domain statistics";
+     }
+
+     if (cur)
+          mdb_cursor_close(cur);
+     if (txn)
+          txn_manager_abort(db->txn_manager, txn);
+     if (error) {
+          page_db_set_error(db, page_db_error_internal, __func__);
+          page_db_add_error(db, error);
+          if (mdb_rc != 0)
+               page_db_add_error(db, mdb_strerror(mdb_rc));
+          return db->error->code;
+     }
+     return 0;
+}
+
+PageDBError
+page_db_get_domain_stats_range(PageDB *db,
+                               uint32_t first,
+                               uint32_t last,
+                               PageDBDomainStatsEntry **entries,
+                               size_t *n_entries) {
+     MDB_txn *txn = 0;
+     MDB_cursor *cur = 0;
+     MDB_val key = {
+          .mv_size = sizeof(first),
+          .mv_data = &first
+     };
+     MDB_val val;
+
+     int mdb_rc = 0;
+     char *error = 0;
+     size_t m = 0;
+     *entries = 0;
+     *n_entries = 0;
+     if (txn_manager_begin(db->txn_manager, MDB_RDONLY, &txn) != 0) {
+          txn = 0;
+          error = db->txn_manager->error->message;
+          goto exit;
+     }
+     if ((mdb_rc = page_db_open_domain_stats(txn, &cur)) != 0) {
+          error = "opening domain_stats cursor";
+          goto exit;
+     }
+     for (mdb_rc = mdb_cursor_get(cur, &key, &val, MDB_SET_RANGE);
+          mdb_rc == 0 && *(uint32_t*)key.mv_data <= last;
+          mdb_rc = mdb_cursor_get(cur, &key, &val, MDB_NEXT)) {
+          if (*n_entries == m) {
+               m = m > 0? 2*m: PAGE_DB_STACK_LINKS;
+               PageDBDomainStatsEntry *new_entries =
+                    realloc(*entries, m*sizeof(*new_entries));
+               if (!new_entries) {
+                    mdb_rc = 0;
+                    error = "memory error";
+                    goto exit;
+               }
+               *entries = new_entries;
+          }
+          PageDBDomainStatsEntry *entry = *entries + (*n_entries)++;
+          entry->domain = *(uint32_t*)key.mv_data;
+          memcpy(&entry->stats, val.mv_data, sizeof(entry->stats));
+     }
+     if (mdb_rc == MDB_NOTFOUND)
+          mdb_rc = 0;
+     else if (mdb_rc != 0)
+          error = "iterating on domain_stats";
+
+exit:
+     if (cur)
+          mdb_cursor_close(cur);
+     if (txn)
+          txn_manager_abort(db->txn_manager, txn);
+     if (error) {
+          free(*entries);
+          *entries = 0;
+          *n_entries = 0;
+          page_db_set_error(db, page_db_error_internal, __func__);
+          page_db_add_error(db, error);
+          if (mdb_rc != 0)
+               page_db_add_error(db, mdb_strerror(mdb_rc));
+          return db->error->code;
+     }
+     return 0;
+}
+
+/** Close database */
+PageDBError
+page_db_delete(PageDB *db) {
+     if (!db)
+          return 0;
+
+     txn_manager_close_env(db->txn_manager);
+     if (txn_manager_delete(db->txn_manager) != 0) {
+          page_db_set_error(db, page_db_error_internal, __func__);
+          page_db_add_error(db, "deleting transaction manager");
+          page_db_add_error(db, db->txn_manager->error->message);
+          return db->error->code;
+     }
+
+     mmap_array_delete(db->idx2hash);
+     mmap_array_delete(db->link_log);
+     if (!db->persist) {
+          char *data = build_path(db->path, "data.mdb");
+          char *lock = build_path(db->path, "lock.mdb");
+          char *idx2hash = build_path(db->path, "idx2hash.bin");
+
+          // proceeed even the data files cannot be deleted from disk
+          (void)remove(data);
+          (void)remove(lock);
+          (void)remove(idx2hash);
+          (void)remove(db->path);
+
+          free(data);
+          free(lock);
+          free(idx2hash);
+     }
+     pthread_mutex_destroy(&db->idx2hash_lock);
+     pthread_mutex_destroy(&db->link_log_lock);
+     free(db->path);
+     domain_temp_delete(db->domain_temp);
+     bloom_filter_delete(db->link_filter);
+     clock_cache_delete(db->info_cache);
+     error_delete(db->error);
+     free(db);
+     return 0;
+}
+
+/** Maximum number of records copied inside a single write transaction by
+ * @ref page_db_migrate */
+#define PAGE_DB_MIGRATE_BATCH 10000
+
+/** Copy a full database from an old environment into the new one.
+ *
+ * Records are appended in the same order, so the destination must be empty.
+ *
+ * @param format_old If not negative the values are @ref PageInfo records
+ *                   that must be converted from this format.
+ */
+static PageDBError
+page_db_migrate_copy(PageDB *db,
+                     MDB_txn *txn_old,
+                     const char *db_name,
+                     int format_old,
+                     size_t *bytes_old,
+                     size_t *bytes_new) {
+     char *error = 0;
+     int mdb_rc = 0;
+
+     MDB_dbi dbi_old;
+     MDB_cursor *cur_old = 0;
+     MDB_txn *txn = 0;
+     MDB_cursor *cur = 0;
+     PageDBHosts hosts;
+
+     if ((mdb_rc = mdb_dbi_open(txn_old, db_name, MDB_INTEGERKEY, &dbi_old)) != 0) {
+          error = "opening old database";
+          goto on_error;
+     }
+     if ((mdb_rc = mdb_cursor_open(txn_old, dbi_old, &cur_old)) != 0) {
+          error = "opening old cursor";
+          goto on_error;
+     }
+
+     MDB_val key;
+     MDB_val val;
+     mdb_rc = mdb_cursor_get(cur_old, &key, &val, MDB_FIRST);
+     while (mdb_rc == 0) {
+          if (txn_manager_expand(db->txn_manager, 0) != 0) {
+               mdb_rc = 0;
+               error = db->txn_manager->error->message;
+               goto on_error;
+          }
+          if (txn_manager_begin(db->txn_manager, 0, &txn) != 0) {
+               txn = 0;
+               mdb_rc = 0;
+               error = db->txn_manager->error->message;
+               goto on_error;
+          }
+          if ((mdb_rc = page_db_open_cursor(txn, db_name, MDB_INTEGERKEY, &cur, 0)) != 0) {
+               error = "opening cursor";
+               goto on_error;
+          }
+          if ((mdb_rc = page_db_hosts_init(&hosts, txn, 0)) != 0) {
+               error = "opening domains database";
+               goto on_error;
+          }
+          for (size_t n=0;
+               n < PAGE_DB_MIGRATE_BATCH && mdb_rc == 0;
+               ++n, mdb_rc = mdb_cursor_get(cur_old, &key, &val, MDB_NEXT)) {
+               if (bytes_old)
+                    *bytes_old += val.mv_size;
+               int put_rc;
+               size_t size = val.mv_size;
+               if (format_old >= 0) {
+                    PageInfo *pi = format_old == 0?
+                         page_info_load_v0(&val):
+                         page_info_load(0, 0, &val);
+                    if (!pi) {
+                         error = "loading old page info";
+                         goto on_error;
+                    }
+                    put_rc = page_info_put(&hosts, cur, &key, pi, MDB_APPEND, &size);
+                    page_info_delete(pi);
+               } else {
+                    put_rc = mdb_cursor_put(cur, &key, &val, MDB_APPEND);
+               }
+               if (bytes_new)
+                    *bytes_new += size;
+               if (put_rc != 0) {
+                    mdb_rc = put_rc;
+                    error = "appending record";
+                    goto on_error;
+               }
+          }
+          if (mdb_rc != 0 && mdb_rc != MDB_NOTFOUND) {
+               error = "iterating old database";
+               goto on_error;
+          }
+          txn_manager_commit(db->txn_manager, txn);
+          txn = 0;
+          if (db->txn_manager->error->code != 0) {
+               mdb_rc = 0;
+               error = db->txn_manager->error->message;
+               goto on_error;
+          }
+     }
+     if (mdb_rc != MDB_NOTFOUND) {
+          error = "iterating old database";
+          goto on_error;
+     }
+     mdb_cursor_close(cur_old);
+     return 0;
+
+on_error:
+     if (txn)
+          txn_manager_abort(db->txn_manager, txn);
+     if (cur_old)
+          mdb_cursor_close(cur_old);
+
+     page_db_set_error(db, page_db_error_internal, __func__);
+     page_db_add_error(db, db_name);
+     page_db_add_error(db, error);
+     if (mdb_rc != 0)
+          page_db_add_error(db, mdb_strerror(mdb_rc));
+     return db->error->code;
+}
+
+PageDBError
+page_db_migrate(PageDB *db,
+                const char *path_old,
+                size_t *bytes_old,
+                size_t *bytes_new) {
+     char *error = 0;
+     int mdb_rc = 0;
+     MDB_env *env_old = 0;
+     MDB_txn *txn_old = 0;
+     MDB_dbi dbi_info;
+     MDB_txn *txn = 0;
+     MDB_cursor *cur_info = 0;
+
+     if (bytes_old)
+          *bytes_old = 0;
+     if (bytes_new)
+          *bytes_new = 0;
+
+     if ((mdb_rc = mdb_env_create(&env_old)) != 0)
+          error = "creating old environment";
+     else if ((mdb_rc = mdb_env_set_maxdbs(env_old, 5)) != 0)
+          error = "setting number of databases";
+     else if ((mdb_rc = mdb_env_open(env_old,
+                                     path_old,
+                                     MDB_NOTLS | MDB_RDONLY, 0664)) != 0)
+          error = "opening old environment";
+     else if ((mdb_rc = mdb_txn_begin(env_old, 0, MDB_RDONLY, &txn_old)) != 0)
+          error = "starting old transaction";
+     else if ((mdb_rc = mdb_dbi_open(txn_old, "info", 0, &dbi_info)) != 0)
+          error = "opening old info database";
+     if (error)
+          goto on_error;
+
+     MDB_val key = {
+          .mv_size = sizeof(info_format),
+          .mv_data = info_format
+     };
+     MDB_val val;
+     int format_old = 0;
+     switch (mdb_rc = mdb_get(txn_old, dbi_info, &key, &val)) {
+     case MDB_NOTFOUND:
+          break;
+     case 0:
+          format_old = *(uint32_t*)val.mv_data;
+          if (format_old >= PAGE_DB_FORMAT) {
+               mdb_rc = 0;
+               error = "old database already has the current format";
                goto on_error;
           }
+          break;
+     default:
+          error = "reading old format";
+          goto on_error;
      }
 
-     // store n_pages
      key.mv_size = sizeof(info_n_pages);
      key.mv_data = info_n_pages;
-     val.mv_size = sizeof(size_t);
-     val.mv_data = &n_pages;
-     if ((mdb_rc = mdb_cursor_put(cur_info, &key, &val, 0)) != 0) {
-          error = "storing n_pages";
+     if ((mdb_rc = mdb_get(txn_old, dbi_info, &key, &val)) != 0) {
+          error = "reading old n_pages";
           goto on_error;
      }
+     size_t n_pages = *(size_t*)val.mv_data;
 
-     // store links and commit transaction
-     // The format for the links is the following:
-     //
-     // KEY = ID of crawled page
-     // VAL = Number of links to different domain,
-     //       diff link id 1, diff link id 2, ...
-     //       same link id 1, same link id 2, ...
+     if (page_db_migrate_copy(db, txn_old, "hash2info", format_old, bytes_old, bytes_new) != 0 ||
+         page_db_migrate_copy(db, txn_old, "hash2idx", -1, 0, 0) != 0 ||
+         page_db_migrate_copy(db, txn_old, "links", -1, 0, 0) != 0)
+          goto on_copy_error;
 
-     key.mv_size = sizeof(uint64_t);
-     key.mv_data = diff_id; // remember that diff_id[0] is the id of the
-                            // crawled page
-     // the links are stored as deltas starting from the 'from' page, encoded
-     // using varint.
-     uint8_t *buf = val.mv_data = malloc(MAX_VARINT_SIZE*(n_links + 1));
-     if (!buf) {
-          error = "allocating memory to store links";
-          goto on_error;
-     }
-     // write number of diff links (substract 1 to take into account this page id)
-     buf = varint_encode_uint64(diff_i - 1, buf);
-     // write diff links
-     for (size_t i=1; i<diff_i; ++i)
-          buf = varint_encode_int64((int64_t)diff_id[i] - (int64_t)diff_id[i-1], buf);
-     same_id[0] = diff_id[diff_i-1];
-     for (size_t i=1; i<same_i; ++i)
-          buf = varint_encode_int64((int64_t)same_id[i] - (int64_t)same_id[i-1], buf);
-
-     val.mv_size = (char*)buf - (char*)val.mv_data;
-     if ((mdb_rc = mdb_cursor_put(cur_links, &key, &val, 0)) != 0) {
-          error = "storing links";
-          goto on_error;
+     val.mv_size = sizeof(n_pages);
+     val.mv_data = &n_pages;
+     if (txn_manager_begin(db->txn_manager, 0, &txn) != 0) {
+          txn = 0;
+          error = db->txn_manager->error->message;
      }
-     free(val.mv_data);
-     free(same_id);
-     free(diff_id);
-     same_id = diff_id = 0;
-
-     if (txn_manager_commit(db->txn_manager, txn) != 0) {
+     else if ((mdb_rc = page_db_open_info(txn, &cur_info)) != 0)
+          error = "opening info cursor";
+     else if ((mdb_rc = mdb_cursor_put(cur_info, &key, &val, 0)) != 0)
+          error = "writing n_pages";
+     else if ((mdb_rc = page_db_domain_stats_build(txn)) != 0)
+          error = "building domain_stats database";
+     else if (txn_manager_commit(db->txn_manager, txn) != 0) {
+          txn = 0;
+          mdb_rc = 0;
           error = db->txn_manager->error->message;
+     } else
+          txn = 0;
+     if (error)
           goto on_error;
-     }
-     return db->error->code;
 
-on_error:
-     if (same_id)
-          free(same_id);
-     if (diff_id)
-          free(diff_id);
-     if (txn)
-          txn_manager_abort(db->txn_manager, txn);
+     mdb_txn_abort(txn_old);
+     mdb_env_close(env_old);
+     page_db_link_log_reset(db);
+     return page_db_idx2hash_load(db);
 
+on_error:
      page_db_set_error(db, page_db_error_internal, __func__);
      page_db_add_error(db, error);
      if (mdb_rc != 0)
           page_db_add_error(db, mdb_strerror(mdb_rc));
+on_copy_error:
+     if (txn)
+          txn_manager_abort(db->txn_manager, txn);
+     if (txn_old)
+          mdb_txn_abort(txn_old);
+     mdb_env_close(env_old);
+     return db->error->code;
+}
 
+PageDBError
+page_db_compact(PageDB *db, size_t *bytes_old, size_t *bytes_new) {
+     if (txn_manager_compact(db->txn_manager,
+                             PAGE_DB_MAX_DBS,
+                             bytes_old,
+                             bytes_new) != 0) {
+          page_db_set_error(db, page_db_error_internal, __func__);
+          page_db_add_error(db, db->txn_manager->error->message);
+     }
      return db->error->code;
 }
 
 PageDBError
-page_db_get_info(PageDB *db, uint64_t hash, PageInfo **pi) {
-     MDB_txn *txn;
-     MDB_cursor *cur = 0;
+page_db_set_map_size(PageDB *db, size_t size, size_t growth) {
+     txn_manager_set_growth(db->txn_manager, growth);
+     if (txn_manager_reserve(db->txn_manager, size) != 0) {
+          page_db_set_error(db, page_db_error_internal, __func__);
+          page_db_add_error(db, db->txn_manager->error->message);
+     }
+     return db->error->code;
+}
 
-     int mdb_rc;
+PageDBError
+page_db_set_sync(PageDB *db, TxnManagerSync sync, double interval) {
+     if (txn_manager_set_sync(db->txn_manager, sync, interval) != 0) {
+          page_db_set_error(db, page_db_error_internal, __func__);
+          page_db_add_error(db, db->txn_manager->error->message);
+     }
+     return db->error->code;
+}
+
+/** Check if an uncrawled page should be removed, see @ref page_db_prune.
+ *
+ * @param cur_from A cursor to hash2info, to look up the page that first
+ *                 linked this one
+ * @param prune Set to 1 if the page should be removed
+ *
+ * @return 0 if success, otherwise an LMDB error code
+ */
+static int
+page_db_prune_check(PageDBHosts *hosts,
+                    MDB_cursor *cur_from,
+                    const PageInfoView *view,
+                    float min_score,
+                    uint64_t max_depth,
+                    double max_age,
+                    double now,
+                    int *prune) {
+     *prune = 0;
+     if (view->n_crawls > 0)
+          return 0;
+     if (view->score < min_score ||
+         (max_depth > 0 && view->depth > max_depth)) {
+          *prune = 1;
+          return 0;
+     }
+     if (max_age <= 0 || view->linked_from == 0)
+          return 0;
+
+     // pages linked from other shards are kept
+     uint64_t from = view->linked_from;
+     MDB_val key = {
+          .mv_size = sizeof(from),
+          .mv_data = &from
+     };
+     MDB_val val;
+     PageInfoView from_view;
+     int mdb_rc = mdb_cursor_get(cur_from, &key, &val, MDB_SET);
+     if (mdb_rc == MDB_NOTFOUND)
+          return 0;
+     if (mdb_rc != 0)
+          return mdb_rc;
+     if (page_info_view_load(&from_view, hosts, &key, &val) != 0)
+          return MDB_CORRUPTED;
+     *prune = from_view.n_crawls > 0 && now - from_view.last_crawl > max_age;
+     return 0;
+}
+
+/** Remove the pages from hash2info and hash2idx, and move their indices
+ * to the pruned database */
+static PageDBError
+page_db_prune_pages(PageDB *db,
+                    float min_score,
+                    uint64_t max_depth,
+                    double max_age,
+                    size_t *n_pruned) {
+     PageDBWriter w;
+     MDB_cursor *cur_pruned = 0;
+     MDB_cursor *cur_from = 0;
+     MDB_val key;
+     MDB_val val;
+
+     int mdb_rc = 0;
      char *error = 0;
-     if (txn_manager_begin(db->txn_manager, MDB_RDONLY, &txn) != 0)
-          error = db->txn_manager->error->message;
-     // open hash2info database
-     else if ((mdb_rc = page_db_open_hash2info(txn, &cur)) != 0) {
-          error = "opening hash2info database";
-          goto on_error;
+
+     // indices pruned inside the current transaction, marked inside
+     // idx2hash once it commits
+     uint64_t *pruned = malloc(PAGE_DB_PRUNE_BATCH*sizeof(*pruned));
+     if (!pruned) {
+          page_db_set_error(db, page_db_error_memory, __func__);
+          return db->error->code;
      }
-     else {
-          MDB_val key = {
-               .mv_size = sizeof(hash),
-               .mv_data = &hash
-          };
-          MDB_val val;
-          switch (mdb_rc = mdb_cursor_get(cur, &key, &val, MDB_SET)) {
-          case 0:
-               *pi = page_info_load(&val);
-               if (!pi) {
-                    error = "deserializing data from database";
+
+     double now = difftime(time(0), 0);
+     uint64_t next = 0;
+     int done = 0;
+     while (!done) {
+          if (page_db_writer_begin(&w, db) != 0) {
+               free(pruned);
+               return db->error->code;
+          }
+          if ((mdb_rc = page_db_open_pruned(w.txn, &cur_pruned)) != 0) {
+               error = "opening pruned cursor";
+               goto on_error;
+          }
+          if ((mdb_rc = page_db_open_hash2info(w.txn, &cur_from)) != 0) {
+               error = "opening hash2info cursor";
+               goto on_error;
+          }
+
+          size_t n = 0;
+          key.mv_size = sizeof(next);
+          key.mv_data = &next;
+          mdb_rc = mdb_cursor_get(w.cur_hash2info, &key, &val, MDB_SET_RANGE);
+          for (size_t i=0; mdb_rc == 0 && i<PAGE_DB_PRUNE_BATCH; ++i) {
+               PageInfoView view;
+               int prune;
+               if (page_info_view_load(&view, &w.hosts, &key, &val) != 0) {
+                    mdb_rc = 0;
+                    error = "parsing page info";
                     goto on_error;
                }
+               if ((mdb_rc = page_db_prune_check(&w.hosts,
+                                                 cur_from,
+                                                 &view,
+                                                 min_score,
+                                                 max_depth,
+                                                 max_age,
+                                                 now,
+                                                 &prune)) != 0) {
+                    error = "checking page";
+                    goto on_error;
+               }
+               if (prune) {
+                    // the view and the key are not valid after other writes
+                    PageDBDomainStats delta;
+                    memset(&delta, 0, sizeof(delta));
+                    page_db_domain_stats_view(&delta, -1, &view);
+                    uint64_t hash = *(uint64_t*)key.mv_data;
+                    key.mv_data = &hash;
+                    PageDBDomainStats *stats;
+                    if ((mdb_rc = page_db_writer_domain_stats(
+                              &w, page_db_hash_get_domain(hash), &stats)) != 0) {
+                         error = "updating domain statistics";
+                         goto on_error;
+                    }
+                    page_db_domain_stats_merge(stats, &delta);
+                    if ((mdb_rc = page_db_writer_changed(&w, hash)) != 0) {
+                         error = "invalidating cached page info";
+                         goto on_error;
+                    }
+                    MDB_val idx;
+                    MDB_val empty = {
+                         .mv_size = 0,
+                         .mv_data = 0
+                    };
+                    switch (mdb_rc = mdb_cursor_get(w.cur_hash2idx, &key, &idx, MDB_SET)) {
+                    case 0:
+                         pruned[n] = *(uint64_t*)idx.mv_data;
+                         w.idx2hash_sum -= page_db_idx2hash_mix(
+                              page_db_idx2hash_pos(db, pruned[n]), hash);
+                         idx.mv_data = pruned + n++;
+                         if ((mdb_rc = mdb_cursor_put(cur_pruned, &idx, &empty, 0)) != 0 ||
+                             (mdb_rc = mdb_cursor_del(w.cur_hash2idx, 0)) != 0) {
+                              error = "removing page from hash2idx";
+                              goto on_error;
+                         }
+                         break;
+                    case MDB_NOTFOUND:
+                         break;
+                    default:
+                         error = "retrieving page from hash2idx";
+                         goto on_error;
+                    }
+                    if ((mdb_rc = mdb_cursor_del(w.cur_hash2info, 0)) != 0) {
+                         error = "removing page from hash2info";
+                         goto on_error;
+                    }
+               }
+               // after a delete the cursor is already at the next page, but
+               // MDB_NEXT works in both cases
+               mdb_rc = mdb_cursor_get(w.cur_hash2info, &key, &val, MDB_NEXT);
+          }
+          switch (mdb_rc) {
+          case 0:
+               next = *(uint64_t*)key.mv_data;
                break;
           case MDB_NOTFOUND:
-               *pi = 0;
+               done = 1;
                break;
           default:
-               error = "retrieving val from hash2info";
+               error = "iterating on hash2info";
                goto on_error;
-               break;
           }
+          mdb_cursor_close(cur_pruned);
+          mdb_cursor_close(cur_from);
+          cur_pruned = cur_from = 0;
+          if (page_db_writer_commit(&w) != 0) {
+               free(pruned);
+               return db->error->code;
+          }
+          for (size_t i=0; i<n; ++i)
+               (void)page_db_idx2hash_set(db, pruned[i], 0);
+          *n_pruned += n;
      }
-     mdb_cursor_close(cur);
-     txn_manager_abort(db->txn_manager, txn);
+     free(pruned);
      return 0;
 
 on_error:
-     txn_manager_abort(db->txn_manager, txn);
+     if (cur_pruned)
+          mdb_cursor_close(cur_pruned);
+     if (cur_from)
+          mdb_cursor_close(cur_from);
+     page_db_writer_abort(&w);
+     free(pruned);
+
      page_db_set_error(db, page_db_error_internal, __func__);
      page_db_add_error(db, error);
      if (mdb_rc != 0)
           page_db_add_error(db, mdb_strerror(mdb_rc));
-
      return db->error->code;
 }
 
-static PageDBError
-page_db_get_idx_cur(PageDB *db, MDB_cursor *cur, uint64_t hash, uint64_t *idx) {
-     int mdb_rc = 0;
-
-     MDB_val key = {
-          .mv_size = sizeof(uint64_t),
-          .mv_data = &hash
-     };
-     MDB_val val;
-     switch (mdb_rc = mdb_cursor_get(cur, &key, &val, MDB_SET)) {
-     case 0:
-          *idx = *(uint64_t*)val.mv_data;
-          return 0;
-
-     case MDB_NOTFOUND:
-          *idx = 0;
-          return page_db_error_no_page;
-
-     default:
-          page_db_set_error(db, page_db_error_internal, __func__);
-          page_db_add_error(db, "retrieving val from hash2info");
-          page_db_add_error(db, mdb_strerror(mdb_rc));
-          return db->error->code;
-     }
+/** Order indices, for bsearch */
+static int
+page_db_idx_cmp(const void *a, const void *b) {
+     uint64_t ia = *(const uint64_t*)a;
+     uint64_t ib = *(const uint64_t*)b;
+     return ia < ib? -1: ia > ib;
 }
 
-PageDBError
-page_db_get_idx(PageDB *db, uint64_t hash, uint64_t *idx) {
+/** Read all the indices inside the pruned database, in order.
+ *
+ * @param pruned Set to an array allocated with malloc, or NULL if empty
+ *
+ * @return 0 if success, otherwise the error code
+ */
+static PageDBError
+page_db_prune_read(PageDB *db, uint64_t **pruned, size_t *n_pruned) {
      MDB_txn *txn = 0;
      MDB_cursor *cur = 0;
+     MDB_val key;
+     MDB_val val;
+     MDB_stat stat;
 
-     int mdb_rc;
-     int ret = 0;
+     int mdb_rc = 0;
      char *error = 0;
-     if (txn_manager_begin(db->txn_manager, MDB_RDONLY, &txn) != 0)
-          error = db->txn_manager->error->message;
-     // open hash2info database
-     else if ((mdb_rc = page_db_open_hash2idx(txn, &cur)) != 0)
-          error = "opening hash2idx database";
-
-     if (error) {
-          page_db_set_error(db, page_db_error_internal, __func__);
-          page_db_add_error(db, error);
-          if (mdb_rc != 0)
-               page_db_add_error(db, mdb_strerror(mdb_rc));
 
-          ret = page_db_error_internal;
+     *pruned = 0;
+     *n_pruned = 0;
+     if (txn_manager_begin(db->txn_manager, MDB_RDONLY, &txn) != 0) {
+          txn = 0;
+          error = db->txn_manager->error->message;
      }
-     else {
-          ret = page_db_get_idx_cur(db, cur, hash, idx);
+     else if ((mdb_rc = page_db_open_pruned(txn, &cur)) != 0)
+          error = "opening pruned cursor";
+     else if ((mdb_rc = mdb_stat(txn, mdb_cursor_dbi(cur), &stat)) != 0)
+          error = "counting pruned pages";
+     else if (stat.ms_entries > 0 &&
+              !(*pruned = malloc(stat.ms_entries*sizeof(**pruned))))
+          error = "allocating pruned pages";
+     if (error)
+          goto on_error;
+
+     for (mdb_rc = mdb_cursor_get(cur, &key, &val, MDB_FIRST);
+          mdb_rc == 0 && *n_pruned < stat.ms_entries;
+          mdb_rc = mdb_cursor_get(cur, &key, &val, MDB_NEXT))
+          (*pruned)[(*n_pruned)++] = *(uint64_t*)key.mv_data;
+     if (mdb_rc != 0 && mdb_rc != MDB_NOTFOUND) {
+          error = "iterating on pruned";
+          goto on_error;
      }
+     mdb_cursor_close(cur);
+     txn_manager_abort(db->txn_manager, txn);
+     return 0;
+
+on_error:
      if (cur)
           mdb_cursor_close(cur);
      if (txn)
           txn_manager_abort(db->txn_manager, txn);
-     return ret;
-}
-
-PageDBError
-page_db_get_scores(PageDB *db, MMapArray **scores) {
-     MDB_txn *txn;
+     free(*pruned);
+     *pruned = 0;
+     *n_pruned = 0;
 
-     MDB_cursor *cur_hash2info;
-     MDB_cursor *cur_hash2idx;
-     MDB_cursor *cur_info;
+     page_db_set_error(db, page_db_error_internal, __func__);
+     page_db_add_error(db, error);
+     if (mdb_rc != 0)
+          page_db_add_error(db, mdb_strerror(mdb_rc));
+     return db->error->code;
+}
 
+/** Remove the pruned indices from the links of every crawled page */
+static PageDBError
+page_db_prune_links(PageDB *db, const uint64_t *pruned, size_t n_pruned) {
+     PageDBWriter w;
      MDB_val key;
      MDB_val val;
 
      int mdb_rc = 0;
-     char *error1 = 0;
-     char *error2 = 0;
-
-     char *pscores = 0;
-
-     if ((txn_manager_begin(db->txn_manager, MDB_RDONLY, &txn)) != 0)
-          error1 = db->txn_manager->error->message;
-     else if ((mdb_rc = page_db_open_hash2info(txn, &cur_hash2info)) != 0)
-          error1 = "opening hash2info cursor";
-     else if ((mdb_rc = page_db_open_hash2idx(txn, &cur_hash2idx)) != 0)
-          error1 = "opening hash2idx cursor";
-     else if ((mdb_rc = page_db_open_info(txn, &cur_info)) != 0)
-          error1 = "opening info cursor";
-
-     if (error1)
-          goto on_error;
+     char *error = 0;
 
-     // get n_pages
-     key.mv_size = sizeof(info_n_pages);
-     key.mv_data = info_n_pages;
-     if ((mdb_rc = mdb_cursor_get(cur_info, &key, &val, MDB_SET)) != 0) {
-          error1 = "retrieving info.n_pages";
-          error2 = mdb_strerror(mdb_rc);
-          goto on_error;
-     }
-     size_t n_pages = *(size_t*)val.mv_data;
+     uint64_t *ids = 0;
+     size_t m_ids = 0;
 
-     pscores = build_path(db->path, "scores.bin");
-     if (mmap_array_new(scores, pscores, n_pages, sizeof(float)) != 0) {
-          error1 = "creating scores array";
-          error2 = *scores? (*scores)->error->message: "memory error";
-          goto on_error;
+     uint64_t next = 0;
+     int done = 0;
+     while (!done) {
+          if (page_db_writer_begin(&w, db) != 0) {
+               free(ids);
+               return db->error->code;
+          }
+          key.mv_size = sizeof(next);
+          key.mv_data = &next;
+          mdb_rc = mdb_cursor_get(w.cur_links, &key, &val, MDB_SET_RANGE);
+          for (size_t i=0; mdb_rc == 0 && i<PAGE_DB_PRUNE_BATCH; ++i) {
+               // each link takes at least one byte
+               if (val.mv_size > m_ids) {
+                    uint64_t *new_ids = realloc(ids, val.mv_size*sizeof(*ids));
+                    if (!new_ids) {
+                         error = "allocating links";
+                         goto on_error;
+                    }
+                    ids = new_ids;
+                    m_ids = val.mv_size;
+               }
+               uint64_t idx = *(uint64_t*)key.mv_data;
+               uint8_t read;
+               uint8_t *pos = val.mv_data;
+               uint8_t *end = pos + val.mv_size;
+               size_t n_diff = varint_decode_uint64(pos, &read);
+               pos += read;
+
+               // decode and filter at the same time
+               uint64_t id = idx;
+               size_t n_links = 0;
+               size_t n_kept = 0;
+               size_t n_diff_kept = 0;
+               for (size_t j=0; pos < end; ++j, ++n_links) {
+                    id += varint_decode_int64(pos, &read);
+                    pos += read;
+                    if (bsearch(&id, pruned, n_pruned, sizeof(*pruned), page_db_idx_cmp))
+                         continue;
+                    ids[n_kept++] = id;
+                    if (j < n_diff)
+                         ++n_diff_kept;
+               }
+               if (n_kept < n_links &&
+                   (mdb_rc = page_db_writer_put_links(
+                        &w, idx,
+                        ids, n_diff_kept,
+                        ids + n_diff_kept, n_kept - n_diff_kept)) != 0) {
+                    mdb_rc = 0;
+                    goto on_writer_error;
+               }
+               mdb_rc = mdb_cursor_get(w.cur_links, &key, &val, MDB_NEXT);
+          }
+          switch (mdb_rc) {
+          case 0:
+               next = *(uint64_t*)key.mv_data;
+               break;
+          case MDB_NOTFOUND:
+               done = 1;
+               break;
+          default:
+               error = "iterating on links";
+               goto on_error;
+          }
+          if (page_db_writer_commit(&w) != 0) {
+               free(ids);
+               return db->error->code;
+          }
      }
-     mmap_array_zero(*scores);
+     free(ids);
+     return 0;
 
-     for (mdb_rc = mdb_cursor_get(cur_hash2info, &key, &val, MDB_FIRST);
-          mdb_rc == 0;
-          mdb_rc = mdb_cursor_get(cur_hash2info, &key, &val, MDB_NEXT)) {
+on_error:
+     page_db_set_error(db, page_db_error_internal, __func__);
+     page_db_add_error(db, error);
+     if (mdb_rc != 0)
+          page_db_add_error(db, mdb_strerror(mdb_rc));
+on_writer_error:
+     page_db_writer_abort(&w);
+     free(ids);
+     return db->error->code;
+}
 
-          uint64_t hash = *(uint64_t*)key.mv_data;
-          float score = page_info_dump_get_score(&val);
+/** Move the pruned indices to the free database, once no link points
+ * to them anymore */
+static PageDBError
+page_db_prune_free(PageDB *db) {
+     PageDBWriter w;
+     MDB_cursor *cur_pruned = 0;
+     MDB_val key;
+     MDB_val val;
 
-          size_t idx;
-          switch (page_db_get_idx_cur(db, cur_hash2idx, hash, &idx)) {
-          case 0:
-               if (mmap_array_set(*scores, idx, &score) != 0) {
-                    error1 = "setting score";
-                    error2 = (*scores)->error->message;
+     int mdb_rc = 0;
+     char *error = 0;
+
+     int done = 0;
+     while (!done) {
+          if (page_db_writer_begin(&w, db) != 0)
+               return db->error->code;
+          if ((mdb_rc = page_db_open_pruned(w.txn, &cur_pruned)) != 0) {
+               error = "opening pruned cursor";
+               goto on_error;
+          }
+          mdb_rc = mdb_cursor_get(cur_pruned, &key, &val, MDB_FIRST);
+          for (size_t i=0; mdb_rc == 0 && i<PAGE_DB_PRUNE_BATCH; ++i) {
+               // shards cannot know if other shards still link the page
+               if (db->n_shards == 1 &&
+                   (mdb_rc = mdb_cursor_put(w.cur_free, &key, &val, 0)) != 0) {
+                    error = "adding index to free";
+                    goto on_error;
+               }
+               if ((mdb_rc = mdb_cursor_del(cur_pruned, 0)) != 0) {
+                    error = "removing index from pruned";
                     goto on_error;
                }
+               mdb_rc = mdb_cursor_get(cur_pruned, &key, &val, MDB_FIRST);
+          }
+          switch (mdb_rc) {
+          case 0:
                break;
-          case page_db_error_no_page:
-               // ignore
+          case MDB_NOTFOUND:
+               done = 1;
                break;
           default:
-               error1 = db->error->message;
+               error = "iterating on pruned";
                goto on_error;
           }
-
-     }
-     if (mdb_rc != MDB_NOTFOUND) {
-          error1 = "iterating on hash2info";
-          error2 = mdb_strerror(mdb_rc);
-          goto on_error;
+          mdb_cursor_close(cur_pruned);
+          cur_pruned = 0;
+          if (page_db_writer_commit(&w) != 0)
+               return db->error->code;
      }
-     goto exit;
+     return 0;
 
 on_error:
-     page_db_set_error(db, page_db_error_internal, __func__);
-     page_db_add_error(db, error1);
-     page_db_add_error(db, error2);
-
-exit:
-     mdb_cursor_close(cur_hash2info);
-     mdb_cursor_close(cur_hash2idx);
-     mdb_cursor_close(cur_info);
-     if (txn)
-          txn_manager_abort(db->txn_manager, txn);
-     free(pscores);
+     if (cur_pruned)
+          mdb_cursor_close(cur_pruned);
+     page_db_writer_abort(&w);
 
+     page_db_set_error(db, page_db_error_internal, __func__);
+     page_db_add_error(db, error);
+     if (mdb_rc != 0)
+          page_db_add_error(db, mdb_strerror(mdb_rc));
      return db->error->code;
 }
 
-float
-page_db_get_domain_crawl_rate(PageDB *db, uint32_t domain_hash) {
-     if (db->domain_temp)
-          return domain_temp_get(db->domain_temp, domain_hash);
-     else
-          return 0.0;
-}
-
-/** Close database */
 PageDBError
-page_db_delete(PageDB *db) {
-     if (!db)
-          return 0;
-
-     mdb_env_close(db->txn_manager->env);
-     if (txn_manager_delete(db->txn_manager) != 0) {
-          page_db_set_error(db, page_db_error_internal, __func__);
-          page_db_add_error(db, "deleting transaction manager");
-          page_db_add_error(db, db->txn_manager->error->message);
-          return db->error->code;
-     }
-
-     if (!db->persist) {
-          char *data = build_path(db->path, "data.mdb");
-          char *lock = build_path(db->path, "lock.mdb");
-
-          // proceeed even the data files cannot be deleted from disk
-          (void)remove(data);
-          (void)remove(lock);
-          (void)remove(db->path);
-
-          free(data);
-          free(lock);
-     }
-     free(db->path);
-     domain_temp_delete(db->domain_temp);
-     error_delete(db->error);
-     free(db);
-     return 0;
+page_db_prune(PageDB *db,
+              float min_score,
+              uint64_t max_depth,
+              double max_age,
+              size_t *n_pruned) {
+     size_t n = 0;
+     uint64_t *pruned = 0;
+     size_t n_links = 0;
+
+     // pages pruned by an interrupted call are included
+     if (page_db_prune_pages(db, min_score, max_depth, max_age, &n) == 0 &&
+         page_db_prune_read(db, &pruned, &n_links) == 0 &&
+         (n_links == 0 ||
+          page_db_prune_links(db, pruned, n_links) == 0))
+          (void)page_db_prune_free(db);
+     free(pruned);
+
+     if (n_pruned)
+          *n_pruned = n;
+     return db->error->code;
 }
 
 PageDBError
@@ -1265,6 +5332,7 @@ page_db_info_dump(PageDB *db, FILE *output) {
      MDB_txn *txn;
      MDB_cursor *cur_hash2info;
      MDB_cursor *cur_hash2idx;
+     PageDBHosts hosts;
      MDB_val key;
      MDB_val val;
 
@@ -1280,13 +5348,15 @@ page_db_info_dump(PageDB *db, FILE *output) {
           error = "getting first element";
      else if ((mdb_rc = page_db_open_hash2idx(txn, &cur_hash2idx)) != 0)
           error = "opening hash2idx cursor";
+     else if ((mdb_rc = page_db_hosts_init(&hosts, txn, MDB_RDONLY)) != 0)
+          error = "opening domains database";
 
      if (error != 0)
           goto on_error;
 
      int more_data = 1;
      do {
-          PageInfo *pi = page_info_load(&val);
+          PageInfo *pi = page_info_load(&hosts, &key, &val);
           if (!pi) {
                error = "PageInfo error format";
                goto on_error;
@@ -1353,6 +5423,236 @@ page_db_links_dump(PageDB *db, FILE *output) {
      return 0;
 }
 
+/** Columns written by @ref page_db_export, in the same order as the header */
+enum {
+     page_db_export_hash,
+     page_db_export_idx,
+     page_db_export_depth,
+     page_db_export_n_crawls,
+     page_db_export_n_changes,
+     page_db_export_first_crawl,
+     page_db_export_last_crawl,
+     page_db_export_score,
+     page_db_export_url_offsets,
+     page_db_export_url_data,
+     page_db_export_n_columns
+};
+
+static const char *page_db_export_names[page_db_export_n_columns] = {
+     "hash", "idx", "depth", "n_crawls", "n_changes",
+     "first_crawl", "last_crawl", "score",
+     "url_offsets", "url_data"
+};
+
+static const char *page_db_export_types[page_db_export_n_columns] = {
+     "uint64", "uint64", "uint64", "uint64", "uint64",
+     "float64", "float64", "float32",
+     "uint64", "bytes"
+};
+
+/** Write the size lowest bytes of value in little-endian order */
+static int
+page_db_export_put(FILE *column, uint64_t value, size_t size) {
+     unsigned char buf[sizeof(value)];
+     for (size_t i=0; i<size; ++i) {
+          buf[i] = value & 0xFF;
+          value >>= 8;
+     }
+     return fwrite(buf, size, 1, column) == 1? 0: -1;
+}
+
+static int
+page_db_export_put_double(FILE *column, double value) {
+     uint64_t bits;
+     memcpy(&bits, &value, sizeof(bits));
+     return page_db_export_put(column, bits, sizeof(bits));
+}
+
+static int
+page_db_export_put_float(FILE *column, float value) {
+     uint32_t bits;
+     memcpy(&bits, &value, sizeof(bits));
+     return page_db_export_put(column, bits, sizeof(bits));
+}
+
+PageDBError
+page_db_export(PageDB *db, const char *path) {
+     MDB_txn *txn = 0;
+     MDB_cursor *cur_hash2info = 0;
+     MDB_cursor *cur_hash2idx = 0;
+     PageDBHosts hosts;
+     MDB_val key;
+     MDB_val val;
+     MDB_val key_idx;
+     MDB_val val_idx;
+
+     FILE *columns[page_db_export_n_columns] = {0};
+     FILE *header = 0;
+     char *url = 0;
+     size_t url_size = 0;
+
+     int mdb_rc = 0;
+     char *error1 = 0;
+     char *error2 = 0;
+
+     if ((error2 = make_dir(path)) != 0) {
+          error1 = "creating export directory";
+          goto on_error;
+     }
+     for (size_t i=0; i<page_db_export_n_columns; ++i) {
+          char *fname = concat(page_db_export_names[i], "bin", '.');
+          char *pcolumn = fname? build_path(path, fname): 0;
+          if (pcolumn) {
+               if (!(columns[i] = fopen(pcolumn, "wb")))
+                    error2 = strerror(errno);
+          } else
+               error2 = "memory error";
+          free(fname);
+          free(pcolumn);
+          if (!columns[i]) {
+               error1 = "opening column file";
+               goto on_error;
+          }
+     }
+
+     if ((txn_manager_begin(db->txn_manager, MDB_RDONLY, &txn)) != 0) {
+          txn = 0;
+          error1 = db->txn_manager->error->message;
+     }
+     else if ((mdb_rc = page_db_open_hash2info(txn, &cur_hash2info)) != 0)
+          error1 = "opening hash2info cursor";
+     else if ((mdb_rc = page_db_open_hash2idx(txn, &cur_hash2idx)) != 0)
+          error1 = "opening hash2idx cursor";
+     else if ((mdb_rc = page_db_hosts_init(&hosts, txn, MDB_RDONLY)) != 0)
+          error1 = "opening domains database";
+
+     if (error1) {
+          error2 = mdb_rc? mdb_strerror(mdb_rc): 0;
+          goto on_error;
+     }
+
+     uint64_t n_pages = 0;
+     uint64_t url_offset = 0;
+     if (page_db_export_put(columns[page_db_export_url_offsets], url_offset, 8) != 0)
+          goto on_write_error;
+
+     // same join as page_db_get_scores: both databases have the same keys in
+     // the same order
+     int mdb_rc_idx = mdb_cursor_get(cur_hash2idx, &key_idx, &val_idx, MDB_FIRST);
+     for (mdb_rc = mdb_cursor_get(cur_hash2info, &key, &val, MDB_FIRST);
+          mdb_rc == 0;
+          mdb_rc = mdb_cursor_get(cur_hash2info, &key, &val, MDB_NEXT)) {
+
+          uint64_t hash = *(uint64_t*)key.mv_data;
+          while (mdb_rc_idx == 0 && *(uint64_t*)key_idx.mv_data < hash)
+               mdb_rc_idx = mdb_cursor_get(cur_hash2idx, &key_idx, &val_idx, MDB_NEXT);
+          if (mdb_rc_idx != 0 || *(uint64_t*)key_idx.mv_data != hash) {
+               error1 = "Could not retrieve page index";
+               error2 = mdb_rc_idx? mdb_strerror(mdb_rc_idx): 0;
+               goto on_error;
+          }
+
+          PageInfoView view;
+          if (page_info_view_load(&view, &hosts, &key, &val) != 0) {
+               error1 = "PageInfo error format";
+               goto on_error;
+          }
+          size_t max_size = page_info_view_url_max_size(&view);
+          if (max_size > url_size) {
+               char *new_url = realloc(url, max_size);
+               if (!new_url) {
+                    error1 = "memory error";
+                    goto on_error;
+               }
+               url = new_url;
+               url_size = max_size;
+          }
+          int url_len = page_info_view_url(&view, url, url_size);
+          if (url_len < 0) {
+               error1 = "decoding URL";
+               goto on_error;
+          }
+          url_offset += (uint64_t)url_len;
+
+          if ((page_db_export_put(columns[page_db_export_hash], hash, 8) != 0) ||
+              (page_db_export_put(columns[page_db_export_idx],
+                                  *(uint64_t*)val_idx.mv_data, 8) != 0) ||
+              (page_db_export_put(columns[page_db_export_depth], view.depth, 8) != 0) ||
+              (page_db_export_put(columns[page_db_export_n_crawls], view.n_crawls, 8) != 0) ||
+              (page_db_export_put(columns[page_db_export_n_changes], view.n_changes, 8) != 0) ||
+              (page_db_export_put_double(columns[page_db_export_first_crawl],
+                                         view.first_crawl) != 0) ||
+              (page_db_export_put_double(columns[page_db_export_last_crawl],
+                                         view.last_crawl) != 0) ||
+              (page_db_export_put_float(columns[page_db_export_score], view.score) != 0) ||
+              (page_db_export_put(columns[page_db_export_url_offsets], url_offset, 8) != 0) ||
+              (url_len > 0 &&
+               fwrite(url, (size_t)url_len, 1, columns[page_db_export_url_data]) != 1))
+               goto on_write_error;
+          ++n_pages;
+     }
+     if (mdb_rc != MDB_NOTFOUND) {
+          error1 = "iterating on hash2info";
+          error2 = mdb_strerror(mdb_rc);
+          goto on_error;
+     }
+
+     for (size_t i=0; i<page_db_export_n_columns; ++i) {
+          FILE *column = columns[i];
+          columns[i] = 0;
+          if (fclose(column) != 0)
+               goto on_write_error;
+     }
+
+     // the header is written last, so that an interrupted export has none
+     char *pheader = build_path(path, "header.txt");
+     if (!pheader) {
+          error1 = "memory error";
+          goto on_error;
+     }
+     header = fopen(pheader, "w");
+     free(pheader);
+     if (!header)
+          goto on_write_error;
+     fprintf(header, "aduana_page_db_export %d\n", PAGE_DB_EXPORT_VERSION);
+     fprintf(header, "n_pages %"PRIu64"\n", n_pages);
+     fprintf(header, "byte_order little\n");
+     for (size_t i=0; i<page_db_export_n_columns; ++i)
+          fprintf(header, "column %s %s %s.bin\n",
+                  page_db_export_names[i],
+                  page_db_export_types[i],
+                  page_db_export_names[i]);
+     FILE *pending = header;
+     header = 0;
+     if (ferror(pending) || fclose(pending) != 0)
+          goto on_write_error;
+
+     goto exit;
+
+on_write_error:
+     error1 = "writing export";
+     error2 = strerror(errno);
+on_error:
+     page_db_set_error(db, page_db_error_internal, __func__);
+     page_db_add_error(db, error1);
+     if (error2)
+          page_db_add_error(db, error2);
+
+exit:
+     for (size_t i=0; i<page_db_export_n_columns; ++i)
+          if (columns[i])
+               fclose(columns[i]);
+     if (header)
+          fclose(header);
+     free(url);
+     mdb_cursor_close(cur_hash2info);
+     mdb_cursor_close(cur_hash2idx);
+     if (txn)
+          txn_manager_abort(db->txn_manager, txn);
+
+     return db->error->code;
+}
+
 void
 page_db_set_persist(PageDB *db, int value) {
      db->persist = value;
@@ -1370,17 +5670,186 @@ page_db_set_domain_temp(PageDB *db, size_t n_domains, float window) {
      }
      return 0;
 }
+
+PageDBError
+page_db_set_shard(PageDB *db, size_t shard, size_t n_shards) {
+     MDB_txn *txn = 0;
+     MDB_dbi dbi;
+     MDB_val key;
+     MDB_val val;
+     size_t shard_old;
+     size_t n_shards_old;
+     uint64_t settings[2] = {shard, n_shards};
+
+     int mdb_rc = 0;
+     char *error = 0;
+     char msg[100];
+
+     if (shard >= n_shards) {
+          page_db_set_error(db, page_db_error_internal, __func__);
+          page_db_add_error(db, "shard must be smaller than the number of shards");
+          return db->error->code;
+     }
+
+     if (txn_manager_begin(db->txn_manager, 0, &txn) != 0) {
+          txn = 0;
+          error = db->txn_manager->error->message;
+     }
+     else if ((mdb_rc = mdb_dbi_open(txn, "info", 0, &dbi)) != 0)
+          error = "opening info database";
+     else if ((mdb_rc = page_db_get_shard(txn, dbi, &shard_old, &n_shards_old)) != 0)
+          error = "reading shard settings";
+     if (error != 0)
+          goto on_error;
+
+     if (shard_old == shard && n_shards_old == n_shards) {
+          txn_manager_abort(db->txn_manager, txn);
+          db->shard = shard;
+          db->n_shards = n_shards;
+          return 0;
+     }
+
+     // indices already assigned cannot be changed
+     key.mv_size = sizeof(info_n_pages);
+     key.mv_data = info_n_pages;
+     if ((mdb_rc = mdb_get(txn, dbi, &key, &val)) != 0) {
+          error = "retrieving info.n_pages";
+          goto on_error;
+     }
+     if (*(size_t*)val.mv_data > 0) {
+          mdb_rc = 0;
+          sprintf(msg, "database is already shard %zu of %zu", shard_old, n_shards_old);
+          error = msg;
+          goto on_error;
+     }
+
+     key.mv_size = sizeof(info_shard);
+     key.mv_data = info_shard;
+     val.mv_size = sizeof(settings);
+     val.mv_data = settings;
+     if ((mdb_rc = mdb_put(txn, dbi, &key, &val, 0)) != 0) {
+          error = "storing shard settings";
+          goto on_error;
+     }
+     if (txn_manager_commit(db->txn_manager, txn) != 0) {
+          txn = 0;
+          error = db->txn_manager->error->message;
+          goto on_error;
+     }
+     db->shard = shard;
+     db->n_shards = n_shards;
+     return 0;
+
+on_error:
+     if (txn)
+          txn_manager_abort(db->txn_manager, txn);
+     page_db_set_error(db, page_db_error_internal, __func__);
+     page_db_add_error(db, error);
+     if (mdb_rc != 0)
+          page_db_add_error(db, mdb_strerror(mdb_rc));
+     return db->error->code;
+}
+
+void
+page_db_set_link_filter(PageDB *db, size_t bits_per_page) {
+     db->link_filter_bits = bits_per_page;
+     bloom_filter_delete(db->link_filter);
+     db->link_filter = 0;
+}
+
+void
+page_db_set_link_log(PageDB *db, size_t max_size) {
+     pthread_mutex_lock(&db->link_log_lock);
+     db->link_log_max_size = max_size;
+     page_db_link_log_truncate(db);
+     pthread_mutex_unlock(&db->link_log_lock);
+}
+
+PageDBError
+page_db_set_info_cache(PageDB *db, size_t max_bytes) {
+     clock_cache_delete(db->info_cache);
+     db->info_cache = 0;
+     if (max_bytes == 0)
+          return 0;
+
+     if (!(db->info_cache = clock_cache_new(max_bytes,
+                                            CLOCK_CACHE_DEFAULT_SHARDS,
+                                            page_info_copy,
+                                            page_info_free))) {
+          page_db_set_error(db, page_db_error_memory, __func__);
+          page_db_add_error(db, "could not allocate PageInfo cache");
+          return db->error->code;
+     }
+     return 0;
+}
+
+void
+page_db_info_cache_stats(PageDB *db, ClockCacheStats *stats) {
+     if (db->info_cache)
+          clock_cache_stats(db->info_cache, stats);
+     else
+          memset(stats, 0, sizeof(*stats));
+}
+
+void
+page_db_link_filter_stats(PageDB *db, PageDBLinkFilterStats *stats) {
+     *stats = db->link_filter_stats;
+     if (db->link_filter) {
+          stats->n_items = db->link_filter->n_items;
+          stats->memory = bloom_filter_memory(db->link_filter);
+          stats->fp_rate = bloom_filter_fp_rate(db->link_filter);
+     } else {
+          stats->n_items = 0;
+          stats->memory = 0;
+          stats->fp_rate = 0.0;
+     }
+}
 /// @}
 
 /// @addtogroup HashInfoStream
 /// @{
+/** Move the cursor of a stream over the hashes between first and last.
+ *
+ * @return 0 if success, MDB_NOTFOUND past the last hash, otherwise an LMDB
+ *         error code.
+ */
+static int
+page_db_range_get(MDB_cursor *cur,
+                  StreamState state,
+                  uint64_t first,
+                  uint64_t last,
+                  MDB_val *key,
+                  MDB_val *val) {
+     int mdb_rc;
+     if (state == stream_state_init) {
+          key->mv_size = sizeof(first);
+          key->mv_data = &first;
+          mdb_rc = mdb_cursor_get(cur, key, val, MDB_SET_RANGE);
+     } else {
+          mdb_rc = mdb_cursor_get(cur, key, val, MDB_NEXT);
+     }
+     if (mdb_rc == 0 && *(uint64_t*)key->mv_data > last)
+          mdb_rc = MDB_NOTFOUND;
+     return mdb_rc;
+}
+
 PageDBError
 hashinfo_stream_new(HashInfoStream **st, PageDB *db) {
+     return hashinfo_stream_new_range(st, db, 0, UINT64_MAX);
+}
+
+PageDBError
+hashinfo_stream_new_range(HashInfoStream **st,
+                          PageDB *db,
+                          uint64_t first,
+                          uint64_t last) {
      HashInfoStream *p = *st = calloc(1, sizeof(*p));
      if (p == 0)
           return page_db_error_memory;
 
      p->db = db;
+     p->first = first;
+     p->last = last;
 
      MDB_txn *txn;
      int mdb_rc = 0;
@@ -1396,6 +5865,10 @@ hashinfo_stream_new(HashInfoStream **st, PageDB *db) {
           error = "opening hash2info cursor";
           goto mdb_error;
      }
+     if ((mdb_rc = page_db_hosts_init(&p->hosts, txn, MDB_RDONLY)) != 0) {
+          error = "opening domains database";
+          goto mdb_error;
+     }
 
      p->state = stream_state_init;
 
@@ -1416,13 +5889,27 @@ StreamState
 hashinfo_stream_next(HashInfoStream *st, uint64_t *hash, PageInfo **pi) {
      MDB_val key;
      MDB_val val;
-     switch (mdb_cursor_get(st->cur,
-                            &key,
-                            &val,
-                            st->state == stream_state_init? MDB_FIRST: MDB_NEXT)) {
+     switch (page_db_range_get(st->cur, st->state, st->first, st->last, &key, &val)) {
      case 0:
           *hash = *(uint64_t*)key.mv_data;
-          *pi = page_info_load(&val);
+          *pi = page_info_load(&st->hosts, &key, &val);
+          return st->state = stream_state_next;
+     case MDB_NOTFOUND:
+          return st->state = stream_state_end;
+     default:
+          return st->state = stream_state_error;
+     }
+}
+
+StreamState
+hashinfo_stream_next_view(HashInfoStream *st, uint64_t *hash, PageInfoView *view) {
+     MDB_val key;
+     MDB_val val;
+     switch (page_db_range_get(st->cur, st->state, st->first, st->last, &key, &val)) {
+     case 0:
+          *hash = *(uint64_t*)key.mv_data;
+          if (page_info_view_load(view, &st->hosts, &key, &val) != 0)
+               return st->state = stream_state_error;
           return st->state = stream_state_next;
      case MDB_NOTFOUND:
           return st->state = stream_state_end;
@@ -1559,6 +6046,8 @@ page_db_link_stream_reset(void *st) {
           mdb_cursor_close(es->cur);
           es->cur = 0;
      }
+     // drop links of the current page, if reset in the middle of it
+     es->i_to = es->n_to = 0;
 
      if (page_db_link_stream_open_cursor(es) != 0) {
           return stream_state_error;
@@ -1609,11 +6098,21 @@ page_db_link_stream_delete(PageDBLinkStream *es) {
 
 PageDBError
 hashidx_stream_new(HashIdxStream **st, PageDB *db) {
+     return hashidx_stream_new_range(st, db, 0, UINT64_MAX);
+}
+
+PageDBError
+hashidx_stream_new_range(HashIdxStream **st,
+                         PageDB *db,
+                         uint64_t first,
+                         uint64_t last) {
      HashIdxStream *p = *st = calloc(1, sizeof(*p));
      if (p == 0)
           return page_db_error_memory;
 
      p->db = db;
+     p->first = first;
+     p->last = last;
 
      MDB_txn *txn;
      int mdb_rc = 0;
@@ -1649,10 +6148,7 @@ StreamState
 hashidx_stream_next(HashIdxStream *st, uint64_t *hash, size_t *idx) {
      MDB_val key;
      MDB_val val;
-     switch (mdb_cursor_get(st->cur,
-                            &key,
-                            &val,
-                            st->state == stream_state_init? MDB_FIRST: MDB_NEXT)) {
+     switch (page_db_range_get(st->cur, st->state, st->first, st->last, &key, &val)) {
      case 0:
           *hash = *(uint64_t*)key.mv_data;
           *idx = *(size_t*)val.mv_data;
@@ -11,6 +11,7 @@
 #else
 #include <malloc.h>
 #endif
+#include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -21,9 +22,12 @@
 #include "lmdb.h"
 #include "xxhash.h"
 
+#include "bloom.h"
+#include "clock_cache.h"
 #include "domain_temp.h"
 #include "hits.h"
 #include "link_stream.h"
+#include "mmap_array.h"
 #include "page_rank.h"
 #include "txn_manager.h"
 
@@ -40,8 +44,10 @@
  * surrounding text.
  */
 typedef struct {
-     char *url;   /**< ASCII, null terminated string for the page URL*/
-     float score; /**< An estimated value of the link score */
+     char *url;     /**< ASCII, null terminated string for the page URL*/
+     float score;   /**< An estimated value of the link score */
+     uint64_t hash; /**< Precomputed @ref page_db_hash of the URL, or 0 if
+                         it must be computed when the link is stored */
 } LinkInfo;
 
 /** Allocate at least this amount of memory for link info */
@@ -77,6 +83,9 @@ typedef struct {
      char *content_hash;          /**< A hash to detect content change since last crawl.
                                        Arbitrary byte sequence */
      size_t content_hash_length;  /**< Number of byes of the content_hash */
+     uint64_t hash;               /**< Precomputed @ref page_db_hash of the URL,
+                                       or 0 if it must be computed when the
+                                       page is stored */
 } CrawledPage;
 
 /** Create a new CrawledPage
@@ -94,6 +103,19 @@ typedef struct {
 CrawledPage *
 crawled_page_new(const char *url);
 
+/** Create a new CrawledPage whose URL has already been hashed.
+ *
+ * Same as @ref crawled_page_new but the hash is not computed again when the
+ * page is stored. The hash must have the same layout as @ref page_db_hash:
+ * pages are grouped and split into same domain and other domains links by
+ * the high 32 bits. If the pages are also looked up by URL it must be
+ * exactly @ref page_db_hash.
+ *
+ * @param hash Must not be 0
+ */
+CrawledPage *
+crawled_page_new_hashed(const char *url, uint64_t hash);
+
 /** Delete a Crawled Page created with @ref crawled_page_new */
 void
 crawled_page_delete(CrawledPage *cp);
@@ -121,6 +143,19 @@ crawled_page_set_hash32(CrawledPage *cp, uint32_t hash);
 int
 crawled_page_add_link(CrawledPage *cp, const char *url, float score);
 
+/** Add a new link whose URL has already been hashed.
+ *
+ * When the page is stored the link is neither hashed nor parsed: the URL is
+ * just copied if the link is a new page. Whether the link is inside the same
+ * domain as the crawled page is decided by comparing the domain part of the
+ * hashes instead of the host names. See @ref crawled_page_new_hashed for the
+ * requirements on the hash.
+ *
+ * @param hash Must not be 0
+ */
+int
+crawled_page_add_link_hashed(CrawledPage *cp, const char *url, float score, uint64_t hash);
+
 /** Get number of links inside page */
 size_t
 crawled_page_n_links(const CrawledPage *cp);
@@ -129,6 +164,31 @@ crawled_page_n_links(const CrawledPage *cp);
 const LinkInfo *
 crawled_page_get_link(const CrawledPage *cp, size_t i);
 
+/** The domain of a crawled page, used to classify its links.
+ *
+ * The URL of the crawled page is parsed only if some link does not carry a
+ * precomputed hash.
+ */
+typedef struct {
+     const CrawledPage *page;
+     uint64_t hash;  /**< Hash of the crawled page */
+     int start;      /**< Start of the domain, see @ref url_domain. -1 if the URL
+                          has no domain, -2 if not parsed yet */
+     int end;        /**< End of the domain */
+} CrawledPageDomain;
+
+/** Hash the crawled page, unless it is already hashed */
+void
+crawled_page_domain_init(CrawledPageDomain *d, const CrawledPage *cp);
+
+/** Hash a link of the crawled page, unless it is already hashed.
+ *
+ * @param same Set to 1 if the link is inside the same domain as the crawled
+ *             page, 0 otherwise
+ */
+uint64_t
+crawled_page_domain_link(CrawledPageDomain *d, size_t i, int *same);
+
 /// @}
 
 /// @addtogroup PageInfo
@@ -144,8 +204,8 @@ typedef struct {
                                      * @ref CrawledPage::links[i] */
      uint64_t linked_from;          /**< The page that first linked this one */
      uint64_t depth;                /**< How many steps did we take to reach this page */
-     double first_crawl;            /**< First time this page was crawled */
-     double last_crawl;             /**< Last time this page was crawled */
+     double first_crawl;            /**< First time this page was crawled. Stored with second resolution */
+     double last_crawl;             /**< Last time this page was crawled. Stored with second resolution */
      uint64_t n_changes;            /**< Number of content changes detected between first and last crawl */
      uint64_t n_crawls;             /**< Number of times this page has been crawled. Can be zero if it has been observed just as a link*/
      float score;                   /**< A copy of the same field at the last crawl */
@@ -222,29 +282,143 @@ page_info_list_new(PageInfo *pi, uint64_t hash);
 PageInfoList *
 page_info_list_cons(PageInfoList *pil, PageInfo *pi, uint64_t hash);
 
-/** Deletes the list and all its contents */
+/** Deletes the list and all its contents. Does nothing if NULL */
 void
 page_info_list_delete(PageInfoList *pil);
 
+/** A read-only view of a @ref PageInfo stored inside the database.
+ *
+ * The fields are parsed directly from the LMDB value, without allocating
+ * memory, and the URL is kept compressed until requested with
+ * @ref page_info_view_url. The view points to memory owned by LMDB, and is
+ * only valid while the read transaction that produced it is active.
+ */
+typedef struct {
+     unsigned int version;          /**< Format of the record, see @ref PAGE_DB_FORMAT */
+     const char *host;              /**< Scheme and host of the URL, shared by the domain. Not null terminated */
+     size_t host_size;              /**< Number of bytes in @ref PageInfoView::host, 0 if not shared */
+     const char *curl;              /**< Compressed URL, without the host. See @ref page_info_view_url */
+     size_t curl_size;              /**< Number of bytes in @ref PageInfoView::curl */
+     uint64_t linked_from;          /**< See @ref PageInfo::linked_from */
+     uint64_t depth;                /**< See @ref PageInfo::depth */
+     double first_crawl;            /**< See @ref PageInfo::first_crawl */
+     double last_crawl;             /**< See @ref PageInfo::last_crawl */
+     uint64_t n_changes;            /**< See @ref PageInfo::n_changes */
+     uint64_t n_crawls;             /**< See @ref PageInfo::n_crawls */
+     float score;                   /**< See @ref PageInfo::score */
+     uint64_t content_hash_length;  /**< Number of bytes in @ref PageInfoView::content_hash */
+     const char *content_hash;      /**< Hash of the last crawl, not null terminated. NULL if not crawled */
+} PageInfoView;
+
+/** Size of a buffer guaranteed to be large enough for @ref page_info_view_url */
+size_t
+page_info_view_url_max_size(const PageInfoView *view);
+
+/** Decompress the URL of the page.
+ *
+ * @param view
+ * @param url Output buffer, where the null terminated URL will be written
+ * @param size Size of the output buffer
+ *
+ * @return Length of the URL, or -1 if the buffer is not large enough
+ */
+int
+page_info_view_url(const PageInfoView *view, char *url, size_t size);
+
+/** Same as @ref page_info_rate */
+float
+page_info_view_rate(const PageInfoView *view);
+
+/** Same as @ref page_info_is_seed */
+int
+page_info_view_is_seed(const PageInfoView *view);
+
+/** Create a new @ref PageInfo with a copy of the view contents.
+ *
+ * @return NULL if memory error
+ */
+PageInfo *
+page_info_new_from_view(const PageInfoView *view);
+
 /// @}
 
 /// @addtogroup PageDB
 /// @{
 #define PAGE_DB_DEFAULT_SIZE 100*MB /**< Initial size of the mmap region */
+#define PAGE_DB_MAX_DBS 8 /**< Number of named databases inside the environment */
+
+/** Version of the on-disk format of @ref PageInfo records.
+ *
+ * It is stored inside each record and inside the info database. Databases
+ * created before the format was versioned are format 0 and must be converted
+ * with @ref page_db_migrate.
+ *
+ * Format 1 compressed URLs with smaz. Format 2 compresses them with
+ * @ref UrlCodec and stores the scheme and host once per domain, inside the
+ * domains database. Format 1 databases are upgraded when opened: old records
+ * remain readable and are rewritten in the new format as they are updated.
+ */
+#define PAGE_DB_FORMAT 2
+
+/** Oldest format that can be read without @ref page_db_migrate */
+#define PAGE_DB_FORMAT_COMPAT 1
 
 typedef enum {
      page_db_error_ok = 0,       /**< No error */
      page_db_error_memory,       /**< Error allocating memory */
      page_db_error_invalid_path, /**< File system error */
      page_db_error_internal,     /**< Unexpected error */
-     page_db_error_no_page       /**< A page was requested but could not be found */
+     page_db_error_no_page,      /**< A page was requested but could not be found */
+     page_db_error_format,       /**< Database written with an incompatible format, see @ref page_db_migrate */
+     page_db_error_link_log_reset, /**< The link log was truncated, see @ref page_db_link_log_read */
+     page_db_error_pruned        /**< The page was removed by @ref page_db_prune */
 } PageDBError;
 
 #define PAGE_DB_DEFAULT_PERSIST 1 /**< Default @ref PageDB.persist */
+#define PAGE_DB_DEFAULT_LINK_FILTER_BITS 0 /**< Default @ref PageDB.link_filter_bits */
+/** Default @ref PageDB.info_cache size. 0 disables the cache */
+#define PAGE_DB_DEFAULT_INFO_CACHE_SIZE 0
+/** Default @ref PageDB.link_log_max_size: 128MB */
+#define PAGE_DB_DEFAULT_LINK_LOG_MAX_SIZE (16*1024*1024)
+
+/** Usage of the filter of known URLs, see @ref page_db_set_link_filter */
+typedef struct {
+     size_t n_queries;         /**< Number of hashes checked against the filter */
+     size_t n_positives;       /**< Hashes reported as probably known */
+     size_t n_false_positives; /**< Positives that were not inside hash2idx */
+     /** Negatives that were inside hash2idx, written by another handle or
+         process after the filter was built */
+     size_t n_false_negatives;
+     size_t n_items;           /**< Hashes inside the filter */
+     size_t memory;            /**< Bytes used by the filter */
+     double fp_rate;           /**< Expected false positive rate, from the filter fill */
+} PageDBLinkFilterStats;
+
+/** Statistics of the pages of a domain, see @ref page_db_get_domain_stats.
+ *
+ * Sums are kept instead of means so that they can be updated as pages are
+ * added, crawled again or pruned. For example the mean score of the domain
+ * is score/n_pages and its mean change rate is rate/n_rated.
+ */
+typedef struct {
+     uint64_t n_pages;   /**< Pages of the domain, crawled or just linked */
+     uint64_t n_crawled; /**< Pages crawled at least once */
+     uint64_t n_crawls;  /**< Sum of @ref PageInfo::n_crawls */
+     uint64_t n_changes; /**< Sum of @ref PageInfo::n_changes */
+     uint64_t n_rated;   /**< Pages with a change rate, see @ref page_info_rate */
+     double rate;        /**< Sum of the change rates of the rated pages */
+     double score;       /**< Sum of @ref PageInfo::score */
+} PageDBDomainStats;
+
+/** The statistics of a domain, see @ref page_db_get_domain_stats_range */
+typedef struct {
+     uint32_t domain;          /**< See @ref page_db_hash_get_domain */
+     PageDBDomainStats stats;
+} PageDBDomainStatsEntry;
 
 /** Page database.
  *
- * We are really talking about 4 diferent key/value databases:
+ * We are really talking about several diferent key/value databases:
  *   - info:
  *        contains fixed size information about the whole database. Right now
  *        it just contains the number of pages stored.
@@ -256,6 +430,14 @@ typedef enum {
  *   - links:
  *        maps URL index to links indices. This allows us to make a fast streaming
  *        of all links inside a database.
+ *   - pruned:
+ *        indices of the pages removed by @ref page_db_prune which could still
+ *        appear inside links.
+ *   - free:
+ *        indices of pruned pages that can be assigned again to new pages.
+ *   - domain_stats:
+ *        maps domain hash to @ref PageDBDomainStats, updated by the same
+ *        transaction that modifies hash2info.
  */
 typedef struct {
      /** Path to the database directory */
@@ -268,15 +450,140 @@ typedef struct {
      /** Track the most crawled domains */
      DomainTemp *domain_temp;
 
+     /** Filter of the hashes inside hash2idx. Links already known are
+         resolved with a lookup and only the rest take the insert path.
+         Built from hash2idx on the first write */
+     BloomFilter *link_filter;
+     /** Usage counters of @ref PageDB::link_filter */
+     PageDBLinkFilterStats link_filter_stats;
+
+     /** Decoded @ref PageInfo of the pages read recently by
+         @ref page_db_get_info, NULL if disabled. See
+         @ref page_db_set_info_cache */
+     ClockCache *info_cache;
+
+     /** The n-th page stored gets index n*n_shards + shard, so that the
+         indices of several databases do not overlap. See
+         @ref page_db_set_shard */
+     size_t shard;
+     size_t n_shards;
+
+     /** Handle of the domains database, opened once with the environment.
+         See @ref PageDBHosts */
+     MDB_dbi dbi_domains;
+
+     /** Hash of each page by position: entry n holds the hash of the n-th
+         page stored. Written when a page is added to hash2idx. When the
+         database is opened it is checked against a checksum stored inside
+         the info database, and rebuilt from hash2idx if it does not match.
+         See @ref page_db_get_hash */
+     MMapArray *idx2hash;
+     /** Number of entries of @ref PageDB::idx2hash already committed */
+     size_t n_idx2hash;
+     /** Held to read @ref PageDB::idx2hash, to make it grow or to write
+         it back to disk */
+     pthread_mutex_t idx2hash_lock;
+
+     /** The links written since the log was last truncated, so that copies
+         of the links database can follow it. See @ref page_db_link_log_read */
+     MMapArray *link_log;
+     /** Number of entries of @ref PageDB::link_log already committed */
+     size_t n_link_log;
+     /** Incremented each time @ref PageDB::link_log is truncated */
+     uint64_t link_log_generation;
+     /** Held to read @ref PageDB::link_log or to make it grow */
+     pthread_mutex_t link_log_lock;
+
      Error *error;
 
 // Options
 // -----------------------------------------------------------------------------
      /** If true, do not delete files after deleting object*/
      int persist;
+     /** Bits per page used by @ref PageDB::link_filter. 0 disables it */
+     size_t link_filter_bits;
+     /** The link log is truncated by the first write transaction after it
+         grows past this number of entries. 0 disables it */
+     size_t link_log_max_size;
 } PageDB;
 
 
+/** Scheme and host shared by the URLs of a domain.
+ *
+ * The first URL stored for a domain registers its scheme and host inside the
+ * domains database, indexed by @ref page_db_hash_get_domain. Records of URLs
+ * starting with that prefix only store the rest of the URL.
+ *
+ * This structure resolves prefixes inside a transaction, caching the last one
+ * since records of the same domain are stored together. Inside write
+ * transactions the cached prefix is a copy, since pages written by the
+ * transaction can be spilled or reused.
+ */
+typedef struct {
+     MDB_txn *txn;
+     MDB_dbi dbi;      /**< The domains database */
+     int copy;         /**< Cache a copy of the prefix inside @ref PageDBHosts::buf */
+     uint32_t domain;  /**< Domain of the cached prefix */
+     MDB_val host;     /**< Cached prefix. mv_data is NULL if none */
+     char buf[512];    /**< Copy of the cached prefix, for write transactions */
+} PageDBHosts;
+
+/** A write transaction whose steps are driven by the caller.
+ *
+ * @ref page_db_add_many makes all the steps to add a crawled page inside a
+ * single call. Splitting them lets a @ref ShardedPageDB store a crawled page
+ * in one database while its links are numbered by the database of each link.
+ */
+typedef struct {
+     PageDB *db;
+     MDB_txn *txn;
+     MDB_cursor *cur_hash2info;
+     MDB_cursor *cur_hash2idx;
+     MDB_cursor *cur_links;
+     MDB_cursor *cur_info;
+     PageDBHosts hosts;
+     size_t n_pages;    /**< Number of pages, written back at commit */
+     /** Checksum of @ref PageDB::idx2hash, written back at commit */
+     uint64_t idx2hash_sum;
+     size_t n_link_log; /**< Entries of @ref PageDB::link_log, published at commit */
+     MDB_cursor *cur_free;
+     size_t n_free;     /**< Number of indices inside the free database */
+     uint64_t *reused;  /**< Indices taken from the free database */
+     size_t n_reused;
+     size_t m_reused;
+     MDB_cursor *cur_domain_stats;
+     /** Changes to the domain statistics, merged into the domain_stats
+         database before commit */
+     PageDBDomainStatsEntry *domain_stats;
+     size_t n_domain_stats;
+     size_t m_domain_stats;
+     /** Pages modified inside hash2info, removed from
+         @ref PageDB::info_cache after commit */
+     uint64_t *changed;
+     size_t n_changed;
+     size_t m_changed;
+} PageDBWriter;
+
+/** A read transaction and its cursors, reused between lookups.
+ *
+ * Looking up a page with @ref page_db_get_info begins a transaction and
+ * opens its cursors each time. Callers making many lookups, for example
+ * each request of a scheduler, can keep a reader instead: its cursors are
+ * renewed by each @ref page_db_reader_begin, and the transaction is recycled
+ * by the @ref TxnManager after @ref page_db_reader_end.
+ *
+ * A reader must be used by a single thread at a time.
+ */
+typedef struct {
+     PageDB *db;
+     MDB_txn *txn;               /**< NULL outside begin/end */
+     MDB_cursor *cur_hash2info;
+     MDB_cursor *cur_hash2idx;
+     PageDBHosts hosts;
+     /** @ref TxnManager::generation when the cursors were opened */
+     unsigned int generation;
+} PageDBReader;
+
 /** Hash function used to convert from URL to hash.
  *
  * The hash is a 64 bit number where the first 32 bits are a hash of the domain
@@ -292,6 +599,16 @@ typedef struct {
 uint64_t
 page_db_hash(const char *url);
 
+/** Same as @ref page_db_hash for many URLs.
+ *
+ * Meant for crawlers that hash the links before building the
+ * @ref CrawledPage, see @ref crawled_page_add_link_hashed.
+ *
+ * @param out Array of n hashes
+ */
+void
+page_db_hash_many(const char **urls, size_t n, uint64_t *out);
+
 /** Extract the domain hash from the full hash */
 uint32_t
 page_db_hash_get_domain(uint64_t hash);
@@ -344,6 +661,154 @@ page_db_new(PageDB **db, const char *path);
 PageDBError
 page_db_add(PageDB *db, const CrawledPage *page, PageInfoList **page_info_list);
 
+/** Update @ref PageDB with several crawled pages inside a single transaction.
+ *
+ * The result is the same as calling @ref page_db_add for each page, but the
+ * cost of starting and commiting the write transaction is paid only once.
+ * If any page fails the whole batch is discarded.
+ *
+ * @param db The database to update
+ * @param pages Array of crawled pages
+ * @param n Number of elements inside pages
+ * @param page_info_list If not NULL this function will allocate and populate a new
+ *                       @ref PageInfoList which contains the @ref PageInfo of the
+ *                       updated pages for all the batch. If no page is updated
+ *                       it will be set to NULL.
+ * @return 0 if success, otherwise the error code
+ */
+PageDBError
+page_db_add_many(PageDB *db,
+                 const CrawledPage **pages,
+                 size_t n,
+                 PageInfoList **page_info_list);
+
+/** Add pages to the database.
+ *
+ * Same as @ref page_db_add_many without returning the updated pages. Its
+ * signature complies with @ref IngestQueueAddFunc, with state being the
+ * @ref PageDB, so that it can be fed from an @ref IngestQueue.
+ */
+int
+page_db_ingest(void *state, const CrawledPage **pages, size_t n);
+
+/** Get the next page for @ref page_db_bulk_load.
+ *
+ * The page must remain valid until the next call.
+ *
+ * @return stream_state_next if a page was returned, stream_state_end if
+ *         there are no more pages, otherwise stream_state_error
+ */
+typedef StreamState (PageDBBulkLoadNextFunc)(void *state, const CrawledPage **page);
+
+/** Fill an empty database with many pages at once.
+ *
+ * The result is the same as adding all the pages, in order, with
+ * @ref page_db_add, except that the pages get their index in hash order
+ * and that depth is not propagated: crawled pages have depth 0 unless they
+ * were linked by a previous page, and links have depth 1.
+ *
+ * Pages and links are sorted by hash using temporary files inside the
+ * database directory, so that memory use is bounded, and then written in
+ * key order with MDB_APPEND. This is about three times faster than
+ * @ref page_db_add_many, since hashing, sorting and compressing the URLs
+ * remain.
+ *
+ * The pages are written in several transactions. If loading fails the
+ * database could be left with part of the pages and should be discarded.
+ *
+ * @param next Called to get each page
+ * @param state First argument to next
+ * @param max_memory Bytes used to sort. If 0 @ref EXTERNAL_SORT_DEFAULT_MAX_MEMORY
+ *
+ * @return 0 if success, otherwise the error code
+ */
+PageDBError
+page_db_bulk_load(PageDB *db,
+                  PageDBBulkLoadNextFunc *next,
+                  void *state,
+                  size_t max_memory);
+
+/** Start a write transaction.
+ *
+ * Only one writer can be active at a time for each database, and it must be
+ * used from the thread that started it.
+ *
+ * @return 0 if success, otherwise the error code
+ */
+PageDBError
+page_db_writer_begin(PageDBWriter *w, PageDB *db);
+
+/** Update the @ref PageInfo of a crawled page and get its index.
+ *
+ * Links are not stored, see @ref page_db_writer_put_links.
+ *
+ * @param hash @ref page_db_hash of the page URL
+ * @param depth Set to the depth of the page
+ * @param idx Set to the index of the page
+ */
+PageDBError
+page_db_writer_add_crawled(PageDBWriter *w,
+                           const CrawledPage *page,
+                           uint64_t hash,
+                           uint64_t *depth,
+                           uint64_t *idx);
+
+/** Get the index of a link, adding the page if new.
+ *
+ * @param hash @ref page_db_hash of the link URL
+ * @param linked_from Hash of the crawled page
+ * @param depth Depth of the new page
+ * @param idx Set to the index of the page
+ */
+PageDBError
+page_db_writer_add_link(PageDBWriter *w,
+                        uint64_t hash,
+                        const LinkInfo *link,
+                        uint64_t linked_from,
+                        uint64_t depth,
+                        uint64_t *idx);
+
+/** Store the links of a crawled page, replacing the previous ones.
+ *
+ * @param idx Index of the crawled page
+ * @param diff_id Indices of links to other domains
+ * @param same_id Indices of links inside the same domain
+ */
+PageDBError
+page_db_writer_put_links(PageDBWriter *w,
+                         uint64_t idx,
+                         const uint64_t *diff_id, size_t n_diff,
+                         const uint64_t *same_id, size_t n_same);
+
+/** Store the number of pages and commit.
+ *
+ * The transaction is aborted if the commit fails.
+ */
+PageDBError
+page_db_writer_commit(PageDBWriter *w);
+
+/** Abort the transaction, discarding all changes */
+void
+page_db_writer_abort(PageDBWriter *w);
+
+/** Keep the indices handed out by a writer that failed to commit from being
+ * handed out again.
+ *
+ * Other databases can already hold links to those indices, for example the
+ * other shards of a @ref ShardedPageDB. The indices are left without a page.
+ *
+ * @param n_pages Value of @ref PageDBWriter::n_pages before the commit
+ * @param reused Indices taken from the free database, see
+ *               @ref PageDBWriter::reused
+ *
+ * @return 0 if success, otherwise the error code
+ */
+PageDBError
+page_db_reserve_idx(PageDB *db,
+                    size_t n_pages,
+                    const uint64_t *reused,
+                    size_t n_reused);
+
 /** Retrieve the PageInfo stored inside the database.
 
     Beware that if not found it will signal success but the PageInfo will be
@@ -352,6 +817,105 @@ page_db_add(PageDB *db, const CrawledPage *page, PageInfoList **page_info_list);
 PageDBError
 page_db_get_info(PageDB *db, uint64_t hash, PageInfo **pi);
 
+/** Open a read transaction to retrieve several @ref PageInfoView.
+ *
+ * Views retrieved with @ref page_db_info_cursor_get are valid until
+ * @ref page_db_info_cursor_close is called.
+ *
+ * @param db
+ * @param cur Cursor to the hash2info database
+ *
+ * @return 0 if success, otherwise the error code
+ */
+PageDBError
+page_db_info_cursor_open(PageDB *db, MDB_cursor **cur);
+
+/** Retrieve a view of the @ref PageInfo stored inside the database.
+ *
+ * @return 0 if found, @ref page_db_error_no_page if not found (without
+ *         setting the database error), otherwise the error code
+ */
+PageDBError
+page_db_info_cursor_get(PageDB *db,
+                        MDB_cursor *cur,
+                        uint64_t hash,
+                        PageInfoView *view);
+
+/** Close cursor and its transaction */
+void
+page_db_info_cursor_close(PageDB *db, MDB_cursor *cur);
+
+/** Initialize a reader, without beginning a transaction */
+void
+page_db_reader_init(PageDBReader *r, PageDB *db);
+
+/** Begin a read transaction, reusing the cursors of the last one.
+ *
+ * Results retrieved with the reader are valid until @ref page_db_reader_end.
+ *
+ * @return 0 if success, otherwise the error code
+ */
+PageDBError
+page_db_reader_begin(PageDBReader *r);
+
+/** End the read transaction, keeping the cursors for the next one */
+void
+page_db_reader_end(PageDBReader *r);
+
+/** End the read transaction, if any, and close the cursors */
+void
+page_db_reader_close(PageDBReader *r);
+
+/** Retrieve a view of the @ref PageInfo stored inside the database.
+ *
+ * @return 0 if found, @ref page_db_error_no_page if not found (without
+ *         setting the database error), otherwise the error code
+ */
+PageDBError
+page_db_reader_get_view(PageDBReader *r, uint64_t hash, PageInfoView *view);
+
+/** Retrieve the views of several pages.
+ *
+ * The hashes are looked up in key order, so that consecutive lookups start
+ * from the B-tree page of the previous one.
+ *
+ * @param hashes
+ * @param n Number of hashes
+ * @param views Array of n elements, the view of each hash
+ * @param found Array of n elements, set to 1 if the page of each hash
+ *              was found and its view set, and to 0 otherwise
+ *
+ * @return 0 if success, otherwise the error code
+ */
+PageDBError
+page_db_reader_get_view_many(PageDBReader *r,
+                             const uint64_t *hashes,
+                             size_t n,
+                             PageInfoView *views,
+                             char *found);
+
+/** Get index for the given URL.
+ *
+ * @return 0 if found, @ref page_db_error_no_page if not found (without
+ *         setting the database error), otherwise the error code
+ */
+PageDBError
+page_db_reader_get_idx(PageDBReader *r, uint64_t hash, uint64_t *idx);
+
+/** Retrieve the @ref PageInfo of several pages, inside a single read
+ * transaction and in key order.
+ *
+ * @param pis Array of n elements, set to a new @ref PageInfo for each hash,
+ *            or to NULL if not found. The caller must delete them.
+ *
+ * @return 0 if success, otherwise the error code and pis are all NULL
+ */
+PageDBError
+page_db_get_info_many(PageDB *db,
+                      const uint64_t *hashes,
+                      size_t n,
+                      PageInfo **pis);
+
 /** Get index for the given URL */
 PageDBError
 page_db_get_idx(PageDB *db, uint64_t hash, uint64_t *idx);
@@ -364,6 +928,98 @@ page_db_get_scores(PageDB *db, MMapArray **scores);
 float
 page_db_get_domain_crawl_rate(PageDB *db, uint32_t domain_hash);
 
+/** Get the statistics of a domain, without scanning its pages.
+ *
+ * The statistics of a domain without pages are all zero.
+ *
+ * @param domain_hash See @ref page_db_hash_get_domain
+ *
+ * @return 0 if success, otherwise the error code
+ */
+PageDBError
+page_db_get_domain_stats(PageDB *db,
+                         uint32_t domain_hash,
+                         PageDBDomainStats *stats);
+
+/** Get the statistics of all the domains whose hash is between first and
+ * last, both included, in hash order.
+ *
+ * @param entries Set to an array allocated with malloc, or NULL if no
+ *                domain falls inside the range. It must be freed by the
+ *                caller.
+ * @param n_entries Set to the number of elements of entries
+ *
+ * @return 0 if success, otherwise the error code
+ */
+PageDBError
+page_db_get_domain_stats_range(PageDB *db,
+                               uint32_t first,
+                               uint32_t last,
+                               PageDBDomainStatsEntry **entries,
+                               size_t *n_entries);
+
+/** Convert a database written with an older format (0 or 1) into the
+ * current @ref PAGE_DB_FORMAT.
+ *
+ * All the pages and links inside the old database are copied into db,
+ * rewriting every @ref PageInfo record. The old database is not modified.
+ *
+ * @param db An empty database, as created by @ref page_db_new
+ * @param path_old Path to the old database
+ * @param bytes_old If not NULL, total size of the PageInfo records before conversion
+ * @param bytes_new If not NULL, total size of the PageInfo records after conversion
+ *
+ * @return 0 if success, otherwise the error code
+ */
+PageDBError
+page_db_migrate(PageDB *db,
+                const char *path_old,
+                size_t *bytes_old,
+                size_t *bytes_new);
+
+/** Reclaim the free space inside the database file.
+ *
+ * LMDB reuses free pages but never shrinks the file. This writes a compacted
+ * copy and swaps it in, see @ref txn_manager_compact. Other threads can keep
+ * reading while the copy is made; writes wait until the compaction finishes.
+ *
+ * @param db
+ * @param bytes_old If not NULL, size of the database file before compaction
+ * @param bytes_new If not NULL, size of the database file after compaction
+ *
+ * @return 0 if success, otherwise the error code
+ */
+PageDBError
+page_db_compact(PageDB *db, size_t *bytes_old, size_t *bytes_new);
+
+/** Reserve the memory map and set how it grows.
+ *
+ * A map of several times the expected database size, reserved right after
+ * @ref page_db_new, avoids the resizes that block every transaction until
+ * the long reads finish. See @ref txn_manager_reserve.
+ *
+ * @param size Minimum size of the map, in bytes
+ * @param growth Bytes added by each resize. If 0 the map doubles.
+ *
+ * @return 0 if success, otherwise the error code
+ */
+PageDBError
+page_db_set_map_size(PageDB *db, size_t size, size_t growth);
+
+/** Set when the writes to the database are made durable.
+ *
+ * By default it is left to the OS. See @ref txn_manager_set_sync, and
+ * @ref txn_manager_sync_stats for the latency of the syncs. Each sync also
+ * writes back @ref PageDB::idx2hash.
+ *
+ * @param sync The policy
+ * @param interval Seconds between syncs with @ref txn_manager_sync_periodic
+ *
+ * @return 0 if success, otherwise the error code
+ */
+PageDBError
+page_db_set_sync(PageDB *db, TxnManagerSync sync, double interval);
+
 /** Close database, delete files if it should not be persisted, and free memory */
 PageDBError
 page_db_delete(PageDB *db);
@@ -376,6 +1032,198 @@ page_db_set_persist(PageDB *db, int value);
 PageDBError
 page_db_set_domain_temp(PageDB *db, size_t n_domains, float window);
 
+/** Make this database one of n_shards, see @ref PageDB::shard.
+ *
+ * The setting is stored inside the database and can be made only while it
+ * is still empty. Afterwards it can only be set again to the same values.
+ *
+ * @return 0 if success, otherwise the error code
+ */
+PageDBError
+page_db_set_shard(PageDB *db, size_t shard, size_t n_shards);
+
+/** Set the memory used by the filter of known URLs.
+ *
+ * The filter is rebuilt on the next write. It is disabled by default since
+ * LMDB looks up the key when inserting a new page anyway, and known pages
+ * cost a lookup with or without the filter.
+ *
+ * The filter only sees the writes of this handle. Pages added by other
+ * handles or processes are found when inserting them, and counted in
+ * @ref PageDBLinkFilterStats::n_false_negatives.
+ *
+ * @param bits_per_page 10 bits give about 1% false positives. 0 disables the filter.
+ */
+void
+page_db_set_link_filter(PageDB *db, size_t bits_per_page);
+
+/** Get usage counters and memory of the filter of known URLs */
+void
+page_db_link_filter_stats(PageDB *db, PageDBLinkFilterStats *stats);
+
+/** Set the memory used by the cache of decoded @ref PageInfo.
+ *
+ * @ref page_db_get_info and @ref page_db_get_info_many look up the cache
+ * before reading hash2info, which saves the transaction and the decoding of
+ * the URL for pages read repeatedly, like the pages of the largest domains.
+ * Pages are removed from the cache after each write that modifies them.
+ *
+ * It must not be called while other threads are using the database.
+ *
+ * @param max_bytes 0 disables the cache
+ *
+ * @return 0 if success, otherwise the error code
+ */
+PageDBError
+page_db_set_info_cache(PageDB *db, size_t max_bytes);
+
+/** Get usage counters and memory of the cache of decoded @ref PageInfo.
+ *
+ * All counters are zero if the cache is disabled.
+ */
+void
+page_db_info_cache_stats(PageDB *db, ClockCacheStats *stats);
+
+/** Get the hash of the page with the given index.
+ *
+ * It does not start a transaction, so it is cheap enough to walk all the
+ * pages by index.
+ *
+ * @return 0 if success, @ref ::page_db_error_no_page if the index has not
+ *         been assigned yet, @ref ::page_db_error_pruned if its page has
+ *         been removed by @ref page_db_prune.
+ */
+PageDBError
+page_db_get_hash(PageDB *db, uint64_t idx, uint64_t *hash);
+
+/** A position inside @ref PageDB::link_log */
+typedef struct {
+     uint64_t generation; /**< Value of @ref PageDB::link_log_generation */
+     size_t pos;          /**< Number of entries already read */
+} PageDBLinkLogPos;
+
+/** Get the end of the link log.
+ *
+ * Take it before reading the links database: records committed in between
+ * are then read twice, which is harmless since each one replaces all the
+ * links of a page.
+ */
+void
+page_db_link_log_tell(PageDB *db, PageDBLinkLogPos *pos);
+
+/** Copy the link log records committed after a position.
+ *
+ * Every time the links of a page are written a record is appended with:
+ *   - the index of the page
+ *   - the number of links to other domains, n_diff
+ *   - the number of links to the same domain, n_same
+ *   - the n_diff + n_same link indices, those to other domains first
+ *
+ * @param pos Advanced to the end of the records returned
+ * @param records Set to an array allocated with malloc, or NULL if there
+ *                are no new records. It must be freed by the caller.
+ * @param n_records Set to the number of uint64_t inside records
+ *
+ * @return 0 if success, @ref ::page_db_error_link_log_reset if the log has
+ *         been truncated or disabled since pos was taken, in which case the
+ *         links database must be read again, otherwise the error code.
+ */
+PageDBError
+page_db_link_log_read(PageDB *db,
+                      PageDBLinkLogPos *pos,
+                      uint64_t **records,
+                      size_t *n_records);
+
+/** Set @ref PageDB::link_log_max_size.
+ *
+ * The log is truncated, so it must not be called while a write transaction
+ * is open.
+ */
+void
+page_db_set_link_log(PageDB *db, size_t max_size);
+
+/** Maximum number of pages or links examined inside a single write
+ * transaction by @ref page_db_prune */
+#define PAGE_DB_PRUNE_BATCH 10000
+
+/** Remove uncrawled pages that are unlikely to be ever crawled.
+ *
+ * A page that has not been crawled is removed if:
+ *   - its score is lower than min_score, or
+ *   - its depth is larger than max_depth, or
+ *   - the page that first linked it was last crawled more than max_age
+ *     seconds ago.
+ *
+ * The page is deleted from hash2info and hash2idx, and then from the links
+ * of the crawled pages. Afterwards its index is assigned to the next new page,
+ * so that arrays indexed by page do not keep growing. Meanwhile
+ * @ref page_db_get_hash returns @ref ::page_db_error_pruned for it. Indices
+ * are not reused by shards, see @ref page_db_set_shard, since links from the
+ * other shards could still point to them.
+ *
+ * The work is split in write transactions of @ref PAGE_DB_PRUNE_BATCH pages,
+ * so that it can run on a background thread while pages are being added.
+ * If interrupted, the next call finishes removing the links of the pages
+ * already pruned. Only one call can run at a time.
+ *
+ * Schedules are not modified, see @ref bf_scheduler_prune.
+ *
+ * @param db
+ * @param min_score
+ * @param max_depth 0 disables this limit
+ * @param max_age 0 disables this limit
+ * @param n_pruned If not NULL, set to the number of pages removed
+ *
+ * @return 0 if success, otherwise the error code
+ */
+PageDBError
+page_db_prune(PageDB *db,
+              float min_score,
+              uint64_t max_depth,
+              double max_age,
+              size_t *n_pruned);
+
+/** Limits of one of n_partitions ranges of hashes.
+ *
+ * The ranges split the domain half of the hash in equal parts, so all the
+ * pages of a domain fall inside the same range and, since domain hashes are
+ * uniform, all ranges hold about the same number of pages.
+ *
+ * @param first Set to the smallest hash inside the range
+ * @param last Set to the largest hash inside the range
+ */
+void
+page_db_partition(size_t partition,
+                  size_t n_partitions,
+                  uint64_t *first,
+                  uint64_t *last);
+
+/** Scan a partition of the database, see @ref page_db_scan.
+ *
+ * @return 0 if success, otherwise the scan is stopped
+ */
+typedef int (PageDBScanFunc)(void *state,
+                             size_t partition,
+                             uint64_t first,
+                             uint64_t last);
+
+/** Call f for each partition of the hashes, from several threads.
+ *
+ * Each call should open its own streams, for example with
+ * @ref hashinfo_stream_new_range. Partitions are handed out in order as
+ * threads become free, and the calling thread takes partitions too.
+ *
+ * @param n_threads 0 to use one thread for each online processor
+ *
+ * @return 0 if success, otherwise the error code
+ */
+PageDBError
+page_db_scan(PageDB *db,
+             size_t n_partitions,
+             size_t n_threads,
+             PageDBScanFunc *f,
+             void *state);
+
 /** Dump database to file in human readable format */
 PageDBError
 page_db_info_dump(PageDB *db, FILE *output);
@@ -383,6 +1231,33 @@ page_db_info_dump(PageDB *db, FILE *output);
 /** Dump database to file in human readable format */
 PageDBError
 page_db_links_dump(PageDB *db, FILE *output);
+
+/** Version of the files written by @ref page_db_export */
+#define PAGE_DB_EXPORT_VERSION 1
+
+/** Write a columnar snapshot of all pages, from a single read transaction.
+ *
+ * Each field is written to its own file inside path, as a flat array of
+ * little-endian values with one element for each page, in hash order:
+ *
+ * - hash.bin, idx.bin, depth.bin, n_crawls.bin, n_changes.bin: uint64
+ * - first_crawl.bin, last_crawl.bin: float64
+ * - score.bin: float32
+ *
+ * The URLs are concatenated without separators inside url_data.bin, and
+ * url_offsets.bin holds n_pages + 1 uint64, so that the URL of page i spans
+ * from url_offsets[i] to url_offsets[i + 1].
+ *
+ * The files can be mapped directly into memory, for example with
+ * numpy.memmap. header.txt is written last and describes the schema, one
+ * "column name type file" line for each file after the version, n_pages and
+ * byte_order lines.
+ *
+ * @param path Directory for the snapshot. Created if it does not exist,
+ *             existing files are overwritten.
+ */
+PageDBError
+page_db_export(PageDB *db, const char *path);
 /// @}
 
 /// @addtogroup LinkStream
@@ -442,16 +1317,36 @@ typedef struct {
      PageDB *db;
      MDB_cursor *cur;   /**< Cursor to info database */
      StreamState state;
+     PageDBHosts hosts; /**< Host prefixes of the stream transaction */
+     uint64_t first;    /**< Smallest hash streamed */
+     uint64_t last;     /**< Largest hash streamed */
 } HashInfoStream;
 
 /** Create a new stream */
 PageDBError
 hashinfo_stream_new(HashInfoStream **st, PageDB *db);
 
-/** Get next element in stream */
+/** Create a new stream over the hashes between first and last, both
+ * included. See @ref page_db_partition */
+PageDBError
+hashinfo_stream_new_range(HashInfoStream **st,
+                          PageDB *db,
+                          uint64_t first,
+                          uint64_t last);
+
+/** Get next element in stream.
+ *
+ * The @ref PageInfo is allocated and must be deleted with
+ * @ref page_info_delete. See @ref hashinfo_stream_next_view to avoid the
+ * allocation.
+ */
 StreamState
 hashinfo_stream_next(HashInfoStream *st, uint64_t *hash, PageInfo **pi);
 
+/** Get next element in stream, as a view valid until the next call */
+StreamState
+hashinfo_stream_next_view(HashInfoStream *st, uint64_t *hash, PageInfoView *view);
+
 /** Free stream */
 void
 hashinfo_stream_delete(HashInfoStream *st);
@@ -466,12 +1361,22 @@ typedef struct {
      PageDB *db;
      MDB_cursor *cur;   /**< Cursor to the hash2idx database */
      StreamState state;
+     uint64_t first;    /**< Smallest hash streamed */
+     uint64_t last;     /**< Largest hash streamed */
 } HashIdxStream;
 
 /** Create a new stream */
 PageDBError
 hashidx_stream_new(HashIdxStream **st, PageDB *db);
 
+/** Create a new stream over the hashes between first and last, both
+ * included. See @ref page_db_partition */
+PageDBError
+hashidx_stream_new_range(HashIdxStream **st,
+                         PageDB *db,
+                         uint64_t first,
+                         uint64_t last);
+
 /** Get next element in stream */
 StreamState
 hashidx_stream_next(HashIdxStream *st, uint64_t *hash, size_t *idx);
@@ -0,0 +1,94 @@
+#define _POSIX_C_SOURCE 200809L
+#define _BSD_SOURCE 1
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "page_db.h"
+
+typedef struct {
+     FILE *input;
+     char *line;
+     size_t line_size;
+     CrawledPage *page;
+     size_t n_pages;
+} BulkLoadInput;
+
+/* Each line is the URL of a crawled page followed by the URLs of its links,
+ * separated by whitespace */
+static StreamState
+bulk_load_input_next(void *state, const CrawledPage **page) {
+     BulkLoadInput *in = state;
+     if (in->page)
+          crawled_page_delete(in->page);
+     in->page = 0;
+
+     const char *sep = " \t\r\n";
+     char *save = 0;
+     char *url = 0;
+     do {
+          if (getline(&in->line, &in->line_size, in->input) == -1)
+               return ferror(in->input)? stream_state_error: stream_state_end;
+     } while (!(url = strtok_r(in->line, sep, &save)));
+
+     if (!(in->page = crawled_page_new(url)))
+          return stream_state_error;
+     in->page->time = time(0);
+     while ((url = strtok_r(0, sep, &save)))
+          if (crawled_page_add_link(in->page, url, 0.0) != 0)
+               return stream_state_error;
+
+     in->n_pages++;
+     *page = in->page;
+     return stream_state_next;
+}
+
+int
+main(int argc, char **argv) {
+     if (argc != 2 && argc != 3) {
+          fprintf(stderr, "Use: %s path_to_page_db [path_to_input]\n", argv[0]);
+          fprintf(stderr, "    Loads crawled pages into an empty page database.\n");
+          fprintf(stderr, "    Each input line is the URL of a crawled page followed by\n");
+          fprintf(stderr, "    the URLs of its links. Reads stdin if no input is given.\n");
+          fprintf(stderr, "    Depth is not propagated: every linked page gets depth 1,\n");
+          fprintf(stderr, "    whatever its distance to the pages not linked by others.\n");
+          return -1;
+     }
+
+     BulkLoadInput in = {
+          .input = argc == 3? fopen(argv[2], "r"): stdin
+     };
+     if (!in.input) {
+          fprintf(stderr, "Error opening input: %s\n", argv[2]);
+          return -1;
+     }
+
+     PageDB *page_db = 0;
+     if (page_db_new(&page_db, argv[1]) != 0) {
+          fprintf(stderr, "Error opening page database: ");
+          fprintf(stderr, "%s", page_db? page_db->error->message: "NULL");
+          fprintf(stderr, "\n");
+          return -1;
+     }
+     page_db_set_persist(page_db, 1);
+
+     int ret = 0;
+     if (page_db_bulk_load(page_db, bulk_load_input_next, &in, 0) != 0) {
+          fprintf(stderr, "Error loading database: ");
+          fprintf(stderr, "%s", page_db->error->message);
+          fprintf(stderr, "\n");
+          ret = -1;
+     } else {
+          printf("%zu crawled pages loaded\n", in.n_pages);
+     }
+
+     if (in.page)
+          crawled_page_delete(in.page);
+     free(in.line);
+     if (in.input != stdin)
+          fclose(in.input);
+     page_db_delete(page_db);
+     return ret;
+}
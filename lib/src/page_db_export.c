@@ -0,0 +1,36 @@
+#define _POSIX_C_SOURCE 200809L
+#define _BSD_SOURCE 1
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include "page_db.h"
+
+int
+main(int argc, char **argv) {
+     if (argc != 3) {
+          fprintf(stderr, "Use: %s path_to_page_db path_to_output\n", argv[0]);
+          fprintf(stderr, "    Writes a columnar snapshot of the pages inside the output directory.\n");
+          fprintf(stderr, "    See header.txt inside the output for the format of each file.\n");
+          return -1;
+     }
+
+     PageDB *page_db = 0;
+     if (page_db_new(&page_db, argv[1]) != 0) {
+          fprintf(stderr, "Error opening page database: ");
+          fprintf(stderr, "%s", page_db? page_db->error->message: "NULL");
+          fprintf(stderr, "\n");
+          return -1;
+     }
+     page_db_set_persist(page_db, 1);
+
+     if (page_db_export(page_db, argv[2]) != 0) {
+          fprintf(stderr, "Error exporting database: ");
+          fprintf(stderr, "%s", page_db->error->message);
+          fprintf(stderr, "\n");
+          page_db_delete(page_db);
+          return -1;
+     }
+
+     page_db_delete(page_db);
+     return 0;
+}
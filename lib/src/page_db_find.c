@@ -43,12 +43,23 @@ main(int argc, char **argv) {
           return -1;
      }
      uint64_t hash;
-     PageInfo *pi;
-     while (hashinfo_stream_next(st, &hash, &pi) == stream_state_next) {
-          if (regexec(&r_url, pi->url, 0, 0, 0) == 0)
-               printf("%016"PRIx64" %s\n", hash, pi->url);
-          page_info_delete(pi);
+     PageInfoView view;
+     char *url = 0;
+     size_t url_size = 0;
+     while (hashinfo_stream_next_view(st, &hash, &view) == stream_state_next) {
+          size_t size = page_info_view_url_max_size(&view);
+          if (size > url_size) {
+               if (!(url = realloc(url, size))) {
+                    fprintf(stderr, "Memory error\n");
+                    return -1;
+               }
+               url_size = size;
+          }
+          if (page_info_view_url(&view, url, url_size) >= 0 &&
+              regexec(&r_url, url, 0, 0, 0) == 0)
+               printf("%016"PRIx64" %s\n", hash, url);
      }
+     free(url);
      hashinfo_stream_delete(st);
 
      page_db_delete(page_db);
@@ -0,0 +1,54 @@
+#define _POSIX_C_SOURCE 200809L
+#define _BSD_SOURCE 1
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include "page_db.h"
+
+int
+main(int argc, char **argv) {
+     if (argc != 3) {
+          fprintf(stderr, "Use: %s path_to_old_page_db path_to_new_page_db\n", argv[0]);
+          fprintf(stderr, "    Converts a page database written with an older format.\n");
+          fprintf(stderr, "    The new database must not exist or be empty.\n");
+          return -1;
+     }
+
+     PageDB *page_db = 0;
+     if (page_db_new(&page_db, argv[2]) != 0) {
+          fprintf(stderr, "Error opening page database: ");
+          fprintf(stderr, "%s", page_db? page_db->error->message: "NULL");
+          fprintf(stderr, "\n");
+          return -1;
+     }
+     page_db_set_persist(page_db, 1);
+
+     size_t bytes_old = 0;
+     size_t bytes_new = 0;
+     if (page_db_migrate(page_db, argv[1], &bytes_old, &bytes_new) != 0) {
+          fprintf(stderr, "Error migrating database: ");
+          fprintf(stderr, "%s", page_db->error->message);
+          fprintf(stderr, "\n");
+          page_db_delete(page_db);
+          return -1;
+     }
+
+     MDB_txn *txn;
+     MDB_dbi dbi;
+     MDB_stat stat;
+     size_t n_pages = 0;
+     if (txn_manager_begin(page_db->txn_manager, MDB_RDONLY, &txn) == 0) {
+          if (mdb_dbi_open(txn, "hash2info", MDB_INTEGERKEY, &dbi) == 0 &&
+              mdb_stat(txn, dbi, &stat) == 0)
+               n_pages = stat.ms_entries;
+          txn_manager_abort(page_db->txn_manager, txn);
+     }
+     if (n_pages > 0)
+          printf("%zu pages: %.1f bytes/page before, %.1f bytes/page after\n",
+                 n_pages,
+                 (double)bytes_old/(double)n_pages,
+                 (double)bytes_new/(double)n_pages);
+
+     page_db_delete(page_db);
+     return 0;
+}
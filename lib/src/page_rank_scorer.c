@@ -7,6 +7,7 @@
 #include "page_rank.h"
 #include "page_rank_scorer.h"
 #include "page_db.h"
+#include "link_graph.h"
 #include "util.h"
 
 static void
@@ -31,6 +32,7 @@ page_rank_scorer_new(PageRankScorer **prs, PageDB *db) {
      }
 
      p->page_db = db;
+     p->link_graph = 0;
      if (page_rank_new(&p->page_rank, db->path, 1000) != 0) {
           page_rank_scorer_set_error(p, page_rank_scorer_error_internal, __func__);
           page_rank_scorer_add_error(p, "initializing PageRank");
@@ -38,6 +40,17 @@ page_rank_scorer_new(PageRankScorer **prs, PageDB *db) {
           return p->error->code;
      }
 
+     char *path = build_path(db->path, "pr_links");
+     if (!path || link_graph_new(&p->link_graph, path) != 0) {
+          page_rank_scorer_set_error(p, page_rank_scorer_error_internal, __func__);
+          page_rank_scorer_add_error(p, "initializing link graph");
+          page_rank_scorer_add_error(p, path && p->link_graph?
+                                     p->link_graph->error->message: "NULL");
+          free(path);
+          return p->error->code;
+     }
+     free(path);
+
      page_rank_scorer_set_persist(p, PAGE_RANK_SCORER_PERSIST);
      page_rank_scorer_set_use_content_scores(p, PAGE_RANK_SCORER_USE_CONTENT_SCORES);
      return 0;
@@ -50,10 +63,18 @@ page_rank_scorer_update(void *state) {
      char *error1 = 0;
      char *error2 = 0;
 
-     PageDBLinkStream *st = 0;
-     if (page_db_link_stream_new(&st, prs->page_db) != 0) {
+     // decode the links database once instead of once per iteration
+     LinkGraphStream *st = 0;
+     if (link_graph_update(prs->link_graph,
+                           prs->page_db,
+                           PAGE_DB_LINK_STREAM_DEFAULT_ONLY_DIFF_DOMAIN) != 0) {
+          error1 = "updating link graph";
+          error2 = prs->link_graph->error->message;
+          goto on_error;
+     }
+     if (link_graph_stream_new(&st, prs->link_graph) != 0) {
           error1 = "creating link stream";
-          error2 = st? "unknown": "NULL";
+          error2 = "NULL";
           goto on_error;
      }
 
@@ -66,8 +87,8 @@ page_rank_scorer_update(void *state) {
 
      if (page_rank_compute(prs->page_rank,
                            st,
-                           page_db_link_stream_next,
-                           page_db_link_stream_reset) != 0) {
+                           link_graph_stream_next,
+                           link_graph_stream_reset) != 0) {
           error1 = "computing PageRank";
           error2 = prs->page_rank->error->message;
           goto on_error;
@@ -80,10 +101,10 @@ page_rank_scorer_update(void *state) {
           goto on_error;
      }
 
-     page_db_link_stream_delete(st);
+     link_graph_stream_delete(st);
      return 0;
 on_error:
-     page_db_link_stream_delete(st);
+     link_graph_stream_delete(st);
 
      page_rank_scorer_set_error(prs,  page_rank_scorer_error_internal, __func__);
      page_rank_scorer_add_error(prs, error1);
@@ -114,6 +135,12 @@ page_rank_scorer_delete(PageRankScorer *prs) {
                                      : "unknown error");
           return prs->error->code;
      }
+     if (link_graph_delete(prs->link_graph) != 0) {
+          page_rank_scorer_set_error(prs,  page_rank_scorer_error_internal, __func__);
+          page_rank_scorer_add_error(prs, "deleting link graph");
+          page_rank_scorer_add_error(prs, prs->link_graph->error->message);
+          return prs->error->code;
+     }
      error_delete(prs->error);
      free(prs);
      return 0;
@@ -131,6 +158,7 @@ void
 page_rank_scorer_set_persist(PageRankScorer *prs, int value) {
      prs->persist = value;
      page_rank_set_persist(prs->page_rank, value);
+     link_graph_set_persist(prs->link_graph, value);
 }
 
 void
@@ -3,6 +3,7 @@
 
 #include "page_rank.h"
 #include "page_db.h"
+#include "link_graph.h"
 #include "scorer.h"
 #include "util.h"
 
@@ -32,6 +33,8 @@ typedef struct {
      PageRank *page_rank;
      /** Database with crawl information */
      PageDB *page_db;
+     /** Snapshot of the links, rebuilt on each update */
+     LinkGraph *link_graph;
 
      /** Error status */
      Error *error;
@@ -0,0 +1,782 @@
+#define _POSIX_C_SOURCE 200809L
+#define _BSD_SOURCE 1
+#define _GNU_SOURCE 1
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sharded_page_db.h"
+#include "util.h"
+
+static void
+sharded_page_db_set_error(ShardedPageDB *db, int code, const char *message) {
+     error_set(db->error, code, message);
+}
+
+static void
+sharded_page_db_add_error(ShardedPageDB *db, const char *message) {
+     error_add(db->error, message);
+}
+
+/** Directory of a shard */
+static char *
+sharded_page_db_shard_path(const char *path, size_t shard) {
+     char name[32];
+     snprintf(name, sizeof(name), "shard_%03zu", shard);
+     return build_path(path, name);
+}
+
+/** File inside the directory of a shard with the indices handed out by the
+ * batch being committed. See @ref sharded_page_db_repair */
+#define SHARDED_PAGE_DB_RESERVED "reserved.bin"
+
+/** Save the indices handed out by the writer of a shard before any shard
+ * commits.
+ *
+ * @return 0 if success, otherwise errno
+ */
+static int
+sharded_page_db_reserve_save(PageDB *shard, const PageDBWriter *w) {
+     char *path = build_path(shard->path, SHARDED_PAGE_DB_RESERVED);
+     if (!path)
+          return ENOMEM;
+     int rc = 0;
+     FILE *f = fopen(path, "wb");
+     if (!f)
+          rc = errno;
+     else {
+          size_t header[2] = {w->n_pages, w->n_reused};
+          if (fwrite(header, sizeof(header), 1, f) != 1 ||
+              (w->n_reused > 0 &&
+               fwrite(w->reused, sizeof(*w->reused), w->n_reused, f) != w->n_reused) ||
+              fflush(f) != 0)
+               rc = errno? errno: EIO;
+          // with no sync policy a crash can lose the commits anyway
+          else if (shard->txn_manager->sync != txn_manager_sync_none &&
+                   fsync(fileno(f)) != 0)
+               rc = errno;
+          if (fclose(f) != 0 && rc == 0)
+               rc = errno;
+     }
+     free(path);
+     return rc;
+}
+
+/** Remove the indices saved by @ref sharded_page_db_reserve_save, once
+ * they do not need to be reserved */
+static void
+sharded_page_db_reserve_clear(PageDB *shard) {
+     char *path = build_path(shard->path, SHARDED_PAGE_DB_RESERVED);
+     if (path)
+          (void)remove(path);
+     free(path);
+}
+
+/** Reserve the indices saved by a batch that did not commit inside the
+ * shard.
+ *
+ * Each shard commits on its own, and the shards that did commit can hold
+ * links to indices handed out by the shard that failed. Handing them out
+ * again would make those links point to other pages. The indices are
+ * saved before any shard commits, so that they are reserved even if the
+ * process stops in the middle of the commits.
+ *
+ * @return 0 if nothing to reserve or success, otherwise the error code
+ */
+static ShardedPageDBError
+sharded_page_db_repair(ShardedPageDB *db, size_t s) {
+     PageDB *shard = db->shards[s];
+     char *path = build_path(shard->path, SHARDED_PAGE_DB_RESERVED);
+     if (!path) {
+          sharded_page_db_set_error(db, sharded_page_db_error_memory, __func__);
+          return db->error->code;
+     }
+     FILE *f = fopen(path, "rb");
+     if (!f) {
+          int missing = errno == ENOENT;
+          free(path);
+          if (missing)
+               return 0;
+          sharded_page_db_set_error(db, sharded_page_db_error_invalid_path, __func__);
+          sharded_page_db_add_error(db, "opening reserved indices");
+          sharded_page_db_add_error(db, strerror(errno));
+          return db->error->code;
+     }
+     size_t header[2];
+     uint64_t *reused = 0;
+     // a file cut short was being saved when the process stopped, before
+     // any shard committed, and there is nothing to reserve
+     int complete = fread(header, sizeof(header), 1, f) == 1;
+     if (complete && header[1] > 0) {
+          if (!(reused = malloc(header[1]*sizeof(*reused)))) {
+               fclose(f);
+               free(path);
+               sharded_page_db_set_error(db, sharded_page_db_error_memory, __func__);
+               return db->error->code;
+          }
+          complete = fread(reused, sizeof(*reused), header[1], f) == header[1];
+     }
+     fclose(f);
+
+     ShardedPageDBError rc = 0;
+     if (complete && page_db_reserve_idx(shard, header[0], reused, header[1]) != 0) {
+          sharded_page_db_set_error(db, sharded_page_db_error_internal, __func__);
+          sharded_page_db_add_error(db, "reserving indices of a failed batch");
+          sharded_page_db_add_error(db, shard->error->message);
+          rc = db->error->code;
+     } else {
+          (void)remove(path);
+     }
+     free(reused);
+     free(path);
+     return rc;
+}
+
+ShardedPageDBError
+sharded_page_db_new(ShardedPageDB **db, const char *path, size_t n_shards) {
+     ShardedPageDB *p = *db = calloc(1, sizeof(*p));
+     if (p == 0)
+          return sharded_page_db_error_memory;
+
+     p->error = error_new();
+     if (p->error == 0) {
+          free(p);
+          *db = 0;
+          return sharded_page_db_error_memory;
+     }
+     p->persist = SHARDED_PAGE_DB_DEFAULT_PERSIST;
+     if (pthread_mutex_init(&p->add_lock, 0) != 0) {
+          error_delete(p->error);
+          free(p);
+          *db = 0;
+          return sharded_page_db_error_thread;
+     }
+
+     if (n_shards == 0) {
+          sharded_page_db_set_error(p, sharded_page_db_error_internal, __func__);
+          sharded_page_db_add_error(p, "number of shards must be positive");
+          return p->error->code;
+     }
+
+     const char *error = make_dir(path);
+     if (error != 0) {
+          sharded_page_db_set_error(p, sharded_page_db_error_invalid_path, __func__);
+          sharded_page_db_add_error(p, error);
+          return p->error->code;
+     }
+     if (!(p->path = strdup(path)) ||
+         !(p->shards = calloc(n_shards, sizeof(*p->shards)))) {
+          sharded_page_db_set_error(p, sharded_page_db_error_memory, __func__);
+          return p->error->code;
+     }
+     p->n_shards = n_shards;
+
+     for (size_t s=0; s<n_shards; ++s) {
+          char *shard_path = sharded_page_db_shard_path(path, s);
+          if (!shard_path) {
+               sharded_page_db_set_error(p, sharded_page_db_error_memory, __func__);
+               return p->error->code;
+          }
+          PageDBError rc = page_db_new(&p->shards[s], shard_path);
+          free(shard_path);
+          if (rc == 0)
+               rc = page_db_set_shard(p->shards[s], s, n_shards);
+          if (rc != 0) {
+               sharded_page_db_set_error(p, sharded_page_db_error_internal, __func__);
+               sharded_page_db_add_error(p, "opening shard");
+               if (p->shards[s])
+                    sharded_page_db_add_error(p, p->shards[s]->error->message);
+               return p->error->code;
+          }
+          if (sharded_page_db_repair(p, s) != 0)
+               return p->error->code;
+     }
+     return 0;
+}
+
+size_t
+sharded_page_db_shard(const ShardedPageDB *db, uint64_t hash) {
+     return ((uint64_t)page_db_hash_get_domain(hash) * db->n_shards) >> 32;
+}
+
+/** A batch of pages being written by one thread for each shard.
+ *
+ * Writing a crawled page needs the index of its links, which are assigned by
+ * the shard of each link. The work is split in phases separated by
+ * @ref sharded_page_db_batch_wait:
+ *
+ * 1. Hash the pages and the links
+ * 2. Each shard updates its crawled pages
+ * 3. Each shard numbers its links, adding the new pages
+ * 4. Each shard stores the links of its crawled pages
+ *
+ * After the last phase every shard commits, unless some shard failed.
+ */
+typedef struct {
+     ShardedPageDB *db;
+     const CrawledPage **pages;
+     size_t n_pages;
+
+     uint64_t *page_hash;
+     uint64_t *page_depth;
+     uint64_t *page_idx;
+     /** Links of page i are between link_start[i] and link_start[i+1] */
+     size_t *link_start;
+     uint64_t *link_hash;
+     uint64_t *link_idx;
+     /** 1 if the link is inside the same domain as the crawled page */
+     uint8_t *link_same;
+     /** 1 if the link already appeared before inside the same page */
+     uint8_t *link_dup;
+
+     pthread_mutex_t mtx;
+     pthread_cond_t cond;
+     size_t n_waiting;   /**< Threads waiting for the current phase to end */
+     size_t phase;
+     int start;          /**< 1 if all threads were created, -1 if abort */
+     int failed;         /**< Set if any shard failed */
+     /** Value of failed when the last phase ended. Shards can fail while the
+         others are still waking up, for example when committing */
+     int phase_failed;
+} ShardedPageDBBatch;
+
+/** Wait until all threads finish the current phase.
+ *
+ * @return 0 if no thread had failed when the phase ended
+ */
+static int
+sharded_page_db_batch_wait(ShardedPageDBBatch *b) {
+     pthread_mutex_lock(&b->mtx);
+     size_t phase = b->phase;
+     if (++b->n_waiting == b->db->n_shards) {
+          b->n_waiting = 0;
+          b->phase_failed = b->failed;
+          b->phase++;
+          pthread_cond_broadcast(&b->cond);
+     } else {
+          while (b->phase == phase)
+               pthread_cond_wait(&b->cond, &b->mtx);
+     }
+     int failed = b->phase_failed;
+     pthread_mutex_unlock(&b->mtx);
+     return failed;
+}
+
+static void
+sharded_page_db_batch_fail(ShardedPageDBBatch *b) {
+     pthread_mutex_lock(&b->mtx);
+     b->failed = 1;
+     pthread_mutex_unlock(&b->mtx);
+}
+
+/** A link of the page being hashed, to find repetitions */
+typedef struct {
+     uint64_t hash;
+     size_t j;      /**< Position inside the crawled page */
+} ShardedPageDBLink;
+
+static int
+sharded_page_db_link_cmp(const void *a, const void *b) {
+     const ShardedPageDBLink *la = a;
+     const ShardedPageDBLink *lb = b;
+     if (la->hash != lb->hash)
+          return la->hash < lb->hash? -1: 1;
+     return la->j < lb->j? -1: la->j > lb->j;
+}
+
+typedef struct {
+     ShardedPageDBBatch *batch;
+     size_t shard;
+     pthread_t thread;
+
+     ShardedPageDBLink *links; /**< Scratch space to sort links */
+     size_t m_links;
+} ShardedPageDBWorker;
+
+/** Hash the links of a page and mark the repeated ones.
+ *
+ * The domain of the crawled page is parsed just once for all the links.
+ *
+ * @return 0 if success, -1 if memory error
+ */
+static int
+sharded_page_db_batch_hash_page(ShardedPageDBWorker *wk, size_t i) {
+     ShardedPageDBBatch *b = wk->batch;
+     CrawledPageDomain cp_domain;
+     crawled_page_domain_init(&cp_domain, b->pages[i]);
+     b->page_hash[i] = cp_domain.hash;
+
+     size_t first = b->link_start[i];
+     size_t n_links = b->link_start[i + 1] - first;
+     if (n_links > wk->m_links) {
+          ShardedPageDBLink *links = realloc(wk->links, n_links*sizeof(*links));
+          if (!links)
+               return -1;
+          wk->links = links;
+          wk->m_links = n_links;
+     }
+     for (size_t j=0; j<n_links; ++j) {
+          int same;
+          wk->links[j].hash = b->link_hash[first + j] =
+               crawled_page_domain_link(&cp_domain, j, &same);
+          wk->links[j].j = j;
+          b->link_same[first + j] = same;
+     }
+     // only the first appearance of each link is stored
+     qsort(wk->links, n_links, sizeof(*wk->links), sharded_page_db_link_cmp);
+     for (size_t j=0; j<n_links; ++j)
+          b->link_dup[first + wk->links[j].j] =
+               j > 0 && wk->links[j].hash == wk->links[j - 1].hash;
+     return 0;
+}
+
+/** Store the links of a crawled page, split by domain like
+ * @ref page_db_add_many does */
+static PageDBError
+sharded_page_db_batch_put_links(ShardedPageDBBatch *b, PageDBWriter *w, size_t i) {
+     size_t first = b->link_start[i];
+     size_t n_links = b->link_start[i + 1] - first;
+     uint64_t *diff_id = malloc((2*n_links + 1)*sizeof(*diff_id));
+     if (!diff_id) {
+          error_set(w->db->error, page_db_error_memory, __func__);
+          return w->db->error->code;
+     }
+     uint64_t *same_id = diff_id + n_links;
+     size_t n_diff = 0;
+     size_t n_same = 0;
+     for (size_t j=first; j<first + n_links; ++j) {
+          if (b->link_dup[j])
+               continue;
+          if (b->link_same[j])
+               same_id[n_same++] = b->link_idx[j];
+          else
+               diff_id[n_diff++] = b->link_idx[j];
+     }
+     PageDBError rc = page_db_writer_put_links(
+          w, b->page_idx[i], diff_id, n_diff, same_id, n_same);
+     free(diff_id);
+     return rc;
+}
+
+static void *
+sharded_page_db_worker(void *arg) {
+     ShardedPageDBWorker *wk = arg;
+     ShardedPageDBBatch *b = wk->batch;
+     ShardedPageDB *db = b->db;
+     const size_t s = wk->shard;
+     const size_t n_shards = db->n_shards;
+
+     pthread_mutex_lock(&b->mtx);
+     while (b->start == 0)
+          pthread_cond_wait(&b->cond, &b->mtx);
+     int start = b->start;
+     pthread_mutex_unlock(&b->mtx);
+     if (start < 0)
+          return 0;
+
+     PageDBWriter w;
+     int ok = page_db_writer_begin(&w, db->shards[s]) == 0;
+     if (!ok)
+          sharded_page_db_batch_fail(b);
+
+     for (size_t i=s; i<b->n_pages && ok; i += n_shards)
+          if (sharded_page_db_batch_hash_page(wk, i) != 0) {
+               error_set(db->shards[s]->error, page_db_error_memory, __func__);
+               page_db_writer_abort(&w);
+               ok = 0;
+               sharded_page_db_batch_fail(b);
+          }
+
+     if (sharded_page_db_batch_wait(b) == 0 && ok) {
+          for (size_t i=0; i<b->n_pages && ok; ++i)
+               if (sharded_page_db_shard(db, b->page_hash[i]) == s)
+                    ok = page_db_writer_add_crawled(&w,
+                                                    b->pages[i],
+                                                    b->page_hash[i],
+                                                    b->page_depth + i,
+                                                    b->page_idx + i) == 0;
+          if (!ok)
+               sharded_page_db_batch_fail(b);
+     }
+     if (sharded_page_db_batch_wait(b) == 0 && ok) {
+          for (size_t i=0; i<b->n_pages && ok; ++i)
+               for (size_t j=b->link_start[i]; j<b->link_start[i + 1] && ok; ++j)
+                    if (!b->link_dup[j] &&
+                        sharded_page_db_shard(db, b->link_hash[j]) == s)
+                         ok = page_db_writer_add_link(
+                              &w,
+                              b->link_hash[j],
+                              crawled_page_get_link(b->pages[i], j - b->link_start[i]),
+                              b->page_hash[i],
+                              b->page_depth[i] + 1,
+                              b->link_idx + j) == 0;
+          if (!ok)
+               sharded_page_db_batch_fail(b);
+     }
+     if (sharded_page_db_batch_wait(b) == 0 && ok) {
+          for (size_t i=0; i<b->n_pages && ok; ++i)
+               if (sharded_page_db_shard(db, b->page_hash[i]) == s)
+                    ok = sharded_page_db_batch_put_links(b, &w, i) == 0;
+          if (!ok)
+               sharded_page_db_batch_fail(b);
+     }
+     // the indices must be saved before any shard commits, otherwise they
+     // could not be reserved if this shard fails to commit
+     if (sharded_page_db_batch_wait(b) == 0 && ok) {
+          int rc = sharded_page_db_reserve_save(db->shards[s], &w);
+          if (rc != 0) {
+               error_set(db->shards[s]->error, page_db_error_invalid_path, __func__);
+               error_add(db->shards[s]->error, "saving reserved indices");
+               error_add(db->shards[s]->error, strerror(rc));
+               page_db_writer_abort(&w);
+               ok = 0;
+               sharded_page_db_batch_fail(b);
+          }
+     } else if (ok) {
+          page_db_writer_abort(&w);
+          ok = 0;
+     }
+     // nobody commits unless all shards succeeded
+     if (sharded_page_db_batch_wait(b) == 0 && ok) {
+          if (page_db_writer_commit(&w) != 0)
+               // the saved indices are reserved by sharded_page_db_add_many
+               sharded_page_db_batch_fail(b);
+          else
+               sharded_page_db_reserve_clear(db->shards[s]);
+     } else if (ok) {
+          page_db_writer_abort(&w);
+          sharded_page_db_reserve_clear(db->shards[s]);
+     }
+     return 0;
+}
+
+ShardedPageDBError
+sharded_page_db_add_many(ShardedPageDB *db, const CrawledPage **pages, size_t n) {
+     const size_t n_shards = db->n_shards;
+     ShardedPageDBBatch b = {
+          .db = db,
+          .pages = pages,
+          .n_pages = n,
+     };
+     ShardedPageDBWorker *workers = 0;
+
+     pthread_mutex_lock(&db->add_lock);
+     // a previous batch could have failed to reserve its indices
+     for (size_t s=0; s<n_shards; ++s)
+          if (sharded_page_db_repair(db, s) != 0)
+               goto exit;
+     size_t n_links = 0;
+     if (!(b.link_start = malloc((n + 1)*sizeof(*b.link_start))))
+          goto on_memory_error;
+     for (size_t i=0; i<n; ++i) {
+          b.link_start[i] = n_links;
+          n_links += crawled_page_n_links(pages[i]);
+     }
+     b.link_start[n] = n_links;
+
+     b.page_hash = malloc(n*sizeof(*b.page_hash));
+     b.page_depth = malloc(n*sizeof(*b.page_depth));
+     b.page_idx = malloc(n*sizeof(*b.page_idx));
+     b.link_hash = malloc(n_links*sizeof(*b.link_hash));
+     b.link_idx = malloc(n_links*sizeof(*b.link_idx));
+     b.link_same = malloc(n_links*sizeof(*b.link_same));
+     b.link_dup = malloc(n_links*sizeof(*b.link_dup));
+     workers = calloc(n_shards, sizeof(*workers));
+     if (!b.page_hash || !b.page_depth || !b.page_idx ||
+         (n_links > 0 &&
+          (!b.link_hash || !b.link_idx || !b.link_same || !b.link_dup)) ||
+         !workers)
+          goto on_memory_error;
+
+     if (pthread_mutex_init(&b.mtx, 0) != 0)
+          goto on_thread_error;
+     if (pthread_cond_init(&b.cond, 0) != 0) {
+          pthread_mutex_destroy(&b.mtx);
+          goto on_thread_error;
+     }
+
+     // Threads wait until all of them have been created, otherwise a thread
+     // could wait forever for a missing one to finish its phase
+     size_t n_created = 0;
+     for (; n_created<n_shards; ++n_created) {
+          workers[n_created].batch = &b;
+          workers[n_created].shard = n_created;
+          if (pthread_create(&workers[n_created].thread,
+                             0,
+                             sharded_page_db_worker,
+                             workers + n_created) != 0)
+               break;
+     }
+     pthread_mutex_lock(&b.mtx);
+     b.start = n_created == n_shards? 1: -1;
+     pthread_cond_broadcast(&b.cond);
+     pthread_mutex_unlock(&b.mtx);
+
+     int join_failed = 0;
+     for (size_t s=0; s<n_created; ++s)
+          if (pthread_join(workers[s].thread, 0) != 0)
+               join_failed = 1;
+     for (size_t s=0; s<n_created; ++s)
+          free(workers[s].links);
+     pthread_mutex_destroy(&b.mtx);
+     pthread_cond_destroy(&b.cond);
+
+     if (b.start < 0 || join_failed)
+          goto on_thread_error;
+     if (b.failed) {
+          // if it fails it is retried by the next batch
+          for (size_t s=0; s<n_shards; ++s)
+               (void)sharded_page_db_repair(db, s);
+          sharded_page_db_set_error(db, sharded_page_db_error_internal, __func__);
+          for (size_t s=0; s<n_shards; ++s)
+               if (db->shards[s]->error->code != 0) {
+                    sharded_page_db_add_error(db, db->shards[s]->error->message);
+                    break;
+               }
+     }
+     goto exit;
+
+on_memory_error:
+     sharded_page_db_set_error(db, sharded_page_db_error_memory, __func__);
+     goto exit;
+on_thread_error:
+     sharded_page_db_set_error(db, sharded_page_db_error_thread, __func__);
+exit:
+     free(b.link_start);
+     free(b.page_hash);
+     free(b.page_depth);
+     free(b.page_idx);
+     free(b.link_hash);
+     free(b.link_idx);
+     free(b.link_same);
+     free(b.link_dup);
+     free(workers);
+     pthread_mutex_unlock(&db->add_lock);
+     return db->error->code;
+}
+
+int
+sharded_page_db_ingest(void *state, const CrawledPage **pages, size_t n) {
+     return sharded_page_db_add_many((ShardedPageDB*)state, pages, n);
+}
+
+ShardedPageDBError
+sharded_page_db_get_idx(ShardedPageDB *db, uint64_t hash, uint64_t *idx) {
+     PageDB *shard = db->shards[sharded_page_db_shard(db, hash)];
+     switch (page_db_get_idx(shard, hash, idx)) {
+     case page_db_error_ok:
+          return 0;
+     case page_db_error_no_page:
+          sharded_page_db_set_error(db, sharded_page_db_error_no_page, __func__);
+          break;
+     default:
+          sharded_page_db_set_error(db, sharded_page_db_error_internal, __func__);
+          sharded_page_db_add_error(db, shard->error->message);
+          break;
+     }
+     return db->error->code;
+}
+
+ShardedPageDBError
+sharded_page_db_get_info(ShardedPageDB *db, uint64_t hash, PageInfo **pi) {
+     PageDB *shard = db->shards[sharded_page_db_shard(db, hash)];
+     if (page_db_get_info(shard, hash, pi) != 0) {
+          sharded_page_db_set_error(db, sharded_page_db_error_internal, __func__);
+          sharded_page_db_add_error(db, shard->error->message);
+     }
+     return db->error->code;
+}
+
+void
+sharded_page_db_set_persist(ShardedPageDB *db, int value) {
+     db->persist = value;
+     for (size_t s=0; s<db->n_shards; ++s)
+          if (db->shards[s])
+               page_db_set_persist(db->shards[s], value);
+}
+
+ShardedPageDBError
+sharded_page_db_delete(ShardedPageDB *db) {
+     if (!db)
+          return 0;
+
+     int failed = 0;
+     if (db->shards) {
+          for (size_t s=0; s<db->n_shards; ++s)
+               if (db->shards[s] && page_db_delete(db->shards[s]) != 0)
+                    failed = 1;
+          // the shard directories are removed by each shard
+          if (!db->persist && db->path && !failed)
+               (void)remove(db->path);
+     }
+     free(db->shards);
+     free(db->path);
+     pthread_mutex_destroy(&db->add_lock);
+     error_delete(db->error);
+     free(db);
+     return failed? sharded_page_db_error_internal: 0;
+}
+
+/** Read the next link of a shard stream into its head */
+static void
+sharded_page_db_link_stream_advance(ShardedPageDBLinkStream *st, size_t i) {
+     st->states[i] = page_db_link_stream_next(st->streams[i], st->heads + i);
+}
+
+ShardedPageDBError
+sharded_page_db_link_stream_new(ShardedPageDBLinkStream **es, ShardedPageDB *db) {
+     ShardedPageDBLinkStream *st = *es = calloc(1, sizeof(*st));
+     if (!st)
+          goto on_memory_error;
+     st->n_streams = db->n_shards;
+     st->only_diff_domain = PAGE_DB_LINK_STREAM_DEFAULT_ONLY_DIFF_DOMAIN;
+     if (!(st->streams = calloc(st->n_streams, sizeof(*st->streams))) ||
+         !(st->heads = calloc(st->n_streams, sizeof(*st->heads))) ||
+         !(st->states = calloc(st->n_streams, sizeof(*st->states))))
+          goto on_memory_error;
+
+     for (size_t s=0; s<st->n_streams; ++s)
+          if (page_db_link_stream_new(st->streams + s, db->shards[s]) != 0) {
+               sharded_page_db_set_error(db, sharded_page_db_error_internal, __func__);
+               sharded_page_db_add_error(db, "creating shard link stream");
+               sharded_page_db_add_error(db, db->shards[s]->error->message);
+               goto on_error;
+          }
+     if (sharded_page_db_link_stream_reset(st) == stream_state_error) {
+          sharded_page_db_set_error(db, sharded_page_db_error_internal, __func__);
+          sharded_page_db_add_error(db, "resetting link stream");
+          goto on_error;
+     }
+     return 0;
+
+on_memory_error:
+     sharded_page_db_set_error(db, sharded_page_db_error_memory, __func__);
+on_error:
+     sharded_page_db_link_stream_delete(st);
+     *es = 0;
+     return db->error->code;
+}
+
+StreamState
+sharded_page_db_link_stream_reset(void *es) {
+     ShardedPageDBLinkStream *st = es;
+     st->state = stream_state_init;
+     for (size_t s=0; s<st->n_streams; ++s) {
+          st->streams[s]->only_diff_domain = st->only_diff_domain;
+          if (page_db_link_stream_reset(st->streams[s]) == stream_state_error)
+               return st->state = stream_state_error;
+          sharded_page_db_link_stream_advance(st, s);
+          if (st->states[s] == stream_state_error)
+               return st->state = stream_state_error;
+     }
+     return st->state;
+}
+
+StreamState
+sharded_page_db_link_stream_next(void *es, Link *link) {
+     ShardedPageDBLinkStream *st = es;
+     if (st->state == stream_state_end || st->state == stream_state_error)
+          return st->state;
+
+     // few shards, a linear scan for the smallest head is enough
+     size_t best = st->n_streams;
+     for (size_t s=0; s<st->n_streams; ++s)
+          if (st->states[s] == stream_state_next &&
+              (best == st->n_streams || st->heads[s].from < st->heads[best].from))
+               best = s;
+     if (best == st->n_streams)
+          return st->state = stream_state_end;
+
+     *link = st->heads[best];
+     sharded_page_db_link_stream_advance(st, best);
+     if (st->states[best] == stream_state_error)
+          return st->state = stream_state_error;
+     return st->state = stream_state_next;
+}
+
+void
+sharded_page_db_link_stream_delete(ShardedPageDBLinkStream *es) {
+     if (!es)
+          return;
+     if (es->streams)
+          for (size_t s=0; s<es->n_streams; ++s)
+               page_db_link_stream_delete(es->streams[s]);
+     free(es->streams);
+     free(es->heads);
+     free(es->states);
+     free(es);
+}
+
+ShardedPageDBError
+sharded_hashinfo_stream_new(ShardedHashInfoStream **st, ShardedPageDB *db) {
+     ShardedHashInfoStream *p = *st = calloc(1, sizeof(*p));
+     if (!p || !(p->streams = calloc(db->n_shards, sizeof(*p->streams)))) {
+          sharded_page_db_set_error(db, sharded_page_db_error_memory, __func__);
+          goto on_error;
+     }
+     p->n_streams = db->n_shards;
+     for (size_t s=0; s<p->n_streams; ++s)
+          if (hashinfo_stream_new(p->streams + s, db->shards[s]) != 0) {
+               sharded_page_db_set_error(db, sharded_page_db_error_internal, __func__);
+               sharded_page_db_add_error(db, "creating shard hashinfo stream");
+               sharded_page_db_add_error(db, db->shards[s]->error->message);
+               goto on_error;
+          }
+     p->state = stream_state_init;
+     return 0;
+
+on_error:
+     sharded_hashinfo_stream_delete(p);
+     *st = 0;
+     return db->error->code;
+}
+
+StreamState
+sharded_hashinfo_stream_next(ShardedHashInfoStream *st, uint64_t *hash, PageInfo **pi) {
+     while (st->current < st->n_streams) {
+          switch (st->state = hashinfo_stream_next(st->streams[st->current], hash, pi)) {
+          case stream_state_end:
+               st->current++;
+               break;
+          default:
+               return st->state;
+          }
+     }
+     return st->state = stream_state_end;
+}
+
+StreamState
+sharded_hashinfo_stream_next_view(ShardedHashInfoStream *st,
+                                  uint64_t *hash,
+                                  PageInfoView *view) {
+     while (st->current < st->n_streams) {
+          switch (st->state = hashinfo_stream_next_view(st->streams[st->current], hash, view)) {
+          case stream_state_end:
+               st->current++;
+               break;
+          default:
+               return st->state;
+          }
+     }
+     return st->state = stream_state_end;
+}
+
+void
+sharded_hashinfo_stream_delete(ShardedHashInfoStream *st) {
+     if (!st)
+          return;
+     if (st->streams)
+          for (size_t s=0; s<st->n_streams; ++s)
+               if (st->streams[s])
+                    hashinfo_stream_delete(st->streams[s]);
+     free(st->streams);
+     free(st);
+}
+
+#if (defined TEST) && TEST
+#include "test_sharded_page_db.c"
+#endif
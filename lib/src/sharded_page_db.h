@@ -0,0 +1,205 @@
+#ifndef __SHARDED_PAGE_DB_H__
+#define __SHARDED_PAGE_DB_H__
+
+#define _POSIX_C_SOURCE 200809L
+#define _BSD_SOURCE 1
+#define _GNU_SOURCE 1
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "link_stream.h"
+#include "page_db.h"
+#include "util.h"
+
+/// @addtogroup ShardedPageDB
+/// @{
+
+/** Default value for @ref ShardedPageDB::persist */
+#define SHARDED_PAGE_DB_DEFAULT_PERSIST 1
+
+typedef enum {
+     sharded_page_db_error_ok = 0,       /**< No error */
+     sharded_page_db_error_memory,       /**< Error allocating memory */
+     sharded_page_db_error_invalid_path, /**< File system error */
+     sharded_page_db_error_internal,     /**< Unexpected error, for example inside a shard */
+     sharded_page_db_error_thread,       /**< Error inside the threading library */
+     sharded_page_db_error_no_page       /**< A page was requested but could not be found */
+} ShardedPageDBError;
+
+/** A page database split in several @ref PageDB, each one inside its own
+ * LMDB environment.
+ *
+ * LMDB allows a single writer for each environment. Splitting the pages by
+ * domain lets @ref sharded_page_db_add_many write all shards at the same
+ * time, one thread for each shard.
+ *
+ * The shard of a page is selected by the top bits of the domain part of
+ * @ref page_db_hash. Since the domain makes the top half of the hash, each
+ * shard holds a contiguous range of hashes, and links inside the same domain
+ * never cross shards.
+ *
+ * The n-th page stored inside shard s gets index n*n_shards + s, so indices
+ * are unique across shards and dense as long as the shards are balanced.
+ * Links are stored inside the shard of the crawled page, but the index of
+ * each link is assigned by the shard of the link.
+ *
+ * Each batch is committed separately inside each shard: if a commit fails
+ * the other shards can still have stored their part of the batch. Their
+ * links can point to indices handed out by the failed shard, so each shard
+ * saves those indices before committing and, if the commit fails, they are
+ * reserved without a page. A shard that could not reserve them is retried
+ * by the next batch or when the database is opened again.
+ */
+typedef struct {
+     char *path;      /**< Directory with a subdirectory for each shard */
+     size_t n_shards;
+     PageDB **shards;
+     /** Serializes @ref sharded_page_db_add_many. The worker of each shard
+         holds its write transaction while waiting for the other workers,
+         so two batches could each wait on a shard held by the other */
+     pthread_mutex_t add_lock;
+
+     Error *error;
+// Options
+// -----------------------------------------------------------------------------
+     /** If false delete all shards from disk when deleting the object */
+     int persist;
+} ShardedPageDB;
+
+/** Open or create a sharded database.
+ *
+ * @param db The new database. NULL if memory error, otherwise it is allocated
+ *           even in case of error so that the error can be inspected.
+ * @param path Directory where the shards are stored.
+ * @param n_shards Number of shards. It must be the same every time the
+ *                 database is opened.
+ *
+ * @return 0 if success, otherwise the error code
+ */
+ShardedPageDBError
+sharded_page_db_new(ShardedPageDB **db, const char *path, size_t n_shards);
+
+/** Shard where the page with the given hash is stored */
+size_t
+sharded_page_db_shard(const ShardedPageDB *db, uint64_t hash);
+
+/** Add crawled pages, writing all shards in parallel.
+ *
+ * Same as @ref page_db_add_many but without returning the updated
+ * @ref PageInfo. Concurrent calls are serialized: each one waits for the
+ * previous batch to finish.
+ */
+ShardedPageDBError
+sharded_page_db_add_many(ShardedPageDB *db, const CrawledPage **pages, size_t n);
+
+/** Same as @ref sharded_page_db_add_many, with the signature of
+ * @ref IngestQueueAddFunc so that it can be fed from an @ref IngestQueue */
+int
+sharded_page_db_ingest(void *state, const CrawledPage **pages, size_t n);
+
+/** Get index for the given URL hash */
+ShardedPageDBError
+sharded_page_db_get_idx(ShardedPageDB *db, uint64_t hash, uint64_t *idx);
+
+/** Retrieve the PageInfo stored inside the database.
+ *
+ * If not found it signals success but the PageInfo will be NULL, like
+ * @ref page_db_get_info.
+ */
+ShardedPageDBError
+sharded_page_db_get_info(ShardedPageDB *db, uint64_t hash, PageInfo **pi);
+
+/** Set @ref ShardedPageDB::persist */
+void
+sharded_page_db_set_persist(ShardedPageDB *db, int value);
+
+/** Close all shards and free memory */
+ShardedPageDBError
+sharded_page_db_delete(ShardedPageDB *db);
+
+/// @}
+
+/// @addtogroup LinkStream
+/// @{
+
+/** Links of all shards, merged by origin page.
+ *
+ * Each shard streams its links ordered by the index of the origin page, and
+ * since indices of different shards are interleaved the streams are merged
+ * to keep the same order.
+ */
+typedef struct {
+     size_t n_streams;
+     PageDBLinkStream **streams;
+     Link *heads;           /**< Next link of each stream */
+     StreamState *states;   /**< State of each stream after reading its head */
+
+     StreamState state;
+
+     /** Copied into every shard stream when reset, see
+      * @ref PageDBLinkStream::only_diff_domain */
+     int only_diff_domain;
+} ShardedPageDBLinkStream;
+
+/** Create a new stream, see @ref page_db_link_stream_new */
+ShardedPageDBError
+sharded_page_db_link_stream_new(ShardedPageDBLinkStream **es, ShardedPageDB *db);
+
+/** Rewind stream to the beginning */
+StreamState
+sharded_page_db_link_stream_reset(void *es);
+
+/** Get next element inside stream */
+StreamState
+sharded_page_db_link_stream_next(void *es, Link *link);
+
+/** Delete link stream and free the transactions of all shards */
+void
+sharded_page_db_link_stream_delete(ShardedPageDBLinkStream *es);
+
+/// @}
+
+/// @addtogroup HashInfoStream
+/// @{
+
+/** Stream over the PageInfo of all shards, ordered by hash.
+ *
+ * Shards hold contiguous ranges of hashes, so the shard streams are just
+ * concatenated.
+ */
+typedef struct {
+     size_t n_streams;
+     HashInfoStream **streams;
+     size_t current;       /**< Stream being read */
+     StreamState state;
+} ShardedHashInfoStream;
+
+/** Create a new stream */
+ShardedPageDBError
+sharded_hashinfo_stream_new(ShardedHashInfoStream **st, ShardedPageDB *db);
+
+/** Get next element in stream, see @ref hashinfo_stream_next */
+StreamState
+sharded_hashinfo_stream_next(ShardedHashInfoStream *st, uint64_t *hash, PageInfo **pi);
+
+/** Get next element in stream, see @ref hashinfo_stream_next_view */
+StreamState
+sharded_hashinfo_stream_next_view(ShardedHashInfoStream *st,
+                                  uint64_t *hash,
+                                  PageInfoView *view);
+
+/** Free stream */
+void
+sharded_hashinfo_stream_delete(ShardedHashInfoStream *st);
+
+/// @}
+
+#if (defined TEST) && TEST
+#include "CuTest.h"
+CuSuite *
+test_sharded_page_db_suite(size_t n_pages);
+#endif
+
+#endif // __SHARDED_PAGE_DB_H__
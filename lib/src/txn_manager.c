@@ -11,8 +11,11 @@
 #include <malloc.h>
 #endif
 #include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 
 #include "txn_manager.h"
 #include "util.h"
@@ -114,10 +117,35 @@ txn_manager_new(TxnManager **tm, MDB_env *env) {
      }
 
      p->env = env;
+     p->n_pool = 0;
+     p->generation = 0;
+     p->growth = 0;
+     p->n_skip = 0;
+     p->n_since_check = 0;
+     p->last_pgno = 0;
+     p->max_pages_per_call = 0;
+     memset(&p->stats, 0, sizeof(p->stats));
+     p->sync = txn_manager_sync_none;
+     p->sync_interval = 0.0;
+     p->sync_thread_running = 0;
+     p->sync_stop = 0;
+     p->n_unsynced = 0;
+     p->synced_bytes = 0;
+     memset(&p->sync_stats, 0, sizeof(p->sync_stats));
+     p->before_sync = 0;
+     p->before_sync_state = 0;
      if (inv_semaphore_init(&p->txn_counter_read) != 0)
           error_set(p->error, txn_manager_error_thread, "creating read txn counter");
      else if (inv_semaphore_init(&p->txn_counter_write) != 0)
           error_set(p->error, txn_manager_error_thread, "creating write txn counter");
+     else if (pthread_mutex_init(&p->pool_lock, 0) != 0)
+          error_set(p->error, txn_manager_error_thread, "creating pool lock");
+     else if (pthread_mutex_init(&p->expand_lock, 0) != 0)
+          error_set(p->error, txn_manager_error_thread, "creating expand lock");
+     else if (pthread_mutex_init(&p->sync_lock, 0) != 0)
+          error_set(p->error, txn_manager_error_thread, "creating sync lock");
+     else if (pthread_cond_init(&p->sync_cond, 0) != 0)
+          error_set(p->error, txn_manager_error_thread, "creating sync condition");
 
      return p->error->code;
 }
@@ -132,7 +160,22 @@ txn_manager_begin(TxnManager *tm, int flags, MDB_txn **txn) {
           error_add(tm->error, "incrementing txn counter");
           return tm->error->code;
      }
-     int mdb_rc = mdb_txn_begin(tm->env, 0, flags, txn);
+     MDB_txn *pooled = 0;
+     if (flags & MDB_RDONLY) {
+          pthread_mutex_lock(&tm->pool_lock);
+          if (tm->n_pool > 0)
+               pooled = tm->pool[--tm->n_pool];
+          pthread_mutex_unlock(&tm->pool_lock);
+     }
+     int mdb_rc;
+     if (pooled && mdb_txn_renew(pooled) == 0) {
+          *txn = pooled;
+          return tm->error->code;
+     }
+     if (pooled)
+          mdb_txn_abort(pooled);
+
+     mdb_rc = mdb_txn_begin(tm->env, 0, flags, txn);
      // other process has changed database size. Try to adapt to new size
      if (mdb_rc == MDB_MAP_RESIZED)
           mdb_rc =
@@ -147,22 +190,125 @@ txn_manager_begin(TxnManager *tm, int flags, MDB_txn **txn) {
      return tm->error->code;
 }
 
+static double
+txn_manager_now(void) {
+     struct timespec t;
+     clock_gettime(CLOCK_MONOTONIC, &t);
+     return (double)t.tv_sec + 1e-9*(double)t.tv_nsec;
+}
+
+/** Size of the data file */
+static size_t
+txn_manager_env_size(TxnManager *tm) {
+     mdb_filehandle_t fd;
+     struct stat st;
+     if (mdb_env_get_fd(tm->env, &fd) == 0 && fstat(fd, &st) == 0)
+          return (size_t)st.st_size;
+     return 0;
+}
+
+#if (defined TEST) && TEST
+int txn_manager_test_sync_error = 0;
+TxnManager *txn_manager_test_commit_fail = 0;
+#endif
+
+/** Sync the environment and update the counters. A transaction counter
+ * must be held, or no transactions be active, so that the environment is
+ * not resized or reopened meanwhile.
+ *
+ * If the sync fails its transactions are left for the next one.
+ *
+ * @return 0 if success, otherwise the code of @ref TxnManager::before_sync
+ *         or the LMDB error code
+ */
+static int
+txn_manager_sync_env(TxnManager *tm) {
+     pthread_mutex_lock(&tm->sync_lock);
+     size_t n_txns = tm->n_unsynced;
+     tm->n_unsynced = 0;
+     pthread_mutex_unlock(&tm->sync_lock);
+
+     double start = txn_manager_now();
+     int rc = tm->before_sync? tm->before_sync(tm->before_sync_state): 0;
+     if (rc == 0)
+          rc = mdb_env_sync(tm->env, 1);
+#if (defined TEST) && TEST
+     if (txn_manager_test_sync_error)
+          rc = txn_manager_test_sync_error;
+#endif
+     double elapsed = txn_manager_now() - start;
+     size_t bytes = rc == 0? txn_manager_env_size(tm): 0;
+
+     pthread_mutex_lock(&tm->sync_lock);
+     if (rc != 0) {
+          tm->n_unsynced += n_txns;
+          tm->sync_stats.n_errors++;
+     } else {
+          TxnManagerSyncStats *stats = &tm->sync_stats;
+          stats->n_syncs++;
+          stats->n_txns += n_txns;
+          // the file shrinks after a compaction
+          if (bytes > tm->synced_bytes)
+               stats->bytes_flushed += bytes - tm->synced_bytes;
+          tm->synced_bytes = bytes;
+          stats->sync_total += elapsed;
+          if (elapsed > stats->sync_max)
+               stats->sync_max = elapsed;
+     }
+     pthread_mutex_unlock(&tm->sync_lock);
+     return rc;
+}
+
 TxnManagerError
 txn_manager_commit(TxnManager *tm, MDB_txn *txn) {
      InvSemaphore *counter =
           mdb_txn_rdonly(txn)?
           &tm->txn_counter_read: &tm->txn_counter_write;
 
-     int mdb_rc = mdb_txn_commit(txn);
+     int mdb_rc;
+#if (defined TEST) && TEST
+     if (tm == txn_manager_test_commit_fail &&
+         counter == &tm->txn_counter_write) {
+          txn_manager_test_commit_fail = 0;
+          // like mdb_txn_commit the transaction is freed on failure
+          mdb_txn_abort(txn);
+          mdb_rc = EIO;
+     } else
+#endif
+     mdb_rc = mdb_txn_commit(txn);
      if (mdb_rc != 0) {
           error_set(tm->error, txn_manager_error_mdb, __func__);
           error_add(tm->error, "commiting new transaction");
           error_add(tm->error, mdb_strerror(mdb_rc));
 
-          txn_manager_abort(tm, txn);
-     } else if (inv_semaphore_dec(counter) != 0) {
-          error_set(tm->error, txn_manager_error_thread, __func__);
-          error_add(tm->error, "decrementing txn counter");
+          // mdb_txn_commit has already freed the transaction
+          if (inv_semaphore_dec(counter) != 0)
+               error_add(tm->error, "decrementing txn counter");
+          // the estimate of free space was wrong, check in the next
+          // expand. The lock is taken after the counter is decremented,
+          // since txn_manager_expand holds it while waiting for writers
+          if (mdb_rc == MDB_MAP_FULL) {
+               pthread_mutex_lock(&tm->expand_lock);
+               tm->n_skip = 0;
+               pthread_mutex_unlock(&tm->expand_lock);
+          }
+     } else {
+          if (counter == &tm->txn_counter_write) {
+               pthread_mutex_lock(&tm->sync_lock);
+               tm->n_unsynced++;
+               TxnManagerSync sync = tm->sync;
+               pthread_mutex_unlock(&tm->sync_lock);
+               // sync before decrementing the counter, which keeps the
+               // environment from being resized meanwhile. The transaction
+               // is committed even if the sync fails: the failure is
+               // counted and the next sync retries it
+               if (sync == txn_manager_sync_commit)
+                    (void)txn_manager_sync_env(tm);
+          }
+          if (inv_semaphore_dec(counter) != 0) {
+               error_set(tm->error, txn_manager_error_thread, __func__);
+               error_add(tm->error, "decrementing txn counter");
+          }
      }
      return tm->error->code;
 }
@@ -173,7 +319,23 @@ txn_manager_abort(TxnManager *tm, MDB_txn *txn) {
           mdb_txn_rdonly(txn)?
           &tm->txn_counter_read: &tm->txn_counter_write;
 
-     mdb_txn_abort(txn);
+     int pooled = 0;
+     unsigned int env_flags;
+     if (mdb_txn_rdonly(txn) &&
+         mdb_env_get_flags(tm->env, &env_flags) == 0 &&
+         (env_flags & MDB_NOTLS)) {
+          // reset before decrementing the counter, the environment could be
+          // resized or closed right after
+          mdb_txn_reset(txn);
+          pthread_mutex_lock(&tm->pool_lock);
+          if (tm->n_pool < TXN_MANAGER_POOL_SIZE) {
+               tm->pool[tm->n_pool++] = txn;
+               pooled = 1;
+          }
+          pthread_mutex_unlock(&tm->pool_lock);
+     }
+     if (!pooled)
+          mdb_txn_abort(txn);
      if (inv_semaphore_dec(counter) != 0) {
           error_set(tm->error, txn_manager_error_thread, __func__);
           error_add(tm->error, "decrementing txn counter");
@@ -181,8 +343,48 @@ txn_manager_abort(TxnManager *tm, MDB_txn *txn) {
      return tm->error->code;
 }
 
+/** Free the pooled read transactions */
+static void
+txn_manager_pool_clear(TxnManager *tm) {
+     pthread_mutex_lock(&tm->pool_lock);
+     for (size_t i=0; i<tm->n_pool; ++i)
+          mdb_txn_abort(tm->pool[i]);
+     tm->n_pool = 0;
+     pthread_mutex_unlock(&tm->pool_lock);
+}
+
+static void
+txn_manager_env_close(TxnManager *tm) {
+     txn_manager_pool_clear(tm);
+     if (tm->env)
+          mdb_env_close(tm->env);
+     tm->env = 0;
+}
+
+static void
+txn_manager_sync_thread_stop(TxnManager *tm) {
+     if (!tm->sync_thread_running)
+          return;
+     pthread_mutex_lock(&tm->sync_lock);
+     tm->sync_stop = 1;
+     pthread_cond_broadcast(&tm->sync_cond);
+     pthread_mutex_unlock(&tm->sync_lock);
+     pthread_join(tm->sync_thread, 0);
+     tm->sync_thread_running = 0;
+}
+
+void
+txn_manager_close_env(TxnManager *tm) {
+     txn_manager_sync_thread_stop(tm);
+     // no transactions are active, flush the last ones
+     if (tm->env && tm->sync != txn_manager_sync_none)
+          (void)txn_manager_sync_env(tm);
+     txn_manager_env_close(tm);
+}
+
 TxnManagerError
 txn_manager_delete(TxnManager *tm) {
+     txn_manager_sync_thread_stop(tm);
      if (inv_semaphore_count(&tm->txn_counter_read) != 0) {
           error_set(tm->error, txn_manager_error_internal, __func__);
           error_add(tm->error, "read transactions still active");
@@ -195,6 +397,16 @@ txn_manager_delete(TxnManager *tm) {
      } else if (inv_semaphore_destroy(&tm->txn_counter_write) != 0) {
           error_set(tm->error, txn_manager_error_thread, __func__);
           error_add(tm->error, "destroying write txn counter");
+     } else if (pthread_mutex_destroy(&tm->pool_lock) != 0) {
+          error_set(tm->error, txn_manager_error_thread, __func__);
+          error_add(tm->error, "destroying pool lock");
+     } else if (pthread_mutex_destroy(&tm->expand_lock) != 0) {
+          error_set(tm->error, txn_manager_error_thread, __func__);
+          error_add(tm->error, "destroying expand lock");
+     } else if (pthread_mutex_destroy(&tm->sync_lock) != 0 ||
+                pthread_cond_destroy(&tm->sync_cond) != 0) {
+          error_set(tm->error, txn_manager_error_thread, __func__);
+          error_add(tm->error, "destroying sync lock");
      } else {
           error_delete(tm->error);
           free(tm);
@@ -204,54 +416,468 @@ txn_manager_delete(TxnManager *tm) {
 }
 
 
-TxnManagerError
-txn_manager_expand(TxnManager *tm, size_t size) {
-     int rc = 0;
+/** Account the time since start as a stall. The expand lock must be held */
+static void
+txn_manager_stall(TxnManager *tm, double start) {
+     double stall = txn_manager_now() - start;
+     tm->stats.stall_total += stall;
+     if (stall > tm->stats.stall_max)
+          tm->stats.stall_max = stall;
+}
+
+/** Size of the map after one growth step */
+static size_t
+txn_manager_grow(const TxnManager *tm, size_t size) {
+     return size + (tm->growth == 0? size: tm->growth);
+}
+
+/** Set the map size. The write counter must be blocked.
+ *
+ * @return 0 if success, otherwise a pthread or LMDB error code
+ */
+static int
+txn_manager_resize(TxnManager *tm, size_t size, TxnManagerError *code, char **error) {
+     int rc;
+     // we disallow creating new transactions, but allow aborting/commiting
+     // until the txn_counter reaches 0
+     if ((rc = inv_semaphore_block(&tm->txn_counter_read)) != 0) {
+          *code = txn_manager_error_thread;
+          *error = "blocking read counter";
+          return rc;
+     }
+     // at this point no transactions are active
+     if ((rc = mdb_env_set_mapsize(tm->env, size)) != 0) {
+          *code = txn_manager_error_mdb;
+          *error = "increasing mapsize";
+          (void)inv_semaphore_release(&tm->txn_counter_read);
+          return rc;
+     }
+     // allow transactions again
+     if ((rc = inv_semaphore_release(&tm->txn_counter_read)) != 0) {
+          *code = txn_manager_error_thread;
+          *error = "releasing read counter";
+          return rc;
+     }
+     tm->stats.n_resizes++;
+     return 0;
+}
+
+/** Expand before a write that counts as n_calls calls to
+ * @ref txn_manager_expand */
+static TxnManagerError
+txn_manager_expand_calls(TxnManager *tm, size_t size, size_t n_calls) {
+     TxnManagerError code = txn_manager_error_mdb;
      char *error = 0;
+     int blocked_write = 0;
+     int rc;
+
+     pthread_mutex_lock(&tm->expand_lock);
+     tm->stats.n_calls += n_calls;
+     if (size == 0 && tm->n_skip >= n_calls) {
+          tm->n_skip -= n_calls;
+          tm->n_since_check += n_calls;
+          pthread_mutex_unlock(&tm->expand_lock);
+          return 0;
+     }
+     double start = txn_manager_now();
+     if ((rc = inv_semaphore_block(&tm->txn_counter_write)) != 0) {
+          code = txn_manager_error_thread;
+          error = "blocking write counter";
+          goto on_error;
+     }
+     blocked_write = 1;
+
+     MDB_envinfo info;
+     MDB_stat stat;
+     if ((rc = mdb_env_info(tm->env, &info)) != 0) {
+          error = "getting environment info";
+          goto on_error;
+     }
+     if ((rc = mdb_env_stat(tm->env, &stat)) != 0) {
+          error = "getting environment stats";
+          goto on_error;
+     }
+     tm->stats.n_checks++;
+
+     // pages used by each call since the last check, rounded up. At least
+     // one, since freed pages are reused without moving me_last_pgno
+     if (tm->last_pgno != 0 && tm->n_since_check > 0) {
+          size_t used = info.me_last_pgno > tm->last_pgno?
+               info.me_last_pgno - tm->last_pgno: 0;
+          size_t per_call = (used + tm->n_since_check - 1)/tm->n_since_check;
+          if (per_call == 0)
+               per_call = 1;
+          if (per_call > tm->max_pages_per_call)
+               tm->max_pages_per_call = per_call;
+     }
+     tm->last_pgno = info.me_last_pgno;
+     // the write following this check is measured by the next one
+     tm->n_since_check = n_calls;
+
+     size_t mapsize = info.me_mapsize;
+     // a batch needs room for all its calls, at the highest rate seen
+     size_t min_pgno = info.me_last_pgno + MDB_MINIMUM_FREE_PAGES +
+          (n_calls - 1)*tm->max_pages_per_call;
+     if (mapsize/stat.ms_psize < min_pgno) {
+          size_t new_size = size != 0? size: txn_manager_grow(tm, mapsize);
+          while (new_size/stat.ms_psize < min_pgno)
+               new_size = txn_manager_grow(tm, new_size);
+          if ((rc = txn_manager_resize(tm, new_size, &code, &error)) != 0)
+               goto on_error;
+          mapsize = new_size;
+     }
+     // skip the next checks while the free space would last twice the
+     // calls, at the highest rate seen
+     size_t free_pgno = mapsize/stat.ms_psize - min_pgno;
+     tm->n_skip = tm->max_pages_per_call == 0?
+          0: free_pgno/(2*tm->max_pages_per_call);
+     if (tm->n_skip > TXN_MANAGER_MAX_SKIP)
+          tm->n_skip = TXN_MANAGER_MAX_SKIP;
+     // the free space must also last the write following this check
+     tm->n_skip = tm->n_skip > n_calls - 1? tm->n_skip - (n_calls - 1): 0;
+
+     if ((rc = inv_semaphore_release(&tm->txn_counter_write)) != 0) {
+          blocked_write = 0;
+          code = txn_manager_error_thread;
+          error = "releasing write counter";
+          goto on_error;
+     }
+     txn_manager_stall(tm, start);
+     pthread_mutex_unlock(&tm->expand_lock);
+
+     return 0;
+on_error:
+     if (blocked_write)
+          (void)inv_semaphore_release(&tm->txn_counter_write);
+     tm->n_skip = 0;
+     pthread_mutex_unlock(&tm->expand_lock);
+
+     error_set(tm->error, code, __func__);
+     error_add(tm->error, error);
+     error_add(tm->error,
+               code == txn_manager_error_thread? strerror(rc): mdb_strerror(rc));
+     return tm->error->code;
+}
 
-#define ERROR(msg, label) do{                   \
-          error = msg;                          \
-          goto label;                           \
-     } while(0)
+TxnManagerError
+txn_manager_expand(TxnManager *tm, size_t size) {
+     return txn_manager_expand_calls(tm, size, 1);
+}
 
+TxnManagerError
+txn_manager_expand_many(TxnManager *tm, size_t n_calls) {
+     return txn_manager_expand_calls(tm, 0, n_calls > 0? n_calls: 1);
+}
 
-     if ((rc = inv_semaphore_block(&tm->txn_counter_write)) != 0)
-          ERROR("blocking write counter", error_thread);
+void
+txn_manager_set_growth(TxnManager *tm, size_t growth) {
+     pthread_mutex_lock(&tm->expand_lock);
+     tm->growth = growth;
+     pthread_mutex_unlock(&tm->expand_lock);
+}
 
+TxnManagerError
+txn_manager_reserve(TxnManager *tm, size_t size) {
+     TxnManagerError code = txn_manager_error_mdb;
+     char *error = 0;
+     int rc;
+
+     pthread_mutex_lock(&tm->expand_lock);
+     double start = txn_manager_now();
+     if ((rc = inv_semaphore_block(&tm->txn_counter_write)) != 0) {
+          code = txn_manager_error_thread;
+          error = "blocking write counter";
+          goto on_error;
+     }
      MDB_envinfo info;
      if ((rc = mdb_env_info(tm->env, &info)) != 0)
-          ERROR("getting environment info", error_mdb);
+          error = "getting environment info";
+     else if (info.me_mapsize < size)
+          rc = txn_manager_resize(tm, size, &code, &error);
+     // the next call to txn_manager_expand computes how many to skip
+     tm->n_skip = 0;
+
+     int rc_release = inv_semaphore_release(&tm->txn_counter_write);
+     if (rc == 0 && rc_release != 0) {
+          rc = rc_release;
+          code = txn_manager_error_thread;
+          error = "releasing write counter";
+     }
+     if (rc != 0)
+          goto on_error;
+     txn_manager_stall(tm, start);
+     pthread_mutex_unlock(&tm->expand_lock);
 
-     MDB_stat stat;
-     if ((rc = mdb_env_stat(tm->env, &stat)) != 0)
-          ERROR("getting environment stats", error_mdb);
+     return 0;
+on_error:
+     pthread_mutex_unlock(&tm->expand_lock);
 
-     size_t max_pgno = info.me_mapsize/stat.ms_psize;
-     if (max_pgno < info.me_last_pgno + MDB_MINIMUM_FREE_PAGES) {
-          // we disallow creating new transactions, but allow aborting/commiting
-          // until the txn_counter reaches 0
-          if ((rc = inv_semaphore_block(&tm->txn_counter_read)) != 0)
-               ERROR("blocking read counter", error_thread);
+     error_set(tm->error, code, __func__);
+     error_add(tm->error, error);
+     error_add(tm->error,
+               code == txn_manager_error_thread? strerror(rc): mdb_strerror(rc));
+     return tm->error->code;
+}
+
+void
+txn_manager_stats(TxnManager *tm, TxnManagerStats *stats) {
+     pthread_mutex_lock(&tm->expand_lock);
+     *stats = tm->stats;
+     pthread_mutex_unlock(&tm->expand_lock);
+}
 
-          // at this point no transactions are active
-          if ((rc = mdb_env_set_mapsize(tm->env, size == 0? info.me_mapsize*2: size)) != 0)
-               ERROR("increasing mapsize", error_mdb);
+static size_t
+txn_manager_file_size(const char *path) {
+     struct stat st;
+     return stat(path, &st) == 0? (size_t)st.st_size: 0;
+}
 
-          // allow transactions again
-          if ((rc = inv_semaphore_release(&tm->txn_counter_read)) != 0)
-               ERROR("releasing read counter", error_thread);
+TxnManagerError
+txn_manager_compact(TxnManager *tm,
+                    unsigned int max_dbs,
+                    size_t *bytes_before,
+                    size_t *bytes_after) {
+     TxnManagerError code = txn_manager_error_mdb;
+     const char *error1 = 0;
+     const char *error2 = 0;
+
+     char *path = 0;
+     char *data = 0;
+     char *copy_dir = 0;
+     char *copy_data = 0;
+
+     int blocked_write = 0;
+     int blocked_read = 0;
+
+     int rc;
+     if ((rc = inv_semaphore_block(&tm->txn_counter_write)) != 0) {
+          code = txn_manager_error_thread;
+          error1 = "blocking write counter";
+          error2 = strerror(rc);
+          goto on_error;
      }
-     if ((rc = inv_semaphore_release(&tm->txn_counter_write)) != 0)
-          ERROR("releasing write counter", error_thread);
+     blocked_write = 1;
 
+     // save settings to reopen the environment
+     const char *env_path;
+     unsigned int flags;
+     MDB_envinfo info;
+     if ((rc = mdb_env_get_path(tm->env, &env_path)) != 0 ||
+         (rc = mdb_env_get_flags(tm->env, &flags)) != 0 ||
+         (rc = mdb_env_info(tm->env, &info)) != 0) {
+          error1 = "getting environment settings";
+          error2 = mdb_strerror(rc);
+          goto on_error;
+     }
+     // mdb_env_get_flags also returns internal flags, not accepted by mdb_env_open
+     flags &= MDB_FIXEDMAP | MDB_NOSUBDIR | MDB_NOSYNC | MDB_RDONLY |
+          MDB_NOMETASYNC | MDB_WRITEMAP | MDB_MAPASYNC | MDB_NOTLS |
+          MDB_NOLOCK | MDB_NORDAHEAD | MDB_NOMEMINIT;
+     if (flags & MDB_NOSUBDIR) {
+          code = txn_manager_error_internal;
+          error1 = "environments opened with MDB_NOSUBDIR are not supported";
+          goto on_error;
+     }
+     if (!(path = strdup(env_path)) ||
+         !(data = build_path(path, "data.mdb")) ||
+         !(copy_dir = build_path(path, "compact")) ||
+         !(copy_data = build_path(copy_dir, "data.mdb"))) {
+          code = txn_manager_error_memory;
+          error1 = "building paths";
+          goto on_error;
+     }
+     if ((error2 = make_dir(copy_dir)) != 0) {
+          code = txn_manager_error_internal;
+          error1 = "creating compact directory";
+          goto on_error;
+     }
+     (void)remove(copy_data);
+
+     // readers are still allowed while the copy is made, but no writes can happen
+     if ((rc = mdb_env_copy2(tm->env, copy_dir, MDB_CP_COMPACT)) != 0) {
+          error1 = "copying environment";
+          error2 = mdb_strerror(rc);
+          goto on_error;
+     }
+
+     if ((rc = inv_semaphore_block(&tm->txn_counter_read)) != 0) {
+          code = txn_manager_error_thread;
+          error1 = "blocking read counter";
+          error2 = strerror(rc);
+          goto on_error;
+     }
+     blocked_read = 1;
+
+     // at this point no transactions are active
+     if (bytes_before)
+          *bytes_before = txn_manager_file_size(data);
+     if (bytes_after)
+          *bytes_after = txn_manager_file_size(copy_data);
+
+     txn_manager_env_close(tm);
+     ++tm->generation;
+     if (rename(copy_data, data) != 0) {
+          // try to reopen the original file
+          error1 = "replacing data file";
+          error2 = strerror(errno);
+     }
+     if ((rc = mdb_env_create(&tm->env)) != 0 ||
+         (rc = mdb_env_set_mapsize(tm->env, info.me_mapsize)) != 0 ||
+         (rc = mdb_env_set_maxdbs(tm->env, max_dbs)) != 0 ||
+         (rc = mdb_env_open(tm->env, path, flags, 0664)) != 0) {
+          error1 = "reopening environment";
+          error2 = mdb_strerror(rc);
+     }
+     if (error1)
+          goto on_error;
+
+     (void)remove(copy_dir);
+     if ((rc = inv_semaphore_release(&tm->txn_counter_read)) != 0 ||
+         (rc = inv_semaphore_release(&tm->txn_counter_write)) != 0) {
+          blocked_read = blocked_write = 0;
+          code = txn_manager_error_thread;
+          error1 = "releasing txn counters";
+          error2 = strerror(rc);
+          goto on_error;
+     }
+     // the new data file has fewer pages, start again the estimate of free
+     // space. Only after releasing the counters, since txn_manager_expand
+     // holds the lock while blocking them
+     pthread_mutex_lock(&tm->expand_lock);
+     tm->n_skip = 0;
+     tm->last_pgno = 0;
+     pthread_mutex_unlock(&tm->expand_lock);
+
+     free(path);
+     free(data);
+     free(copy_dir);
+     free(copy_data);
+     return 0;
+
+on_error:
+     if (copy_data) {
+          (void)remove(copy_data);
+          (void)remove(copy_dir);
+     }
+     if (blocked_read)
+          (void)inv_semaphore_release(&tm->txn_counter_read);
+     if (blocked_write)
+          (void)inv_semaphore_release(&tm->txn_counter_write);
+
+     free(path);
+     free(data);
+     free(copy_dir);
+     free(copy_data);
+
+     error_set(tm->error, code, __func__);
+     error_add(tm->error, error1);
+     if (error2)
+          error_add(tm->error, error2);
      return tm->error->code;
-error_thread:
-     error_set(tm->error, txn_manager_error_thread, __func__);
-     error_add(tm->error, error);
-     error_add(tm->error, strerror(rc));
-error_mdb:
-     error_set(tm->error, txn_manager_error_mdb, __func__);
-     error_add(tm->error, error);
-     error_add(tm->error, mdb_strerror(rc));
-     return tm->error->code;
 }
+
+/** Sync holding the read counter, which waits for a resize or compaction
+ * in progress and keeps new ones from starting.
+ *
+ * @return 0 if success, otherwise the error code
+ */
+static TxnManagerError
+txn_manager_sync_counted(TxnManager *tm, int *rc, const char **error) {
+     if ((*rc = inv_semaphore_inc(&tm->txn_counter_read)) != 0) {
+          *error = strerror(*rc);
+          return txn_manager_error_thread;
+     }
+     TxnManagerError code = txn_manager_error_ok;
+     if ((*rc = txn_manager_sync_env(tm)) != 0) {
+          *error = mdb_strerror(*rc);
+          code = txn_manager_error_mdb;
+     }
+     if ((*rc = inv_semaphore_dec(&tm->txn_counter_read)) != 0 && code == 0) {
+          *error = strerror(*rc);
+          code = txn_manager_error_thread;
+     }
+     return code;
+}
+
+static void *
+txn_manager_sync_thread(void *arg) {
+     TxnManager *tm = arg;
+     double interval = tm->sync_interval;
+
+     pthread_mutex_lock(&tm->sync_lock);
+     while (!tm->sync_stop) {
+          struct timespec deadline;
+          clock_gettime(CLOCK_REALTIME, &deadline);
+          double secs = (double)deadline.tv_nsec*1e-9 + interval;
+          deadline.tv_sec += (time_t)secs;
+          deadline.tv_nsec = (long)((secs - (double)(time_t)secs)*1e9);
+
+          int rc = 0;
+          while (!tm->sync_stop && rc != ETIMEDOUT)
+               rc = pthread_cond_timedwait(&tm->sync_cond, &tm->sync_lock, &deadline);
+          if (tm->sync_stop || tm->n_unsynced == 0)
+               continue;
+
+          pthread_mutex_unlock(&tm->sync_lock);
+          // failures are counted inside the sync stats. The error is not
+          // set since other threads could be using it
+          const char *error;
+          (void)txn_manager_sync_counted(tm, &rc, &error);
+          pthread_mutex_lock(&tm->sync_lock);
+     }
+     pthread_mutex_unlock(&tm->sync_lock);
+     return 0;
+}
+
+TxnManagerError
+txn_manager_set_sync(TxnManager *tm, TxnManagerSync sync, double interval) {
+     txn_manager_sync_thread_stop(tm);
+     if (sync == txn_manager_sync_periodic && !(interval > 0.0)) {
+          error_set(tm->error, txn_manager_error_internal, __func__);
+          error_add(tm->error, "sync interval must be positive");
+          return tm->error->code;
+     }
+     pthread_mutex_lock(&tm->sync_lock);
+     tm->sync = sync;
+     tm->sync_interval = interval;
+     tm->sync_stop = 0;
+     if (tm->env && tm->sync_stats.n_syncs == 0)
+          tm->synced_bytes = txn_manager_env_size(tm);
+     pthread_mutex_unlock(&tm->sync_lock);
+
+     if (sync == txn_manager_sync_periodic) {
+          int rc = pthread_create(&tm->sync_thread, 0, txn_manager_sync_thread, tm);
+          if (rc != 0) {
+               error_set(tm->error, txn_manager_error_thread, __func__);
+               error_add(tm->error, "creating checkpoint thread");
+               error_add(tm->error, strerror(rc));
+               return tm->error->code;
+          }
+          tm->sync_thread_running = 1;
+     }
+     return 0;
+}
+
+TxnManagerError
+txn_manager_sync(TxnManager *tm) {
+     int rc;
+     const char *error;
+     TxnManagerError code = txn_manager_sync_counted(tm, &rc, &error);
+     if (code != 0) {
+          error_set(tm->error, code, __func__);
+          error_add(tm->error, "syncing environment");
+          error_add(tm->error, error);
+     }
+     return code;
+}
+
+void
+txn_manager_sync_stats(TxnManager *tm, TxnManagerSyncStats *stats) {
+     pthread_mutex_lock(&tm->sync_lock);
+     *stats = tm->sync_stats;
+     pthread_mutex_unlock(&tm->sync_lock);
+}
+
+#if (defined TEST) && TEST
+#include "test_txn_manager.c"
+#endif
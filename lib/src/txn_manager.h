@@ -85,6 +85,13 @@ inv_semaphore_destroy(InvSemaphore *is);
  * @{
  */
 
+/** Maximum number of reset read transactions kept for reuse */
+#define TXN_MANAGER_POOL_SIZE 16
+
+/** Maximum number of calls to @ref txn_manager_expand between two checks
+ * of the free space */
+#define TXN_MANAGER_MAX_SKIP 1024
+
 typedef enum {
      txn_manager_error_ok = 0,   /**< No error */
      txn_manager_error_internal, /**< Unexpected error */
@@ -93,6 +100,47 @@ typedef enum {
      txn_manager_error_mdb       /**< Error inside LMDB */
 } TxnManagerError;
 
+/** Counters of @ref txn_manager_expand */
+typedef struct {
+     size_t n_calls;   /**< Calls to @ref txn_manager_expand, see
+                            @ref txn_manager_expand_many */
+     size_t n_checks;  /**< Calls that looked at the free space */
+     size_t n_resizes; /**< Calls that resized the map */
+     /** Seconds spent waiting for transactions to finish inside
+         @ref txn_manager_expand and @ref txn_manager_reserve */
+     double stall_total;
+     double stall_max; /**< Longest of the waits above */
+} TxnManagerStats;
+
+/** When write transactions are written to disk.
+ *
+ * Environments are opened with MDB_NOSYNC, so LMDB never syncs by itself.
+ */
+typedef enum {
+     /** Leave it to the OS. A crash can lose every transaction since the
+         OS last wrote back the pages */
+     txn_manager_sync_none = 0,
+     /** A checkpoint thread syncs the environment periodically. A crash
+         loses at most the transactions of the last interval */
+     txn_manager_sync_periodic,
+     /** Sync after each write transaction commits. Nothing is lost, but
+         each commit waits for the disk */
+     txn_manager_sync_commit
+} TxnManagerSync;
+
+/** Counters of the syncs of the environment */
+typedef struct {
+     size_t n_syncs;       /**< Successful syncs */
+     size_t n_txns;        /**< Write transactions made durable by the syncs */
+     /** Growth of the data file between syncs. This is a lower bound of
+         the bytes flushed, since pages rewritten in place are not counted */
+     size_t bytes_flushed;
+     double sync_total;    /**< Seconds spent syncing */
+     double sync_max;      /**< Longest sync, in seconds */
+     /** Failed syncs. Their transactions are retried by the next sync */
+     size_t n_errors;
+} TxnManagerSyncStats;
+
 /** Transaction Manager.
  *
  * LMDB has several restrictions in the operations it allows in multiple threads,
@@ -108,12 +156,68 @@ typedef enum {
  *
  * This structure tracks the number of read and write transactions active inside the
  * process and allows blocking until all of them are aborted or commited.
+ *
+ * Aborted read transactions are not freed but reset, and renewed by the next
+ * read transaction that begins. This saves allocating the transaction and
+ * acquiring a reader slot for each short lookup. Only environments opened
+ * with MDB_NOTLS pool transactions, since they can be renewed by any thread.
+ *
+ * Looking at the free space of the map requires waiting for the write
+ * transactions to finish, so @ref txn_manager_expand does it only when the
+ * writes since the last look could have used the free space left.
  */
 typedef struct {
      MDB_env *env; /**< LMDB environment where transactions happen */
      InvSemaphore txn_counter_read;  /**< Counter of read transactions */
      InvSemaphore txn_counter_write; /**< Counter of write transactions */
 
+     /** Reset read transactions, waiting to be renewed */
+     MDB_txn *pool[TXN_MANAGER_POOL_SIZE];
+     size_t n_pool;
+     pthread_mutex_t pool_lock;
+     /** Incremented each time @ref txn_manager_compact reopens the
+         environment: database handles and cursors opened before are no
+         longer valid */
+     unsigned int generation;
+
+     /** Bytes added to the map by each resize. If 0 the map is doubled */
+     size_t growth;
+     /** Calls to @ref txn_manager_expand left before the next check */
+     size_t n_skip;
+     /** Calls to @ref txn_manager_expand since the last check, including
+         the one that made it */
+     size_t n_since_check;
+     /** Last page used at the last check, 0 if there was none */
+     size_t last_pgno;
+     /** Largest number of pages used between two calls to
+         @ref txn_manager_expand, as seen by the checks */
+     size_t max_pages_per_call;
+     TxnManagerStats stats;
+     pthread_mutex_t expand_lock;
+
+     /** See @ref txn_manager_set_sync */
+     TxnManagerSync sync;
+     /** Seconds between syncs of the checkpoint thread */
+     double sync_interval;
+     pthread_t sync_thread;
+     int sync_thread_running;
+     /** Set to make the checkpoint thread exit */
+     int sync_stop;
+     /** Write transactions committed since the last sync */
+     size_t n_unsynced;
+     /** Size of the data file at the last sync */
+     size_t synced_bytes;
+     TxnManagerSyncStats sync_stats;
+     /** Protects the sync fields */
+     pthread_mutex_t sync_lock;
+     /** Wakes up the checkpoint thread to exit */
+     pthread_cond_t sync_cond;
+     /** If set, called before each sync of the environment to write back
+         the files outside it that the committed transactions refer to.
+         It returns 0 if success, otherwise the sync fails */
+     int (*before_sync)(void *state);
+     void *before_sync_state;
+
      Error *error;
 } TxnManager;
 
@@ -141,9 +245,20 @@ txn_manager_new(TxnManager **tm, MDB_env *env);
 TxnManagerError
 txn_manager_begin(TxnManager *tm, int flags, MDB_txn **txn);
 
+#if (defined TEST) && TEST
+/** If not 0 the syncs of the environment fail with this error */
+extern int txn_manager_test_sync_error;
+/** If set the next write transaction committed inside it fails */
+extern TxnManager *txn_manager_test_commit_fail;
+#endif
+
 /** Commit transaction.
  *
- * The corresponding counter will be decremented
+ * The corresponding counter will be decremented.
+ *
+ * With @ref txn_manager_sync_commit the environment is synced after the
+ * commit. A failed sync does not undo the commit, so it is not reported as
+ * an error but counted in @ref TxnManagerSyncStats::n_errors.
  */
 TxnManagerError
 txn_manager_commit(TxnManager *tm, MDB_txn *txn);
@@ -155,7 +270,19 @@ txn_manager_commit(TxnManager *tm, MDB_txn *txn);
 TxnManagerError
 txn_manager_abort(TxnManager *tm, MDB_txn *txn);
 
-/** Destroy and free manager */
+/** Free the pooled read transactions and close the environment.
+ *
+ * Must be used instead of mdb_env_close. No transactions can be active.
+ * The checkpoint thread is stopped and, unless the sync policy is
+ * @ref txn_manager_sync_none, the environment is synced before closing.
+ */
+void
+txn_manager_close_env(TxnManager *tm);
+
+/** Destroy and free manager.
+ *
+ * The environment must have been closed with @ref txn_manager_close_env
+ */
 TxnManagerError
 txn_manager_delete(TxnManager *tm);
 
@@ -168,15 +295,120 @@ txn_manager_delete(TxnManager *tm);
 /** Check if the environment must be resized. If this is the case then resize
  *  it.
  *
- * This call will block for sure until there are no write transactions active.
- * This call may block until there are no read transactions active, only if a resize
- * is necessary.
+ * Checking blocks until there are no write transactions active. To keep
+ * this cheap the check is skipped while the free space left is enough for
+ * several more calls, judging by the pages used between previous checks
+ * (at most @ref TXN_MANAGER_MAX_SKIP calls are skipped). A call with
+ * size different than 0 always checks.
+ *
+ * A resize blocks until there are no read transactions active either, and
+ * creation of new read and write transactions will be blocked until it
+ * finishes. Use @ref txn_manager_reserve to avoid resizes.
  *
- * If a resize happens then creation of new read and write transactions will be
- * blocked until it finishes.
+ * @param size New size of the map if a resize is needed. If 0 the map grows
+ *             by @ref TxnManager::growth. In any case it grows enough to
+ *             leave @ref MDB_MINIMUM_FREE_PAGES free.
  */
 TxnManagerError
 txn_manager_expand(TxnManager *tm, size_t size);
 
+/** Same as @ref txn_manager_expand with size 0, before a write transaction
+ * that does the work of n_calls smaller ones, for example adding a batch
+ * of pages instead of a single page.
+ *
+ * The check is skipped only if the skipped calls left cover the whole
+ * batch, and the pages used by the batch are spread over its n_calls when
+ * estimating how many calls to skip next.
+ */
+TxnManagerError
+txn_manager_expand_many(TxnManager *tm, size_t n_calls);
+
+/** Set the number of bytes added to the map by each resize.
+ *
+ * @param growth If 0, the map is doubled, which is the default
+ */
+void
+txn_manager_set_growth(TxnManager *tm, size_t growth);
+
+/** Make the map at least size bytes.
+ *
+ * The map is just address space: the data file grows only as pages are
+ * written. Reserving at start a map much larger than the data will ever
+ * need means that @ref txn_manager_expand never resizes, and therefore
+ * never waits for long read transactions. The size is limited by the
+ * address space of the process, so this is not useful in 32 bit systems.
+ *
+ * It blocks until there are no transactions active, if the map must be
+ * resized.
+ */
+TxnManagerError
+txn_manager_reserve(TxnManager *tm, size_t size);
+
+/** Get the counters of @ref txn_manager_expand */
+void
+txn_manager_stats(TxnManager *tm, TxnManagerStats *stats);
+
+/** Set when write transactions are written to disk.
+ *
+ * Stops the checkpoint thread if running, and starts it again if the new
+ * policy is @ref txn_manager_sync_periodic. The checkpoint thread does
+ * nothing while no write transaction has been committed since the last
+ * sync. It must not be called while other threads are using the manager.
+ *
+ * @param sync The policy, see @ref TxnManagerSync
+ * @param interval Seconds between syncs with @ref txn_manager_sync_periodic
+ *
+ * @return 0 if success, otherwise error code.
+ */
+TxnManagerError
+txn_manager_set_sync(TxnManager *tm, TxnManagerSync sync, double interval);
+
+/** Write to disk all the transactions committed, whatever the policy.
+ *
+ * It does not block transactions, but it waits for a resize or compaction
+ * in progress.
+ */
+TxnManagerError
+txn_manager_sync(TxnManager *tm);
+
+/** Get the counters of the syncs of the environment */
+void
+txn_manager_sync_stats(TxnManager *tm, TxnManagerSyncStats *stats);
+
+/** Compact the environment, reclaiming the free pages inside the data file.
+ *
+ * A compacted copy of the environment is written with mdb_env_copy2 while
+ * read transactions continue. Write transactions are blocked for the whole
+ * operation. Finally, when no read transactions are active either, the
+ * environment is closed, the copy replaces the data file, and the
+ * environment is opened again with the same settings.
+ *
+ * The copy is written inside a "compact" subdirectory of the environment
+ * directory, which must have enough space to hold it.
+ *
+ * Since the environment is reopened, this call will fail with environments
+ * opened with MDB_NOSUBDIR and no other process should have it open. If
+ * reopening fails the environment cannot be used anymore.
+ *
+ * @param tm
+ * @param max_dbs Number of named databases used to reopen the environment
+ * @param bytes_before If not NULL, size of the data file before compaction
+ * @param bytes_after If not NULL, size of the data file after compaction
+ *
+ * @return 0 if success, otherwise error code.
+ */
+TxnManagerError
+txn_manager_compact(TxnManager *tm,
+                    unsigned int max_dbs,
+                    size_t *bytes_before,
+                    size_t *bytes_after);
+
 /// @}
+
+#if (defined TEST) && TEST
+#include "CuTest.h"
+CuSuite *
+test_txn_manager_suite(void);
+#endif
+
 #endif // __TXN_MANAGER_H__
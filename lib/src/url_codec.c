@@ -0,0 +1,141 @@
+#define _POSIX_C_SOURCE 200809L
+#define _BSD_SOURCE 1
+#define _GNU_SOURCE 1
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "url_codec.h"
+
+typedef struct {
+     const char *str;
+     size_t length;
+} UrlCodecToken;
+
+/* The dictionary. Tokens were selected by hand among frequent substrings of
+   crawled URLs and checked against the greedy encoding savings. It is not
+   trained on a corpus: the only URLs shipped are the seeds of the examples,
+   a few hundred news sites, and a dictionary fitted to them would favour
+   their hosts, which @ref PageDB does not even encode since it stores each
+   host once. Changing it changes the on-disk format of @ref PageDB, so a
+   trained dictionary needs a new format and a sample of a real crawl.
+*/
+#define T(s) {s, sizeof(s) - 1}
+static const UrlCodecToken url_codec_tokens[] = {
+     T("http://"), T("https://"), T("http://www."), T("https://www."),
+     T("www."), T(".com"), T(".org"), T(".net"), T(".co.uk"), T(".edu"),
+     T(".gov"), T(".de"), T(".html"), T(".htm"), T(".php"), T(".aspx"),
+     T(".asp"), T(".jsp"), T(".pdf"), T(".jpg"), T(".png"), T("index"),
+     T("index.php"), T("index.html"), T("default"), T("/wiki/"), T("/news/"),
+     T("news"), T("/en/"), T("/blog/"), T("blog"), T("/tag/"), T("/tags/"),
+     T("/category/"), T("category"), T("/article"), T("article"), T("/post"),
+     T("post"), T("/product"), T("product"), T("/search"), T("search"),
+     T("/page/"), T("page"), T("/forum"), T("/topic"), T("/thread"),
+     T("/user"), T("/profile"), T("/view"), T("view"), T("/content/"),
+     T("/images/"), T("/files/"), T("/wp-content/"), T("/uploads/"),
+     T("/about"), T("/contact"), T("/home"), T("?q="), T("?id="), T("?p="),
+     T("?page="), T("&page="), T("?s="), T("&id="), T("&amp;"), T("%20"),
+     T("%2F"), T("utm_source="), T("&utm_medium="), T("&utm_campaign="),
+     T("ref="), T("sort="), T("type="), T("/201"), T("201"), T("20"), T("the"),
+     T("-the-"), T("-and-"), T("-of-"), T("ing"), T("tion"), T("ation"),
+     T("er"), T("es"), T("ion"), T("ent"), T("on"), T("an"), T("in"), T("re"),
+     T("at"), T("or"), T("al"), T("le"), T("st"), T("ar"), T("en"), T("ic"),
+     T("it"), T("is"), T("ed"), T("te"), T("ra"), T("ro"), T("ri"), T("li"),
+     T("la"), T("ti"), T("co"), T("ma"), T("de"), T("ne"), T("id"),
+     T("watch?v="), T("/video"), T("/story"), T("/world"), T("/politics"),
+     T("/sport"), T("/business"), T("/technology"), T("/health"),
+     T("/science")
+};
+#undef T
+
+#define URL_CODEC_N_TOKENS (sizeof(url_codec_tokens)/sizeof(*url_codec_tokens))
+
+/* Token numbers ordered by first char and then by decreasing length, so
+   that the first match is the longest one. Tokens starting with char c are
+   inside [url_codec_first[c], url_codec_first[c + 1]) */
+static uint8_t url_codec_sorted[URL_CODEC_N_TOKENS];
+static uint8_t url_codec_first[257];
+static pthread_once_t url_codec_once = PTHREAD_ONCE_INIT;
+
+static void
+url_codec_init(void) {
+     size_t n = 0;
+     for (size_t c=0; c<256; ++c) {
+          url_codec_first[c] = n;
+          for (size_t len=URL_CODEC_MAX_TOKEN_LENGTH; len>1; --len)
+               for (size_t t=0; t<URL_CODEC_N_TOKENS; ++t)
+                    if ((uint8_t)url_codec_tokens[t].str[0] == c &&
+                        url_codec_tokens[t].length == len)
+                         url_codec_sorted[n++] = t;
+     }
+     url_codec_first[256] = n;
+}
+
+size_t
+url_codec_encode(const char *in, size_t in_size, char *out) {
+     pthread_once(&url_codec_once, url_codec_init);
+
+     uint8_t *o = (uint8_t*)out;
+     size_t i = 0;
+     while (i < in_size) {
+          uint8_t c = in[i];
+          size_t k = url_codec_first[c];
+          for (; k < url_codec_first[c + 1]; ++k) {
+               const UrlCodecToken *tok = url_codec_tokens + url_codec_sorted[k];
+               if (tok->length <= in_size - i &&
+                   memcmp(in + i, tok->str, tok->length) == 0) {
+                    *(o++) = 0x80 + url_codec_sorted[k];
+                    i += tok->length;
+                    break;
+               }
+          }
+          if (k == url_codec_first[c + 1]) {
+               if (c >= 0x80)
+                    *(o++) = 0xFF;
+               *(o++) = c;
+               ++i;
+          }
+     }
+     return o - (uint8_t*)out;
+}
+
+int
+url_codec_decode(const char *in, size_t in_size, char *out, size_t out_size) {
+     const uint8_t *b = (const uint8_t*)in;
+     const uint8_t *end = b + in_size;
+     size_t j = 0;
+     for (; b < end; ++b) {
+          if (*b < 0x80 || *b == 0xFF) {
+               if (*b == 0xFF && ++b == end)
+                    return -1;
+               if (j >= out_size)
+                    return -1;
+               out[j++] = *b;
+          } else {
+               const UrlCodecToken *tok = url_codec_tokens + (*b - 0x80);
+               if (j + tok->length > out_size)
+                    return -1;
+               memcpy(out + j, tok->str, tok->length);
+               j += tok->length;
+          }
+     }
+     return j;
+}
+
+size_t
+url_codec_host_size(const char *url) {
+     const char *p = url;
+     while (isalnum(*p) || *p == '+' || *p == '-' || *p == '.')
+          ++p;
+     if (p == url || strncmp(p, "://", 3) != 0)
+          return 0;
+     p += 3;
+     p += strcspn(p, "/?#");
+     return p - url;
+}
+
+#if (defined TEST) && TEST
+#include "test_url_codec.c"
+#endif
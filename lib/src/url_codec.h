@@ -0,0 +1,78 @@
+#ifndef __URL_CODEC_H__
+#define __URL_CODEC_H__
+
+#define _POSIX_C_SOURCE 200809L
+#define _BSD_SOURCE 1
+#define _GNU_SOURCE 1
+
+#include <stddef.h>
+
+/** @addtogroup UrlCodec
+ *
+ * Compression of URLs using a static dictionary of tokens common in URLs
+ * (schemes, top level domains, extensions, path components and query
+ * parameters).
+ *
+ * The encoded stream is a sequence of bytes where:
+ *
+ *   - 0x00 to 0x7F: the same ASCII char
+ *   - 0x80 to 0xFE: token number (byte - 0x80) of the dictionary
+ *   - 0xFF: escape, the next byte is copied verbatim
+ *
+ * Inside @ref PageDB the scheme and host of most URLs are not stored with
+ * the URL but once per domain, see @ref url_codec_host_size, so the
+ * dictionary is aimed at paths and queries.
+ * @{
+ */
+
+/** Length of the longest token in the dictionary */
+#define URL_CODEC_MAX_TOKEN_LENGTH 14
+
+/** Size of a buffer large enough to encode n chars */
+#define URL_CODEC_MAX_ENCODED_SIZE(n) (2*(n))
+
+/** Size of a buffer large enough to decode n encoded bytes */
+#define URL_CODEC_MAX_DECODED_SIZE(n) (URL_CODEC_MAX_TOKEN_LENGTH*(n))
+
+/** Encode a string.
+ *
+ * @param in The string to encode
+ * @param in_size Number of chars to encode
+ * @param out Output buffer, of at least @ref URL_CODEC_MAX_ENCODED_SIZE bytes
+ *
+ * @return Number of bytes written to out
+ */
+size_t
+url_codec_encode(const char *in, size_t in_size, char *out);
+
+/** Decode a string encoded with @ref url_codec_encode.
+ *
+ * The output is not null terminated.
+ *
+ * @param in
+ * @param in_size Number of encoded bytes
+ * @param out Output buffer
+ * @param out_size Size of the output buffer
+ *
+ * @return Number of chars written, or -1 if out_size is not enough
+ */
+int
+url_codec_decode(const char *in, size_t in_size, char *out, size_t out_size);
+
+/** Length of the "scheme://host" prefix of an URL, including user and port
+ * if present but not the path.
+ *
+ * @return 0 if the URL does not start with a scheme
+ */
+size_t
+url_codec_host_size(const char *url);
+
+/// @}
+
+#if (defined TEST) && TEST
+#include "CuTest.h"
+CuSuite *
+test_url_codec_suite(void);
+#endif
+
+#endif // __URL_CODEC_H__
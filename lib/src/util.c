@@ -13,6 +13,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "util.h"
 
@@ -153,11 +156,11 @@ varint_encode_uint64(uint64_t n, uint8_t *out) {
 }
 
 uint64_t
-varint_decode_uint64(uint8_t *in, uint8_t* read) {
+varint_decode_uint64(const uint8_t *in, uint8_t* read) {
      uint64_t res = 0;
      uint8_t b = 0;
      do {
-          res |= (*in & 0x7F) << b;
+          res |= ((uint64_t)(*in & 0x7F)) << b;
           b += 7;
      } while (*(in++) & 0x80);
 
@@ -171,7 +174,7 @@ varint_encode_int64(int64_t n, uint8_t *out) {
      return varint_encode_uint64(n >= 0? 2*n: 2*llabs(n) + 1, out);
 }
 int64_t
-varint_decode_int64(uint8_t *in, uint8_t* read) {
+varint_decode_int64(const uint8_t *in, uint8_t* read) {
      uint64_t res = varint_decode_uint64(in, read);
      if (res % 2 == 0)
           return res/2;
@@ -179,6 +182,63 @@ varint_decode_int64(uint8_t *in, uint8_t* read) {
           return -((res - 1)/2);
 }
 
+size_t
+varint_size_uint64(uint64_t n) {
+     size_t size = 1;
+     while (n >>= 7)
+          ++size;
+     return size;
+}
+
+size_t
+varint_size_int64(int64_t n) {
+     return varint_size_uint64(n >= 0? 2*n: 2*llabs(n) + 1);
+}
+
+#ifdef __SSE2__
+/** Bit i is set if byte i of the block is one of the URL delimiters */
+__attribute__((no_sanitize_address))
+static unsigned int
+url_delim_mask(const __m128i *block) {
+     __m128i c = _mm_load_si128(block);
+     __m128i m = _mm_or_si128(
+          _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(':')),
+                       _mm_cmpeq_epi8(c, _mm_set1_epi8('@'))),
+          _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('/')),
+                       _mm_cmpeq_epi8(c, _mm_setzero_si128())));
+     return (unsigned int)_mm_movemask_epi8(m);
+}
+#endif
+
+/** Position of the first ':', '@', '/' or '\0' at or after position i.
+ *
+ * With SSE2 the URL is scanned 16 bytes at a time. The first and last blocks
+ * usually include bytes before position i or after the terminating null,
+ * which is why the address sanitizer is disabled here. Those bytes are never
+ * used: the first mask is shifted past them and the scan stops at the block
+ * holding the null. Loads are aligned, so a block never crosses into the
+ * next page, and reading it cannot fault when the string itself is mapped.
+ */
+__attribute__((no_sanitize_address))
+static int
+url_find_delim(const char *url, int i) {
+#ifdef __SSE2__
+     uintptr_t misalign = (uintptr_t)(url + i) & 15;
+     const __m128i *block = (const __m128i*)(url + i - misalign);
+     unsigned int mask = url_delim_mask(block) >> misalign;
+     if (mask)
+          return i + __builtin_ctz(mask);
+     do
+          mask = url_delim_mask(++block);
+     while (!mask);
+     return (int)((const char*)block - url) + __builtin_ctz(mask);
+#else
+     while (url[i] != ':' && url[i] != '@' && url[i] != '/' && url[i] != '\0')
+          ++i;
+     return i;
+#endif
+}
+
 int
 url_domain(const char *url, int *start, int *end) {
      //     +-- colon 1
@@ -213,6 +273,7 @@ url_domain(const char *url, int *start, int *end) {
 
      int n_colon = 1;
      for (; slash3 == -1; i++) {
+          i = url_find_delim(url, i);
           switch (url[i]) {
           case '\0':
                slash3 = i;
@@ -158,7 +158,7 @@ varint_encode_uint64(uint64_t n, uint8_t *out);
  * @return The decoded number
  **/
 uint64_t
-varint_decode_uint64(uint8_t *in, uint8_t* read);
+varint_decode_uint64(const uint8_t *in, uint8_t* read);
 
 /** Encode signed 64bit integer using varint encoding
  *
@@ -176,7 +176,15 @@ varint_encode_int64(int64_t n, uint8_t *out);
  * @return The decoded number
  * */
 int64_t
-varint_decode_int64(uint8_t *in, uint8_t* read);
+varint_decode_int64(const uint8_t *in, uint8_t* read);
+
+/** Number of bytes that @ref varint_encode_uint64 would write */
+size_t
+varint_size_uint64(uint64_t n);
+
+/** Number of bytes that @ref varint_encode_int64 would write */
+size_t
+varint_size_int64(int64_t n);
 
 /// @}
 
@@ -3,6 +3,7 @@
 #include <errno.h>
 
 #include "CuTest.h"
+#include "test.h"
 
 #include "page_db.h"
 #include "page_rank.h"
@@ -10,6 +11,57 @@
 #include "bf_scheduler.h"
 #include "domain_temp.h"
 #include "freq_scheduler.h"
+#include "ingest_queue.h"
+#include "url_codec.h"
+#include "bloom.h"
+#include "sharded_page_db.h"
+#include "external_sort.h"
+#include "link_graph.h"
+#include "clock_cache.h"
+#include "txn_manager.h"
+
+#ifdef TEST_ALLOC_COUNT
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+/* Only the thread running the benchmark counts, and only while it runs */
+static __thread int alloc_counting = 0;
+static __thread size_t alloc_count = 0;
+
+void *
+malloc(size_t size) {
+     if (alloc_counting)
+          ++alloc_count;
+     return __libc_malloc(size);
+}
+
+void *
+calloc(size_t n, size_t size) {
+     if (alloc_counting)
+          ++alloc_count;
+     return __libc_calloc(n, size);
+}
+
+void *
+realloc(void *ptr, size_t size) {
+     if (alloc_counting)
+          ++alloc_count;
+     return __libc_realloc(ptr, size);
+}
+
+void
+test_alloc_count_start(void) {
+     alloc_count = 0;
+     alloc_counting = 1;
+}
+
+size_t
+test_alloc_count_stop(void) {
+     alloc_counting = 0;
+     return alloc_count;
+}
+#endif
 
 int main(int argc, char **argv) {
      size_t n_pages = 0;
@@ -51,6 +103,14 @@ int main(int argc, char **argv) {
      RUN_SUITE("util", test_util_suite());
      RUN_SUITE("domain_temp", test_domain_temp_suite());
      RUN_SUITE("freq_scheduler", test_freq_scheduler_suite(n_pages));
+     RUN_SUITE("ingest_queue", test_ingest_queue_suite(n_pages));
+     RUN_SUITE("url_codec", test_url_codec_suite());
+     RUN_SUITE("bloom", test_bloom_suite());
+     RUN_SUITE("sharded_page_db", test_sharded_page_db_suite(n_pages));
+     RUN_SUITE("external_sort", test_external_sort_suite());
+     RUN_SUITE("link_graph", test_link_graph_suite());
+     RUN_SUITE("clock_cache", test_clock_cache_suite());
+     RUN_SUITE("txn_manager", test_txn_manager_suite());
      if (fail_count == 0)
 	  return 0;
      else
@@ -1,8 +1,38 @@
 #ifndef __TEST_H__
 #define __TEST_H__
 
+#include <stdlib.h>
+
 #include "CuTest.h"
 
+/* The sanitizers replace the allocator themselves */
+#if (defined __SANITIZE_ADDRESS__) || (defined __SANITIZE_THREAD__)
+#define TEST_SANITIZER 1
+#elif defined __has_feature
+#if __has_feature(address_sanitizer) || __has_feature(thread_sanitizer) || \
+     __has_feature(memory_sanitizer)
+#define TEST_SANITIZER 1
+#endif
+#endif
+
+#if (defined __GLIBC__) && !(defined TEST_SANITIZER)
+/** Start counting the calls to malloc, calloc and realloc made by the
+ * calling thread. Only available with glibc and without sanitizers, where
+ * test.c wraps the allocator.
+ *
+ * Declared weak since the library is also linked by the tools, where it
+ * is NULL.
+ */
+#define TEST_ALLOC_COUNT 1
+void
+test_alloc_count_start(void) __attribute__((weak));
+
+/** Stop counting and return the number of allocations since
+ * @ref test_alloc_count_start */
+size_t
+test_alloc_count_stop(void) __attribute__((weak));
+#endif
+
 #define CHECK_DELETE(tc, msg, cmd) do {\
      int __ret = (cmd);\
      CuAssert(tc, __ret? msg: "", __ret == 0);\
@@ -313,6 +313,133 @@ test_bf_scheduler_restart(CuTest *tc) {
      page_db_delete(db);
 }
 
+static void
+test_bf_scheduler_compact(CuTest *tc) {
+     printf("%s\n", __func__);
+     char test_dir_db[] = "test-bfs-XXXXXX";
+     mkdtemp(test_dir_db);
+
+     PageDB *db;
+     int ret = page_db_new(&db, test_dir_db);
+     CuAssert(tc,
+	      db!=0? db->error->message: "NULL",
+	      ret == 0);
+     db->persist = 0;
+
+     BFScheduler *sch;
+     ret = bf_scheduler_new(&sch, db, 0);
+     CuAssert(tc,
+	      sch != 0? sch->error->message: "NULL",
+	      ret == 0);
+     sch->persist = 0;
+
+     const int n_links = 10000;
+     CrawledPage *cp = crawled_page_new("http://www.foobar.com/spam");
+     char link[1000];
+     for (int i=0; i<n_links; ++i) {
+	  sprintf(link, "http://www.foobar.com/page_%d", i);
+	  crawled_page_add_link(cp, link, ((float)i)/n_links);
+     }
+     CuAssert(tc,
+	      sch->error->message,
+	      bf_scheduler_add(sch, cp) == 0);
+     crawled_page_delete(cp);
+
+     // popped entries are deleted from the schedule
+     PageRequest *reqs;
+     for (int i=0; i<9; ++i) {
+	  CuAssert(tc,
+		   sch->error->message,
+		   bf_scheduler_request(sch, n_links/10, &reqs) == 0);
+	  page_request_delete(reqs);
+     }
+
+     size_t bytes_old = 0;
+     size_t bytes_new = 0;
+     CuAssert(tc,
+	      sch->error->message,
+	      bf_scheduler_compact(sch, &bytes_old, &bytes_new) == 0);
+     CuAssertTrue(tc, bytes_new > 0);
+     CuAssertTrue(tc, bytes_new < bytes_old);
+
+     CuAssert(tc,
+	      sch->error->message,
+	      bf_scheduler_request(sch, n_links, &reqs) == 0);
+     CuAssertIntEquals(tc, n_links/10, reqs->n_urls);
+     for (int i=0; i<n_links/10; ++i) {
+	  sprintf(link, "http://www.foobar.com/page_%d", n_links/10 - 1 - i);
+	  CuAssertStrEquals(tc, link, reqs->urls[i]);
+     }
+     page_request_delete(reqs);
+
+     bf_scheduler_delete(sch);
+     page_db_delete(db);
+}
+
+void
+test_bf_scheduler_prune(CuTest *tc) {
+     printf("%s\n", __func__);
+     char test_dir_db[] = "test-bfs-XXXXXX";
+     mkdtemp(test_dir_db);
+
+     PageDB *db;
+     int ret = page_db_new(&db, test_dir_db);
+     CuAssert(tc,
+	      db!=0? db->error->message: "NULL",
+	      ret == 0);
+     db->persist = 0;
+
+     BFScheduler *sch;
+     ret = bf_scheduler_new(&sch, db, 0);
+     CuAssert(tc,
+	      sch != 0? sch->error->message: "NULL",
+	      ret == 0);
+     sch->persist = 0;
+
+     const int n_links = 1000;
+     CrawledPage *cp = crawled_page_new("http://www.foobar.com/spam");
+     char link[1000];
+     for (int i=0; i<n_links; ++i) {
+	  sprintf(link, "http://www.foobar.com/page_%d", i);
+	  crawled_page_add_link(cp, link, ((float)i)/n_links);
+     }
+     CuAssert(tc,
+	      sch->error->message,
+	      bf_scheduler_add(sch, cp) == 0);
+     crawled_page_delete(cp);
+
+     // keep the upper half
+     size_t n_pruned = 0;
+     CuAssert(tc,
+	      sch->error->message,
+	      bf_scheduler_prune(sch, 0.5, 0, 0, &n_pruned) == 0);
+     CuAssertIntEquals(tc, n_links/2, n_pruned);
+
+     MDB_txn *txn;
+     MDB_cursor *cur;
+     MDB_stat stat;
+     CuAssertIntEquals(tc, 0, txn_manager_begin(sch->txn_manager, MDB_RDONLY, &txn));
+     CuAssertIntEquals(tc, 0, bf_scheduler_open_cursor(txn, &cur));
+     CuAssertIntEquals(tc, 0, mdb_stat(txn, mdb_cursor_dbi(cur), &stat));
+     CuAssertIntEquals(tc, n_links/2, stat.ms_entries);
+     mdb_cursor_close(cur);
+     txn_manager_abort(sch->txn_manager, txn);
+
+     PageRequest *reqs;
+     CuAssert(tc,
+	      sch->error->message,
+	      bf_scheduler_request(sch, n_links, &reqs) == 0);
+     CuAssertIntEquals(tc, n_links/2, reqs->n_urls);
+     for (int i=0; i<n_links/2; ++i) {
+	  sprintf(link, "http://www.foobar.com/page_%d", n_links - 1 - i);
+	  CuAssertStrEquals(tc, link, reqs->urls[i]);
+     }
+     page_request_delete(reqs);
+
+     bf_scheduler_delete(sch);
+     page_db_delete(db);
+}
+
 CuSuite *
 test_bf_scheduler_suite(size_t n_pages) {
      test_n_pages = n_pages;
@@ -320,6 +447,8 @@ test_bf_scheduler_suite(size_t n_pages) {
      CuSuite *suite = CuSuiteNew();
      SUITE_ADD_TEST(suite, test_bf_scheduler_requests);
      SUITE_ADD_TEST(suite, test_bf_scheduler_restart);
+     SUITE_ADD_TEST(suite, test_bf_scheduler_compact);
+     SUITE_ADD_TEST(suite, test_bf_scheduler_prune);
      SUITE_ADD_TEST(suite, test_bf_scheduler_page_rank);
      SUITE_ADD_TEST(suite, test_bf_scheduler_hits);
 
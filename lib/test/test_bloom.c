@@ -0,0 +1,44 @@
+#include "CuTest.h"
+
+void
+test_bloom_filter(CuTest *tc) {
+     printf("%s\n", __func__);
+
+     const size_t n_items = 100000;
+     BloomFilter *bf = bloom_filter_new(n_items, 10);
+     CuAssertPtrNotNull(tc, bf);
+
+     // hashes of pages inside few domains, like page_db_hash
+     for (size_t i=0; i<n_items; ++i)
+          bloom_filter_add(bf, ((uint64_t)(i % 100) << 32) | (uint64_t)(2*i));
+     CuAssertIntEquals(tc, n_items, bf->n_items);
+
+     // no false negatives
+     for (size_t i=0; i<n_items; ++i)
+          CuAssertTrue(tc,
+                       bloom_filter_contains(
+                            bf, ((uint64_t)(i % 100) << 32) | (uint64_t)(2*i)));
+
+     size_t n_fp = 0;
+     for (size_t i=0; i<n_items; ++i)
+          n_fp += bloom_filter_contains(
+               bf, ((uint64_t)(i % 100) << 32) | (uint64_t)(2*i + 1));
+     double fp_rate = (double)n_fp/(double)n_items;
+     size_t memory = bloom_filter_memory(bf);
+     printf("%10zu items: %.2f%% false positives (%.2f%% expected), %.2f bits/item\n",
+            n_items,
+            100.0*fp_rate,
+            100.0*bloom_filter_fp_rate(bf),
+            8.0*(double)memory/(double)n_items);
+     CuAssertTrue(tc, fp_rate < 0.02);
+     CuAssertTrue(tc, bloom_filter_fp_rate(bf) < 0.02);
+
+     bloom_filter_delete(bf);
+}
+
+CuSuite *
+test_bloom_suite(void) {
+     CuSuite *suite = CuSuiteNew();
+     SUITE_ADD_TEST(suite, test_bloom_filter);
+     return suite;
+}
@@ -0,0 +1,143 @@
+#include "CuTest.h"
+
+static void *
+test_clock_cache_copy(const void *value) {
+     return strdup(value);
+}
+
+static void
+test_clock_cache_free(void *value) {
+     free(value);
+}
+
+void
+test_clock_cache(CuTest *tc) {
+     printf("%s\n", __func__);
+
+     const size_t n_keys = 1000;
+     const size_t value_size = 32;
+     // room for about n_keys/10 values, in a single shard
+     ClockCache *cache = clock_cache_new(
+          n_keys/10*(value_size + CLOCK_CACHE_ENTRY_OVERHEAD),
+          1,
+          test_clock_cache_copy,
+          test_clock_cache_free);
+     CuAssertPtrNotNull(tc, cache);
+
+     char value[value_size];
+     void *cached;
+     uint64_t version;
+     ClockCacheStats stats;
+
+     // a few hot keys are read between each new key
+     for (size_t i=0; i<n_keys; ++i) {
+          for (uint64_t hot=0; hot<10; ++hot)
+               if (!clock_cache_get(cache, hot, &cached, &version)) {
+                    sprintf(value, "hot_%zu", (size_t)hot);
+                    clock_cache_put(cache, hot, value, value_size, version);
+               } else {
+                    sprintf(value, "hot_%zu", (size_t)hot);
+                    CuAssertStrEquals(tc, value, cached);
+                    free(cached);
+               }
+          CuAssertIntEquals(tc, 0, clock_cache_get(cache, 100 + i, &cached, &version));
+          sprintf(value, "cold_%zu", i);
+          clock_cache_put(cache, 100 + i, value, value_size, version);
+     }
+     clock_cache_stats(cache, &stats);
+     CuAssertTrue(tc, stats.n_bytes <= stats.max_bytes);
+     CuAssertTrue(tc, stats.n_entries <= n_keys/10);
+     CuAssertTrue(tc, stats.n_evictions >= n_keys - n_keys/10);
+     // the hot keys were missed just the first time
+     CuAssertIntEquals(tc, 10 + n_keys, stats.n_misses);
+     CuAssertIntEquals(tc, 10*(n_keys - 1), stats.n_hits);
+     for (uint64_t hot=0; hot<10; ++hot) {
+          CuAssertIntEquals(tc, 1, clock_cache_get(cache, hot, &cached, 0));
+          free(cached);
+     }
+     // the last cold key is still there
+     CuAssertIntEquals(tc, 1, clock_cache_get(cache, 100 + n_keys - 1, &cached, 0));
+     sprintf(value, "cold_%zu", n_keys - 1);
+     CuAssertStrEquals(tc, value, cached);
+     free(cached);
+
+     // a value read before an invalidation is not stored
+     CuAssertIntEquals(tc, 0, clock_cache_get(cache, 99, &cached, &version));
+     clock_cache_invalidate(cache, 5);
+     CuAssertIntEquals(tc, 0, clock_cache_get(cache, 5, &cached, 0));
+     clock_cache_put(cache, 99, "stale", value_size, version);
+     CuAssertIntEquals(tc, 0, clock_cache_get(cache, 99, &cached, &version));
+     clock_cache_put(cache, 99, "fresh", value_size, version);
+     CuAssertIntEquals(tc, 1, clock_cache_get(cache, 99, &cached, 0));
+     CuAssertStrEquals(tc, "fresh", cached);
+     free(cached);
+
+     clock_cache_stats(cache, &stats);
+     CuAssertIntEquals(tc, 1, stats.n_invalidations);
+     CuAssertIntEquals(tc, 1, stats.n_rejected);
+
+     clock_cache_clear(cache);
+     clock_cache_stats(cache, &stats);
+     CuAssertIntEquals(tc, 0, stats.n_entries);
+     CuAssertIntEquals(tc, 0, stats.n_bytes);
+     CuAssertIntEquals(tc, 0, clock_cache_get(cache, 99, &cached, 0));
+
+     clock_cache_delete(cache);
+}
+
+void
+test_clock_cache_sharded(CuTest *tc) {
+     printf("%s\n", __func__);
+
+     // everything fits, so every key can be found again after many
+     // insertions and removals moved the entries around
+     const size_t n_keys = 100000;
+     ClockCache *cache = clock_cache_new(
+          n_keys*(16 + CLOCK_CACHE_ENTRY_OVERHEAD),
+          0,
+          test_clock_cache_copy,
+          test_clock_cache_free);
+     CuAssertPtrNotNull(tc, cache);
+     CuAssertIntEquals(tc, CLOCK_CACHE_DEFAULT_SHARDS, cache->n_shards);
+
+     char value[16];
+     void *cached;
+     uint64_t version;
+     // keys sharing the high half, like the pages of a domain
+     for (size_t i=0; i<n_keys; ++i) {
+          uint64_t key = ((uint64_t)(i % 10) << 32) | i;
+          clock_cache_get(cache, key, &cached, &version);
+          sprintf(value, "%zu", i);
+          clock_cache_put(cache, key, value, 1, version);
+     }
+     for (size_t i=0; i<n_keys; i+=3)
+          clock_cache_invalidate(cache, ((uint64_t)(i % 10) << 32) | i);
+
+     size_t n_found = 0;
+     for (size_t i=0; i<n_keys; ++i) {
+          uint64_t key = ((uint64_t)(i % 10) << 32) | i;
+          if (clock_cache_get(cache, key, &cached, 0)) {
+               sprintf(value, "%zu", i);
+               CuAssertStrEquals(tc, value, cached);
+               free(cached);
+               ++n_found;
+          } else
+               CuAssertIntEquals(tc, 0, i % 3);
+     }
+     ClockCacheStats stats;
+     clock_cache_stats(cache, &stats);
+     CuAssertIntEquals(tc, n_found, stats.n_entries);
+     // some shards can be fuller than others
+     CuAssertTrue(tc, n_found + stats.n_evictions == n_keys - (n_keys + 2)/3);
+     CuAssertTrue(tc, n_found > n_keys/2);
+
+     clock_cache_delete(cache);
+}
+
+CuSuite *
+test_clock_cache_suite(void) {
+     CuSuite *suite = CuSuiteNew();
+     SUITE_ADD_TEST(suite, test_clock_cache);
+     SUITE_ADD_TEST(suite, test_clock_cache_sharded);
+     return suite;
+}
@@ -0,0 +1,88 @@
+#include <unistd.h>
+
+#include "CuTest.h"
+#include "test.h"
+
+/* Records are a key followed by a variable number of bytes, all equal to
+ * the position where the record was added */
+typedef struct {
+     uint64_t key;
+     uint64_t i;
+} TestExternalSortRecord;
+
+static int
+test_external_sort_cmp(const void *a, const void *b) {
+     const TestExternalSortRecord *ra = a;
+     const TestExternalSortRecord *rb = b;
+     return ra->key < rb->key? -1: ra->key > rb->key;
+}
+
+static void
+test_external_sort_run(CuTest *tc, size_t n_records, size_t max_memory, int expect_runs) {
+     char test_dir[] = "test-sort-XXXXXX";
+     mkdtemp(test_dir);
+     char *path = build_path(test_dir, "run");
+
+     ExternalSort *es;
+     CuAssertIntEquals(tc,
+                       0,
+                       external_sort_new(&es, path, test_external_sort_cmp, max_memory));
+
+     char data[sizeof(TestExternalSortRecord) + 64];
+     TestExternalSortRecord *rec = (TestExternalSortRecord*)data;
+     for (size_t i=0; i<n_records; ++i) {
+          // few distinct keys so that stability can be checked
+          rec->key = (i*7919) % 101;
+          rec->i = i;
+          size_t extra = i % 64;
+          memset(data + sizeof(*rec), (int)(i & 0xFF), extra);
+          CuAssert(tc,
+                   es->error->message,
+                   external_sort_add(es, data, sizeof(*rec) + extra) == 0);
+     }
+     CuAssertIntEquals(tc, n_records, es->n_records);
+
+     const void *out;
+     size_t size;
+     size_t n = 0;
+     TestExternalSortRecord prev = {0, 0};
+     while (external_sort_next(es, &out, &size) == stream_state_next) {
+          const TestExternalSortRecord *r = out;
+          CuAssertIntEquals(tc, sizeof(*r) + r->i % 64, size);
+          for (size_t j=sizeof(*r); j<size; ++j)
+               CuAssertIntEquals(tc, (int)(r->i & 0xFF), ((unsigned char*)out)[j]);
+          if (n > 0) {
+               CuAssertTrue(tc, prev.key <= r->key);
+               if (prev.key == r->key)
+                    CuAssertTrue(tc, prev.i < r->i);
+          }
+          prev = *r;
+          ++n;
+     }
+     CuAssertIntEquals(tc, stream_state_end, es->state);
+     CuAssertIntEquals(tc, n_records, n);
+     CuAssertIntEquals(tc, expect_runs, es->n_runs > 0);
+
+     CHECK_DELETE(tc, "deleting sort", external_sort_delete(es));
+     free(path);
+     CuAssertIntEquals(tc, 0, rmdir(test_dir));
+}
+
+void
+test_external_sort(CuTest *tc) {
+     printf("%s\n", __func__);
+
+     // all records in memory
+     test_external_sort_run(tc, 10000, 0, 0);
+     // many runs
+     test_external_sort_run(tc, 100000, 100000, 1);
+     // nothing to sort
+     test_external_sort_run(tc, 0, 0, 0);
+}
+
+CuSuite *
+test_external_sort_suite(void) {
+     CuSuite *suite = CuSuiteNew();
+     SUITE_ADD_TEST(suite, test_external_sort);
+     return suite;
+}
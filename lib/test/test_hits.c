@@ -37,10 +37,10 @@ test_hits(CuTest *tc) {
      db->persist = 0;
 
      char *urls[5] = {"1", "2", "3", "4", "5" };
-     LinkInfo links_1[] = {{"2", 0.1}, {"5", 0.1}};
-     LinkInfo links_2[] = {{"3", 0.1}, {"5", 0.1}};
-     LinkInfo links_3[] = {{"4", 0.1}, {"5", 0.1}};
-     LinkInfo links_4[] = {{"1", 0.1}, {"5", 0.1}};
+     LinkInfo links_1[] = {{"2", 0.1, 0}, {"5", 0.1, 0}};
+     LinkInfo links_2[] = {{"3", 0.1, 0}, {"5", 0.1, 0}};
+     LinkInfo links_3[] = {{"4", 0.1, 0}, {"5", 0.1, 0}};
+     LinkInfo links_4[] = {{"1", 0.1, 0}, {"5", 0.1, 0}};
      LinkInfo *links[5] = {
           links_1, links_2, links_3, links_4, 0
      };
@@ -0,0 +1,149 @@
+#include "CuTest.h"
+#include "test.h"
+
+static size_t test_n_pages = 50000;
+
+#define TEST_N_PRODUCERS 4
+
+typedef struct {
+     IngestQueue *q;
+     size_t first;
+     size_t n;
+     int error;
+} TestProducer;
+
+static void *
+test_ingest_queue_producer(void *arg) {
+     TestProducer *p = arg;
+     char url[100];
+     for (size_t i=p->first; i<p->first + p->n; ++i) {
+          sprintf(url, "http://test_domain_%zu.org/test_url_%zu", i%100, i);
+          CrawledPage *page = crawled_page_new(url);
+          for (size_t j=1; j<=10; ++j) {
+               sprintf(url, "http://test_domain_%zu.org/test_url_%zu",
+                       (i + j)%100, i + j);
+               crawled_page_add_link(page, url, 0.5);
+          }
+          if (ingest_queue_push(p->q, page) != 0) {
+               p->error = 1;
+               break;
+          }
+     }
+     return 0;
+}
+
+static double
+test_ingest_queue_now(void) {
+     struct timespec t;
+     clock_gettime(CLOCK_MONOTONIC, &t);
+     return (double)t.tv_sec + 1e-9*(double)t.tv_nsec;
+}
+
+/* Several threads push pages concurrently into a small queue in front of a
+ * PageDB */
+void
+test_ingest_queue_page_db(CuTest *tc) {
+     printf("%s\n", __func__);
+
+     char test_dir[] = "test-ingest-queue-XXXXXX";
+     mkdtemp(test_dir);
+
+     PageDB *db;
+     int ret = page_db_new(&db, test_dir);
+     CuAssert(tc,
+              db!=0? db->error->message: "NULL",
+              ret == 0);
+     page_db_set_persist(db, 0);
+
+     IngestQueue *q;
+     ret = ingest_queue_new(&q, db, page_db_ingest, 256);
+     CuAssert(tc,
+              q!=0? q->error->message: "NULL",
+              ret == 0);
+     ingest_queue_set_batch_size(q, 100);
+     ingest_queue_set_max_delay(q, 10);
+
+     const size_t n_pages = TEST_N_PRODUCERS*(test_n_pages/TEST_N_PRODUCERS);
+     TestProducer producers[TEST_N_PRODUCERS];
+     pthread_t threads[TEST_N_PRODUCERS];
+
+     double start = test_ingest_queue_now();
+     for (size_t t=0; t<TEST_N_PRODUCERS; ++t) {
+          producers[t] = (TestProducer) {
+               .q = q,
+               .first = t*(n_pages/TEST_N_PRODUCERS),
+               .n = n_pages/TEST_N_PRODUCERS,
+               .error = 0
+          };
+          CuAssertIntEquals(
+               tc, 0,
+               pthread_create(threads + t, 0,
+                              test_ingest_queue_producer, producers + t));
+     }
+     for (size_t t=0; t<TEST_N_PRODUCERS; ++t) {
+          CuAssertIntEquals(tc, 0, pthread_join(threads[t], 0));
+          CuAssertIntEquals(tc, 0, producers[t].error);
+     }
+     CuAssert(tc, q->error->message, ingest_queue_flush(q) == 0);
+     double delta = test_ingest_queue_now() - start;
+     if (delta > 0)
+          printf("%10zu producers: %.0f pages/sec, %.1f pages/txn\n",
+                 (size_t)TEST_N_PRODUCERS,
+                 ((double)n_pages)/delta,
+                 ((double)n_pages)/((double)q->n_batches));
+
+     CuAssertIntEquals(tc, n_pages, q->n_done);
+     CuAssertTrue(tc, q->n_batches < n_pages);
+
+     char url[100];
+     for (size_t i=0; i<n_pages; i+=n_pages/100) {
+          sprintf(url, "http://test_domain_%zu.org/test_url_%zu", i%100, i);
+          PageInfo *pi;
+          CuAssert(tc,
+                   db->error->message,
+                   page_db_get_info(db, page_db_hash(url), &pi) == 0);
+          CuAssertPtrNotNull(tc, pi);
+          CuAssertIntEquals(tc, 1, pi->n_crawls);
+          page_info_delete(pi);
+     }
+
+     CuAssertIntEquals(tc, 0, ingest_queue_delete(q));
+     page_db_delete(db);
+}
+
+static int
+test_ingest_queue_fail(void *state, const CrawledPage **pages, size_t n) {
+     (void)state;
+     (void)pages;
+     (void)n;
+     return 1;
+}
+
+/* Errors inside the writer thread are reported back to producers */
+void
+test_ingest_queue_error(CuTest *tc) {
+     printf("%s\n", __func__);
+
+     IngestQueue *q;
+     CuAssertIntEquals(tc, 0,
+                       ingest_queue_new(&q, 0, test_ingest_queue_fail, 4));
+     ingest_queue_set_max_delay(q, 0);
+
+     CuAssertIntEquals(tc, 0,
+                       ingest_queue_push(q, crawled_page_new("http://a.com")));
+     CuAssertIntEquals(tc, ingest_queue_error_internal, ingest_queue_flush(q));
+     CuAssertIntEquals(tc, ingest_queue_error_internal,
+                       ingest_queue_push(q, crawled_page_new("http://b.com")));
+     CuAssertIntEquals(tc, ingest_queue_error_internal, ingest_queue_delete(q));
+}
+
+CuSuite *
+test_ingest_queue_suite(size_t n_pages) {
+     test_n_pages = n_pages;
+
+     CuSuite *suite = CuSuiteNew();
+     SUITE_ADD_TEST(suite, test_ingest_queue_page_db);
+     SUITE_ADD_TEST(suite, test_ingest_queue_error);
+
+     return suite;
+}
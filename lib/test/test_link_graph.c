@@ -0,0 +1,316 @@
+#include <unistd.h>
+
+#include "CuTest.h"
+
+#include "test.h"
+#include "page_db.h"
+#include "page_rank.h"
+
+/* The graph streams the same links as the database */
+static void
+test_link_graph_stream(CuTest *tc) {
+     printf("%s\n", __func__);
+     char test_dir[] = "test-pagedb-XXXXXX";
+     mkdtemp(test_dir);
+
+     PageDB *db;
+     int ret = page_db_new(&db, test_dir);
+     CuAssert(tc,
+              db!=0? db->error->message: "NULL",
+              ret == 0);
+     db->persist = 0;
+
+     // some pages without links between pages with links
+     const size_t n_pages = 500;
+     char url[100];
+     for (size_t i=0; i<n_pages; ++i) {
+          sprintf(url, "http://test_domain_%zu.org/test_url_%zu", i%7, i);
+          CrawledPage *cp = crawled_page_new(url);
+          for (size_t j=0; j<i%5; ++j) {
+               sprintf(url, "http://test_domain_%zu.org/test_url_%zu", (i + j)%7, (7*i + j)%n_pages);
+               crawled_page_add_link(cp, url, 0);
+          }
+          CuAssert(tc,
+                   db->error->message,
+                   page_db_add(db, cp, 0) == 0);
+          crawled_page_delete(cp);
+     }
+
+     char *path = build_path(test_dir, "links");
+     LinkGraph *lg;
+     ret = link_graph_new(&lg, path);
+     CuAssert(tc,
+              lg? lg->error->message: "NULL",
+              ret == 0);
+     free(path);
+
+     for (int only_diff_domain=0; only_diff_domain<=1; ++only_diff_domain) {
+          // build twice to check the previous snapshot is replaced
+          for (int build=0; build<2; ++build)
+               CuAssert(tc,
+                        lg->error->message,
+                        link_graph_build(lg, db, only_diff_domain) == 0);
+          CuAssertIntEquals(tc, sizeof(uint32_t), lg->target_size);
+
+          PageDBLinkStream *st;
+          CuAssert(tc,
+                   db->error->message,
+                   page_db_link_stream_new(&st, db) == 0);
+          st->only_diff_domain = only_diff_domain;
+
+          LinkGraphStream *gst;
+          CuAssertIntEquals(tc, 0, link_graph_stream_new(&gst, lg));
+
+          for (int pass=0; pass<2; ++pass) {
+               size_t n_links = 0;
+               Link link1;
+               Link link2;
+               StreamState ss;
+               while ((ss = page_db_link_stream_next(st, &link1)) == stream_state_next) {
+                    CuAssertIntEquals(tc, stream_state_next, link_graph_stream_next(gst, &link2));
+                    CuAssertTrue(tc, link1.from == link2.from);
+                    CuAssertTrue(tc, link1.to == link2.to);
+                    ++n_links;
+               }
+               CuAssertIntEquals(tc, stream_state_end, ss);
+               CuAssertIntEquals(tc, stream_state_end, link_graph_stream_next(gst, &link2));
+               CuAssertIntEquals(tc, n_links, lg->n_links);
+               CuAssertTrue(tc, n_links > 0);
+
+               CuAssertIntEquals(tc, stream_state_init, page_db_link_stream_reset(st));
+               CuAssertIntEquals(tc, stream_state_init, link_graph_stream_reset(gst));
+          }
+          link_graph_stream_delete(gst);
+          page_db_link_stream_delete(st);
+     }
+
+     // the files stay after deleting the graph if persisted
+     link_graph_set_persist(lg, 1);
+     char *path_offsets = strdup(lg->path_offsets);
+     char *path_targets = strdup(lg->path_targets);
+     CHECK_DELETE(tc, lg->error->message, link_graph_delete(lg));
+     CuAssertIntEquals(tc, 0, access(path_offsets, F_OK));
+     CuAssertIntEquals(tc, 0, access(path_targets, F_OK));
+     CuAssertIntEquals(tc, 0, remove(path_offsets));
+     CuAssertIntEquals(tc, 0, remove(path_targets));
+     free(path_offsets);
+     free(path_targets);
+
+     page_db_delete(db);
+}
+
+/* PageRank gives the same scores from the graph or from the database */
+static void
+test_link_graph_page_rank(CuTest *tc) {
+     printf("%s\n", __func__);
+     char test_dir[] = "test-pagedb-XXXXXX";
+     mkdtemp(test_dir);
+
+     PageDB *db;
+     int ret = page_db_new(&db, test_dir);
+     CuAssert(tc,
+              db!=0? db->error->message: "NULL",
+              ret == 0);
+     db->persist = 0;
+
+     const size_t n_pages = 1000;
+     char url[100];
+     for (size_t i=0; i<n_pages; ++i) {
+          sprintf(url, "http://test_domain_%zu.org/test_url_%zu", i%10, i);
+          CrawledPage *cp = crawled_page_new(url);
+          for (size_t j=1; j<=3; ++j) {
+               sprintf(url, "http://test_domain_%zu.org/test_url_%zu", (i*j)%10, (i*j + 1)%n_pages);
+               crawled_page_add_link(cp, url, 0);
+          }
+          CuAssert(tc,
+                   db->error->message,
+                   page_db_add(db, cp, 0) == 0);
+          crawled_page_delete(cp);
+     }
+
+     PageRank *pr1;
+     ret = page_rank_new(&pr1, test_dir, 1000);
+     CuAssert(tc,
+              pr1!=0? pr1->error->message: "NULL",
+              ret == 0);
+     PageDBLinkStream *st;
+     CuAssert(tc,
+              db->error->message,
+              page_db_link_stream_new(&st, db) == 0);
+     CuAssert(tc,
+              pr1->error->message,
+              page_rank_compute(pr1,
+                                st,
+                                page_db_link_stream_next,
+                                page_db_link_stream_reset) == 0);
+     page_db_link_stream_delete(st);
+
+     // in memory graph, and a different directory for the scores
+     char test_dir_pr[] = "test-pr-XXXXXX";
+     mkdtemp(test_dir_pr);
+     PageRank *pr2;
+     ret = page_rank_new(&pr2, test_dir_pr, 1000);
+     CuAssert(tc,
+              pr2!=0? pr2->error->message: "NULL",
+              ret == 0);
+     LinkGraph *lg;
+     ret = link_graph_new(&lg, 0);
+     CuAssert(tc,
+              lg? lg->error->message: "NULL",
+              ret == 0);
+     CuAssert(tc,
+              lg->error->message,
+              link_graph_build(lg, db, PAGE_DB_LINK_STREAM_DEFAULT_ONLY_DIFF_DOMAIN) == 0);
+     LinkGraphStream *gst;
+     CuAssertIntEquals(tc, 0, link_graph_stream_new(&gst, lg));
+     CuAssert(tc,
+              pr2->error->message,
+              page_rank_compute(pr2,
+                                gst,
+                                link_graph_stream_next,
+                                link_graph_stream_reset) == 0);
+     link_graph_stream_delete(gst);
+
+     CuAssertIntEquals(tc, pr1->n_pages, pr2->n_pages);
+     for (size_t i=0; i<pr1->n_pages; ++i) {
+          float old1, new1, old2, new2;
+          CuAssertIntEquals(tc, 0, page_rank_get(pr1, i, &old1, &new1));
+          CuAssertIntEquals(tc, 0, page_rank_get(pr2, i, &old2, &new2));
+          CuAssertDblEquals(tc, new1, new2, 1e-9);
+     }
+
+     CHECK_DELETE(tc, lg->error->message, link_graph_delete(lg));
+     CHECK_DELETE(tc, pr1->error->message, page_rank_delete(pr1));
+     CHECK_DELETE(tc, pr2->error->message, page_rank_delete(pr2));
+     rmdir(test_dir_pr);
+     page_db_delete(db);
+}
+
+/* Check the graph streams the same links as the database */
+static void
+test_link_graph_check(CuTest *tc, LinkGraph *lg, PageDB *db, int only_diff_domain) {
+     PageDBLinkStream *st;
+     CuAssert(tc,
+              db->error->message,
+              page_db_link_stream_new(&st, db) == 0);
+     st->only_diff_domain = only_diff_domain;
+     LinkGraphStream *gst;
+     CuAssertIntEquals(tc, 0, link_graph_stream_new(&gst, lg));
+
+     Link link1;
+     Link link2;
+     StreamState ss;
+     while ((ss = page_db_link_stream_next(st, &link1)) == stream_state_next) {
+          CuAssertIntEquals(tc, stream_state_next, link_graph_stream_next(gst, &link2));
+          CuAssertTrue(tc, link1.from == link2.from);
+          CuAssertTrue(tc, link1.to == link2.to);
+     }
+     CuAssertIntEquals(tc, stream_state_end, ss);
+     CuAssertIntEquals(tc, stream_state_end, link_graph_stream_next(gst, &link2));
+
+     link_graph_stream_delete(gst);
+     page_db_link_stream_delete(st);
+}
+
+/* Add pages, crawling again some of them with other links */
+static void
+test_link_graph_add(CuTest *tc, PageDB *db, size_t first, size_t n_pages, size_t seed) {
+     char url[100];
+     for (size_t i=first; i<first + n_pages; ++i) {
+          sprintf(url, "http://test_domain_%zu.org/test_url_%zu", i%7, i%(first + 1) == 0? i: i/2);
+          CrawledPage *cp = crawled_page_new(url);
+          for (size_t j=0; j<(i + seed)%6; ++j) {
+               sprintf(url, "http://test_domain_%zu.org/test_url_%zu", (i + j + seed)%7, (7*i + j)%(2*first + 10));
+               crawled_page_add_link(cp, url, 0);
+          }
+          CuAssert(tc,
+                   db->error->message,
+                   page_db_add(db, cp, 0) == 0);
+          crawled_page_delete(cp);
+     }
+}
+
+/* Follow the database through the link log */
+static void
+test_link_graph_update(CuTest *tc) {
+     printf("%s\n", __func__);
+     char test_dir[] = "test-pagedb-XXXXXX";
+     mkdtemp(test_dir);
+
+     PageDB *db;
+     int ret = page_db_new(&db, test_dir);
+     CuAssert(tc,
+              db!=0? db->error->message: "NULL",
+              ret == 0);
+     db->persist = 0;
+
+     char *path = build_path(test_dir, "links");
+     for (int only_diff_domain=0; only_diff_domain<=1; ++only_diff_domain) {
+          LinkGraph *lg;
+          ret = link_graph_new(&lg, path);
+          CuAssert(tc,
+                   lg? lg->error->message: "NULL",
+                   ret == 0);
+          size_t n_pages = 100*only_diff_domain;
+          test_link_graph_add(tc, db, n_pages, 100, 0);
+          n_pages += 100;
+
+          // the first update reads the whole database
+          CuAssert(tc,
+                   lg->error->message,
+                   link_graph_update(lg, db, only_diff_domain) == 0);
+          CuAssertIntEquals(tc, 0, lg->n_delta);
+          test_link_graph_check(tc, lg, db, only_diff_domain);
+
+          // changes are kept as a delta
+          lg->merge_ratio = 100.0;
+          for (size_t seed=1; seed<=3; ++seed) {
+               test_link_graph_add(tc, db, n_pages, 50, seed);
+               n_pages += 50;
+               CuAssert(tc,
+                        lg->error->message,
+                        link_graph_update(lg, db, only_diff_domain) == 0);
+               CuAssertTrue(tc, lg->n_delta > 0);
+               test_link_graph_check(tc, lg, db, only_diff_domain);
+          }
+
+          // and merged into a new snapshot
+          size_t n_links = lg->n_links;
+          lg->merge_ratio = 0.0;
+          test_link_graph_add(tc, db, n_pages, 50, 4);
+          n_pages += 50;
+          CuAssert(tc,
+                   lg->error->message,
+                   link_graph_update(lg, db, only_diff_domain) == 0);
+          CuAssertIntEquals(tc, 0, lg->n_delta);
+          CuAssertTrue(tc, lg->n_links > n_links);
+          test_link_graph_check(tc, lg, db, only_diff_domain);
+
+          // after truncating the log the database is read again
+          lg->merge_ratio = 100.0;
+          page_db_set_link_log(db, 10);
+          test_link_graph_add(tc, db, n_pages, 10, 5);
+          test_link_graph_add(tc, db, n_pages + 10, 10, 6);
+          n_pages += 20;
+          CuAssert(tc,
+                   lg->error->message,
+                   link_graph_update(lg, db, only_diff_domain) == 0);
+          CuAssertIntEquals(tc, 0, lg->n_delta);
+          test_link_graph_check(tc, lg, db, only_diff_domain);
+          page_db_set_link_log(db, PAGE_DB_DEFAULT_LINK_LOG_MAX_SIZE);
+
+          CHECK_DELETE(tc, lg->error->message, link_graph_delete(lg));
+     }
+     free(path);
+
+     page_db_delete(db);
+}
+
+CuSuite *
+test_link_graph_suite(void) {
+     CuSuite *suite = CuSuiteNew();
+     SUITE_ADD_TEST(suite, test_link_graph_stream);
+     SUITE_ADD_TEST(suite, test_link_graph_page_rank);
+     SUITE_ADD_TEST(suite, test_link_graph_update);
+     return suite;
+}
@@ -0,0 +1,398 @@
+#include <pthread.h>
+#include <time.h>
+
+#include "CuTest.h"
+#include "test.h"
+
+static size_t test_n_pages = 50000;
+
+static double
+test_sharded_page_db_now(void) {
+     struct timespec t;
+     clock_gettime(CLOCK_MONOTONIC, &t);
+     return (double)t.tv_sec + 1e-9*(double)t.tv_nsec;
+}
+
+/* Pages of 20 domains, each one with links to its own domain, to other
+ * domains and a repeated link */
+static CrawledPage **
+test_sharded_page_db_pages(size_t n_pages, size_t n_links) {
+     char url[100];
+     CrawledPage **pages = calloc(n_pages, sizeof(*pages));
+     if (!pages)
+          return 0;
+     for (size_t i=0; i<n_pages; ++i) {
+          sprintf(url, "http://test_domain_%zu.org/test_url_%zu", i%20, i);
+          pages[i] = crawled_page_new(url);
+          for (size_t j=0; j<n_links; ++j) {
+               // the last link repeats the first one
+               size_t k = j == n_links - 1? 0: j;
+               sprintf(url, "http://test_domain_%zu.org/test_url_%zu",
+                       k % 2? i%20: (i + k + 1)%20, i + k + 1);
+               crawled_page_add_link(pages[i], url, 0.5);
+          }
+     }
+     return pages;
+}
+
+static void
+test_sharded_page_db_pages_delete(CrawledPage **pages, size_t n_pages) {
+     for (size_t i=0; i<n_pages; ++i)
+          crawled_page_delete(pages[i]);
+     free(pages);
+}
+
+/* Number of links streamed, checking they are ordered by origin */
+static size_t
+test_sharded_page_db_count_links(CuTest *tc, void *es, LinkStreamNextFunc *next) {
+     Link link;
+     size_t n = 0;
+     int64_t from = -1;
+     while (next(es, &link) == stream_state_next) {
+          CuAssertTrue(tc, link.from >= from);
+          from = link.from;
+          ++n;
+     }
+     return n;
+}
+
+/* Pages stored inside several shards get the same links as inside a single
+ * database, and the streams of all shards are merged in order */
+void
+test_sharded_page_db_add(CuTest *tc) {
+     printf("%s\n", __func__);
+
+     const size_t n_pages = 1000;
+     const size_t n_shards = 3;
+     CrawledPage **pages = test_sharded_page_db_pages(n_pages, 10);
+     CuAssertPtrNotNull(tc, pages);
+
+     char test_dir[] = "test-sharded-XXXXXX";
+     mkdtemp(test_dir);
+     ShardedPageDB *db;
+     int ret = sharded_page_db_new(&db, test_dir, n_shards);
+     CuAssert(tc,
+              db!=0? db->error->message: "NULL",
+              ret == 0);
+     sharded_page_db_set_persist(db, 0);
+
+     char single_dir[] = "test-pagedb-XXXXXX";
+     mkdtemp(single_dir);
+     PageDB *single;
+     ret = page_db_new(&single, single_dir);
+     CuAssert(tc,
+              single!=0? single->error->message: "NULL",
+              ret == 0);
+     page_db_set_persist(single, 0);
+
+     for (size_t i=0; i<n_pages; i+=10) {
+          CuAssert(tc,
+                   db->error->message,
+                   sharded_page_db_add_many(db, (const CrawledPage**)pages + i, 10) == 0);
+          CuAssert(tc,
+                   single->error->message,
+                   page_db_add_many(single, (const CrawledPage**)pages + i, 10, 0) == 0);
+     }
+
+     // every page lives inside the shard given by its index
+     for (size_t i=0; i<n_pages; ++i) {
+          uint64_t hash = page_db_hash(pages[i]->url);
+          uint64_t idx;
+          CuAssert(tc,
+                   db->error->message,
+                   sharded_page_db_get_idx(db, hash, &idx) == 0);
+          CuAssertIntEquals(tc, sharded_page_db_shard(db, hash), idx % n_shards);
+
+          PageInfo *pi;
+          CuAssert(tc,
+                   db->error->message,
+                   sharded_page_db_get_info(db, hash, &pi) == 0);
+          CuAssertPtrNotNull(tc, pi);
+          CuAssertStrEquals(tc, pages[i]->url, pi->url);
+          CuAssertIntEquals(tc, 1, pi->n_crawls);
+          page_info_delete(pi);
+     }
+     uint64_t missing;
+     CuAssertIntEquals(tc,
+                       sharded_page_db_error_no_page,
+                       sharded_page_db_get_idx(db, page_db_hash("http://missing.org"), &missing));
+     error_clean(db->error);
+
+     // same pages, in hash order, and unique indices
+     ShardedHashInfoStream *st;
+     CuAssert(tc,
+              db->error->message,
+              sharded_hashinfo_stream_new(&st, db) == 0);
+     HashInfoStream *single_st;
+     CuAssert(tc,
+              single->error->message,
+              hashinfo_stream_new(&single_st, single) == 0);
+
+     size_t n_idx = 0;
+     uint64_t *idx = 0;
+     uint64_t hash, single_hash;
+     PageInfoView view;
+     while (sharded_hashinfo_stream_next_view(st, &hash, &view) == stream_state_next) {
+          CuAssertIntEquals(tc,
+                            stream_state_next,
+                            hashinfo_stream_next_view(single_st, &single_hash, &view));
+          CuAssertTrue(tc, hash == single_hash);
+
+          CuAssertPtrNotNull(tc, idx = realloc(idx, (n_idx + 1)*sizeof(*idx)));
+          CuAssert(tc,
+                   db->error->message,
+                   sharded_page_db_get_idx(db, hash, idx + n_idx) == 0);
+          for (size_t i=0; i<n_idx; ++i)
+               CuAssertTrue(tc, idx[i] != idx[n_idx]);
+          ++n_idx;
+     }
+     CuAssertIntEquals(tc, stream_state_end, st->state);
+     CuAssertIntEquals(tc,
+                       stream_state_end,
+                       hashinfo_stream_next_view(single_st, &single_hash, &view));
+     sharded_hashinfo_stream_delete(st);
+     hashinfo_stream_delete(single_st);
+     free(idx);
+
+     // links split by domain the same way
+     for (int only_diff_domain=0; only_diff_domain<2; ++only_diff_domain) {
+          ShardedPageDBLinkStream *es;
+          CuAssert(tc,
+                   db->error->message,
+                   sharded_page_db_link_stream_new(&es, db) == 0);
+          es->only_diff_domain = only_diff_domain;
+          CuAssertTrue(tc, sharded_page_db_link_stream_reset(es) != stream_state_error);
+
+          PageDBLinkStream *single_es;
+          CuAssert(tc,
+                   single->error->message,
+                   page_db_link_stream_new(&single_es, single) == 0);
+          single_es->only_diff_domain = only_diff_domain;
+          CuAssertTrue(tc, page_db_link_stream_reset(single_es) != stream_state_error);
+
+          size_t n_links = test_sharded_page_db_count_links(
+               tc, es, sharded_page_db_link_stream_next);
+          CuAssertIntEquals(tc, stream_state_end, es->state);
+          CuAssertIntEquals(tc,
+                            test_sharded_page_db_count_links(
+                                 tc, single_es, page_db_link_stream_next),
+                            n_links);
+          if (!only_diff_domain)
+               CuAssertIntEquals(tc, 9*n_pages, n_links);
+
+          sharded_page_db_link_stream_delete(es);
+          page_db_link_stream_delete(single_es);
+     }
+
+     page_db_delete(single);
+     sharded_page_db_set_persist(db, 1);
+     CHECK_DELETE(tc, "deleting sharded database", sharded_page_db_delete(db));
+
+     // shards remember how they were split
+     ret = sharded_page_db_new(&db, test_dir, n_shards + 1);
+     CuAssertTrue(tc, ret != 0);
+     sharded_page_db_delete(db);
+
+     ret = sharded_page_db_new(&db, test_dir, n_shards);
+     CuAssert(tc,
+              db!=0? db->error->message: "NULL",
+              ret == 0);
+     sharded_page_db_set_persist(db, 0);
+     CHECK_DELETE(tc, "deleting sharded database", sharded_page_db_delete(db));
+
+     test_sharded_page_db_pages_delete(pages, n_pages);
+}
+
+typedef struct {
+     ShardedPageDB *db;
+     CrawledPage **pages;
+     size_t n_pages;
+     int failed;
+} TestShardedPageDBAdder;
+
+static void *
+test_sharded_page_db_adder(void *arg) {
+     TestShardedPageDBAdder *a = arg;
+     for (size_t i=0; i<a->n_pages && !a->failed; i+=10)
+          a->failed = sharded_page_db_add_many(
+               a->db, (const CrawledPage**)a->pages + i, 10) != 0;
+     return 0;
+}
+
+/* Batches added by several threads at the same time */
+void
+test_sharded_page_db_concurrent(CuTest *tc) {
+     printf("%s\n", __func__);
+
+     const size_t n_pages = 1000;
+     const size_t n_threads = 4;
+     CrawledPage **pages = test_sharded_page_db_pages(n_pages, 10);
+     CuAssertPtrNotNull(tc, pages);
+
+     char test_dir[] = "test-sharded-XXXXXX";
+     mkdtemp(test_dir);
+     ShardedPageDB *db;
+     int ret = sharded_page_db_new(&db, test_dir, 3);
+     CuAssert(tc,
+              db!=0? db->error->message: "NULL",
+              ret == 0);
+     sharded_page_db_set_persist(db, 0);
+
+     pthread_t threads[n_threads];
+     TestShardedPageDBAdder adders[n_threads];
+     for (size_t t=0; t<n_threads; ++t) {
+          adders[t].db = db;
+          adders[t].pages = pages + t*(n_pages/n_threads);
+          adders[t].n_pages = n_pages/n_threads;
+          adders[t].failed = 0;
+          CuAssertIntEquals(
+               tc, 0, pthread_create(threads + t, 0, test_sharded_page_db_adder, adders + t));
+     }
+     for (size_t t=0; t<n_threads; ++t) {
+          CuAssertIntEquals(tc, 0, pthread_join(threads[t], 0));
+          CuAssert(tc, db->error->message, !adders[t].failed);
+     }
+
+     for (size_t i=0; i<n_pages; ++i) {
+          PageInfo *pi;
+          CuAssert(tc,
+                   db->error->message,
+                   sharded_page_db_get_info(db, page_db_hash(pages[i]->url), &pi) == 0);
+          CuAssertPtrNotNull(tc, pi);
+          CuAssertIntEquals(tc, 1, pi->n_crawls);
+          page_info_delete(pi);
+     }
+
+     CHECK_DELETE(tc, "deleting sharded database", sharded_page_db_delete(db));
+     test_sharded_page_db_pages_delete(pages, n_pages);
+}
+
+/* A shard that fails to commit keeps the indices that the other shards
+ * already link to, instead of giving them to the pages of the next batch */
+void
+test_sharded_page_db_commit_fail(CuTest *tc) {
+     printf("%s\n", __func__);
+
+     const size_t n_pages = 300;
+     const size_t n_links = 10;
+     const size_t n_shards = 3;
+     CrawledPage **pages = test_sharded_page_db_pages(n_pages, n_links);
+     CuAssertPtrNotNull(tc, pages);
+
+     char test_dir[] = "test-sharded-XXXXXX";
+     mkdtemp(test_dir);
+     ShardedPageDB *db;
+     int ret = sharded_page_db_new(&db, test_dir, n_shards);
+     CuAssert(tc,
+              db!=0? db->error->message: "NULL",
+              ret == 0);
+     sharded_page_db_set_persist(db, 0);
+
+     CuAssert(tc,
+              db->error->message,
+              sharded_page_db_add_many(db, (const CrawledPage**)pages, 100) == 0);
+
+     txn_manager_test_commit_fail = db->shards[1]->txn_manager;
+     CuAssertTrue(tc,
+                  sharded_page_db_add_many(db, (const CrawledPage**)pages + 100, 100) != 0);
+     CuAssertPtrEquals(tc, 0, txn_manager_test_commit_fail);
+
+     // the indices were reserved at once
+     char *reserved = build_path(db->shards[1]->path, SHARDED_PAGE_DB_RESERVED);
+     CuAssertPtrNotNull(tc, reserved);
+     CuAssertTrue(tc, access(reserved, F_OK) != 0);
+     free(reserved);
+
+     error_clean(db->error);
+     for (size_t s=0; s<n_shards; ++s)
+          error_clean(db->shards[s]->error);
+     CuAssert(tc,
+              db->error->message,
+              sharded_page_db_add_many(db, (const CrawledPage**)pages + 200, 100) == 0);
+
+     // every link points to the page it was made for, or to no page
+     ShardedPageDBLinkStream *es;
+     CuAssert(tc,
+              db->error->message,
+              sharded_page_db_link_stream_new(&es, db) == 0);
+     CuAssertTrue(tc, sharded_page_db_link_stream_reset(es) != stream_state_error);
+     Link link;
+     size_t n_checked = 0;
+     while (sharded_page_db_link_stream_next(es, &link) == stream_state_next) {
+          uint64_t from_hash;
+          uint64_t to_hash;
+          CuAssertIntEquals(tc,
+                            0,
+                            page_db_get_hash(db->shards[link.from % n_shards],
+                                             link.from,
+                                             &from_hash));
+          if (page_db_get_hash(db->shards[link.to % n_shards],
+                               link.to,
+                               &to_hash) != 0)
+               continue;
+          size_t i = 0;
+          while (i < n_pages && page_db_hash(pages[i]->url) != from_hash)
+               ++i;
+          CuAssertTrue(tc, i < n_pages);
+          int found = 0;
+          for (size_t j=0; j<n_links && !found; ++j)
+               found = page_db_hash(crawled_page_get_link(pages[i], j)->url) == to_hash;
+          CuAssertTrue(tc, found);
+          ++n_checked;
+     }
+     CuAssertIntEquals(tc, stream_state_end, es->state);
+     CuAssertTrue(tc, n_checked > 0);
+     sharded_page_db_link_stream_delete(es);
+
+     CHECK_DELETE(tc, "deleting sharded database", sharded_page_db_delete(db));
+     test_sharded_page_db_pages_delete(pages, n_pages);
+}
+
+/* Ingest speed with a growing number of shards. Only meaningful with as many
+ * free cores as shards */
+void
+test_sharded_page_db_speed(CuTest *tc) {
+     printf("%s\n", __func__);
+
+     const size_t shards[] = {1, 2, 4};
+     const size_t n_pages = test_n_pages;
+     CrawledPage **pages = test_sharded_page_db_pages(n_pages, 10);
+     CuAssertPtrNotNull(tc, pages);
+
+     for (size_t c=0; c<sizeof(shards)/sizeof(shards[0]); ++c) {
+          char test_dir[] = "test-sharded-XXXXXX";
+          mkdtemp(test_dir);
+          ShardedPageDB *db;
+          int ret = sharded_page_db_new(&db, test_dir, shards[c]);
+          CuAssert(tc,
+                   db!=0? db->error->message: "NULL",
+                   ret == 0);
+          sharded_page_db_set_persist(db, 0);
+
+          double start = test_sharded_page_db_now();
+          for (size_t i=0; i<n_pages; i+=100) {
+               size_t n = n_pages - i < 100? n_pages - i: 100;
+               CuAssert(tc,
+                        db->error->message,
+                        sharded_page_db_add_many(db, (const CrawledPage**)pages + i, n) == 0);
+          }
+          double delta = test_sharded_page_db_now() - start;
+          printf("%10zu shards: %.0f pages/sec\n", shards[c], (double)n_pages/delta);
+
+          CHECK_DELETE(tc, "deleting sharded database", sharded_page_db_delete(db));
+     }
+     test_sharded_page_db_pages_delete(pages, n_pages);
+}
+
+CuSuite *
+test_sharded_page_db_suite(size_t n_pages) {
+     test_n_pages = n_pages;
+
+     CuSuite *suite = CuSuiteNew();
+     SUITE_ADD_TEST(suite, test_sharded_page_db_add);
+     SUITE_ADD_TEST(suite, test_sharded_page_db_concurrent);
+     SUITE_ADD_TEST(suite, test_sharded_page_db_commit_fail);
+     SUITE_ADD_TEST(suite, test_sharded_page_db_speed);
+
+     return suite;
+}
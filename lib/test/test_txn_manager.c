@@ -0,0 +1,326 @@
+#include "CuTest.h"
+
+#define TEST_MB ((size_t)1 << 20)
+#define TEST_GB ((size_t)1 << 30)
+
+static MDB_env *
+test_txn_manager_env(CuTest *tc, const char *path, size_t mapsize) {
+     MDB_env *env;
+     CuAssertIntEquals(tc, 0, mdb_env_create(&env));
+     CuAssertIntEquals(tc, 0, mdb_env_set_mapsize(env, mapsize));
+     CuAssertIntEquals(tc, 0, mdb_env_open(env, path, MDB_NOTLS | MDB_NOSYNC, 0664));
+     return env;
+}
+
+static size_t
+test_txn_manager_mapsize(TxnManager *tm) {
+     MDB_envinfo info;
+     mdb_env_info(tm->env, &info);
+     return info.me_mapsize;
+}
+
+static double
+test_txn_manager_now(void) {
+     struct timespec t;
+     clock_gettime(CLOCK_MONOTONIC, &t);
+     return (double)t.tv_sec + 1e-9*(double)t.tv_nsec;
+}
+
+/* Write batches of random values, each one preceded by a call to expand
+ * like PageDB does */
+void
+test_txn_manager_expand(CuTest *tc) {
+     printf("%s\n", __func__);
+
+     char test_dir[] = "test-txn-manager-XXXXXX";
+     mkdtemp(test_dir);
+
+     TxnManager *tm;
+     CuAssertIntEquals(tc, 0, txn_manager_new(&tm, test_txn_manager_env(tc, test_dir, TEST_MB)));
+     txn_manager_set_growth(tm, 16*TEST_MB);
+
+     // grows in steps until MDB_MINIMUM_FREE_PAGES fit
+     CuAssertIntEquals(tc, 0, txn_manager_expand(tm, 0));
+     MDB_stat stat;
+     mdb_env_stat(tm->env, &stat);
+     size_t expected = TEST_MB;
+     while (expected/stat.ms_psize < 1 + MDB_MINIMUM_FREE_PAGES)
+          expected += 16*TEST_MB;
+     CuAssertTrue(tc, expected == test_txn_manager_mapsize(tm));
+
+     MDB_txn *txn;
+     MDB_dbi dbi;
+     CuAssertIntEquals(tc, 0, txn_manager_begin(tm, 0, &txn));
+     CuAssertIntEquals(tc, 0, mdb_dbi_open(txn, 0, MDB_INTEGERKEY, &dbi));
+     CuAssertIntEquals(tc, 0, txn_manager_commit(tm, txn));
+
+     const size_t n_batches = 2000;
+     char value[1000];
+     memset(value, 'x', sizeof(value));
+     uint64_t key = 1;
+     for (size_t i=0; i<n_batches; ++i) {
+          CuAssert(tc, tm->error->message, txn_manager_expand(tm, 0) == 0);
+          CuAssertIntEquals(tc, 0, txn_manager_begin(tm, 0, &txn));
+          for (size_t j=0; j<20; ++j) {
+               key = key*6364136223846793005ULL + 1442695040888963407ULL;
+               MDB_val mdb_key = {.mv_size = sizeof(key), .mv_data = &key};
+               MDB_val mdb_val = {.mv_size = sizeof(value), .mv_data = value};
+               CuAssertIntEquals(tc, 0, mdb_put(txn, dbi, &mdb_key, &mdb_val, 0));
+          }
+          CuAssert(tc, tm->error->message, txn_manager_commit(tm, txn) == 0);
+     }
+     TxnManagerStats stats;
+     txn_manager_stats(tm, &stats);
+     printf("    %zu calls, %zu checks, %zu resizes, map %zuMB\n",
+            stats.n_calls, stats.n_checks, stats.n_resizes,
+            test_txn_manager_mapsize(tm)/TEST_MB);
+     CuAssertIntEquals(tc, n_batches + 1, stats.n_calls);
+     CuAssertTrue(tc, stats.n_checks < stats.n_calls/10);
+     CuAssertTrue(tc, stats.n_resizes > 1);
+     CuAssertTrue(tc, (test_txn_manager_mapsize(tm) - TEST_MB) % (16*TEST_MB) == 0);
+
+     // a batch of more calls than the skipped ones left is always checked,
+     // and leaves room for all of them
+     const size_t n_batch = TXN_MANAGER_MAX_SKIP + 1;
+     size_t n_checks = stats.n_checks;
+     CuAssert(tc, tm->error->message, txn_manager_expand_many(tm, n_batch) == 0);
+     txn_manager_stats(tm, &stats);
+     CuAssertIntEquals(tc, n_batches + 1 + n_batch, stats.n_calls);
+     CuAssertIntEquals(tc, n_checks + 1, stats.n_checks);
+     MDB_envinfo info;
+     mdb_env_info(tm->env, &info);
+     CuAssertTrue(tc,
+                  test_txn_manager_mapsize(tm)/stat.ms_psize >=
+                  info.me_last_pgno + MDB_MINIMUM_FREE_PAGES +
+                  (n_batch - 1)*tm->max_pages_per_call);
+
+     // the reserved map is not backed by the data file
+     char *data = build_path(test_dir, "data.mdb");
+     size_t before = txn_manager_file_size(data);
+     CuAssertIntEquals(tc, 0, txn_manager_reserve(tm, 16*TEST_GB));
+     CuAssertTrue(tc, 16*TEST_GB == test_txn_manager_mapsize(tm));
+     CuAssertTrue(tc, before == txn_manager_file_size(data));
+     // never shrinks
+     CuAssertIntEquals(tc, 0, txn_manager_reserve(tm, TEST_MB));
+     CuAssertTrue(tc, 16*TEST_GB == test_txn_manager_mapsize(tm));
+     free(data);
+
+     txn_manager_close_env(tm);
+     CuAssertIntEquals(tc, 0, txn_manager_delete(tm));
+}
+
+typedef struct {
+     TxnManager *tm;
+     MDB_txn *txn;
+} TestTxnManagerReader;
+
+/* Finish a read transaction after 100ms */
+static void *
+test_txn_manager_reader(void *arg) {
+     TestTxnManagerReader *reader = arg;
+     struct timespec t = {.tv_sec = 0, .tv_nsec = 100*1000*1000};
+     nanosleep(&t, 0);
+     txn_manager_abort(reader->tm, reader->txn);
+     return 0;
+}
+
+/* Time spent inside expand while a long read transaction is open */
+static double
+test_txn_manager_stall_one(CuTest *tc, TxnManager *tm) {
+     TestTxnManagerReader reader = {.tm = tm};
+     CuAssertIntEquals(tc, 0, txn_manager_begin(tm, MDB_RDONLY, &reader.txn));
+     pthread_t thread;
+     CuAssertIntEquals(tc, 0, pthread_create(&thread, 0, test_txn_manager_reader, &reader));
+
+     double start = test_txn_manager_now();
+     CuAssert(tc, tm->error->message, txn_manager_expand(tm, 0) == 0);
+     double stall = test_txn_manager_now() - start;
+
+     pthread_join(thread, 0);
+     return stall;
+}
+
+void
+test_txn_manager_stall(CuTest *tc) {
+     printf("%s\n", __func__);
+
+     char test_dir_small[] = "test-txn-manager-XXXXXX";
+     char test_dir_reserved[] = "test-txn-manager-XXXXXX";
+     mkdtemp(test_dir_small);
+     mkdtemp(test_dir_reserved);
+
+     // a full map must wait for the reader to resize
+     TxnManager *small;
+     CuAssertIntEquals(tc, 0, txn_manager_new(&small, test_txn_manager_env(tc, test_dir_small, TEST_MB)));
+     double stall_small = test_txn_manager_stall_one(tc, small);
+
+     TxnManagerStats stats;
+     txn_manager_stats(small, &stats);
+     CuAssertIntEquals(tc, 1, stats.n_resizes);
+     CuAssertTrue(tc, stall_small > 0.05);
+     CuAssertTrue(tc, stats.stall_max > 0.05);
+
+     // a reserved map just looks at the free space
+     TxnManager *reserved;
+     CuAssertIntEquals(tc, 0, txn_manager_new(&reserved, test_txn_manager_env(tc, test_dir_reserved, TEST_MB)));
+     CuAssertIntEquals(tc, 0, txn_manager_reserve(reserved, 4*TEST_GB));
+     double stall_reserved = test_txn_manager_stall_one(tc, reserved);
+
+     txn_manager_stats(reserved, &stats);
+     CuAssertIntEquals(tc, 1, stats.n_resizes); // the reserve
+     CuAssertIntEquals(tc, 1, stats.n_checks);
+     CuAssertTrue(tc, stall_reserved < 0.05);
+
+     printf("    stall with a 100ms reader: %.3fms resizing, %.3fms reserved\n",
+            1e3*stall_small, 1e3*stall_reserved);
+
+     // cost of the calls that skip the check
+     const size_t n_calls = 1000000;
+     double start = test_txn_manager_now();
+     for (size_t i=0; i<n_calls; ++i)
+          CuAssertIntEquals(tc, 0, txn_manager_expand(reserved, 0));
+     double delta = test_txn_manager_now() - start;
+     txn_manager_stats(reserved, &stats);
+     printf("    %.1fns per expand, %zu checks in %zu calls\n",
+            1e9*delta/(double)n_calls, stats.n_checks, stats.n_calls);
+     CuAssertTrue(tc, stats.n_checks < n_calls/100);
+
+     txn_manager_close_env(small);
+     CuAssertIntEquals(tc, 0, txn_manager_delete(small));
+     txn_manager_close_env(reserved);
+     CuAssertIntEquals(tc, 0, txn_manager_delete(reserved));
+}
+
+/* Commit n small write transactions, returning the seconds taken */
+static double
+test_txn_manager_commits(CuTest *tc, TxnManager *tm, MDB_dbi dbi, size_t n, uint64_t *key) {
+     char value[1000];
+     memset(value, 'x', sizeof(value));
+     double start = test_txn_manager_now();
+     for (size_t i=0; i<n; ++i) {
+          MDB_txn *txn;
+          CuAssertIntEquals(tc, 0, txn_manager_begin(tm, 0, &txn));
+          ++*key;
+          MDB_val mdb_key = {.mv_size = sizeof(*key), .mv_data = key};
+          MDB_val mdb_val = {.mv_size = sizeof(value), .mv_data = value};
+          CuAssertIntEquals(tc, 0, mdb_put(txn, dbi, &mdb_key, &mdb_val, 0));
+          CuAssert(tc, tm->error->message, txn_manager_commit(tm, txn) == 0);
+     }
+     return test_txn_manager_now() - start;
+}
+
+void
+test_txn_manager_sync(CuTest *tc) {
+     printf("%s\n", __func__);
+
+     char test_dir[] = "test-txn-manager-XXXXXX";
+     mkdtemp(test_dir);
+
+     TxnManager *tm;
+     CuAssertIntEquals(tc, 0, txn_manager_new(&tm, test_txn_manager_env(tc, test_dir, 64*TEST_MB)));
+     MDB_txn *txn;
+     MDB_dbi dbi;
+     CuAssertIntEquals(tc, 0, txn_manager_begin(tm, 0, &txn));
+     CuAssertIntEquals(tc, 0, mdb_dbi_open(txn, 0, MDB_INTEGERKEY, &dbi));
+     CuAssertIntEquals(tc, 0, txn_manager_commit(tm, txn));
+
+     CuAssertTrue(tc, txn_manager_set_sync(tm, txn_manager_sync_periodic, 0.0) != 0);
+     CuAssertIntEquals(tc, 0, tm->sync_thread_running);
+     error_clean(tm->error);
+
+     const size_t n_txns = 200;
+     const char *names[] = {"none", "periodic", "commit"};
+     TxnManagerSync policies[] = {
+          txn_manager_sync_none,
+          txn_manager_sync_periodic,
+          txn_manager_sync_commit
+     };
+     uint64_t key = 0;
+     TxnManagerSyncStats before;
+     TxnManagerSyncStats after;
+     for (size_t i=0; i<3; ++i) {
+          // start with nothing left to sync
+          CuAssertIntEquals(tc, 0, txn_manager_sync(tm));
+          CuAssertIntEquals(tc, 0, txn_manager_set_sync(tm, policies[i], 0.05));
+          txn_manager_sync_stats(tm, &before);
+          double delta = test_txn_manager_commits(tc, tm, dbi, n_txns, &key);
+          if (policies[i] == txn_manager_sync_periodic) {
+               // let the checkpoint thread catch up
+               struct timespec t = {.tv_sec = 0, .tv_nsec = 150*1000*1000};
+               nanosleep(&t, 0);
+          }
+          txn_manager_sync_stats(tm, &after);
+
+          size_t n_syncs = after.n_syncs - before.n_syncs;
+          printf("    %-8s %8.0f txn/s, %3zu syncs, %.3fms per sync, %zuKB flushed\n",
+                 names[i],
+                 (double)n_txns/delta,
+                 n_syncs,
+                 n_syncs > 0? 1e3*(after.sync_total - before.sync_total)/(double)n_syncs: 0.0,
+                 (after.bytes_flushed - before.bytes_flushed)/1024);
+
+          switch (policies[i]) {
+          case txn_manager_sync_none:
+               CuAssertIntEquals(tc, 0, n_syncs);
+               break;
+          case txn_manager_sync_periodic:
+               CuAssertTrue(tc, n_syncs >= 1 && n_syncs < n_txns);
+               CuAssertIntEquals(tc, n_txns, after.n_txns - before.n_txns);
+               break;
+          case txn_manager_sync_commit:
+               CuAssertIntEquals(tc, n_txns, n_syncs);
+               CuAssertIntEquals(tc, n_txns, after.n_txns - before.n_txns);
+               break;
+          }
+     }
+     CuAssertTrue(tc, after.bytes_flushed > 0);
+     CuAssertTrue(tc, after.sync_max > 0.0);
+     CuAssertIntEquals(tc, 0, after.n_errors);
+
+     // the checkpoint thread stops, but syncs can still be requested
+     CuAssertIntEquals(tc, 0, txn_manager_set_sync(tm, txn_manager_sync_none, 0.0));
+     CuAssertIntEquals(tc, 0, tm->sync_thread_running);
+     test_txn_manager_commits(tc, tm, dbi, 10, &key);
+     txn_manager_sync_stats(tm, &before);
+     CuAssertIntEquals(tc, 0, txn_manager_sync(tm));
+     txn_manager_sync_stats(tm, &after);
+     CuAssertIntEquals(tc, before.n_syncs + 1, after.n_syncs);
+     CuAssertIntEquals(tc, before.n_txns + 10, after.n_txns);
+
+     // a failed sync leaves the commit in place and is retried later
+     CuAssertIntEquals(tc, 0, txn_manager_set_sync(tm, txn_manager_sync_commit, 0.0));
+     txn_manager_sync_stats(tm, &before);
+     txn_manager_test_sync_error = EIO;
+     uint64_t first = key;
+     test_txn_manager_commits(tc, tm, dbi, 5, &key);
+     txn_manager_test_sync_error = 0;
+     CuAssertIntEquals(tc, 0, tm->error->code);
+     txn_manager_sync_stats(tm, &after);
+     CuAssertIntEquals(tc, before.n_errors + 5, after.n_errors);
+     CuAssertIntEquals(tc, before.n_syncs, after.n_syncs);
+     CuAssertIntEquals(tc, 0, txn_manager_begin(tm, MDB_RDONLY, &txn));
+     for (uint64_t k=first + 1; k<=key; ++k) {
+          MDB_val mdb_key = {.mv_size = sizeof(k), .mv_data = &k};
+          MDB_val mdb_val;
+          CuAssertIntEquals(tc, 0, mdb_get(txn, dbi, &mdb_key, &mdb_val));
+     }
+     CuAssertIntEquals(tc, 0, txn_manager_abort(tm, txn));
+     CuAssertIntEquals(tc, 0, txn_manager_sync(tm));
+     txn_manager_sync_stats(tm, &before);
+     CuAssertIntEquals(tc, after.n_txns + 5, before.n_txns);
+
+     // closing stops the thread
+     CuAssertIntEquals(tc, 0, txn_manager_set_sync(tm, txn_manager_sync_periodic, 10.0));
+     txn_manager_close_env(tm);
+     CuAssertIntEquals(tc, 0, tm->sync_thread_running);
+     CuAssertIntEquals(tc, 0, txn_manager_delete(tm));
+}
+
+CuSuite *
+test_txn_manager_suite(void) {
+     CuSuite *suite = CuSuiteNew();
+     SUITE_ADD_TEST(suite, test_txn_manager_expand);
+     SUITE_ADD_TEST(suite, test_txn_manager_stall);
+     SUITE_ADD_TEST(suite, test_txn_manager_sync);
+     return suite;
+}
@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "CuTest.h"
+#include "smaz.h"
+
+/* Sample of real URLs, taken from the seeds of the examples */
+static const char *test_urls[] = {
+     "http://www.ucomics.com/ziggy/",
+     "http://www.canada.com/edmonton/edmontonjournal/",
+     "http://www.pittsburghlive.com/x/tribune-review/",
+     "http://www.bayarea.com/mld/mercurynews/",
+     "http://www.ucomics.com/nonsequitur/viewnq.cfm",
+     "http://www.unitedmedia.com/comics/committed/index.html",
+     "http://www.netradio.net/country/audio/countrynews.ram",
+     "http://www.nytimes.com/pages/nyregion/",
+     "http://www.pslgroup.com/dg/past7days.htm",
+     "http://www.townonline.com/metrowest/weston/",
+     "http://www.kingfeatures.com/features/comics/thenorm/about.htm",
+     "http://www.zwire.com/site/news.cfm?brd=1641",
+     "http://www.csmonitor.com/usa/index.html",
+     "http://abcnews.go.com/sections/us/",
+     "http://www.hri.org/news/latest/",
+     "http://www.usatoday.com/news/digest/nd1.htm",
+     "http://www.usnews.com/usnews/news/home.htm",
+     "http://www.zwire.com/site/news.asp?brd=2088",
+     "http://www.msnbc.com/news/liv_front.asp",
+     "http://www.nj.com/gloucester/today/index.ssf",
+     "http://www.reuters.com/news.jhtml?type=politics",
+     "http://www.foxnews.com/topstories/index.html",
+     "http://www.reddit.com/r/MachineLearning/",
+     "http://aitopics.org/topic/machine-learning",
+     "http://en.wikipedia.org/wiki/Machine_learning",
+     "http://ml.cmu.edu/news/index.html",
+     "http://venturebeat.com/tag/machine-learning/",
+     "http://www.extremetech.com/tag/machine-learning",
+     "http://newsoffice.mit.edu/topic/machine-learning",
+     "http://www.democracynow.org/",
+};
+#define TEST_N_URLS (sizeof(test_urls)/sizeof(*test_urls))
+
+/* URLs of a crawl inside a few sites, where most URLs share the host of
+   the URL before them. The seeds above have almost one URL per host, and
+   understate what @ref PageDB saves storing each host only once */
+static const char *test_urls_site[] = {
+     "https://en.wikipedia.org/wiki/Machine_learning",
+     "https://en.wikipedia.org/wiki/Supervised_learning",
+     "https://en.wikipedia.org/wiki/Unsupervised_learning",
+     "https://en.wikipedia.org/wiki/Reinforcement_learning",
+     "https://en.wikipedia.org/wiki/Artificial_neural_network",
+     "https://en.wikipedia.org/wiki/Support_vector_machine",
+     "https://en.wikipedia.org/wiki/Category:Machine_learning",
+     "https://en.wikipedia.org/wiki/Special:BookSources/978-0-262-01802-9",
+     "https://en.wikipedia.org/w/index.php?title=Machine_learning&action=edit",
+     "https://en.wikipedia.org/wiki/Portal:Computer_science",
+     "https://en.wikipedia.org/wiki/Data_mining",
+     "https://en.wikipedia.org/wiki/Statistical_classification",
+     "http://www.nytimes.com/2015/06/14/world/europe/greece-debt-talks.html",
+     "http://www.nytimes.com/2015/06/14/us/politics/hillary-clinton-rally.html",
+     "http://www.nytimes.com/2015/06/13/business/economy/jobs-report.html",
+     "http://www.nytimes.com/2015/06/13/technology/apple-music-streaming.html",
+     "http://www.nytimes.com/2015/06/12/sports/baseball/yankees-win.html",
+     "http://www.nytimes.com/2015/06/12/science/space/pluto-new-horizons.html",
+     "http://www.nytimes.com/pages/world/index.html",
+     "http://www.nytimes.com/pages/business/index.html",
+     "http://www.nytimes.com/section/technology",
+     "http://www.nytimes.com/column/the-upshot",
+     "http://www.nytimes.com/interactive/2015/06/10/upshot/map.html",
+     "http://www.nytimes.com/video/world/100000003733571/greece.html",
+     "http://stackoverflow.com/questions/11227809/why-is-processing-a-sorted-array-faster",
+     "http://stackoverflow.com/questions/927358/how-to-undo-the-last-commits-in-git",
+     "http://stackoverflow.com/questions/tagged/python?sort=newest&pagesize=15",
+     "http://stackoverflow.com/questions/tagged/c?page=2&sort=votes",
+     "http://stackoverflow.com/users/22656/jon-skeet",
+     "http://stackoverflow.com/users/1144035/gordon-linoff?tab=answers",
+     "http://stackoverflow.com/a/11227902",
+     "http://stackoverflow.com/q/231767",
+     "http://stackoverflow.com/questions/231767/what-does-the-yield-keyword-do",
+     "http://stackoverflow.com/questions/tagged/lmdb",
+     "http://stackoverflow.com/help/how-to-ask",
+     "http://stackoverflow.com/tags?page=3&tab=popular",
+     "http://www.bbc.com/news/world-europe-33120000",
+     "http://www.bbc.com/news/uk-politics-33119283",
+     "http://www.bbc.com/news/technology-33117410",
+     "http://www.bbc.com/news/business-33114567",
+     "http://www.bbc.com/news/science-environment-33112345",
+     "http://www.bbc.com/sport/0/football/33118829",
+     "http://www.bbc.com/sport/0/tennis/33109876",
+     "http://www.bbc.com/news/world/asia",
+     "http://www.bbc.com/news/world/us_and_canada",
+     "http://www.bbc.com/culture/story/20150612-the-best-films-of-2015",
+     "http://www.bbc.com/travel/story/20150611-a-city-built-on-water",
+     "http://www.bbc.com/news/magazine-33105678",
+};
+#define TEST_N_URLS_SITE (sizeof(test_urls_site)/sizeof(*test_urls_site))
+
+static void
+test_url_codec_check(CuTest *tc, const char *url) {
+     size_t url_size = strlen(url);
+     char enc[URL_CODEC_MAX_ENCODED_SIZE(url_size) + 1];
+     char dec[URL_CODEC_MAX_DECODED_SIZE(sizeof(enc)) + 1];
+
+     size_t enc_size = url_codec_encode(url, url_size, enc);
+     CuAssertTrue(tc, enc_size <= URL_CODEC_MAX_ENCODED_SIZE(url_size));
+     int dec_size = url_codec_decode(enc, enc_size, dec, sizeof(dec));
+     CuAssertIntEquals(tc, url_size, dec_size);
+     dec[dec_size] = '\0';
+     CuAssertStrEquals(tc, url, dec);
+}
+
+void
+test_url_codec_roundtrip(CuTest *tc) {
+     printf("%s\n", __func__);
+
+     for (size_t i=0; i<TEST_N_URLS; ++i)
+          test_url_codec_check(tc, test_urls[i]);
+     test_url_codec_check(tc, "");
+     test_url_codec_check(tc, "_seed_1");
+     test_url_codec_check(tc, "http://www.example.com/caf\xc3\xa9?q=\xff\x80");
+
+     // the dictionary is used at all
+     char enc[100];
+     CuAssertIntEquals(tc, 2, url_codec_encode("http://www.index", 16, enc));
+
+     // output buffer too small
+     char dec[100];
+     size_t enc_size = url_codec_encode(test_urls[0], strlen(test_urls[0]), enc);
+     CuAssertIntEquals(tc, -1, url_codec_decode(enc, enc_size, dec, 5));
+     // truncated escape
+     enc[0] = (char)0xFF;
+     CuAssertIntEquals(tc, -1, url_codec_decode(enc, 1, dec, sizeof(dec)));
+}
+
+void
+test_url_codec_host_size(CuTest *tc) {
+     printf("%s\n", __func__);
+
+     CuAssertIntEquals(tc, 22, url_codec_host_size("http://www.example.com/a/b"));
+     CuAssertIntEquals(tc, 22, url_codec_host_size("http://www.example.com"));
+     CuAssertIntEquals(tc, 28, url_codec_host_size("https://u:p@example.com:8080?q"));
+     CuAssertIntEquals(tc, 0, url_codec_host_size("www.example.com/a"));
+     CuAssertIntEquals(tc, 0, url_codec_host_size("_seed_1"));
+     CuAssertIntEquals(tc, 0, url_codec_host_size("://x"));
+}
+
+/* Compare against smaz, which was used before to compress URLs */
+void
+test_url_codec_speed(CuTest *tc) {
+     printf("%s\n", __func__);
+
+     const size_t n_rounds = 20000;
+     char enc[TEST_N_URLS][256];
+     size_t enc_size[TEST_N_URLS];
+     char dec[1024];
+
+     size_t size_url = 0;
+     size_t size_path = 0;
+     size_t size_smaz = 0;
+     size_t size_codec = 0;
+     size_t size_codec_path = 0;
+     for (size_t i=0; i<TEST_N_URLS; ++i) {
+          size_t url_size = strlen(test_urls[i]);
+          size_t host_size = url_codec_host_size(test_urls[i]);
+          size_url += url_size;
+          size_path += url_size - host_size;
+          size_smaz += smaz_compress(
+               (char*)test_urls[i], url_size, enc[i], sizeof(enc[i]));
+          size_codec += url_codec_encode(test_urls[i], url_size, enc[i]);
+          size_codec_path += url_codec_encode(
+               test_urls[i] + host_size, url_size - host_size, enc[i]);
+     }
+     printf("      smaz: %.2f bytes/url (%.2fx)\n",
+            (double)size_smaz/TEST_N_URLS, (double)size_url/size_smaz);
+     printf("     codec: %.2f bytes/url (%.2fx)\n",
+            (double)size_codec/TEST_N_URLS, (double)size_url/size_codec);
+     printf("codec path: %.2f bytes/url (%.2fx of the path, %.2fx of the URL)\n",
+            (double)size_codec_path/TEST_N_URLS,
+            (double)size_path/size_codec_path,
+            (double)size_url/size_codec_path);
+     CuAssertTrue(tc, size_codec < size_smaz);
+
+     // Within a site the host is stored once and each record only keeps
+     // the encoded path
+     size_url = 0;
+     size_smaz = 0;
+     size_codec = 0;
+     size_codec_path = 0;
+     for (size_t i=0; i<TEST_N_URLS_SITE; ++i) {
+          const char *url = test_urls_site[i];
+          size_t url_size = strlen(url);
+          size_t host_size = url_codec_host_size(url);
+          size_url += url_size;
+          size_smaz += smaz_compress((char*)url, url_size, dec, sizeof(dec));
+          size_codec += url_codec_encode(url, url_size, dec);
+          size_codec_path += url_codec_encode(
+               url + host_size, url_size - host_size, dec);
+          if (i == 0 ||
+              host_size != url_codec_host_size(test_urls_site[i - 1]) ||
+              strncmp(url, test_urls_site[i - 1], host_size) != 0)
+               size_codec_path += host_size;
+     }
+     printf("  %zu URLs of 4 sites:\n", TEST_N_URLS_SITE);
+     printf("      smaz: %.2f bytes/url (%.2fx)\n",
+            (double)size_smaz/TEST_N_URLS_SITE, (double)size_url/size_smaz);
+     printf("     codec: %.2f bytes/url (%.2fx)\n",
+            (double)size_codec/TEST_N_URLS_SITE, (double)size_url/size_codec);
+     printf("codec host: %.2f bytes/url (%.2fx), the host stored once\n",
+            (double)size_codec_path/TEST_N_URLS_SITE,
+            (double)size_url/size_codec_path);
+     CuAssertTrue(tc, size_codec_path < size_codec);
+
+     const size_t n_urls = n_rounds*TEST_N_URLS;
+     clock_t start;
+     double delta;
+
+#define TEST_SPEED(name, cmd) do {                                      \
+          start = clock();                                              \
+          for (size_t r=0; r<n_rounds; ++r)                             \
+               for (size_t i=0; i<TEST_N_URLS; ++i)                     \
+                    cmd;                                                \
+          delta = (double)(clock() - start)/(double)CLOCKS_PER_SEC;     \
+          printf("%10s: %.0f urls/sec\n", name, n_urls/delta);          \
+     } while (0)
+
+     TEST_SPEED("smaz enc",
+                enc_size[i] = smaz_compress(
+                     (char*)test_urls[i], strlen(test_urls[i]),
+                     enc[i], sizeof(enc[i])));
+     TEST_SPEED("smaz dec",
+                smaz_decompress(enc[i], enc_size[i], dec, sizeof(dec)));
+     TEST_SPEED("codec enc",
+                enc_size[i] = url_codec_encode(
+                     test_urls[i], strlen(test_urls[i]), enc[i]));
+     TEST_SPEED("codec dec",
+                url_codec_decode(enc[i], enc_size[i], dec, sizeof(dec)));
+#undef TEST_SPEED
+}
+
+CuSuite *
+test_url_codec_suite(void) {
+     CuSuite *suite = CuSuiteNew();
+     SUITE_ADD_TEST(suite, test_url_codec_roundtrip);
+     SUITE_ADD_TEST(suite, test_url_codec_host_size);
+     SUITE_ADD_TEST(suite, test_url_codec_speed);
+     return suite;
+}
@@ -0,0 +1,42 @@
+import tempfile
+
+import aduana
+
+def crawled_pages(n_pages):
+    for i in xrange(n_pages):
+        yield aduana.CrawledPage(
+            'http://a.com/{0}'.format(i),
+            ['http://b.com/{0}'.format(i), 'http://a.com/{0}'.format(i + 1)])
+
+def test_ingest_queue_page_db():
+    page_db = aduana.PageDB(tempfile.mkdtemp(prefix='test-', dir='./'))
+    queue = aduana.IngestQueue(page_db, batch_size=10)
+
+    n_pages = 100
+    for cp in crawled_pages(n_pages):
+        queue.push(cp)
+    queue.flush()
+    assert 0 < queue.n_batches <= n_pages
+
+    for i in xrange(n_pages):
+        pi = page_db.page_info(aduana.PageDB.urlhash('http://a.com/{0}'.format(i)))
+        assert pi.n_crawls == 1
+    pi = page_db.page_info(aduana.PageDB.urlhash('http://b.com/0'))
+    assert pi.n_crawls == 0
+
+    queue.close()
+    page_db.close()
+
+def test_ingest_queue_bf_scheduler():
+    page_db = aduana.PageDB(tempfile.mkdtemp(prefix='test-', dir='./'))
+    sch = aduana.BFScheduler(page_db)
+    queue = aduana.IngestQueue(sch, capacity=16, max_delay=1)
+
+    for cp in crawled_pages(10):
+        queue.push(cp)
+    queue.close()
+
+    assert len(sch.requests(5)) == 5
+
+    sch.close()
+    page_db.close()